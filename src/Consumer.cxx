@@ -9,8 +9,11 @@
 // or submit itself to any jurisdiction.
 
 #include "Consumer.h"
+#include "MemoryPagesPool.h"
 #include "ReadoutUtils.h"
 
+#include <unistd.h>
+
 Consumer::Consumer(ConfigFile& cfg, std::string cfgEntryPoint)
 {
   // configuration parameter: | consumer-* | filterLinksInclude | string |  | Defines a filter based on link ids. Only data belonging to the links in this list (coma separated values) are accepted. If empty, all link ids are fine. |
@@ -46,6 +49,36 @@ Consumer::Consumer(ConfigFile& cfg, std::string cfgEntryPoint)
     filterEquipmentIdsEnabled = 1;
     theLog.log(LogInfoDevel_(3002), "Filtering on equipment ids enabled: include=%s exclude=%s", cfgFilterEquipmentIdsInclude.c_str(), cfgFilterEquipmentIdsExclude.c_str());
   }
+
+  // configuration parameter: | consumer-* | dispatchQueueSize | int | 0 | If non-zero, data is pushed to this consumer from a dedicated thread, fed by a queue of this number of data sets. This avoids a slow consumer to throttle the others. If zero, data is pushed from the main readout loop. Not used for consumers getting data from another consumer (consumerOutput). As pages are then released by several threads, this needs memory pools in multi-producer/multi-consumer mode (readout.memoryPoolMagazineSize). |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".dispatchQueueSize", cfgDispatchQueueSize);
+  if ((cfgDispatchQueueSize > 0) && (MemoryPagesPoolMagazineSize <= 0)) {
+    throw("dispatchQueueSize needs readout.memoryPoolMagazineSize set (pages released concurrently by the dispatch threads)");
+  }
+  // configuration parameter: | consumer-* | dispatchOverflowPolicy | string | block | When dispatchQueueSize is set, defines what to do when the queue is full. block: wait for free space (other consumers are then also delayed). dropNewest: discard the incoming data set. dropOldest: discard the oldest data set in queue. sample: as dropNewest, and when the queue is more than half full, accept only 1 out of dispatchSampleRatio data sets. |
+  std::string cfgDispatchOverflowPolicy = "block";
+  cfg.getOptionalValue<std::string>(cfgEntryPoint + ".dispatchOverflowPolicy", cfgDispatchOverflowPolicy);
+  if (cfgDispatchOverflowPolicy == "block") {
+    cfgDispatchPolicy = DispatchPolicy::Block;
+  } else if (cfgDispatchOverflowPolicy == "dropNewest") {
+    cfgDispatchPolicy = DispatchPolicy::DropNewest;
+  } else if (cfgDispatchOverflowPolicy == "dropOldest") {
+    cfgDispatchPolicy = DispatchPolicy::DropOldest;
+  } else if (cfgDispatchOverflowPolicy == "sample") {
+    cfgDispatchPolicy = DispatchPolicy::Sample;
+  } else {
+    throw("Wrong value for configuration item dispatchOverflowPolicy");
+  }
+  // configuration parameter: | consumer-* | dispatchSampleRatio | int | 10 | When dispatchOverflowPolicy is sample, only 1 out of this number of data sets is accepted when the dispatch queue is more than half full. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".dispatchSampleRatio", cfgDispatchSampleRatio);
+  if (cfgDispatchSampleRatio < 1) {
+    cfgDispatchSampleRatio = 1;
+  }
+  // configuration parameter: | consumer-* | dispatchIdleSleepTime | int | 100 | When dispatchQueueSize is set, sleep time (microseconds) of the dispatch thread when queue is empty. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".dispatchIdleSleepTime", cfgDispatchIdleSleepTime);
+  if (cfgDispatchQueueSize > 0) {
+    theLog.log(LogInfoDevel_(3002), "Dispatch thread enabled: queue size = %d, overflow policy = %s", cfgDispatchQueueSize, cfgDispatchOverflowPolicy.c_str());
+  }
 }
 
 int Consumer::pushData(DataSetReference& bc)
@@ -130,3 +163,126 @@ bool Consumer::isDataBlockFilterOk(const DataBlock& b)
 
   return 1;
 }
+
+int Consumer::dispatchData(DataSetReference& bc)
+{
+  if (dispatchThread == nullptr) {
+    return pushData(bc);
+  }
+
+  dispatchQueueDepth.set(dispatchQueue->getNumberOfUsedSlots());
+  DispatchItem item = { bc, dispatchClock.getTime() };
+
+  switch (cfgDispatchPolicy) {
+    case DispatchPolicy::Block:
+      for (;;) {
+        uint32_t seq = dispatchSpaceNotifier.getSequence();
+        if (!dispatchQueue->isFull()) {
+          break;
+        }
+        dispatchBlocked++;
+        dispatchSpaceNotifier.wait(seq, cfgDispatchIdleSleepTime);
+      }
+      break;
+    case DispatchPolicy::DropNewest:
+      if (dispatchQueue->isFull()) {
+        dispatchDropped++;
+        return 0;
+      }
+      break;
+    case DispatchPolicy::DropOldest:
+      if (dispatchQueue->isFull()) {
+        DispatchItem oldest;
+        std::unique_lock<std::mutex> lock(dispatchQueueMutex);
+        if (dispatchQueue->pop(oldest) == 0) {
+          dispatchDropped++;
+        }
+      }
+      break;
+    case DispatchPolicy::Sample:
+      if ((dispatchQueue->isFull()) || ((dispatchQueue->getNumberOfUsedSlots() * 2 >= cfgDispatchQueueSize) && ((dispatchSampleCount++ % cfgDispatchSampleRatio) != 0))) {
+        dispatchDropped++;
+        return 0;
+      }
+      break;
+  }
+
+  if (dispatchQueue->push(item) != 0) {
+    dispatchDropped++;
+  } else {
+    dispatchNotifier.notify();
+  }
+  return 0;
+}
+
+bool Consumer::dispatchQueuePop(DispatchItem& item)
+{
+  if (cfgDispatchPolicy == DispatchPolicy::DropOldest) {
+    std::unique_lock<std::mutex> lock(dispatchQueueMutex);
+    return (dispatchQueue->pop(item) == 0);
+  }
+  return (dispatchQueue->pop(item) == 0);
+}
+
+void Consumer::dispatchLoop()
+{
+  for (;;) {
+    DispatchItem item;
+    uint32_t seq = dispatchNotifier.getSequence();
+    if (dispatchQueuePop(item)) {
+      if (cfgDispatchPolicy == DispatchPolicy::Block) {
+        dispatchSpaceNotifier.notify();
+      }
+      dispatchLag.set((CounterValue)((dispatchClock.getTime() - item.timeQueued) * 1000000));
+      if (pushData(item.data) < 0) {
+        isError++;
+      }
+    } else {
+      if (dispatchShutdown) {
+        break;
+      }
+      dispatchNotifier.idle(seq, cfgDispatchIdleSleepTime);
+    }
+  }
+}
+
+Consumer::~Consumer()
+{
+  // the dispatch thread uses the derived object: it must be stopped by the owner before destruction
+  if (dispatchThread != nullptr) {
+    theLog.log(LogErrorDevel_(3230), "Consumer %s destroyed while dispatch thread running", name.c_str());
+  }
+}
+
+void Consumer::startDispatch()
+{
+  if ((cfgDispatchQueueSize <= 0) || (isForwardConsumer) || (dispatchThread != nullptr)) {
+    return;
+  }
+  dispatchQueue = std::make_unique<AliceO2::Common::Fifo<DispatchItem>>(cfgDispatchQueueSize);
+  dispatchQueueDepth.reset();
+  dispatchLag.reset();
+  dispatchDropped = 0;
+  dispatchBlocked = 0;
+  dispatchSampleCount = 0;
+  dispatchClock.reset();
+  dispatchShutdown = false;
+  std::function<void(void)> l = std::bind(&Consumer::dispatchLoop, this);
+  dispatchThread = std::make_unique<std::thread>(l);
+}
+
+void Consumer::stopDispatch()
+{
+  if (dispatchThread == nullptr) {
+    return;
+  }
+  // remaining data in queue is flushed before thread exits
+  dispatchShutdown = true;
+  dispatchThread->join();
+  dispatchThread = nullptr;
+  dispatchQueue = nullptr;
+  theLog.log(LogInfoDevel_(3003), "Dispatch statistics for %s: queue depth avg=%.1lf max=%llu, lag avg=%.0lfus max=%lluus, %llu data sets dropped, blocked %llu times", this->name.c_str(), dispatchQueueDepth.getAverage(), (unsigned long long)dispatchQueueDepth.getMaximum(), dispatchLag.getAverage(), (unsigned long long)dispatchLag.getMaximum(), dispatchDropped, dispatchBlocked);
+  if (EventNotifierWaitEnabled) {
+    theLog.log(LogInfoDevel_(3003), "Dispatch wakeups for %s: %s", this->name.c_str(), dispatchNotifier.getStats().c_str());
+  }
+}
@@ -10,18 +10,24 @@
 
 #include <Common/Configuration.h>
 #include <Common/Fifo.h>
+#include <Common/Timer.h>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <thread>
 
+#include "CounterStats.h"
 #include "DataBlock.h"
 #include "DataBlockContainer.h"
 #include "DataSet.h"
+#include "EventNotifier.h"
 #include "readoutInfoLogger.h"
 
 class Consumer
 {
  public:
   Consumer(ConfigFile&, std::string);
-  virtual ~Consumer(){};
+  virtual ~Consumer();
   virtual int pushData(DataBlockContainerReference& b) = 0;
 
   // Iterate through blocks of a dataset, using the per-block pushData() method.
@@ -45,12 +51,20 @@ class Consumer
     return 0;
   };
 
+  // Dispatch of data to the consumer, from the main readout loop.
+  // When dispatchQueueSize is set, data is queued and pushed to the consumer from a dedicated thread, so that a slow consumer does not throttle the others.
+  // Otherwise, data is pushed directly with pushData().
+  // Returns a negative number on error (for the direct push only: errors in dispatch thread are reported with isError).
+  int dispatchData(DataSetReference& bc);
+  void startDispatch(); // start the dispatch thread, if enabled. To be called after start().
+  void stopDispatch();  // flush dispatch queue and stop the dispatch thread. To be called before stop(), and in any case by the owner before destroying the consumer.
+
  public:
   Consumer* forwardConsumer = nullptr; // consumer where to push output data, if any
   bool isForwardConsumer = false;      // this consumer will get data from output of another consumer
   std::string name;                    // name of this consumer
   bool stopOnError = false;            // if set, readout will stop when this consumer reports an error (isError flag or pushData() failing)
-  int isError = 0;                     // flag which might be used to count number of errors occuring in the consumer
+  std::atomic<int> isError = 0;        // flag which might be used to count number of errors occuring in the consumer (updated from dispatch thread)
   bool isErrorReported = false;        // flag to keep track of error reports for this consumer
   unsigned long long totalPushSuccess = 0;
   unsigned long long totalPushError = 0;
@@ -71,6 +85,31 @@ class Consumer
   bool filterEquipmentIdsEnabled = 0;         // when set, defines a filter based on equipmentId
   std::vector<int> filterEquipmentIdsInclude; // match is OK only for ids in this list (or for all if list is empty).
   std::vector<int> filterEquipmentIdsExclude; // match is NOT OK for any id in this list.
+
+  // dispatch thread
+  enum class DispatchPolicy { Block, DropNewest, DropOldest, Sample };
+  struct DispatchItem {
+    DataSetReference data; // the data set queued
+    double timeQueued;     // time when it was queued
+  };
+  int cfgDispatchQueueSize = 0;                                        // size of the dispatch queue. Zero to disable dispatch thread.
+  DispatchPolicy cfgDispatchPolicy = DispatchPolicy::Block;            // what to do when dispatch queue is full
+  int cfgDispatchSampleRatio = 10;                                     // for Sample policy, 1 out of this number of data sets accepted when queue more than half full
+  int cfgDispatchIdleSleepTime = 100;                                  // idle sleep time (microseconds) of dispatch thread, when queue empty
+  std::unique_ptr<AliceO2::Common::Fifo<DispatchItem>> dispatchQueue; // queue of data sets to be pushed by dispatch thread
+  std::mutex dispatchQueueMutex;                                       // lock used to pop from queue, with DropOldest policy (both ends may pop)
+  std::unique_ptr<std::thread> dispatchThread;                         // the dispatch thread
+  std::atomic<bool> dispatchShutdown = false;                          // flag set to stop dispatch thread
+  AliceO2::Common::Timer dispatchClock;                                // clock to measure dispatch lag
+  EventNotifier dispatchNotifier;                                      // notified when data is queued
+  EventNotifier dispatchSpaceNotifier;                                 // notified when data is removed from queue (Block policy)
+  CounterStats dispatchQueueDepth;                                     // queue depth, sampled on each dispatch
+  CounterStats dispatchLag;                                            // time (microseconds) spent by data sets in the queue
+  unsigned long long dispatchDropped = 0;                              // number of data sets dropped on queue overflow
+  unsigned long long dispatchBlocked = 0;                              // number of times dispatch was blocked waiting for free space in queue
+  unsigned long long dispatchSampleCount = 0;                          // counter of data sets for Sample policy
+  void dispatchLoop();                                                 // dispatch thread loop
+  bool dispatchQueuePop(DispatchItem& item);                           // get next item from queue (with lock if needed). Returns false if empty.
 };
 
 std::unique_ptr<Consumer> getUniqueConsumerStats(ConfigFile& cfg, std::string cfgEntryPoint);
@@ -9,6 +9,7 @@
 // or submit itself to any jurisdiction.
 
 #include "Consumer.h"
+#include "RdhUtils.h"
 
 typedef struct {
   uint32_t w0;
@@ -56,6 +57,20 @@ class ConsumerDataChecker : public Consumer
     size = b->getData()->header.dataSize;
     //    theLog.log(LogDebugTrace, "checking container %p data @ %p : %d bytes",(void*)b.get(),ptr,(int)size);
 
+    // when RDH packet index of the page is available, packet boundaries and sizes are taken from it
+    // otherwise, 8kB pages are assumed
+    RdhPacketIndex* index = getRdhPacketIndex(b->getData());
+    if (index != nullptr) {
+      size = 0;
+      for (uint32_t p = 0; p < index->numberOfValidPackets; p++) {
+        const RdhPacketIndexEntry& e = index->packets[p];
+        checkedPages++;
+        if (e.memorySize > sizeof(RocPageHeader)) {
+          checkPayload(&((char*)ptr)[e.offset + sizeof(RocPageHeader)], e.memorySize - sizeof(RocPageHeader), ptr, p);
+        }
+      }
+    }
+
     unsigned int pageId = 0;
     for (unsigned int i = 0; i < size; pageId++) {
       checkedPages++;
@@ -102,15 +117,7 @@ class ConsumerDataChecker : public Consumer
       }
       */
 
-      for (unsigned int w = 0; w < pagePayloadSize / sizeof(unsigned int); w += 8) {
-        if ((((unsigned int*)pagePayloadPtr)[w] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 1] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 2] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 3] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 4] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 5] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 6] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 7] != checkValue)) {
-          errorCount++;
-          if ((errorCount < 100) || (errorCount % 1000 == 0)) {
-            theLog.log(LogErrorDevel_(3004), "Error #%llu : Superpage %p Page %d (size %d) : 32-bit word %d mismatch : %X != %X\n", errorCount, ptr, pageId, pagePayloadSize, w, ((unsigned int*)pagePayloadPtr)[w], checkValue);
-          }
-        }
-        checkValue++;
-      }
+      checkPayload(pagePayloadPtr, pagePayloadSize, ptr, pageId);
 
       // printf("page %d (size %d) checked\n",pageId,pagePayloadSize);
 
@@ -132,6 +139,19 @@ class ConsumerDataChecker : public Consumer
   }
 
  private:
+  // check counter increasing every 256-bit word in payload
+  void checkPayload(void* pagePayloadPtr, unsigned int pagePayloadSize, void* ptr, unsigned int pageId)
+  {
+    for (unsigned int w = 0; w < pagePayloadSize / sizeof(unsigned int); w += 8) {
+      if ((((unsigned int*)pagePayloadPtr)[w] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 1] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 2] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 3] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 4] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 5] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 6] != checkValue) || (((unsigned int*)pagePayloadPtr)[w + 7] != checkValue)) {
+        errorCount++;
+        if ((errorCount < 100) || (errorCount % 1000 == 0)) {
+          theLog.log(LogErrorDevel_(3004), "Error #%llu : Superpage %p Page %d (size %d) : 32-bit word %d mismatch : %X != %X\n", errorCount, ptr, pageId, pagePayloadSize, w, ((unsigned int*)pagePayloadPtr)[w], checkValue);
+        }
+      }
+      checkValue++;
+    }
+  }
 };
 
 std::unique_ptr<Consumer> getUniqueConsumerDataChecker(ConfigFile& cfg, std::string cfgEntryPoint) { return std::make_unique<ConsumerDataChecker>(cfg, cfgEntryPoint); }
@@ -14,6 +14,7 @@
 #include <thread>
 
 #include "Consumer.h"
+#include "EventNotifier.h"
 
 const bool debug = false;
 
@@ -39,8 +40,10 @@ class processThread
   // - idleSleepTime: idle sleep time (in microseconds), when input fifo empty or output fifo full, before retrying.
   //
   // The constructor initialize the member variables and create the processing thread.
-  processThread(PtrProcessFunction f, int id, unsigned int fifoSize = 10, unsigned int idleSleepTime = 100)
+  // - outputNotifier: if set, notified when data pushed to outputFifo
+  processThread(PtrProcessFunction f, int id, unsigned int fifoSize = 10, unsigned int idleSleepTime = 100, std::shared_ptr<EventNotifier> vOutputNotifier = nullptr)
   {
+    outputNotifier = vOutputNotifier;
     shutdown = 0;
     fProcess = f;
     cfgIdleSleepTime = idleSleepTime;
@@ -84,6 +87,7 @@ class processThread
     // if (outputFifo==nullptr) return;
     for (; !shutdown;) {
       bool isActive = 0;
+      uint32_t seq = inputNotifier.getSequence();
       // wait there is a slot in output fifo before processing a new block, so that we are sure we can push the result
       if (!outputFifo->isFull()) {
         DataBlockContainerReference bc = nullptr;
@@ -98,12 +102,15 @@ class processThread
           }
           if (result) {
             outputFifo->push(result);
+            if (outputNotifier != nullptr) {
+              outputNotifier->notify();
+            }
           }
         }
       }
       if (!isActive) {
         // printf("thread %d sleeping\n",threadId);
-        usleep(cfgIdleSleepTime);
+        inputNotifier.idle(seq, cfgIdleSleepTime);
       }
     }
     // printf("processing thread %d completed\n",threadId);
@@ -115,6 +122,10 @@ class processThread
   unsigned int cfgIdleSleepTime = 0;     // idle sleep time (in microseconds), when fifos empty or full, before retrying
   PtrProcessFunction fProcess = nullptr; // the process function to be used
   int threadId = 0;                      // id of the thread
+  std::shared_ptr<EventNotifier> outputNotifier; // notified when data pushed to output fifo
+
+ public:
+  EventNotifier inputNotifier; // to be notified when data pushed to input fifo
 };
 
 // A consumer class allowing to call a function from a dynamically loaded
@@ -139,6 +150,7 @@ class ConsumerDataProcessor : public Consumer
 
   std::atomic<int> shutdown;                 // flag set to 1 to request thread termination
   std::unique_ptr<std::thread> outputThread; // the collector thread taking care of emptying processors output fifos
+  std::shared_ptr<EventNotifier> outputNotifier; // notified when data pushed to processing threads output fifos
   int cfgIdleSleepTime;                      // sleep time (microseconds) for the processing threads (see class processThread) and the collector thread aggregating output
   int cfgFifoSize;                           // fifo size for the processing threads (see class processThread)
 
@@ -184,8 +196,9 @@ class ConsumerDataProcessor : public Consumer
     // configuration parameter: | consumer-processor-* | numberOfThreads | int | 1 | Number of threads running the processBlock() function in parallel. |
     cfg.getOptionalValue<int>(cfgEntryPoint + ".numberOfThreads", numberOfThreads, 1);
     theLog.log(LogInfoDevel_(3002), "Using %d thread(s) for processing", numberOfThreads);
+    outputNotifier = std::make_shared<EventNotifier>();
     for (int i = 0; i < numberOfThreads; i++) {
-      threadPool.push_back(std::make_unique<processThread>(processBlock, i + 1, cfgFifoSize, cfgIdleSleepTime));
+      threadPool.push_back(std::make_unique<processThread>(processBlock, i + 1, cfgFifoSize, cfgIdleSleepTime, outputNotifier));
     }
 
     // create a FIFO to keep track of incoming page IDs
@@ -228,6 +241,9 @@ class ConsumerDataProcessor : public Consumer
     idFifo = nullptr;
     theLog.log(LogInfoDevel_(3003), "bytes processed: %llu bytes dropped: %llu acceptance rate: %.2lf%%", (unsigned long long)processedBytes, (unsigned long long)dropBytes, processedBlocks * 100.0 / (processedBlocks + dropBlocks));
     theLog.log(LogInfoDevel_(3003), "bytes accepted in: %llu bytes out: %llu compression %.4lf", (unsigned long long)processedBytes, (unsigned long long)processedBytesOut, processedBytesOut * 1.0 / processedBytes);
+    if (EventNotifierWaitEnabled) {
+      theLog.log(LogInfoDevel_(3003), "Output thread wakeups: %s", outputNotifier->getStats().c_str());
+    }
 
     if (fpPagesIn != nullptr) {
       fclose(fpPagesIn);
@@ -267,6 +283,7 @@ class ConsumerDataProcessor : public Consumer
       }
       // if (threadPool[threadIndex]->inputFifo->isFull()) {continue; if (debug) {printf("pushing %p to thread %d\n",b.get(),threadIndex+1);}
       if (threadPool[threadIndex]->inputFifo->push(b) == 0) {
+        threadPool[threadIndex]->inputNotifier.notify();
         break;
       }
     }
@@ -328,6 +345,7 @@ class ConsumerDataProcessor : public Consumer
 
     for (; !shutdown;) {
       isActive = 0;
+      uint32_t seq = outputNotifier->getSequence();
 
       DataBlockId nextId = 0;
       if (cfgEnsurePageOrder) {
@@ -372,7 +390,7 @@ class ConsumerDataProcessor : public Consumer
 
       // wait a bit if inactive
       if (!isActive) {
-        usleep(cfgIdleSleepTime);
+        outputNotifier->idle(seq, cfgIdleSleepTime);
       }
     }
     // if (debug){printf("loopOutput() completed\n");}
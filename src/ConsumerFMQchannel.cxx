@@ -12,6 +12,7 @@
 #include "MemoryBank.h"
 #include "MemoryBankManager.h"
 #include "MemoryPagesPool.h"
+#include "MemoryPagesSlabPool.h"
 #include "ReadoutStats.h"
 #include "ReadoutUtils.h"
 #include "CounterStats.h"
@@ -27,17 +28,16 @@
 #include <fairmq/tools/Unique.h>
 
 #include "RAWDataHeader.h"
+#include "RdhUtils.h"
 #include "SubTimeframe.h"
 
 // cleanup function
 // defined with the callback footprint expected in the 3rd argument of FairMQTransportFactory.CreateMessage()
-// when object not null, it should be a (DataBlockContainerReference *), which will be destroyed
+// when object not null, it should be a (DataBlockContainer *) external reference, which will be released
 void msgcleanupCallback(void* data, void* object)
 {
   if ((object != nullptr) && (data != nullptr)) {
-    DataBlockContainerReference* ptr = (DataBlockContainerReference*)object;
-    // printf("ptr %p: use_count=%d\n",ptr,(int)ptr->use_count());
-    delete ptr;
+    DataBlockContainer::releaseExternalReference((DataBlockContainer*)object);
   }
 }
 
@@ -100,12 +100,25 @@ class ConsumerFMQchannel : public Consumer
   bool enableRawFormat = false;
   bool enableStfSuperpage = false; // optimized stf transport: minimize STF packets
   bool enableRawFormatDatablock = false;
+  int enableHbfContinuation = 0;           // when set, HBF spanning several pages are sent in several parts instead of being repacked
+  uint64_t hbfContinuationCount = 0;       // number of HBF sent in several parts
 
   std::shared_ptr<MemoryBank> memBank; // a dedicated memory bank allocated by FMQ mechanism
   std::shared_ptr<MemoryPagesPool> mp; // a memory pool from which to allocate data pages
+  std::shared_ptr<MemoryPagesSlabPool> mpSlab; // if defined, a memory pool with pages of different sizes, used instead of mp
 
   int memoryPoolPageSize;
   int memoryPoolNumberOfPages;
+  size_t memoryPoolBlockMaxSize = 0; // usable size of biggest page available from the pool
+
+  // get a page from the pool, with at least the given usable size (only checked with size classes, the others have all the same size)
+  DataBlockContainerReference getNewDataBlockContainer(size_t size)
+  {
+    if (mpSlab != nullptr) {
+      return mpSlab->getNewDataBlockContainer(size);
+    }
+    return mp->getNewDataBlockContainer();
+  }
 
   CounterStats repackSizeStats; // keep track of page size used when repacking
 
@@ -113,6 +126,15 @@ class ConsumerFMQchannel : public Consumer
   std::vector<FairMQMessagePtr> messagesToSend; // collect HBF messages of each update
   uint64_t messagesToSendSize;                  // size (bytes) of messagesToSend payload
 
+  // HBF data not sent yet (from one block to the next), member to reuse memory from one call to the next
+  struct pendingFrame {
+    DataBlockContainer* blockRef; // external reference to the block
+    unsigned int HBstart;
+    unsigned int HBlength;
+    unsigned int HBid;
+  };
+  std::vector<pendingFrame> pendingFrames;
+
   ConsumerFMQchannel(ConfigFile& cfg, std::string cfgEntryPoint) : Consumer(cfg, cfgEntryPoint)
   {
 
@@ -140,6 +162,12 @@ class ConsumerFMQchannel : public Consumer
       enableRawFormatDatablock = true;
     }
 
+    // configuration parameter: | consumer-FairMQChannel-* | enableHbfContinuation | int | 0 | Used when enableRawFormat = 0. If set, a HBF spanning several data pages is not repacked (copied) in a single message part, but sent as consecutive message parts referencing the original pages, and flag hbfContinuation is set in the STF header. The receiver should then merge consecutive parts having the same HBF orbit. |
+    cfg.getOptionalValue<int>(cfgEntryPoint + ".enableHbfContinuation", enableHbfContinuation);
+    if (enableHbfContinuation) {
+      theLog.log(LogInfoDevel_(3002), "FMQ HBF continuation enabled: HBF spanning several data pages sent in several message parts, without copy");
+    }
+
     // configuration parameter: | consumer-FairMQChannel-* | sessionName | string | default | Name of the FMQ session. c.f. FairMQ::FairMQChannel.h |
     std::string cfgSessionName = "default";
     cfg.getOptionalValue<std::string>(cfgEntryPoint + ".sessionName", cfgSessionName);
@@ -234,10 +262,10 @@ class ConsumerFMQchannel : public Consumer
       theLog.log(LogInfoDevel_(3008), "Creating FMQ unmanaged memory region");
       memoryBuffer = sendingChannel->Transport()->CreateUnmanagedRegion(mMemorySize, [](void* /*data*/, size_t /*size*/, void* hint) { // cleanup callback
         if (hint != nullptr) {
-          DataBlockContainerReference* blockRef = (DataBlockContainerReference*)hint;
-          //printf("ack hint=%p page %p\n",hint,(*blockRef)->getData());
-          decDataBlockStats((*blockRef)->getData());
-          delete blockRef;
+          DataBlockContainer* blockRef = (DataBlockContainer*)hint;
+          //printf("ack hint=%p page %p\n",hint,blockRef->getData());
+          decDataBlockStats(blockRef->getData());
+          DataBlockContainer::releaseExternalReference(blockRef);
         }
       },"",0,fair::mq::RegionConfig{true, true});  // lock / zero
 
@@ -272,23 +300,44 @@ class ConsumerFMQchannel : public Consumer
     cfg.getOptionalValue<std::string>(cfgEntryPoint + ".memoryPoolPageSize", cfgMemoryPoolPageSize);
     memoryPoolPageSize = (int)ReadoutUtils::getNumberOfBytesFromString(cfgMemoryPoolPageSize.c_str());
     cfg.getOptionalValue<int>(cfgEntryPoint + ".memoryPoolNumberOfPages", memoryPoolNumberOfPages);
-    mp = theMemoryBankManager.getPagedPool(memoryPoolPageSize, memoryPoolNumberOfPages, memoryBankName);
-    if (mp == nullptr) {
-      throw "ConsumerFMQ: failed to get memory pool from " + memoryBankName + " for " + std::to_string(memoryPoolNumberOfPages) + " pages x " + std::to_string(memoryPoolPageSize) + " bytes";
+    // configuration parameter: | consumer-FairMQChannel-* | memoryPoolSizeClasses | string |  | If set, the memory pool is created with pages of different sizes, given as a comma-separated list of pageSize:numberOfPages, e.g. 1k:1000,128k:100. Each block (STF header, repacked HBF) then uses the smallest page available fitting it. When set, memoryPoolPageSize and memoryPoolNumberOfPages are ignored. |
+    std::string cfgMemoryPoolSizeClasses;
+    cfg.getOptionalValue<std::string>(cfgEntryPoint + ".memoryPoolSizeClasses", cfgMemoryPoolSizeClasses);
+    if (cfgMemoryPoolSizeClasses.length()) {
+      std::vector<MemoryPagesSlabPool::SizeClass> sizeClasses;
+      if (MemoryPagesSlabPool::getSizeClassesFromString(cfgMemoryPoolSizeClasses, sizeClasses)) {
+        throw "ConsumerFMQ: wrong memoryPoolSizeClasses " + cfgMemoryPoolSizeClasses;
+      }
+      mpSlab = theMemoryBankManager.getSlabPool(sizeClasses, memoryBankName);
+      if (mpSlab == nullptr) {
+        throw "ConsumerFMQ: failed to get memory pool from " + memoryBankName + " for size classes " + cfgMemoryPoolSizeClasses;
+      }
+      memoryPoolBlockMaxSize = mpSlab->getDataBlockMaxSize();
+      theLog.log(LogInfoDevel_(3008), "Using memory pool with size classes %s", cfgMemoryPoolSizeClasses.c_str());
+    } else {
+      mp = theMemoryBankManager.getPagedPool(memoryPoolPageSize, memoryPoolNumberOfPages, memoryBankName);
+      if (mp == nullptr) {
+        throw "ConsumerFMQ: failed to get memory pool from " + memoryBankName + " for " + std::to_string(memoryPoolNumberOfPages) + " pages x " + std::to_string(memoryPoolPageSize) + " bytes";
+      }
+      memoryPoolBlockMaxSize = mp->getDataBlockMaxSize();
+      theLog.log(LogInfoDevel_(3008), "Using memory pool %d pages x %d bytes", memoryPoolNumberOfPages, memoryPoolPageSize);
     }
-    theLog.log(LogInfoDevel_(3008), "Using memory pool %d pages x %d bytes", memoryPoolNumberOfPages, memoryPoolPageSize);
   }
 
   ~ConsumerFMQchannel()
   {
     // log memory pool statistics
-    if (mp!=nullptr) {
-      theLog.log(LogInfoDevel_(3003), "Consumer %s - memory pool statistics ... %s", name.c_str(), mp->getStats().c_str());
+    if ((mp != nullptr) || (mpSlab != nullptr)) {
+      theLog.log(LogInfoDevel_(3003), "Consumer %s - memory pool statistics ... %s", name.c_str(), (mpSlab != nullptr) ? mpSlab->getStats().c_str() : mp->getStats().c_str());
       theLog.log(LogInfoDevel_(3003), "Consumer %s - STFB repacking statistics ... number: %" PRIu64 " average page size: %" PRIu64 " max page size: %" PRIu64, name.c_str(), repackSizeStats.getCount(), (uint64_t)repackSizeStats.getAverage(), repackSizeStats.getMaximum());
+      if (enableHbfContinuation) {
+        theLog.log(LogInfoDevel_(3003), "Consumer %s - STFB HBF continuation ... number: %" PRIu64, name.c_str(), hbfContinuationCount);
+      }
     }
     
     // release in reverse order
     mp = nullptr;
+    mpSlab = nullptr;
     memoryBuffer = nullptr; // warning: data range may still be referenced in memory bank manager
     sendingChannel = nullptr;
     transportFactory = nullptr;
@@ -319,7 +368,7 @@ class ConsumerFMQchannel : public Consumer
         if (b->data == nullptr) {
           continue;
         }
-        DataBlockContainerReference* blockRef = new DataBlockContainerReference(br);
+        DataBlockContainer* blockRef = DataBlockContainer::addExternalReference(br);
         if (blockRef == nullptr) {
           totalPushError++;
           return -1;
@@ -350,8 +399,8 @@ class ConsumerFMQchannel : public Consumer
     // 1 FMQ message per data page, 1 part= header, 1 part= payload
     if (enableRawFormatDatablock) {
       for (auto& br : *bc) {
-        // create a copy of the reference, in a newly allocated object, so that reference is kept alive until this new object is destroyed in the cleanupCallback
-        DataBlockContainerReference* ptr = new DataBlockContainerReference(br);
+        // create an external reference, so that block is kept alive until it is released in the cleanupCallback
+        DataBlockContainer* ptr = DataBlockContainer::addExternalReference(br);
         if (ptr == nullptr) {
           totalPushError++;
           return -1;
@@ -373,12 +422,16 @@ class ConsumerFMQchannel : public Consumer
     if ((enableStfSuperpage) || (!isRdhFormat)) {
 
       DataBlockContainerReference headerBlock = nullptr;
-      headerBlock = mp->getNewDataBlockContainer();
+      if (memoryPoolBlockMaxSize < sizeof(SubTimeframe)) {
+        totalPushError++;
+        return -1;
+      }
+      headerBlock = getNewDataBlockContainer(sizeof(SubTimeframe));
       if (headerBlock == nullptr) {
         totalPushError++;
         return -1;
       }
-      auto blockRef = new DataBlockContainerReference(headerBlock);
+      auto blockRef = DataBlockContainer::addExternalReference(headerBlock);
       if (blockRef == nullptr) {
         totalPushError++;
         return -1;
@@ -423,7 +476,7 @@ class ConsumerFMQchannel : public Consumer
       // one msg part per superpage
       for (auto& br : *bc) {
         DataBlock* b = br->getData();
-        DataBlockContainerReference* blockRef = new DataBlockContainerReference(br);
+        DataBlockContainer* blockRef = DataBlockContainer::addExternalReference(br);
         if (blockRef == nullptr) {
           totalPushError++;
           return -1;
@@ -447,20 +500,20 @@ class ConsumerFMQchannel : public Consumer
     // 1 FMQ message for header + 1 FMQ message per HBF (all belonging to same CRU/link id)
 
     // we iterate a first time to count number of HB
-    if (memoryPoolPageSize < (int)sizeof(SubTimeframe)) {
+    if (memoryPoolBlockMaxSize < sizeof(SubTimeframe)) {
       totalPushError++;
       return -1;
     }
     DataBlockContainerReference headerBlock = nullptr;
     try {
-      headerBlock = mp->getNewDataBlockContainer();
+      headerBlock = getNewDataBlockContainer(sizeof(SubTimeframe));
     } catch (...) {
     }
     if (headerBlock == nullptr) {
       totalPushError++;
       return -1;
     }
-    auto blockRef = new DataBlockContainerReference(headerBlock);
+    auto blockRef = DataBlockContainer::addExternalReference(headerBlock);
     if (blockRef == nullptr) {
       totalPushError++;
       return -1;
@@ -507,19 +560,28 @@ class ConsumerFMQchannel : public Consumer
       }
       // printf("block %d tf %d link %d\n",ix,b->header.timeframeId,b->header.linkId);
 
+      auto checkLinkId = [&](int linkId, int offset) {
+        if (stfHeader->linkId != linkId) {
+          static InfoLogger::AutoMuteToken token(LogWarningSupport_(3004));
+          theLog.log(token, "TF%d equipment %d link Id mismatch %d != %d @ page offset %d", (int)stfHeader->timeframeId, (int)stfHeader->equipmentId, (int)stfHeader->linkId, linkId, offset);
+        }
+      };
+
+      // use RDH packet index of the page, when available
+      RdhPacketIndex* index = getRdhPacketIndex(b);
+      if (index != nullptr) {
+        for (uint32_t i = 0; i < index->numberOfPackets; i++) {
+          checkLinkId((int)index->packets[i].linkId, (int)index->packets[i].offset);
+        }
+        continue;
+      }
+
       for (int offset = 0; offset + sizeof(o2::Header::RAWDataHeader) <= b->header.dataSize;) {
         // printf("checking %p : %d\n",b,offset);
         o2::Header::RAWDataHeader* rdh = (o2::Header::RAWDataHeader*)&b->data[offset];
-        if (rdh->heartbeatOrbit != lastHBid) {
-          lastHBid = rdh->heartbeatOrbit;
-          // printf("offset %d - HBid=%d\n",offset,lastHBid);
-        }
-        if (stfHeader->linkId != rdh->linkId) {
-          static InfoLogger::AutoMuteToken token(LogWarningSupport_(3004));
-          theLog.log(token, "TF%d equipment %d link Id mismatch %d != %d @ page offset %d", (int)stfHeader->timeframeId, (int)stfHeader->equipmentId, (int)stfHeader->linkId, (int)rdh->linkId, (int)offset);
-          // dumpRDH(rdh);
-          // printf("block %p : offset %d = %p\n",b,offset,rdh);
-        }
+        checkLinkId((int)rdh->linkId, offset);
+        // dumpRDH(rdh);
+        // printf("block %p : offset %d = %p\n",b,offset,rdh);
         uint16_t offsetNextPacket = rdh->offsetNextPacket;
         if (offsetNextPacket == 0) {
           break;
@@ -535,8 +597,8 @@ class ConsumerFMQchannel : public Consumer
     assert(messagesToSend.empty());
     if (memoryBuffer) {
       // printf("send H %p\n", blockRef);
-      initDataBlockStats((*blockRef)->getData());
-      incDataBlockStats((*blockRef)->getData());
+      initDataBlockStats(blockRef->getData());
+      incDataBlockStats(blockRef->getData());
       messagesToSend.emplace_back(sendingChannel->NewMessage(memoryBuffer, (void*)stfHeader, sizeof(SubTimeframe), (void*)(blockRef)));
     } else {
       messagesToSend.emplace_back(sendingChannel->NewMessage((void*)stfHeader, sizeof(SubTimeframe), msgcleanupCallback, (void*)(blockRef)));
@@ -548,21 +610,15 @@ class ConsumerFMQchannel : public Consumer
     lastHBid = -1;
 
     // this is for data not sent yet (from one loop to the next)
-    struct pendingFrame {
-      DataBlockContainerReference* blockRef;
-      unsigned int HBstart;
-      unsigned int HBlength;
-      unsigned int HBid;
-    };
-    std::vector<pendingFrame> pendingFrames;
+    pendingFrames.clear();
 
     auto pendingFramesAppend = [&](unsigned int ix, unsigned int l, unsigned int id, DataBlockContainerReference br) {
       pendingFrame pf;
       pf.HBstart = ix;
       pf.HBlength = l;
       pf.HBid = id;
-      // create a copy of the reference, in a newly allocated object, so that reference is kept alive until this new object is destroyed in the cleanupCallback
-      pf.blockRef = new DataBlockContainerReference(br);
+      // create an external reference, so that block is kept alive until it is released in the cleanupCallback
+      pf.blockRef = DataBlockContainer::addExternalReference(br);
       // printf("allocating blockRef %p for %p\n",pf.blockRef,br);
       pendingFrames.push_back(pf);
     };
@@ -575,28 +631,33 @@ class ConsumerFMQchannel : public Consumer
         return;
       }
 
-      if (nFrames == 1) {
+      if ((nFrames == 1) || (enableHbfContinuation)) {
         // single block, no need to repack
-        auto br = *(pendingFrames[0].blockRef);
-        DataBlock* b = br->getData();
-        int ix = pendingFrames[0].HBstart;
-        int l = pendingFrames[0].HBlength;
-        // std::unique_ptr<FairMQMessage> msgBody(transportFactory->CreateMessage((void *)(&(b->data[ix])),(size_t)(l), cleanupCallback, (void *)(pendingFrames[0].blockRef)));
-        void* hint = (void*)pendingFrames[0].blockRef;
-        // printf("block %p ix = %d : %d hint=%p\n",(void *)(&(b->data[ix])),ix,l,hint);
-        // std::cout << typeid(pendingFrames[0].blockRef).name() << std::endl;
-
-        // create and queue a fmq message
-        if (memoryBuffer) {
-          // printf("send D %p\n", hint);
-          incDataBlockStats((*(pendingFrames[0].blockRef))->getData());
-          messagesToSend.emplace_back(sendingChannel->NewMessage(memoryBuffer, (void*)(&(b->data[ix])), (size_t)(l), hint));
-        } else {
-          messagesToSend.emplace_back(sendingChannel->NewMessage((void*)(&(b->data[ix])), (size_t)(l), msgcleanupCallback, hint));
+        // or HBF continuation allowed: 1 message part per block piece, each referencing original page (no copy)
+        if (nFrames > 1) {
+          stfHeader->hbfContinuation = 1;
+          hbfContinuationCount++;
+        }
+        for (auto& f : pendingFrames) {
+          DataBlock* b = f.blockRef->getData();
+          int ix = f.HBstart;
+          int l = f.HBlength;
+          // std::unique_ptr<FairMQMessage> msgBody(transportFactory->CreateMessage((void *)(&(b->data[ix])),(size_t)(l), cleanupCallback, (void *)(f.blockRef)));
+          void* hint = (void*)f.blockRef;
+          // printf("block %p ix = %d : %d hint=%p\n",(void *)(&(b->data[ix])),ix,l,hint);
+
+          // create and queue a fmq message
+          if (memoryBuffer) {
+            // printf("send D %p\n", hint);
+            incDataBlockStats(f.blockRef->getData());
+            messagesToSend.emplace_back(sendingChannel->NewMessage(memoryBuffer, (void*)(&(b->data[ix])), (size_t)(l), hint));
+          } else {
+            messagesToSend.emplace_back(sendingChannel->NewMessage((void*)(&(b->data[ix])), (size_t)(l), msgcleanupCallback, hint));
+          }
+          f.blockRef = nullptr; // reference now owned by the message
+          messagesToSendSize += l;
+          // printf("sent single HB %d = %d bytes\n",f.HBid,l);
         }
-        messagesToSendSize += l;
-        // printf("sent single HB %d = %d bytes\n",pendingFrames[0].HBid,l);
-        // printf("left to FMQ: %p\n",pendingFrames[0].blockRef);
 
       } else {
         // todo : account number of repack-copies in this situation
@@ -613,14 +674,14 @@ class ConsumerFMQchannel : public Consumer
         // allocate
         // todo: same code as for header -> create func/lambda
         // todo: send empty message if no page left in buffer
-        if (memoryPoolPageSize < totalSize) {
+        if ((int)memoryPoolBlockMaxSize < totalSize) {
 	  static InfoLogger::AutoMuteToken token(LogWarningSupport_(3230));
-          theLog.log(token, "page size too small %d < %d", memoryPoolPageSize, totalSize);
+          theLog.log(token, "page size too small %d < %d", (int)memoryPoolBlockMaxSize, totalSize);
           throw __LINE__;
         }
         DataBlockContainerReference copyBlock = nullptr;
         try {
-          copyBlock = mp->getNewDataBlockContainer();
+          copyBlock = getNewDataBlockContainer(totalSize);
         } catch (...) {
         }
         if (copyBlock == nullptr) {
@@ -628,30 +689,31 @@ class ConsumerFMQchannel : public Consumer
           theLog.log(token, "no page left");
           throw __LINE__;
         }
-        auto blockRef = new DataBlockContainerReference(copyBlock);
+        auto blockRef = DataBlockContainer::addExternalReference(copyBlock);
         char* newBlock = (char*)copyBlock->getData()->data;
-        ;
+        auto repackStartTime = std::chrono::steady_clock::now();
         int newIx = 0;
         for (auto& f : pendingFrames) {
-          auto br = *(f.blockRef);
-          DataBlock* b = br->getData();
+          DataBlock* b = f.blockRef->getData();
           int ix = f.HBstart;
           int l = f.HBlength;
           // printf("block %p @ %d : %d\n",b,ix,l);
           memcpy(&newBlock[newIx], &(b->data[ix]), l);
           // printf("release %p for %p\n",f.blockRef,br);
-          delete f.blockRef;
+          DataBlockContainer::releaseExternalReference(f.blockRef);
           f.blockRef = nullptr;
           newIx += l;
         }
+        gReadoutStats.counters.bytesFairMQrepacked += totalSize;
+        gReadoutStats.counters.timeFairMQrepack += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - repackStartTime).count();
 
         // std::unique_ptr<FairMQMessage> msgBody(transportFactory->CreateMessage((void *)newBlock, totalSize, cleanupCallbackForMalloc, (void *)(newBlock))); sendingChannel->Send(msgBody);
 
         // create and queue a fmq message
         if (memoryBuffer) {
           // printf("send D2 %p\n", blockRef);
-          initDataBlockStats((*blockRef)->getData());
-          incDataBlockStats((*blockRef)->getData());
+          initDataBlockStats(blockRef->getData());
+          incDataBlockStats(blockRef->getData());
           messagesToSend.emplace_back(sendingChannel->NewMessage(memoryBuffer, (void*)newBlock, totalSize, (void*)(blockRef)));
         } else {
           messagesToSend.emplace_back(sendingChannel->NewMessage((void*)newBlock, totalSize, msgcleanupCallback, (void*)(blockRef)));
@@ -669,10 +731,8 @@ class ConsumerFMQchannel : public Consumer
         initDataBlockStats(b);
 
         unsigned int HBstart = 0;
-        for (int offset = 0; offset + sizeof(o2::Header::RAWDataHeader) <= b->header.dataSize;) {
-          o2::Header::RAWDataHeader* rdh = (o2::Header::RAWDataHeader*)&b->data[offset];
-          // printf("CRU block %p = HB %d link %d @ %d\n",b,(int)rdh->heartbeatOrbit,(int)rdh->linkId,offset);
-          if (rdh->heartbeatOrbit != lastHBid) {
+        auto checkHBid = [&](unsigned int offset, unsigned int HBid) {
+          if (HBid != lastHBid) {
             // printf("new HBf detected\n");
             int HBlength = offset - HBstart;
 
@@ -685,13 +745,27 @@ class ConsumerFMQchannel : public Consumer
 
             // update new HB frame
             HBstart = offset;
-            lastHBid = rdh->heartbeatOrbit;
+            lastHBid = HBid;
           }
-          uint16_t offsetNextPacket = rdh->offsetNextPacket;
-          if (offsetNextPacket == 0) {
-            break;
+        };
+
+        // use RDH packet index of the page, when available
+        RdhPacketIndex* index = getRdhPacketIndex(b);
+        if (index != nullptr) {
+          for (uint32_t i = 0; i < index->numberOfPackets; i++) {
+            checkHBid(index->packets[i].offset, index->packets[i].hbOrbit);
+          }
+        } else {
+          for (int offset = 0; offset + sizeof(o2::Header::RAWDataHeader) <= b->header.dataSize;) {
+            o2::Header::RAWDataHeader* rdh = (o2::Header::RAWDataHeader*)&b->data[offset];
+            // printf("CRU block %p = HB %d link %d @ %d\n",b,(int)rdh->heartbeatOrbit,(int)rdh->linkId,offset);
+            checkHBid(offset, rdh->heartbeatOrbit);
+            uint16_t offsetNextPacket = rdh->offsetNextPacket;
+            if (offsetNextPacket == 0) {
+              break;
+            }
+            offset += offsetNextPacket;
           }
-          offset += offsetNextPacket;
         }
 
         // keep last piece for later, HBframe may continue in next block(s)
@@ -716,7 +790,7 @@ class ConsumerFMQchannel : public Consumer
       // cleanup pending frames
       for (auto& f : pendingFrames) {
         if (f.blockRef != nullptr) {
-          delete f.blockRef;
+          DataBlockContainer::releaseExternalReference(f.blockRef);
           f.blockRef = nullptr;
         }
       }
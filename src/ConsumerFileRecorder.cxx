@@ -8,28 +8,240 @@
 // granted to it by virtue of its status as an Intergovernmental Organization
 // or submit itself to any jurisdiction.
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <errno.h>
+#include <fcntl.h>
 #include <iomanip>
+#include <unistd.h>
 
 #include "Consumer.h"
+#include "MemoryPagesPool.h"
 #include "RdhUtils.h"
 #include "ReadoutStats.h"
 #include "ReadoutUtils.h"
 
+// file descriptors used for asynchronous writes
+// the file is closed when the last pending write referencing it is completed
+class FileWriteDescriptor
+{
+ public:
+  int fd = -1;       // buffered file descriptor
+  int fdDirect = -1; // file descriptor opened with O_DIRECT, if enabled (used for aligned writes only)
+  std::atomic<int> writesInFlight = 0;
+
+  ~FileWriteDescriptor()
+  {
+    if (fdDirect >= 0) {
+      ::close(fdDirect);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+};
+
+// an engine to write data to files asynchronously, with a pool of threads calling pwrite()
+// data given to write() must stay valid until completion: a reference to the owner is kept in the queue
+class FileWriteEngine
+{
+ public:
+  // constructor parameters:
+  // - nThreads: number of writing threads
+  // - queueDepth: maximum number of writes in flight (all files)
+  // - fileInFlightMax: maximum number of writes in flight for each file
+  FileWriteEngine(int nThreads, int vQueueDepth, int vFileInFlightMax)
+  {
+    queueDepth = (vQueueDepth > 0) ? vQueueDepth : 1;
+    fileInFlightMax = (vFileInFlightMax > 0) ? vFileInFlightMax : queueDepth;
+    for (int i = 0; i < nThreads; i++) {
+      threads.push_back(std::thread(&FileWriteEngine::run, this));
+    }
+    clock.reset();
+  }
+
+  ~FileWriteEngine()
+  {
+    flush();
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      shutdown = true;
+    }
+    queueNotEmpty.notify_all();
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+
+  // queue a write request, possibly waiting until there is room in queue
+  // isDirect: write done with the O_DIRECT file descriptor (ptr, size, offset should then be aligned, see directAlignment)
+  // returns 0 on success, -1 if a previous write failed
+  int write(const std::shared_ptr<FileWriteDescriptor>& file, uint64_t offset, void* ptr, size_t size, const std::shared_ptr<void>& keepAlive, bool isDirect = false)
+  {
+    if (writeErrors) {
+      return -1;
+    }
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while ((inFlight >= queueDepth) || (file->writesInFlight >= fileInFlightMax)) {
+      nWaitQueue++;
+      queueNotFull.wait(lock);
+    }
+    inFlight++;
+    file->writesInFlight++;
+    queue.push_back({ file, offset, ptr, size, keepAlive, clock.getTime(), isDirect });
+    lock.unlock();
+    queueNotEmpty.notify_one();
+    return 0;
+  }
+
+  // wait until all pending writes completed
+  void flush()
+  {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (inFlight > 0) {
+      queueNotFull.wait(lock);
+    }
+  }
+
+  std::atomic<int> writeErrors = 0; // number of failed writes
+
+  // report statistics
+  void logStats(const std::string& name)
+  {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    double t = clock.getTime();
+    theLog.log(LogInfoDevel_(3003), "Recorder %s async writes: %llu bytes in %llu writes (%llu direct), %.2f MB/s, latency avg=%.0lfus max=%lluus, waited %llu times for queue space, %d errors", name.c_str(), bytesWritten, nWrites, nWritesDirect, (t > 0) ? bytesWritten / (t * 1024.0 * 1024.0) : 0.0, writeLatency.getAverage(), (unsigned long long)writeLatency.getMaximum(), nWaitQueue, (int)writeErrors);
+  }
+
+  static const size_t directAlignment = 4096; // alignment of address, size and offset for O_DIRECT writes
+
+ private:
+  struct WriteRequest {
+    std::shared_ptr<FileWriteDescriptor> file;
+    uint64_t offset;
+    void* ptr;
+    size_t size;
+    std::shared_ptr<void> keepAlive; // data owner, released on completion
+    double timeSubmitted;
+    bool isDirect; // if set, written with the O_DIRECT file descriptor
+  };
+
+  void run()
+  {
+    for (;;) {
+      WriteRequest r;
+      {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        while ((queue.empty()) && (!shutdown)) {
+          queueNotEmpty.wait(lock);
+        }
+        if (queue.empty()) {
+          return;
+        }
+        r = std::move(queue.front());
+        queue.pop_front();
+      }
+
+      // O_DIRECT file descriptor, when selected by the file (see FileHandle::write)
+      bool isDirect = r.isDirect;
+      int fd = isDirect ? r.file->fdDirect : r.file->fd;
+
+      // write all bytes
+      bool isOk = true;
+      size_t done = 0;
+      while (done < r.size) {
+        ssize_t n = pwrite(fd, (char*)r.ptr + done, r.size - done, r.offset + done);
+        if (n <= 0) {
+          if ((n < 0) && (errno == EINTR)) {
+            continue;
+          }
+          isOk = false;
+          break;
+        }
+        done += n;
+      }
+      if (isOk) {
+        gReadoutStats.counters.bytesRecorded += r.size;
+      } else {
+        writeErrors++;
+        static InfoLogger::AutoMuteToken token(LogErrorSupport_(3232));
+        theLog.log(token, "File write error: %s", strerror(errno));
+      }
+
+      // completion
+      r.keepAlive = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        writeLatency.set((CounterValue)((clock.getTime() - r.timeSubmitted) * 1000000));
+        bytesWritten += done;
+        nWrites++;
+        if (isDirect) {
+          nWritesDirect++;
+        }
+        r.file->writesInFlight--;
+        inFlight--;
+      }
+      r.file = nullptr; // file closed here if last reference
+      queueNotFull.notify_all();
+    }
+  }
+
+  int queueDepth;      // maximum number of writes in flight
+  int fileInFlightMax; // maximum number of writes in flight per file
+
+  std::vector<std::thread> threads;
+  std::deque<WriteRequest> queue;
+  std::mutex queueMutex;
+  std::condition_variable queueNotEmpty;
+  std::condition_variable queueNotFull;
+  int inFlight = 0;      // number of writes queued or in progress
+  bool shutdown = false; // set to stop threads
+
+  AliceO2::Common::Timer clock;
+  CounterStats writeLatency; // time between submission and completion, in microseconds
+  unsigned long long bytesWritten = 0;
+  unsigned long long nWrites = 0;
+  unsigned long long nWritesDirect = 0;
+  unsigned long long nWaitQueue = 0;
+};
+
 // a struct to store info related to one file
 class FileHandle
 {
  public:
-  FileHandle(std::string& _path, InfoLogger* _theLog = nullptr, unsigned long long _maxFileSize = 0, int _maxPages = 0)
+  // if writeEngine is set, file written asynchronously with it (and O_DIRECT used when directIO set)
+  FileHandle(std::string& _path, InfoLogger* _theLog = nullptr, unsigned long long _maxFileSize = 0, int _maxPages = 0, FileWriteEngine* _writeEngine = nullptr, bool directIO = false)
   {
     theLog = _theLog;
     path = _path;
     counterBytesTotal = 0;
     maxFileSize = _maxFileSize;
     maxPages = _maxPages;
+    writeEngine = _writeEngine;
     if (theLog != nullptr) {
       theLog->log(LogInfoDevel_(3007), "Opening file for writing: %s", path.c_str());
     }
+    if (writeEngine != nullptr) {
+      writeDescriptor = std::make_shared<FileWriteDescriptor>();
+      writeDescriptor->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (writeDescriptor->fd < 0) {
+        if (theLog != nullptr) {
+          theLog->log(LogErrorSupport_(3232), "Failed to create file: %s", strerror(errno));
+        }
+        writeDescriptor = nullptr;
+        return;
+      }
+      if (directIO) {
+        writeDescriptor->fdDirect = open(path.c_str(), O_WRONLY | O_DIRECT);
+        if ((writeDescriptor->fdDirect < 0) && (theLog != nullptr)) {
+          theLog->log(LogWarningSupport_(3232), "Failed to open file with O_DIRECT, using buffered writes: %s", strerror(errno));
+        }
+        isDirect = (writeDescriptor->fdDirect >= 0);
+      }
+      isOk = true;
+      return;
+    }
     fp = fopen(path.c_str(), "wb");
     if (fp == NULL) {
       if (theLog != nullptr) {
@@ -44,13 +256,17 @@ class FileHandle
 
   void close()
   {
-    if (fp != NULL) {
+    if ((fp != NULL) || (writeDescriptor != nullptr)) {
       if (theLog != nullptr) {
         theLog->log(LogInfoDevel_(3007), "Closing file %s : %llu bytes (~%s)", path.c_str(), counterBytesTotal, ReadoutUtils::NumberOfBytesToString(counterBytesTotal, "B").c_str());
       }
+    }
+    if (fp != NULL) {
       fclose(fp);
       fp = NULL;
     }
+    // with async writes, file is actually closed on completion of last pending write
+    writeDescriptor = nullptr;
     isOk = false;
   }
 
@@ -58,10 +274,11 @@ class FileHandle
   // data given by 'ptr', number of bytes given by 'size'
   // isPage is a flag telling if the data belongs to a page (for the 'number of pages written' counter)
   // remainingBlockSize is taken into account not to exceed max file size, to avoid starting writing anything if the next write would reach limit return one of the status code below
+  // keepAlive is a reference to the owner of the data, kept until write completed (for asynchronous writes)
   enum Status { Success = 0,
                 Error = -1,
                 FileLimitsReached = 1 };
-  FileHandle::Status write(void* ptr, size_t size, bool isPage = false, size_t remainingBlockSize = 0)
+  FileHandle::Status write(void* ptr, size_t size, bool isPage = false, size_t remainingBlockSize = 0, const std::shared_ptr<void>& keepAlive = nullptr)
   {
     lastWriteBytes = 0; // reset last bytes written
     if (isFull) {
@@ -87,14 +304,31 @@ class FileHandle
       close();
       return Status::FileLimitsReached;
     }
-    if (fp == NULL) {
-      return Status::Error;
-    }
-    if (fwrite(ptr, size, 1, fp) != 1) {
-      return Status::Error;
+    if (writeEngine != nullptr) {
+      if (writeDescriptor == nullptr) {
+        return Status::Error;
+      }
+      // O_DIRECT and buffered writes are not mixed in a file:
+      // file written with O_DIRECT as long as all writes are aligned, and buffered from the first one which is not
+      if ((isDirect) && ((((size_t)ptr % FileWriteEngine::directAlignment) != 0) || ((size % FileWriteEngine::directAlignment) != 0) || ((counterBytesTotal % FileWriteEngine::directAlignment) != 0))) {
+        isDirect = false;
+        if (theLog != nullptr) {
+          theLog->log(LogInfoDevel_(3007), "File %s: write not aligned at offset %llu, using buffered writes from now", path.c_str(), counterBytesTotal);
+        }
+      }
+      if (writeEngine->write(writeDescriptor, counterBytesTotal, ptr, size, keepAlive, isDirect) != 0) {
+        return Status::Error;
+      }
+    } else {
+      if (fp == NULL) {
+        return Status::Error;
+      }
+      if (fwrite(ptr, size, 1, fp) != 1) {
+        return Status::Error;
+      }
+      gReadoutStats.counters.bytesRecorded += size;
     }
     counterBytesTotal += size;
-    gReadoutStats.counters.bytesRecorded += size;
     if (isPage) {
       counterPages++;
     }
@@ -116,6 +350,9 @@ class FileHandle
   bool isFull = false;                      // flag set when maximum file size reached
   bool isOk = false;                        // flag set when file ready for writing
   size_t lastWriteBytes = 0;                // number of bytes last written with success
+  FileWriteEngine* writeEngine = nullptr;   // engine used for asynchronous writes, if any
+  std::shared_ptr<FileWriteDescriptor> writeDescriptor; // file descriptors for asynchronous writes
+  bool isDirect = false;                                // set when asynchronous writes done with O_DIRECT
 
  public:
   int fileId = 0; // a placeholder for an incremental counter to identify current file Id (when file splitting enabled)
@@ -190,6 +427,38 @@ class ConsumerFileRecorder : public Consumer
       }
       theLog.log(LogInfoSupport_(3002), "Some packets with RDH-only payload will not be recorded to file, option dropEmptyHBFrames is enabled");
     }
+
+    // configuration parameter: | consumer-fileRecorder-* | writeMode | string | sync | Defines how data is written to file. sync: data written directly from pushData() (stdio). async: data written by a pool of threads (see writeThreads, writeQueueDepth), data pages are kept until write completed. As pages are then released by the writing threads, async needs memory pools in multi-producer/multi-consumer mode (readout.memoryPoolMagazineSize). |
+    std::string cfgWriteMode = "sync";
+    cfg.getOptionalValue<std::string>(cfgEntryPoint + ".writeMode", cfgWriteMode);
+    if (cfgWriteMode == "async") {
+      writeAsync = 1;
+      if (MemoryPagesPoolMagazineSize <= 0) {
+        theLog.log(LogErrorSupport_(3100), "writeMode=async needs readout.memoryPoolMagazineSize set (pages released concurrently by the writing threads)");
+        throw __LINE__;
+      }
+    } else if (cfgWriteMode != "sync") {
+      theLog.log(LogErrorSupport_(3102), "Wrong value for writeMode = %s", cfgWriteMode.c_str());
+      throw __LINE__;
+    }
+    // configuration parameter: | consumer-fileRecorder-* | writeThreads | int | 4 | With writeMode=async, number of threads writing data to file(s). |
+    cfg.getOptionalValue(cfgEntryPoint + ".writeThreads", writeThreads, 4);
+    // configuration parameter: | consumer-fileRecorder-* | writeQueueDepth | int | 32 | With writeMode=async, maximum number of writes in flight (all files). When reached, pushData() waits for completion of pending writes. |
+    cfg.getOptionalValue(cfgEntryPoint + ".writeQueueDepth", writeQueueDepth, 32);
+    // configuration parameter: | consumer-fileRecorder-* | writeFileInFlightMax | int | 8 | With writeMode=async, maximum number of writes in flight for each file. |
+    cfg.getOptionalValue(cfgEntryPoint + ".writeFileInFlightMax", writeFileInFlightMax, 8);
+    // configuration parameter: | consumer-fileRecorder-* | directIO | int | 0 | With writeMode=async, if set, files are also opened with O_DIRECT, used to write data bypassing the page cache as long as buffer address, size and file offset are 4kB-aligned (e.g. raw data pages). From the first write not aligned, the file is written with buffered writes. Not used with dataBlockHeaderEnabled. |
+    cfg.getOptionalValue(cfgEntryPoint + ".directIO", directIO, 0);
+    if ((directIO) && (recordWithDataBlockHeader)) {
+      theLog.log(LogWarningSupport_(3102), "directIO not used with dataBlockHeaderEnabled (headers not aligned)");
+      directIO = 0;
+    }
+    if (writeAsync) {
+      theLog.log(LogInfoDevel_(3002), "Asynchronous writes enabled: threads = %d, queue depth = %d, per-file in flight = %d, direct I/O = %d", writeThreads, writeQueueDepth, writeFileInFlightMax, directIO);
+      if (writeThreads < 1) {
+        writeThreads = 1;
+      }
+    }
   }
 
   ~ConsumerFileRecorder() {}
@@ -219,6 +488,11 @@ class ConsumerFileRecorder : public Consumer
   {
     Consumer::start();
     resetCounters();
+    if (writeAsync) {
+      writeEngine = std::make_unique<FileWriteEngine>(writeThreads, writeQueueDepth, writeFileInFlightMax);
+    }
+    headerCopies.resize(writeAsync ? writeQueueDepth + 1 : 1);
+    headerCopiesIndex = 0;
 
     theLog.log(LogInfoDevel_(3006), "Starting file recorder");
     // check status
@@ -240,6 +514,12 @@ class ConsumerFileRecorder : public Consumer
     }
 
     resetCounters();
+    if (writeEngine != nullptr) {
+      // wait for pending writes and stop threads
+      writeEngine->flush();
+      writeEngine->logStats(name);
+      writeEngine = nullptr;
+    }
     Consumer::stop();
     return 0;
   }
@@ -364,7 +644,7 @@ class ConsumerFileRecorder : public Consumer
     }
 
     // create file handle
-    std::shared_ptr<FileHandle> newHandle = std::make_shared<FileHandle>(newFileName, &theLog, maxFileSize, maxFilePages);
+    std::shared_ptr<FileHandle> newHandle = std::make_shared<FileHandle>(newFileName, &theLog, maxFileSize, maxFilePages, writeEngine.get(), directIO);
     if (newHandle == nullptr) {
       return -1;
     }
@@ -427,7 +707,8 @@ class ConsumerFileRecorder : public Consumer
 
     bool countPage = true; // the first write will increment the page counter for this file
 
-    auto writeToFile = [&](void* ptr, size_t size, size_t remainingBlockSize) {
+    // keepAlive: owner of data, kept until write completed (for async writes). By default, the data block.
+    auto writeToFile = [&](void* ptr, size_t size, size_t remainingBlockSize, const std::shared_ptr<void>& keepAlive) {
       // two attempts, in case file needs to be incremented
       for (int i = 0; i < 2; i++) {
 
@@ -438,7 +719,7 @@ class ConsumerFileRecorder : public Consumer
         }
 
         // try to write
-        FileHandle::Status status = fpUsed->write(ptr, size, countPage, remainingBlockSize);
+        FileHandle::Status status = fpUsed->write(ptr, size, countPage, remainingBlockSize, keepAlive);
 
         // check if need to move to next file
         if (status == FileHandle::Status::FileLimitsReached) {
@@ -487,6 +768,15 @@ class ConsumerFileRecorder : public Consumer
       return false;
     };
 
+    // same, from RDH packet index
+    auto isEmptyHBstopEntry = [&](const RdhPacketIndexEntry& e) {
+      return ((e.flags & RdhPacketFlagStopBit) && (e.flags & RdhPacketFlagEmpty));
+    };
+
+    auto isEmptyHBstartEntry = [&](const RdhPacketIndexEntry& e) {
+      return ((e.pagesCounter == 0) && (e.flags & RdhPacketFlagEmpty));
+    };
+
     try {
       // check we have a valid file handle
       if (fpUsed == nullptr) {
@@ -502,23 +792,46 @@ class ConsumerFileRecorder : public Consumer
         // as-is, some fields like data pointer will not be meaningful in file unless corrected.
         // todo: correct them, e.g. replace data pointer by file offset.
         // In particular, incompatible with dropEmptyHBFrames as size changes.
-        writeToFile(&b->getData()->header, (size_t)b->getData()->header.headerSize, (size_t)b->getData()->header.dataSize);
+        // a copy is written, with userSpace set to zeros: it holds runtime data (e.g. pointer to RDH packet index) meaningless in file.
+        // copies are reused in turn, when not referenced anymore by a pending write.
+        std::shared_ptr<DataBlockHeader>& h = headerCopies[headerCopiesIndex];
+        headerCopiesIndex = (headerCopiesIndex + 1) % headerCopies.size();
+        if ((h == nullptr) || (h.use_count() > 1)) {
+          h = std::make_shared<DataBlockHeader>();
+        }
+        *h = b->getData()->header;
+        memset(h->userSpace, 0, sizeof(h->userSpace));
+        writeToFile(h.get(), std::min((size_t)h->headerSize, sizeof(DataBlockHeader)), (size_t)b->getData()->header.dataSize, h);
         // datablock header does not count as a page, but we account for the payload size for the next write (possibly one full page)
       }
 
       // write payload data
       if (!dropEmptyHBFrames) {
         // by default, we write the full payload data
-        writeToFile(b->getData()->data, (size_t)b->getData()->header.dataSize, 0);
+        writeToFile(b->getData()->data, (size_t)b->getData()->header.dataSize, 0, b);
       } else {
         // we have to check packet by packet and discard empty HBstart/HBstop pairs
         size_t blockSize = b->getData()->header.dataSize;
         uint8_t* baseAddress = (uint8_t*)(b->getData()->data);
-        for (size_t pageOffset = 0; pageOffset < blockSize;) {
+        // use RDH packet index of the page, when available (packets already validated)
+        RdhPacketIndex* index = getRdhPacketIndex(b->getData());
+        uint32_t packetIx = 0;
+        for (size_t pageOffset = 0; pageOffset < blockSize; packetIx++) {
           // validate RDH
           RdhHandle h(baseAddress + pageOffset);
+          const RdhPacketIndexEntry* entry = nullptr;
           try {
-            checkRdh(h);
+            if (index != nullptr) {
+              if (packetIx >= index->numberOfValidPackets) {
+                if (packetIx < index->numberOfPackets) {
+                  invalidRDH++;
+                }
+                throw __LINE__;
+              }
+              entry = &index->packets[packetIx];
+            } else {
+              checkRdh(h);
+            }
           } catch (...) {
             // stop for this page on first RDH error
             // cleanup stored previous packet
@@ -526,6 +839,7 @@ class ConsumerFileRecorder : public Consumer
             // write previous
             break;
           }
+          uint16_t offsetNextPacket = (entry != nullptr) ? entry->offsetNextPacket : h.getOffsetNextPacket();
 
           // check we still have a valid file handle
           if (fpUsed == nullptr) {
@@ -533,35 +847,36 @@ class ConsumerFileRecorder : public Consumer
           }
 
           // is this an empty HBstop following an empty HBstart ?
-          if (previousPacket.isEmptyHBStart && isEmptyHBstop(h)) {
+          if (previousPacket.isEmptyHBStart && ((entry != nullptr) ? isEmptyHBstopEntry(*entry) : isEmptyHBstop(h))) {
             // yes, let's skip it
             previousPacket.clear();
-            pageOffset += h.getOffsetNextPacket();
+            pageOffset += offsetNextPacket;
             emptyPacketsDropped += 2;
             continue;
           }
 
           // write previous packet
           if (previousPacket.address != nullptr) {
-            writeToFile(previousPacket.address, previousPacket.size, 0);
+            writeToFile(previousPacket.address, previousPacket.size, 0, previousPacket.isCopy ? previousPacket.copy : std::shared_ptr<void>(b));
             packetsRecorded++;
             previousPacket.clear();
           }
 
           // is this an empty HBstart ?
-          if (isEmptyHBstart(h)) {
+          if ((entry != nullptr) ? isEmptyHBstartEntry(*entry) : isEmptyHBstart(h)) {
             // keep it aside for later
-            previousPacket.size = h.getOffsetNextPacket();
-            if (pageOffset + h.getOffsetNextPacket() < blockSize) {
+            previousPacket.size = offsetNextPacket;
+            if (pageOffset + offsetNextPacket < blockSize) {
               // not end of page, keep a simple reference
               previousPacket.address = baseAddress + pageOffset;
               previousPacket.isCopy = false;
             } else {
               // end of page, keep a copy
-              previousPacket.address = malloc(previousPacket.size);
-              if (previousPacket.address == nullptr) {
+              previousPacket.copy = std::shared_ptr<char>(new (std::nothrow) char[previousPacket.size], std::default_delete<char[]>());
+              if (previousPacket.copy == nullptr) {
                 throw __LINE__;
               }
+              previousPacket.address = previousPacket.copy.get();
               memcpy(previousPacket.address, baseAddress + pageOffset, previousPacket.size);
               previousPacket.isCopy = true;
             }
@@ -570,14 +885,14 @@ class ConsumerFileRecorder : public Consumer
 
             // write packet
             // use offsetNextPacket instead of memorySize for file to be consistent
-            writeToFile(baseAddress + pageOffset, (size_t)h.getOffsetNextPacket(), 0);
+            writeToFile(baseAddress + pageOffset, (size_t)offsetNextPacket, 0, b);
             packetsRecorded++;
           }
 
-          pageOffset += h.getOffsetNextPacket();
+          pageOffset += offsetNextPacket;
 
           // infinite loop protection, just in case
-          if (h.getOffsetNextPacket() == 0) {
+          if (offsetNextPacket == 0) {
             break;
           }
         }
@@ -610,6 +925,15 @@ class ConsumerFileRecorder : public Consumer
   int maxFilePages = 0;               // maximum number of pages to write (in each file)
   int filesMax = 0;                   // maximum number of files to write (for each stream)
   int dropEmptyHBFrames = 0;          // if set, some empty packets are discarded (see logic in code)
+  int writeAsync = 0;                 // if set, data written with writeEngine
+  int writeThreads = 4;               // number of threads for async writes
+  int writeQueueDepth = 32;           // maximum number of async writes in flight
+  int writeFileInFlightMax = 8;       // maximum number of async writes in flight per file
+  int directIO = 0;                   // if set, O_DIRECT used for aligned async writes
+
+  std::vector<std::shared_ptr<DataBlockHeader>> headerCopies; // copies of headers written to file, kept by pending writes
+  unsigned int headerCopiesIndex = 0;                         // next copy to be used
+  std::unique_ptr<FileWriteEngine> writeEngine; // engine for async writes
 
   class Packet
   {
@@ -618,12 +942,11 @@ class ConsumerFileRecorder : public Consumer
     void* address = nullptr;
     size_t size = 0;
     bool isCopy = false;
+    std::shared_ptr<char> copy; // storage for copy, if any (shared with pending async writes)
     void clear()
     {
       isEmptyHBStart = false;
-      if ((address != nullptr) && (isCopy)) {
-        free(address);
-      }
+      copy = nullptr;
       address = nullptr;
       size = 0;
       isCopy = false;
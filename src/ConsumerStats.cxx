@@ -159,6 +159,8 @@ class ConsumerStats : public Consumer
       sendMetricNoException({ rRfmq, "readout.stfbMemoryPagesReleaseRate"});
       sendMetricNoException({ avgTfmq, "readout.stfbMemoryPagesReleaseLatency"});
       sendMetricNoException({ tfidfmq, "readout.stfbTimeframeId"});
+      sendMetricNoException({ (uint64_t)snapshot.bytesFairMQrepacked.load(), "readout.stfbRepackBytes"}, DerivedMetricMode::RATE);
+      sendMetricNoException({ snapshot.timeFairMQrepack.load() / 1000000000.0, "readout.stfbRepackTime"}, DerivedMetricMode::RATE);
     }
 
 #ifdef WITH_ZMQ
@@ -173,6 +175,9 @@ class ConsumerStats : public Consumer
         theLog.log(LogInfoOps_(3003), "Last interval (%.2fs): blocksRx=%llu, block rate=%.2lf, bytesRx=%llu, rate=%s", deltaT, (unsigned long long)counterBlocksDiff, counterBlocksDiff / deltaT, (unsigned long long)counterBytesDiff, NumberOfBytesToString(counterBytesDiff * 8 / deltaT, "b/s", 1000).c_str());
 	if (gReadoutStats.isFairMQ) {
           theLog.log(LogInfoOps_(3003), "STFB locked pages: current=%llu, release rate=%.2lf Hz, latency=%.3lf s, current TF = %d", nRfmq, rRfmq, avgTfmq, tfidfmq );
+          if (snapshot.bytesFairMQrepacked.load()) {
+            theLog.log(LogInfoOps_(3003), "STFB repacking: total bytes copied=%llu, total copy time=%.3lf s", (unsigned long long)snapshot.bytesFairMQrepacked.load(), snapshot.timeFairMQrepack.load() / 1000000000.0);
+          }
 	}
       }
     }
@@ -14,6 +14,7 @@
 #ifndef READOUT_DATABLOCK
 #define READOUT_DATABLOCK
 
+#include <stddef.h>
 #include <stdint.h>
 #include <type_traits>
 
@@ -33,8 +34,41 @@ const uint32_t undefinedOrbit = 0;            ///< default value, when orbit und
 const uint32_t DataBlockHeaderUserSpace = 128; ///< size of spare area for user data
 
 // Header
+// Fields used for each block on the data path are packed in the first 64 bytes (one cache line).
 struct DataBlockHeader {
 
+  uint32_t headerVersion; ///< id to identify structure
+  uint32_t headerSize;    ///< header size in bytes
+  uint32_t dataSize;      ///< size of payload following or associated with this structure
+  uint16_t equipmentId;   ///< id of equipment generating the data
+  uint8_t linkId;         ///< from RDH
+  uint8_t systemId;       ///< from RDH
+
+  uint64_t timeframeId;         ///< id of timeframe
+  uint16_t feeId;               ///< from RDH
+  uint8_t flagEndOfTimeframe;   ///< flag to signal this is the last TF block
+  uint8_t isRdhFormat;          ///< flag set when payload is RDH-formatted
+  uint32_t timeframeOrbitFirst; ///< from timeframe
+  uint32_t timeframeOrbitLast;  ///< from timeframe
+  uint32_t reserved;            ///< unused, set to zero
+
+  DataBlockId blockId;    ///< id of the block (strictly monotonic increasing sequence)
+  DataBlockId pipelineId; ///< id used to sort data in/out in parallel pipelines
+  uint64_t runNumber;     ///< the current run number
+
+  uint8_t userSpace[DataBlockHeaderUserSpace]; ///< spare area for user data
+};
+
+// Version of this header
+// with DB marker for DataBlock start, 1st byte in header little-endian
+const uint32_t DataBlockVersion = 0x0003DBDB;
+
+// DataBlockHeader instance with all default fields
+const DataBlockHeader defaultDataBlockHeader = { .headerVersion = DataBlockVersion, .headerSize = sizeof(DataBlockHeader), .dataSize = 0, .equipmentId = undefinedEquipmentId, .linkId = undefinedLinkId, .systemId = undefinedSystemId, .timeframeId = undefinedTimeframeId, .feeId = undefinedFeeId, .flagEndOfTimeframe = 0, .isRdhFormat = 1, .timeframeOrbitFirst = undefinedOrbit, .timeframeOrbitLast = undefinedOrbit, .reserved = 0, .blockId = undefinedBlockId, .pipelineId = undefinedBlockId, .runNumber = undefinedRunNumber, .userSpace = { 0 } };
+
+// Previous version of the header (as found in files recorded with dataBlockHeaderEnabled by older releases)
+struct DataBlockHeaderV2 {
+
   uint32_t headerVersion; ///< id to identify structure
   uint32_t headerSize;    ///< header size in bytes
   uint32_t dataSize;      ///< size of payload following or associated with this structure
@@ -54,13 +88,7 @@ struct DataBlockHeader {
 
   uint8_t userSpace[DataBlockHeaderUserSpace]; ///< spare area for user data
 };
-
-// Version of this header
-// with DB marker for DataBlock start, 1st byte in header little-endian
-const uint32_t DataBlockVersion = 0x0002DBDB;
-
-// DataBlockHeader instance with all default fields
-const DataBlockHeader defaultDataBlockHeader = { .headerVersion = DataBlockVersion, .headerSize = sizeof(DataBlockHeader), .dataSize = 0, .blockId = undefinedBlockId, .pipelineId = undefinedBlockId, .timeframeId = undefinedTimeframeId, .runNumber = undefinedRunNumber, .systemId = undefinedSystemId, .feeId = undefinedFeeId, .equipmentId = undefinedEquipmentId, .linkId = undefinedLinkId, .timeframeOrbitFirst = undefinedOrbit, .timeframeOrbitLast = undefinedOrbit, .flagEndOfTimeframe = 0, .isRdhFormat = 1, .userSpace = { 0 } };
+const uint32_t DataBlockVersionV2 = 0x0002DBDB;
 
 // DataBlock
 // Pair of header + payload data
@@ -74,6 +102,8 @@ const DataBlock defaultDataBlock = { .header = defaultDataBlockHeader, .data = n
 
 // compile-time checks
 static_assert(std::is_pod<DataBlockHeader>::value, "DataBlockHeader is not a POD");
+static_assert(offsetof(DataBlockHeader, blockId) == 40, "DataBlockHeader hot fields layout changed");
+static_assert(offsetof(DataBlockHeader, userSpace) <= 64, "DataBlockHeader fields should fit in one cache line");
 static_assert(std::is_pod<DataBlock>::value, "DataBlock is not a POD");
 
 #endif /* READOUT_DATABLOCK */
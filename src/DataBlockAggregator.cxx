@@ -9,13 +9,15 @@
 // or submit itself to any jurisdiction.
 
 #include "DataBlockAggregator.h"
+#include "TimeframeAdmission.h"
 #include "readoutInfoLogger.h"
 #include <inttypes.h>
 
 DataBlockAggregator::DataBlockAggregator(AliceO2::Common::Fifo<DataSetReference>* v_output, std::string name)
 {
   output = v_output;
-  aggregateThread = std::make_unique<Thread>(DataBlockAggregator::threadCallback, this, name, 1000);
+  aggregateThread = std::make_unique<Thread>(DataBlockAggregator::threadCallback, this, name, idleSleepTime);
+  inputNotifier = std::make_shared<EventNotifier>();
   isIncompletePending = 0;
 }
 
@@ -26,12 +28,34 @@ DataBlockAggregator::~DataBlockAggregator()
 
 int DataBlockAggregator::addInput(std::shared_ptr<AliceO2::Common::Fifo<DataBlockContainerReference>> input)
 {
-  // inputs.push_back(input);
+  int inputIndex = (int)inputs.size();
   inputs.push_back(input);
   slicers.push_back(DataBlockSlicer());
+
+  // assign input to a slicer thread, created on first use
+  if (cfgSlicerThreads > 0) {
+    unsigned int shardIndex = inputIndex % cfgSlicerThreads;
+    if (shardIndex >= shards.size()) {
+      auto shard = std::make_unique<tShard>();
+      shard->aggregator = this;
+      shard->slices = std::make_unique<AliceO2::Common::Fifo<tSlice>>(shardQueueSize);
+      shard->inputNotifier = std::make_shared<EventNotifier>();
+      shard->thread = std::make_unique<Thread>(DataBlockAggregator::shardThreadCallback, shard.get(), "Slicer-" + std::to_string(shardIndex), idleSleepTime);
+      shards.push_back(std::move(shard));
+    }
+    shards[shardIndex]->inputIndexes.push_back(inputIndex);
+  }
   return 0;
 }
 
+std::shared_ptr<EventNotifier> DataBlockAggregator::getInputNotifier(int inputIndex)
+{
+  if ((cfgSlicerThreads > 0) && (inputIndex >= 0) && ((unsigned int)(inputIndex % cfgSlicerThreads) < shards.size())) {
+    return shards[inputIndex % cfgSlicerThreads]->inputNotifier;
+  }
+  return inputNotifier;
+}
+
 Thread::CallbackResult DataBlockAggregator::threadCallback(void* arg)
 {
   DataBlockAggregator* dPtr = (DataBlockAggregator*)arg;
@@ -43,23 +67,71 @@ Thread::CallbackResult DataBlockAggregator::threadCallback(void* arg)
     return Thread::CallbackResult::Idle;
   }
 
-  return dPtr->executeCallback();
+  uint32_t seq = dPtr->inputNotifier->getSequence();
+  Thread::CallbackResult result = dPtr->executeCallback();
+  if ((result == Thread::CallbackResult::Idle) && (EventNotifierWaitEnabled)) {
+    // wait for new input data, instead of sleeping in Thread
+    dPtr->inputNotifier->wait(seq, dPtr->idleSleepTime);
+    return Thread::CallbackResult::Ok;
+  }
+  return result;
+}
+
+Thread::CallbackResult DataBlockAggregator::shardThreadCallback(void* arg)
+{
+  tShard* shard = (tShard*)arg;
+  if (shard == NULL) {
+    return Thread::CallbackResult::Error;
+  }
+
+  uint32_t seq = shard->inputNotifier->getSequence();
+  Thread::CallbackResult result = shard->aggregator->executeShardCallback(*shard);
+  if ((result == Thread::CallbackResult::Idle) && (EventNotifierWaitEnabled)) {
+    // wait for new input data (or space in the slices queue), instead of sleeping in Thread
+    shard->inputNotifier->wait(seq, shard->aggregator->idleSleepTime);
+    return Thread::CallbackResult::Ok;
+  }
+  return result;
 }
 
 void DataBlockAggregator::start()
 {
   reset();
+  for (auto& shard : shards) {
+    shard->thread->start();
+  }
   aggregateThread->start();
+  if (shards.size()) {
+    theLog.log(LogInfoDevel_(3002), "Aggregator using %d slicer threads", (int)shards.size());
+  }
 }
 
 void DataBlockAggregator::stop(int waitStop)
 {
   doFlush = 0;
+  for (auto& shard : shards) {
+    shard->thread->stop();
+  }
   aggregateThread->stop();
   if (waitStop) {
+    for (auto& shard : shards) {
+      shard->thread->join();
+    }
     aggregateThread->join();
   }
+  for (auto& shard : shards) {
+    totalBlocksIn += shard->nBlocksIn;
+  }
   theLog.log(LogInfoDevel_(3003), "Aggregator processed %llu blocks", totalBlocksIn);
+  if (enableStfBuilding) {
+    theLog.log(LogInfoDevel_(3003), "Aggregator STF: %llu complete (latency avg = %.0f us, max = %llu us), %llu released on timeout, %llu flushed, %llu dropped (buffer full), %d sources", nStfComplete, stfCompletionLatency.getAverage(), (unsigned long long)stfCompletionLatency.getMaximum(), nStfIncomplete, nStfFlushed, nStfDropped, nSources);
+  }
+  if (nSlicesDropped) {
+    theLog.log(LogInfoDevel_(3003), "Aggregator discarded %llu slices of timeframes dropped by admission control", nSlicesDropped);
+  }
+  if (EventNotifierWaitEnabled) {
+    theLog.log(LogInfoDevel_(3003), "Aggregator input wakeups: %s", inputNotifier->getStats().c_str());
+  }
   for (unsigned int i = 0; i < inputs.size(); i++) {
 
     // printf("aggregator input %d: in=%llu out=%llu\n",i,inputs[i]->getNumberIn(),inputs[i]->getNumberOut());
@@ -67,6 +139,13 @@ void DataBlockAggregator::stop(int waitStop)
 
     inputs[i]->clear();
   }
+  for (auto& shard : shards) {
+    tSlice slice;
+    while (!shard->slices->pop(slice)) {
+      slice.data->clear();
+    }
+    shard->slices->clear();
+  }
   // printf("Aggregator FIFO out after clear: %d items\n",output->getNumberOfUsedSlots());
   // TODO: do we really need to clear? should be automatic
 
@@ -86,6 +165,11 @@ Thread::CallbackResult DataBlockAggregator::executeCallback()
     return Thread::CallbackResult::Idle;
   }
 
+  if (shards.size()) {
+    // slicing done in separate threads
+    return executeMergeCallback();
+  }
+
   unsigned int nInputs = inputs.size();
   unsigned int nBlocksIn = 0;
   unsigned int nSlicesOut = 0;
@@ -128,121 +212,417 @@ Thread::CallbackResult DataBlockAggregator::executeCallback()
       continue;
     }
 
-    const int maxLoop = 1024;
+    int nBlocks = populateSlices(i, now);
+    if (nBlocks < 0) {
+      return Thread::CallbackResult::Error;
+    }
+    nBlocksIn += nBlocks;
+    totalBlocksIn += nBlocks;
 
-    // populate slices
+    // retrieve completed slices
+    const int maxLoop = 1024;
     for (int j = 0; j < maxLoop; j++) {
-      if (inputs[i]->isEmpty()) {
+      if (output->isFull()) {
+        return Thread::CallbackResult::Idle;
+      }
+      bool includeIncomplete = 0;
+      if ((executeFlush) && (inputs[i]->isEmpty())) {
+        includeIncomplete = 1;
+      }
+      bool isClosed = false;
+      DataSetReference bcv = slicers[i].getSlice(includeIncomplete, &isClosed);
+      if (bcv == nullptr) {
         break;
       }
+      addSlice(bcv, isClosed, now);
+      nSlicesOut++;
+      // printf("Pushed STF : %d chunks\n",(int)bcv->size());
+    }
+  }
+  // on next iteration, start from a different input to balance equipments emptying order
+  nextIndex = (nextIndex + 1) % nInputs;
+
+  // in TF buffering mode, are there some complete timeframes?
+  if (enableStfBuilding) {
+    releaseStf(now, executeFlush);
+  }
+
+  if ((nSlicesOut) && (outputNotifier != nullptr)) {
+    outputNotifier->notify();
+  }
+
+  if ((nBlocksIn == 0) && (nSlicesOut == 0)) {
+    if ((executeFlush) && (nStfBuffered == 0)) {
+      doFlush = 0; // flushing is complete if we are now idle
+    }
+    return Thread::CallbackResult::Idle;
+  }
+
+  return Thread::CallbackResult::Ok;
+}
+
+int DataBlockAggregator::populateSlices(int i, double now)
+{
+  const int maxLoop = 1024;
+  int nBlocks = 0;
+
+  for (int j = 0; j < maxLoop; j++) {
+    if (inputs[i]->isEmpty()) {
+      break;
+    }
+    DataBlockContainerReference b = nullptr;
+    inputs[i]->pop(b);
+    nBlocks++;
+    // printf("Got block %d from dev %d eq %d link %d tf %d\n", (int)(b->getData()->header.blockId), i, (int)(b->getData()->header.equipmentId), (int)(b->getData()->header.linkId), (int)(b->getData()->header.timeframeId));
+    if (slicers[i].appendBlock(b, now) <= 0) {
+      return -1;
+    }
+  }
+
+  // close incomplete slices on timeout
+  if (cfgSliceTimeout) {
+    slicers[i].completeSliceOnTimeout(now - cfgSliceTimeout);
+  }
+
+  return nBlocks;
+}
+
+void DataBlockAggregator::addSlice(DataSetReference const& bcv, bool isClosed, double now)
+{
+  // discard data of timeframes rejected by the global admission control (e.g. from a source not applying it)
+  if ((gTimeframeAdmission.isEnabled()) && (gTimeframeAdmission.isDropped(bcv->at(0)->getData()->header.timeframeId))) {
+    nSlicesDropped++;
+    return;
+  }
+
+  if (enableStfBuilding) {
+    // buffer timeframes
+    DataBlock* db = bcv->at(0)->getData();
+    uint64_t tfId = db->header.timeframeId;
+    uint64_t sourceId = (((uint64_t)db->header.equipmentId) << 32) | ((uint64_t)db->header.linkId);
+    tStf* stf = nullptr;
+    if (tfId <= lastTimeframeId) {
+      static InfoLogger::AutoMuteToken token(LogWarningSupport_(3004));
+      theLog.log(token, "Discarding late data for TF %" PRIu64 " (source = 0x%" PRIx64 ")", tfId, sourceId);
+    } else {
+      stf = getStf(tfId, now);
+    }
+    if (stf != nullptr) {
+      stf->sstf.push_back({ sourceId, bcv, now });
+      stf->updateTime = now;
+      if (isClosed) {
+        // a link closes its slice only once for a given TF
+        stf->nSourcesClosed++;
+      }
+      if ((knownSources.insert(sourceId).second) && (cfgStfSources <= 0)) {
+        nSources = knownSources.size();
+        if (isSourcesLearned) {
+          theLog.log(LogInfoDevel_(3004), "New source in STF building (source = 0x%" PRIx64 "), now expecting %d sources", sourceId, nSources);
+        }
+      }
+      // theLog.log(LogDebugTrace, "aggregate - added tf %lu : source %lX",tfId,sourceId);
+    }
+  } else {
+    // push directly out completed slices
+    output->push(bcv);
+  }
+}
+
+DataBlockAggregator::tStf* DataBlockAggregator::getStf(uint64_t tfId, double now)
+{
+  uint64_t bufferSize = stfBuffer.size();
+  if (nStfBuffered) {
+    if ((tfId < stfHeadId) && (stfTailId - tfId >= bufferSize)) {
+      // this TF is older than all pending ones, and out of the window
+      static InfoLogger::AutoMuteToken token(LogWarningSupport_(3004));
+      theLog.log(token, "STF buffer full, discarding data for TF %" PRIu64 " (buffered TF %" PRIu64 " - %" PRIu64 ")", tfId, stfHeadId, stfTailId);
+      return nullptr;
+    }
+    // drop oldest TF until this one fits in the window
+    while ((nStfBuffered) && (tfId >= stfHeadId + bufferSize)) {
+      static InfoLogger::AutoMuteToken token(LogWarningSupport_(3004));
+      theLog.log(token, "STF buffer full, dropping TF %" PRIu64 " (%d sources) to receive TF %" PRIu64, stfHeadId, (int)stfBuffer[stfHeadId % bufferSize].sstf.size(), tfId);
+      nStfDropped++;
+      lastTimeframeId = stfHeadId; // further data for this TF is late
+      popStf();
+    }
+  }
+
+  tStf& stf = stfBuffer[tfId % bufferSize];
+  if (!stf.isUsed) {
+    stf.isUsed = true;
+    stf.tfId = tfId;
+    stf.createTime = now;
+    stf.nSourcesClosed = 0;
+    if (nStfBuffered == 0) {
+      stfHeadId = tfId;
+      stfTailId = tfId;
+    } else if (tfId < stfHeadId) {
+      stfHeadId = tfId;
+    } else if (tfId > stfTailId) {
+      stfTailId = tfId;
+    }
+    nStfBuffered++;
+  }
+  return &stf;
+}
+
+void DataBlockAggregator::popStf()
+{
+  if (nStfBuffered == 0) {
+    return;
+  }
+  tStf& stf = stfBuffer[stfHeadId % stfBuffer.size()];
+  stf.sstf.clear(); // data released, capacity kept
+  stf.isUsed = false;
+  nStfBuffered--;
+
+  // move to next pending TF (TF ids may not be contiguous)
+  if (nStfBuffered) {
+    do {
+      stfHeadId++;
+    } while (!stfBuffer[stfHeadId % stfBuffer.size()].isUsed);
+  }
+}
+
+void DataBlockAggregator::releaseStf(double now, bool executeFlush)
+{
+  int nDataSetPushed = 0;
+  int nStfPushed = 0;
+
+  // number of sources expected in each TF.
+  // When learned from data, TF are released on timeout only until the first one is, to see all sources.
+  int nSourcesExpected = cfgStfSources;
+  if ((nSourcesExpected <= 0) && (isSourcesLearned)) {
+    nSourcesExpected = nSources;
+  }
+
+  // TF are released in order: as soon as all sources have closed their slice, or on timeout
+  while (nStfBuffered) {
+    tStf& stf = stfBuffer[stfHeadId % stfBuffer.size()];
+    double age = now - stf.updateTime;
+    bool isComplete = (nSourcesExpected > 0) && (stf.nSourcesClosed >= nSourcesExpected);
+    if ((isComplete) || (age >= cfgStfTimeout) || (executeFlush)) {
+      if (isComplete) {
+        nStfComplete++;
+        stfCompletionLatency.set((CounterValue)((now - stf.createTime) * 1000000));
+      } else if (age < cfgStfTimeout) {
+        nStfFlushed++;
+      } else if (nSourcesExpected > 0) {
+        nStfIncomplete++;
+        static InfoLogger::AutoMuteToken token(LogWarningSupport_(3004));
+        theLog.log(token, "STF %" PRIu64 " released on timeout, %d / %d sources closed", stf.tfId, stf.nSourcesClosed, nSourcesExpected);
+      } else if (cfgStfSources <= 0) {
+        // first TF on timeout: the sources seen so far are expected in the next ones
+        isSourcesLearned = true;
+        nSourcesExpected = nSources;
+        theLog.log(LogInfoDevel_(3004), "STF building: %d sources expected in each timeframe", nSources);
+      }
+      // printf("pushing age %.3f tf %d -> %d sources\n",age,(int)stf.tfId,(int)stf.sstf.size());
+      double tmin = stf.updateTime;
+      double tmax = stf.updateTime;
+      int ix = 0;
+      for (auto const& ss : stf.sstf) {
+        ix++;
+        if (ix == (int)stf.sstf.size()) {
+          // this is the last piece of this TF, mark last block as such
+          ss.data->back()->getData()->header.flagEndOfTimeframe = 1;
+        }
+        output->push(ss.data);
+        nDataSetPushed++;
+        if (ss.updateTime < tmin) {
+          tmin = ss.updateTime;
+        }
+        if (ss.updateTime < tmax) {
+          tmax = ss.updateTime;
+        }
+      }
+      nStfPushed++;
+      uint64_t newTimeframeId = stf.tfId;
+      if (newTimeframeId > lastTimeframeId + 1) {
+        static InfoLogger::AutoMuteToken token(LogWarningSupport_(3004));
+        theLog.log(token, "Gap in timeframe ids detected: previous = %" PRIu64 " new = %" PRIu64, lastTimeframeId, newTimeframeId);
+      }
+      lastTimeframeId = newTimeframeId;
+      /*
+      if (lastTimeframeId % 10 == 1) {
+        theLog.log(LogDebugTrace, "LastTimeframeId=%lu deltaT=%f",lastTimeframeId,tmax-tmin);
+      }
+      */
+      popStf();
+    } else {
+      break;
+    }
+  }
+  if ((nDataSetPushed) && (outputNotifier != nullptr)) {
+    outputNotifier->notify();
+  }
+}
+
+Thread::CallbackResult DataBlockAggregator::executeShardCallback(tShard& shard)
+{
+  unsigned int nInputs = shard.inputIndexes.size();
+  unsigned int nBlocksIn = 0;
+  unsigned int nSlicesOut = 0;
+  bool isIdle = true;
+  bool isFull = false;
+
+  // same as executeCallback(), slices are pushed to the shard queue instead of STF buffer / output
+  double now = timeNow.getTime();
+  // flush id must be read before flush flag: a completed flush is never acknowledged for a later request
+  uint64_t currentFlushId = flushId;
+  bool executeFlush = 0;
+  if (doFlush) {
+    executeFlush = 1;
+  }
+
+  for (unsigned int ix = 0; (ix < nInputs) && (!isFull); ix++) {
+    int i = shard.inputIndexes[(ix + shard.nextIndex) % nInputs];
+
+    if (disableSlicing) {
+      // no slicing... pass through
+      if (shard.slices->isFull()) {
+        isFull = true;
+        break;
+      }
+      if (inputs[i]->isEmpty()) {
+        continue;
+      }
       DataBlockContainerReference b = nullptr;
       inputs[i]->pop(b);
       nBlocksIn++;
-      totalBlocksIn++;
-      // printf("Got block %d from dev %d eq %d link %d tf %d\n", (int)(b->getData()->header.blockId), i, (int)(b->getData()->header.equipmentId), (int)(b->getData()->header.linkId), (int)(b->getData()->header.timeframeId));
-      if (slicers[i].appendBlock(b, now) <= 0) {
+      DataSetReference bcv = nullptr;
+      try {
+        bcv = std::make_shared<DataSet>();
+      } catch (...) {
         return Thread::CallbackResult::Error;
       }
+      bcv->push_back(b);
+      shard.slices->push({ bcv, false });
+      nSlicesOut++;
+      if (!inputs[i]->isEmpty()) {
+        isIdle = false;
+      }
+      continue;
     }
 
-    // close incomplete slices on timeout
-    if (cfgSliceTimeout) {
-      slicers[i].completeSliceOnTimeout(now - cfgSliceTimeout);
+    int nBlocks = populateSlices(i, now);
+    if (nBlocks < 0) {
+      return Thread::CallbackResult::Error;
     }
+    nBlocksIn += nBlocks;
 
     // retrieve completed slices
+    const int maxLoop = 1024;
     for (int j = 0; j < maxLoop; j++) {
-      if (output->isFull()) {
-        return Thread::CallbackResult::Idle;
+      if (shard.slices->isFull()) {
+        isFull = true;
+        break;
       }
       bool includeIncomplete = 0;
       if ((executeFlush) && (inputs[i]->isEmpty())) {
         includeIncomplete = 1;
       }
-      DataSetReference bcv = slicers[i].getSlice(includeIncomplete);
+      bool isClosed = false;
+      DataSetReference bcv = slicers[i].getSlice(includeIncomplete, &isClosed);
       if (bcv == nullptr) {
         break;
       }
-
-      if (enableStfBuilding) {
-        // buffer timeframes
-        DataBlock* db = bcv->at(0)->getData();
-        uint64_t tfId = db->header.timeframeId;
-        uint64_t sourceId = (((uint64_t)db->header.equipmentId) << 32) | ((uint64_t)db->header.linkId);
-        if (tfId <= lastTimeframeId) {
-	  static InfoLogger::AutoMuteToken token(LogWarningSupport_(3004));
-          theLog.log(token, "Discarding late data for TF %" PRIu64 " (source = 0x%" PRIx64 ")", tfId, sourceId);
-        } else {
-          tStf& stf = stfBuffer[tfId];
-          stf.tfId = tfId;
-          stf.sstf.push_back({ sourceId, bcv, now });
-          stf.updateTime = now;
-          // theLog.log(LogDebugTrace, "aggregate - added tf %lu : source %lX",tfId,sourceId);
-        }
-      } else {
-        // push directly out completed slices
-        output->push(bcv);
-      }
-
+      shard.slices->push({ bcv, isClosed });
       nSlicesOut++;
-      // printf("Pushed STF : %d chunks\n",(int)bcv->size());
+    }
+    if ((!inputs[i]->isEmpty()) || (!slicers[i].isEmpty())) {
+      isIdle = false;
     }
   }
   // on next iteration, start from a different input to balance equipments emptying order
-  nextIndex = (nextIndex + 1) % nInputs;
+  shard.nextIndex = (shard.nextIndex + 1) % nInputs;
+  shard.nBlocksIn += nBlocksIn;
 
-  // in TF buffering mode, are there some complete timeframes?
-  if (enableStfBuilding) {
-    int nDataSetPushed = 0;
-    int nStfPushed = 0;
-    auto it = stfBuffer.begin();
-    while (it != stfBuffer.end()) {
-      double age = now - it->second.updateTime;
-      if ((age >= cfgStfTimeout) || (executeFlush)) {
-        // printf("pushing age %.3f tf %d -> %d sources\n",age,(int)it->second.tfId,(int)it->second.sstf.size());
-        double tmin = it->second.updateTime;
-        double tmax = it->second.updateTime;
-        int ix = 0;
-        for (auto const& ss : it->second.sstf) {
-          ix++;
-          if (ix == (int)it->second.sstf.size()) {
-            // this is the last piece of this TF, mark last block as such
-            ss.data->back()->getData()->header.flagEndOfTimeframe = 1;
-          }
-          output->push(ss.data);
-          nDataSetPushed++;
-          if (ss.updateTime < tmin) {
-            tmin = ss.updateTime;
-          }
-          if (ss.updateTime < tmax) {
-            tmax = ss.updateTime;
-          }
-        }
-        if (it->second.tfId == 1) {
-          nSources = it->second.sstf.size(); // keep track of number of sources in first TF
-        }
-        nStfPushed++;
-	uint64_t newTimeframeId = it->second.tfId;
-	if (newTimeframeId > lastTimeframeId + 1) {
-	  static InfoLogger::AutoMuteToken token(LogWarningSupport_(3004));
-          theLog.log(token, "Gap in timeframe ids detected: previous = %" PRIu64 " new = %" PRIu64, lastTimeframeId, newTimeframeId);
-	}
-        lastTimeframeId = newTimeframeId;
-        /*
-        if (lastTimeframeId % 10 == 1) {
-          theLog.log(LogDebugTrace, "LastTimeframeId=%lu deltaT=%f",lastTimeframeId,tmax-tmin);
-        }
-        */
-        it = stfBuffer.erase(it);
-      } else {
+  // acknowledge flush after a complete iteration in flush mode leaving nothing pending
+  // state published after the slices, so that aggregator thread sees them in queue once acknowledged
+  if ((executeFlush) && (isIdle) && (!isFull)) {
+    shard.flushedId = currentFlushId;
+  }
+
+  if (nSlicesOut) {
+    inputNotifier->notify();
+  }
+
+  if ((isFull) || ((nBlocksIn == 0) && (nSlicesOut == 0))) {
+    return Thread::CallbackResult::Idle;
+  }
+  return Thread::CallbackResult::Ok;
+}
+
+Thread::CallbackResult DataBlockAggregator::executeMergeCallback()
+{
+  unsigned int nShards = shards.size();
+  unsigned int nSlicesIn = 0;
+
+  double now = timeNow.getTime();
+  bool executeFlush = 0;
+  if (doFlush) {
+    executeFlush = 1;
+  }
+
+  // check slicer threads state before reading their queues:
+  // when they have all acknowledged the current flush request, all their pending data is in the queues
+  bool isShardsFlushed = false;
+  if (executeFlush) {
+    isShardsFlushed = true;
+    uint64_t currentFlushId = flushId;
+    for (auto& shard : shards) {
+      if (shard->flushedId != currentFlushId) {
+        isShardsFlushed = false;
+      }
+    }
+  }
+
+  const int maxLoop = 1024;
+  for (unsigned int ix = 0; ix < nShards; ix++) {
+    tShard& shard = *shards[(ix + nextIndex) % nShards];
+    bool wasFull = shard.slices->isFull();
+    int nSlices = 0;
+    for (int j = 0; j < maxLoop; j++) {
+      if (output->isFull()) {
+        break;
+      }
+      tSlice slice;
+      if (shard.slices->pop(slice)) {
         break;
       }
+      addSlice(slice.data, slice.isClosed, now);
+      nSlices++;
     }
+    if (!shard.slices->isEmpty()) {
+      isShardsFlushed = false;
+    }
+    if ((nSlices) && (wasFull)) {
+      // wake up slicer thread waiting for space in queue
+      shard.inputNotifier->notify();
+    }
+    nSlicesIn += nSlices;
   }
+  // on next iteration, start from a different shard
+  nextIndex = (nextIndex + 1) % nShards;
 
-  if ((nBlocksIn == 0) && (nSlicesOut == 0)) {
-    if ((executeFlush) && (stfBuffer.size() == 0)) {
-      doFlush = 0; // flushing is complete if we are now idle
+  // in TF buffering mode, are there some complete timeframes?
+  // on flush, wait that all slices are received, to avoid discarding late ones
+  if (enableStfBuilding) {
+    releaseStf(now, isShardsFlushed);
+  }
+
+  if ((nSlicesIn) && (outputNotifier != nullptr)) {
+    outputNotifier->notify();
+  }
+
+  if (nSlicesIn == 0) {
+    if ((isShardsFlushed) && (nStfBuffered == 0)) {
+      // flushing is complete if we are now idle
+      // flag reset before moving to next flush id, so that slicers can not acknowledge the next id with this request
+      doFlush = 0;
+      flushId++;
     }
     return Thread::CallbackResult::Idle;
   }
@@ -251,88 +631,225 @@ Thread::CallbackResult DataBlockAggregator::executeCallback()
 }
 
 DataBlockSlicer::DataBlockSlicer() {
+  dataSetPool = std::make_shared<DataSetPool>();
   reset();
 }
 
 DataBlockSlicer::~DataBlockSlicer() {}
 
+// allocator used for the data sets (and their shared_ptr control block)
+// memory is taken from a slot of the pool, and the slot is given back to the pool when deallocated.
+// the vector of the data set is moved to the slot when destroyed, and back when constructed, to keep its capacity.
+template <typename T>
+struct DataBlockSlicer::DataSetAllocator {
+  using value_type = T;
+
+  std::shared_ptr<DataSetPool> pool;
+  DataSetSlot* slot;
+
+  DataSetAllocator(std::shared_ptr<DataSetPool> const& vPool, DataSetSlot* vSlot) : pool(vPool), slot(vSlot) {}
+  template <typename U>
+  DataSetAllocator(const DataSetAllocator<U>& a) : pool(a.pool), slot(a.slot)
+  {
+  }
+
+  T* allocate(size_t n)
+  {
+    // T is the shared_ptr control block embedding the DataSet
+    static_assert(alignof(T) <= alignof(DataSetSlot), "DataSetSlot alignment too small");
+    static_assert(sizeof(T) <= sizeof(DataSetSlot::storage), "DataSetSlot too small for DataSet and its shared_ptr control block");
+    if (n * sizeof(T) > sizeof(slot->storage)) {
+      throw std::bad_alloc();
+    }
+    return (T*)slot->storage;
+  }
+
+  void deallocate(T*, size_t)
+  {
+    std::unique_lock<std::mutex> lock(pool->lock);
+    pool->freeSlots.push_back(slot);
+  }
+
+  void construct(DataSet* ds) { new (ds) DataSet(std::move(slot->spare)); }
+
+  void destroy(DataSet* ds)
+  {
+    ds->clear(); // release data blocks now
+    slot->spare = std::move(*ds);
+    ds->~DataSet();
+  }
+
+  template <typename U>
+  bool operator==(const DataSetAllocator<U>& a) const
+  {
+    return slot == a.slot;
+  }
+  template <typename U>
+  bool operator!=(const DataSetAllocator<U>& a) const
+  {
+    return slot != a.slot;
+  }
+};
+
+DataSetReference DataBlockSlicer::getNewDataSet()
+{
+  DataSetSlot* slot = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(dataSetPool->lock);
+    if (!dataSetPool->freeSlots.empty()) {
+      slot = dataSetPool->freeSlots.back();
+      dataSetPool->freeSlots.pop_back();
+    } else if (dataSetPool->slots.size() < dataSetPoolMaxSize) {
+      try {
+        auto newSlot = std::make_unique<DataSetSlot>();
+        newSlot->spare.reserve(dataSetReserve);
+        dataSetPool->slots.push_back(std::move(newSlot));
+        slot = dataSetPool->slots.back().get();
+      } catch (...) {
+      }
+    }
+  }
+
+  try {
+    if (slot == nullptr) {
+      // all slots in use
+      DataSetReference ds = std::make_shared<DataSet>();
+      ds->reserve(dataSetReserve);
+      return ds;
+    }
+    // data set goes back to pool when released
+    return std::allocate_shared<DataSet>(DataSetAllocator<DataSet>(dataSetPool, slot));
+  } catch (...) {
+  }
+  if (slot != nullptr) {
+    std::unique_lock<std::mutex> lock(dataSetPool->lock);
+    dataSetPool->freeSlots.push_back(slot);
+  }
+  return nullptr;
+}
+
+DataBlockSlicer::PartialSlice& DataBlockSlicer::getOpenSlice(uint32_t openSliceId)
+{
+  return partialSlices[openSliceId >> 16].links[openSliceId & 0xFFFF];
+}
+
+void DataBlockSlicer::closeSlice(PartialSlice& s)
+{
+  if (s.openSlicesIndex < 0) {
+    return;
+  }
+  // move last open slice in place of this one
+  uint32_t lastId = openSlices.back();
+  openSlices[s.openSlicesIndex] = lastId;
+  getOpenSlice(lastId).openSlicesIndex = s.openSlicesIndex;
+  openSlices.pop_back();
+  s.openSlicesIndex = -1;
+}
+
 int DataBlockSlicer::appendBlock(DataBlockContainerReference const& block, double timestamp)
 {
   uint64_t tfId = block->getData()->header.timeframeId;
-  DataSourceId sourceId;
-  sourceId.linkId = block->getData()->header.linkId;
-  sourceId.equipmentId = block->getData()->header.equipmentId;
+  uint8_t linkId = block->getData()->header.linkId;
+  uint16_t equipmentId = block->getData()->header.equipmentId;
 
-  if (sourceId.linkId != undefinedLinkId) {
-    if (sourceId.linkId >= maxLinks) {
+  unsigned int linkIndex = maxLinks; // slot used for undefinedLinkId
+  if (linkId != undefinedLinkId) {
+    if (linkId >= maxLinks) {
       static InfoLogger::AutoMuteToken token(LogWarningSupport_(3004));
-      theLog.log(token, "wrong link id %d > %d", sourceId.linkId, maxLinks - 1);
+      theLog.log(token, "wrong link id %d > %d", linkId, maxLinks - 1);
       return -1;
     }
+    linkIndex = linkId;
+  }
+
+  // find slices of this equipment (most of the time, same as previous block)
+  if ((lastEquipmentIndex >= partialSlices.size()) || (partialSlices[lastEquipmentIndex].equipmentId != equipmentId)) {
+    unsigned int ix = 0;
+    for (; ix < partialSlices.size(); ix++) {
+      if (partialSlices[ix].equipmentId == equipmentId) {
+        break;
+      }
+    }
+    if (ix == partialSlices.size()) {
+      EquipmentSlices es;
+      es.equipmentId = equipmentId;
+      es.links.resize(maxLinks + 1);
+      partialSlices.push_back(std::move(es));
+    }
+    lastEquipmentIndex = ix;
   }
 
   // theLog.log(LogDebugTrace, "slicer %p append block eq %d link %d for tf %d",
-  //   this,(int)sourceId.equipmentId,(int)sourceId.linkId,(int)tfId);
-  PartialSlice& s = partialSlices[sourceId];
+  //   this,(int)equipmentId,(int)linkId,(int)tfId);
+  PartialSlice& s = partialSlices[lastEquipmentIndex].links[linkIndex];
 
   if (s.currentDataSet != nullptr) {
-    // theLog.log(LogDebugTrace, "slice size = %d chunks",partialSlices[linkId].currentDataSet->size()); if ((partialSlices[linkId].tfId!=tfId)||(partialSlices[linkId].currentDataSet->size()>2))
-    // {
     if ((s.tfId != tfId) || (tfId == undefinedTimeframeId)) {
       // the current slice is complete
-      // theLog.log(LogDebugTrace, "slicer %p TF %d eq %d link %d is complete (%d blocks)",this, (int)s.tfId,(int)sourceId.equipmentId,(int)sourceId.linkId,s.currentDataSet->size());
-      slices.push(s.currentDataSet);
+      // theLog.log(LogDebugTrace, "slicer %p TF %d eq %d link %d is complete (%d blocks)",this, (int)s.tfId,(int)equipmentId,(int)linkId,s.currentDataSet->size());
+      slices.push({ std::move(s.currentDataSet), true });
       s.currentDataSet = nullptr;
     }
   }
   if (s.currentDataSet == nullptr) {
-    try {
-      s.currentDataSet = std::make_shared<DataSet>();
-    } catch (...) {
+    s.currentDataSet = getNewDataSet();
+    if (s.currentDataSet == nullptr) {
+      closeSlice(s);
       return -1;
     }
+    if (s.openSlicesIndex < 0) {
+      s.openSlicesIndex = (int)openSlices.size();
+      openSlices.push_back((lastEquipmentIndex << 16) | linkIndex);
+    }
   }
   s.currentDataSet->push_back(block);
   s.tfId = tfId;
   s.lastUpdateTime = timestamp;
-  // printf(" %d,%d -> %d blocks\n",s.sourceId.equipmentId,s.sourceId.linkId,s.currentDataSet->size());
+  // printf(" %d,%d -> %d blocks\n",equipmentId,linkId,s.currentDataSet->size());
   return s.currentDataSet->size();
 }
 
-DataSetReference DataBlockSlicer::getSlice(bool includeIncomplete)
+DataSetReference DataBlockSlicer::getSlice(bool includeIncomplete, bool* isClosed)
 {
   // get a slice. get oldest from queue, or possibly currentDataSet when queue empty and includeIncomplete is true
   DataSetReference bcv = nullptr;
+  bool closed = false;
   if (slices.empty()) {
     if (includeIncomplete) {
-      for (auto& s : partialSlices) {
-        bcv = s.second.currentDataSet;
-        if (bcv != nullptr) {
-          s.second.currentDataSet = nullptr;
-          break;
-        }
+      if (!openSlices.empty()) {
+        PartialSlice& s = getOpenSlice(openSlices.back());
+        bcv = std::move(s.currentDataSet);
+        s.currentDataSet = nullptr;
+        closeSlice(s);
       }
     } else {
       return nullptr;
     }
   } else {
-    bcv = slices.front();
+    bcv = std::move(slices.front().data);
+    closed = slices.front().isClosed;
     slices.pop();
   }
+  if (isClosed != nullptr) {
+    *isClosed = closed;
+  }
   return bcv;
 }
 
 int DataBlockSlicer::completeSliceOnTimeout(double timestamp)
 {
   int nFlushed = 0;
-  for (auto& s : partialSlices) {
+  // only slices with data are checked
+  for (size_t i = 0; i < openSlices.size();) {
+    PartialSlice& s = getOpenSlice(openSlices[i]);
     // check if current data set needs to be flushed
-    if (s.second.currentDataSet != nullptr) {
-      if (s.second.lastUpdateTime <= timestamp) {
-        slices.push(s.second.currentDataSet);
-        s.second.currentDataSet = nullptr;
-        nFlushed++;
-      }
+    if (s.lastUpdateTime <= timestamp) {
+      slices.push({ std::move(s.currentDataSet), false });
+      s.currentDataSet = nullptr;
+      closeSlice(s); // last open slice is moved at position i
+      nFlushed++;
+    } else {
+      i++;
     }
   }
   return nFlushed;
@@ -344,14 +861,23 @@ void DataBlockSlicer::reset()
   
   // empty buffers
   while(!slices.empty()) {
-    auto bc = slices.front();
+    auto bc = slices.front().data;
     bc->clear();
     slices.pop();
   }
-  for (auto& s : partialSlices) {
-    s.second.currentDataSet = nullptr;
+  for (auto& es : partialSlices) {
+    for (auto& s : es.links) {
+      s.currentDataSet = nullptr;
+    }
   }
   partialSlices.clear();
+  openSlices.clear();
+  lastEquipmentIndex = 0;
+}
+
+bool DataBlockSlicer::isEmpty()
+{
+  return (slices.empty()) && (openSlices.empty());
 }
 
 void DataBlockAggregator::reset()
@@ -363,20 +889,42 @@ void DataBlockAggregator::reset()
   }
   
   // reset buffers
-  for(auto const & m : stfBuffer) {
-    auto vsstf = m.second.sstf;
-    for (auto& sstf : vsstf) {
-      sstf.data = nullptr;
+  // STF slots are allocated only when needed
+  unsigned int stfBufferSize = (cfgStfBufferSize > 0) ? cfgStfBufferSize : 1;
+  if ((enableStfBuilding) && (stfBuffer.size() != stfBufferSize)) {
+    stfBuffer.clear();
+    stfBuffer.resize(stfBufferSize);
+    for (auto& stf : stfBuffer) {
+      stf.sstf.reserve((cfgStfSources > 0) ? cfgStfSources : stfSourcesReserve);
     }
-    vsstf.clear();
   }
-  stfBuffer.clear();
+  for (auto& stf : stfBuffer) {
+    stf.sstf.clear();
+    stf.isUsed = false;
+  }
+  nStfBuffered = 0;
+  stfHeadId = 0;
+  stfTailId = 0;
   
   // reset counters
   doFlush = 0;
   timeNow.reset();
-  nSources = 0;
+  nSources = (cfgStfSources > 0) ? cfgStfSources : 0;
+  knownSources.clear();
+  isSourcesLearned = false;
+  nStfComplete = 0;
+  nStfIncomplete = 0;
+  nStfFlushed = 0;
+  nStfDropped = 0;
+  nSlicesDropped = 0;
+  stfCompletionLatency.reset();
   nextIndex = 0;
   totalBlocksIn = 0;
+  flushId = 1;
+  for (auto& shard : shards) {
+    shard->nextIndex = 0;
+    shard->nBlocksIn = 0;
+    shard->flushedId = 0;
+  }
   lastTimeframeId = 0;
 }
@@ -12,20 +12,26 @@
 #include <Common/Fifo.h>
 #include <Common/Thread.h>
 #include <Common/Timer.h>
-#include <map>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <queue>
+#include <unordered_set>
 #include <vector>
 
+#include "CounterStats.h"
 #include "DataBlock.h"
 #include "DataBlockContainer.h"
 #include "DataSet.h"
+#include "EventNotifier.h"
 
 using namespace AliceO2::Common;
 
 // DataBlockAggregator
 //
 // One "slicer" per equipment: data blocks with same sourceId are grouped in a "slice" of blocks having the same TF id.
+// Slicing can be done in several threads ("shards", each handling a subset of the equipments).
+// Slices are then merged by the aggregator thread, which builds the STF and releases them in order.
 
 // a class to group blocks with same ID in slices
 class DataBlockSlicer
@@ -41,7 +47,9 @@ class DataBlockSlicer
 
   // get a slice, if available
   // if includeIncomplete is true, also retrieves current slice, even if incomplete otherwise, only a complete slice is returned, if any when iterated, returned in order of creation, older first
-  DataSetReference getSlice(bool includeIncomplete = false);
+  // if isClosed is given, it is set when the slice was completed by data of a following TF from the same link (i.e. the link will not send more data for this TF),
+  // and unset when the slice was completed on timeout or retrieved incomplete.
+  DataSetReference getSlice(bool includeIncomplete = false, bool* isClosed = nullptr);
 
   // consider the slices which have not been updated since timestamp as complete
   // they are flushed and moved to the "ready" slices
@@ -51,39 +59,62 @@ class DataBlockSlicer
   // reset all internal variables/state
   // buffered data is released
   void reset();
-  
+
+  // returns true if no data is buffered (neither open nor complete slices)
+  bool isEmpty();
+
   int slicerId;
 
  private:
-  // data source id used to group data
-  struct DataSourceId {
-    uint16_t equipmentId = undefinedEquipmentId;
-    uint8_t linkId = undefinedLinkId;
-  };
-
   struct PartialSlice {
     uint64_t tfId;                   // timeframeId of this slice
     double lastUpdateTime = 0;       // timestamp of last block pushed
     DataSetReference currentDataSet; // currently associated data
+    int openSlicesIndex = -1;        // position in openSlices, when currentDataSet defined
   };
 
-  struct CompareDataSourceId {
-    inline bool operator()(const DataSourceId& id1, const DataSourceId& id2) const
-    {
-      if (id1.equipmentId != id2.equipmentId) {
-        return id1.equipmentId < id2.equipmentId;
-      } else {
-        return id1.linkId < id2.linkId;
-      }
-    }
+  // slices of a given equipment, directly indexed by linkId
+  // (the slot after last valid linkId is used for undefinedLinkId)
+  struct EquipmentSlices {
+    uint16_t equipmentId;
+    std::vector<PartialSlice> links;
   };
 
-  using PartialSliceMap = std::map<DataSourceId, PartialSlice, CompareDataSourceId>;
+  const unsigned int maxLinks = 32;           // maximum number of links
+  std::vector<EquipmentSlices> partialSlices; // slices being built (one per link), per equipment. Usually, a single equipment per slicer.
+  unsigned int lastEquipmentIndex = 0;        // index in partialSlices of last equipment used, to avoid lookups
+  std::vector<uint32_t> openSlices;           // list of slices with data being built, as (equipment index << 16 | link index). Order does not matter.
 
-  const unsigned int maxLinks = 32; // maximum number of links
-  PartialSliceMap partialSlices;    // slices being built (one per link)
+  PartialSlice& getOpenSlice(uint32_t openSliceId); // access a slice from openSlices entry
+  void closeSlice(PartialSlice& s);                 // remove slice from openSlices (data set is left untouched)
 
-  std::queue<DataSetReference> slices; // data sets which have been built and are complete
+  struct CompleteSlice {
+    DataSetReference data; // data set of the slice
+    bool isClosed;         // set when slice completed by data from next TF
+  };
+  std::queue<CompleteSlice> slices; // data sets which have been built and are complete
+
+  // data sets are recycled: when released by the last user (possibly in another thread),
+  // their vector is cleared and kept for a later use, with capacity preserved.
+  // a data set and its shared_ptr control block are stored in a slot of the pool (see DataSetAllocator),
+  // so that getNewDataSet() does not allocate memory once the slots are created.
+  // the pool is shared with the released data sets, so that it lives as long as needed.
+  struct alignas(64) DataSetSlot {
+    char storage[128]; // shared_ptr control block and data set
+    DataSet spare;     // vector of the data set, kept while slot not used
+  };
+  struct DataSetPool {
+    std::mutex lock;
+    std::vector<std::unique_ptr<DataSetSlot>> slots; // all slots created
+    std::vector<DataSetSlot*> freeSlots;             // slots available
+  };
+  template <typename T>
+  struct DataSetAllocator; // allocator returning the storage of a slot
+  std::shared_ptr<DataSetPool> dataSetPool;
+  const unsigned int dataSetPoolMaxSize = 1024; // maximum number of slots in pool. When all in use, data sets are allocated
+  const unsigned int dataSetReserve = 32;       // capacity reserved in a new data set, in number of blocks
+
+  DataSetReference getNewDataSet(); // get an empty data set
 };
 
 class DataBlockAggregator
@@ -93,6 +124,7 @@ class DataBlockAggregator
   ~DataBlockAggregator();
 
   int addInput(std::shared_ptr<AliceO2::Common::Fifo<DataBlockContainerReference>> input); // add a FIFO to be used as input
+  std::shared_ptr<EventNotifier> getInputNotifier(int inputIndex);                          // get the notifier to be used by the producer of given input (index in order of addInput() calls)
 
   void start();                   // starts processing thread
   void stop(int waitStopped = 1); // stop processing thread (and possibly wait it terminates)
@@ -101,32 +133,69 @@ class DataBlockAggregator
 
   double cfgSliceTimeout = 0; // when set, slices not updated after timeout (seconds) are considered completed and are flushed
 
+  int cfgSlicerThreads = 0; // number of threads used for slicing. Inputs are shared between them (input i is handled by thread i % cfgSlicerThreads). If zero, slicing is done in the aggregator thread. To be set before addInput().
+
   static Thread::CallbackResult threadCallback(void* arg);
 
   Thread::CallbackResult executeCallback();
 
-  bool doFlush = 0; // when set, flush slices including incomplete ones the flag is reset automatically when done
+  std::atomic<bool> doFlush = 0; // when set, flush slices including incomplete ones the flag is reset automatically when done. Can be set from another thread.
 
   bool enableStfBuilding = 0; // when set, STF are buffered until all sources have participated. Data from late sources are discarded.
-  double cfgStfTimeout = 0;   // timeout used with enableStfBuilding
-  int nSources = 0;           // accounted number of sources, on first timeframe
+  double cfgStfTimeout = 0;   // timeout used with enableStfBuilding. STF are released after this time if some sources are missing.
+  int cfgStfSources = 0;      // number of sources expected in each STF, used with enableStfBuilding. If zero, the set of sources is learned from data.
+  int cfgStfBufferSize = 1024; // maximum number of STF buffered, used with enableStfBuilding. When data of a TF too far ahead is received, oldest pending STF are dropped.
+  int nSources = 0;           // number of sources expected in each STF (configured, or learned so far)
 
   void reset(); // reset all internal buffers, counters and states
 
+  std::shared_ptr<EventNotifier> inputNotifier;  // to be notified by producers when new data pushed to inputs (or by slicer threads, when used)
+  std::shared_ptr<EventNotifier> outputNotifier; // if set, notified when new data pushed to output
+
  private:
   std::vector<std::shared_ptr<AliceO2::Common::Fifo<DataBlockContainerReference>>> inputs;
   AliceO2::Common::Fifo<DataSetReference>* output; // todo: unique_ptr
 
   std::unique_ptr<Thread> aggregateThread;
+  const int idleSleepTime = 1000; // idle time of aggregator thread, in microseconds
   AliceO2::Common::Timer incompletePendingTimer;
   AliceO2::Common::Timer timeNow; // a time counter, used to timestamp slices
 
   int isIncompletePending;
 
   std::vector<DataBlockSlicer> slicers;
-  int nextIndex = 0;                    // index of input channel to start with at next iteration to fill output fifo. not starting always from zero to avoid favorizing low-index channels.
+  int nextIndex = 0;                    // index of input channel (or shard) to start with at next iteration to fill output fifo. not starting always from zero to avoid favorizing low-index channels.
   unsigned long long totalBlocksIn = 0; // number of blocks received from inputs
 
+  int populateSlices(int inputIndex, double now); // move available blocks of given input to its slicer, and complete slices on timeout. Returns the number of blocks read, or -1 on error.
+  void addSlice(DataSetReference const& bcv, bool isClosed, double now); // buffer a complete slice in STF, or push it out directly
+
+  // a slice, as passed from slicer threads to aggregator thread
+  struct tSlice {
+    DataSetReference data; // data pages of the slice (pages in pass-through mode)
+    bool isClosed;         // set when the slice was completed by data of next TF
+  };
+
+  // a slicer thread, and the inputs it handles
+  struct tShard {
+    DataBlockAggregator* aggregator;                              // the aggregator this shard belongs to
+    std::vector<int> inputIndexes;                                // inputs handled by this shard
+    unsigned int nextIndex = 0;                                   // index (in inputIndexes) of input to start with at next iteration
+    std::unique_ptr<AliceO2::Common::Fifo<tSlice>> slices;        // slices ready, to be merged by aggregator thread
+    std::shared_ptr<EventNotifier> inputNotifier;                 // notified by producers of the shard inputs
+    std::unique_ptr<Thread> thread;                               // the slicer thread
+    std::atomic<uint64_t> flushedId = 0;                          // id of last flush request completed by this shard: a full iteration was done in flush mode, ending with inputs and slicers empty (updated by slicer thread)
+    unsigned long long nBlocksIn = 0;                             // number of blocks received from inputs
+  };
+  std::vector<std::unique_ptr<tShard>> shards; // slicer threads, when cfgSlicerThreads is set
+  std::atomic<uint64_t> flushId = 1;           // id of current flush request, incremented by aggregator thread when a flush completes. Used to check all shards have completed it.
+  const int shardQueueSize = 1024;             // number of slices buffered between a slicer thread and the aggregator thread
+
+  static Thread::CallbackResult shardThreadCallback(void* arg);
+  Thread::CallbackResult executeShardCallback(tShard& shard);
+  Thread::CallbackResult executeMergeCallback(); // aggregator thread loop, when slicer threads are used
+  void releaseStf(double now, bool executeFlush); // push out the STF which are complete (or on timeout, or flush), in order
+
   // container for sub-subtimeframe (i.e. all data pages of 1 timeframe for a given single source)
   struct tSstf {
     uint64_t sourceId;     // id of the source (equipmentId + linkId);
@@ -138,10 +207,34 @@ class DataBlockAggregator
   struct tStf {
     uint64_t tfId;           // timeframe id
     std::vector<tSstf> sstf; // vector of sub-subtimeframes (1 per source)
-    double updateTime;
+    double updateTime = 0;
+    double createTime = 0;  // time when first data received for this TF
+    int nSourcesClosed = 0; // number of sources which have closed their slice for this TF
+    bool isUsed = false;    // set when this slot of stfBuffer holds a pending TF
   };
 
-  typedef std::map<uint64_t, tStf> tStfMap;
-  tStfMap stfBuffer;            // buffer to hold pending subtimeframes
-  uint64_t lastTimeframeId = 0; // counter for last timeframe id sent out
+  // buffer to hold pending subtimeframes: a ring indexed by timeframe id, TF x being in slot x % stfBuffer.size().
+  // The pending TF ids are kept within a window of stfBuffer.size(), so that slots are not shared.
+  // Slots are allocated once (with sstf capacity reserved), and reused.
+  std::vector<tStf> stfBuffer;
+  unsigned int nStfBuffered = 0;             // number of pending TF in stfBuffer
+  uint64_t stfHeadId = 0;                    // lowest pending TF id (next to be released), when nStfBuffered > 0
+  uint64_t stfTailId = 0;                    // highest pending TF id, when nStfBuffered > 0
+  const unsigned int stfSourcesReserve = 32; // number of sources reserved in each STF slot, when not configured
+  uint64_t lastTimeframeId = 0;              // counter for last timeframe id sent out
+
+  tStf* getStf(uint64_t tfId, double now); // get STF slot for given TF id, allocated if needed. Oldest STF are dropped if it does not fit in buffer. Returns nullptr if data is to be discarded.
+  void popStf();                           // remove the STF at head of buffer, and move head to the next pending one
+
+  std::unordered_set<uint64_t> knownSources; // sources seen so far, to learn the set of sources expected in each STF
+  bool isSourcesLearned = false;             // set when the set of sources has been learned (after first TF released on timeout)
+
+  // STF building statistics
+  unsigned long long nStfComplete = 0;   // number of STF released as soon as all sources closed their slice
+  unsigned long long nStfIncomplete = 0; // number of STF released on timeout, some sources missing
+  unsigned long long nStfFlushed = 0;    // number of STF released by flush
+  unsigned long long nStfDropped = 0;    // number of STF dropped because buffer full
+  CounterStats stfCompletionLatency;     // time (microseconds) between first data received and release of complete STF
+
+  unsigned long long nSlicesDropped = 0; // number of slices discarded because their timeframe was dropped by admission control
 };
@@ -2,10 +2,12 @@
 #define DATAFORMAT_DATABLOCKCONTAINER
 
 #include <Common/MemPool.h>
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <stdint.h>
 #include <stdlib.h>
+#include <thread>
 
 #include "DataBlock.h"
 
@@ -43,10 +45,90 @@ class DataBlockContainer
     return dataBufferSize;
   };
 
+  // optional time tag of the block, e.g. set by the equipment when the block is pushed out (see equipment pageTimestampEnabled)
+  // in nanoseconds, from the monotonic clock (std::chrono::steady_clock). Zero if not set.
+  uint64_t getTimestamp() { return timestamp; }
+  void setTimestamp(uint64_t t) { timestamp = t; }
+
+  // External references, to keep a container alive while it is referenced by a raw pointer
+  // (e.g. a FairMQ message hint) instead of a shared_ptr. Does not involve memory allocation.
+  // addExternalReference() returns the pointer to be used as reference.
+  // Each call should be balanced by a call to releaseExternalReference(), possibly from another thread.
+  static DataBlockContainer* addExternalReference(const std::shared_ptr<DataBlockContainer>& ref)
+  {
+    DataBlockContainer* c = ref.get();
+    if (c == nullptr) {
+      return nullptr;
+    }
+    c->lockExternalReferences();
+    if (c->externalReferencesCount++ == 0) {
+      c->externalReference = ref; // the container keeps itself alive while externally referenced
+    }
+    c->unlockExternalReferences();
+    return c;
+  }
+
+  static void releaseExternalReference(DataBlockContainer* c)
+  {
+    if (c == nullptr) {
+      return;
+    }
+    std::shared_ptr<DataBlockContainer> lastRef;
+    c->lockExternalReferences();
+    if (--c->externalReferencesCount == 0) {
+      lastRef = std::move(c->externalReference);
+    }
+    c->unlockExternalReferences();
+    // container possibly destroyed here, when lastRef goes out of scope
+  }
+
  protected:
   DataBlock* data;                 // The DataBlock in use
   uint64_t dataBufferSize = 0;     // Usable memory size pointed by data. Unspecified if zero.
   ReleaseCallback releaseCallback; // Function called on object destroy, to release dataBlock.
+  uint64_t timestamp = 0;          // Time tag, see getTimestamp().
+
+ private:
+  std::atomic_flag externalReferencesLock = ATOMIC_FLAG_INIT;  // lock for external references
+  int externalReferencesCount = 0;                             // number of external references
+  std::shared_ptr<DataBlockContainer> externalReference;       // self-reference, set while externally referenced
+
+  void lockExternalReferences()
+  {
+    // short critical section: spin, and give way to the lock holder if it takes long (e.g. preempted)
+    for (int i = 1; externalReferencesLock.test_and_set(std::memory_order_acquire); i++) {
+      if ((i % 64) == 0) {
+        std::this_thread::yield();
+      } else {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+      }
+    }
+  }
+  void unlockExternalReferences() { externalReferencesLock.clear(std::memory_order_release); }
+};
+
+// A container for a part of the payload of another container (e.g. the RDH packets of a given timeframe in a page).
+// Payload is not copied: the data points inside the parent block, which is kept alive as long as this container exists.
+// The header is a copy of the parent header, with dataSize set to the size of the range.
+class DataBlockContainerFromBlock : public DataBlockContainer
+{
+ public:
+  DataBlockContainerFromBlock(std::shared_ptr<DataBlockContainer> const& v_parent, uint64_t offset, uint64_t size) : DataBlockContainer((DataBlock*)nullptr), parent(v_parent)
+  {
+    DataBlock* p = parent->getData();
+    block.header = p->header;
+    block.header.dataSize = (uint32_t)size;
+    block.data = &(p->data[offset]);
+    data = &block;
+    dataBufferSize = size;
+    timestamp = parent->getTimestamp();
+  }
+
+ private:
+  std::shared_ptr<DataBlockContainer> parent; // the container owning the payload
+  DataBlock block;                            // header and data pointer of this range
 };
 
 #endif
@@ -0,0 +1,59 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#ifndef _DMACHANNEL_H
+#define _DMACHANNEL_H
+
+#include <Common/Configuration.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// A superpage, i.e. a chunk of the registered memory block given to a DMA channel to be filled with data.
+struct DmaSuperpage {
+  size_t offset = 0;         // offset of the superpage in the registered memory block
+  size_t size = 0;           // usable size of the superpage (bytes)
+  void* userData = nullptr;  // a pointer for user purpose, returned as-is
+  size_t received = 0;       // number of bytes written in the superpage
+  bool ready = false;        // set when the superpage has been filled (or is the last one before end of DMA)
+};
+
+// Interface to a DMA channel transferring data into superpages of a memory block.
+// This is the subset of AliceO2::roc::DmaChannelInterface used by the RORC equipment,
+// so that the same readout loop can be used with a ReadoutCard device or with a software backend.
+// Methods are called from a single thread, except getDescription().
+//
+// Superpages are pushed in the transfer queue. Once filled, they are moved to the ready queue by fillSuperpages(),
+// and can then be retrieved with popSuperpage(). After stopDma(), pending superpages are returned in the ready queue, possibly not ready.
+
+class DmaChannel
+{
+ public:
+  virtual ~DmaChannel(){};
+
+  virtual void startDma() = 0; // start transfers
+  virtual void stopDma() = 0;  // stop transfers. No superpage can be pushed after this call.
+
+  virtual bool pushSuperpage(const DmaSuperpage& superpage) = 0; // give a superpage to be filled. Returns false on failure (e.g. DMA stopped).
+  virtual int getTransferQueueAvailable() = 0;                    // number of superpages which can be pushed
+  virtual int getReadyQueueSize() = 0;                            // number of superpages which can be popped
+  virtual DmaSuperpage popSuperpage() = 0;                        // get next superpage from ready queue
+  virtual void fillSuperpages() = 0;                              // to be called periodically, moves filled superpages to the ready queue
+
+  virtual int32_t getDroppedPackets() = 0;  // total number of packets dropped by the channel
+  virtual std::string getDescription() = 0; // description of the channel (e.g. device details), for logs
+};
+
+// factory function to create a software DMA channel, simulating a card writing data in the given memory block.
+// The parameters are read from the given configuration section.
+std::unique_ptr<DmaChannel> getDmaChannelSimulator(ConfigFile& cfg, std::string cfgEntryPoint, void* baseAddress, size_t baseSize);
+
+#endif // #ifndef _DMACHANNEL_H
@@ -0,0 +1,403 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "DmaChannel.h"
+#include "RAWDataHeader.h"
+#include "RdhUtils.h"
+#include "ReadoutUtils.h"
+#include "readoutInfoLogger.h"
+
+// A software DMA channel.
+// A dedicated thread plays the role of the card: it takes the superpages pushed in the transfer queue,
+// and fills them with RDH packets of each link, at the configured link rate.
+// Like the CRU, each superpage is filled with data from a single link, and is closed at timeframe boundaries.
+// When no superpage is available, packets are dropped (rate-limited links) or the link waits (unlimited rate).
+// Filled superpages are moved to the ready queue by fillSuperpages(), after the configured DMA latency.
+// Only the RDH are written in the packets, the payload is left untouched (as the CPU does not copy data in DMA).
+
+class DmaChannelSimulator : public DmaChannel
+{
+ public:
+  DmaChannelSimulator(ConfigFile& cfg, std::string cfgEntryPoint, void* baseAddress, size_t baseSize);
+  ~DmaChannelSimulator();
+
+  void startDma();
+  void stopDma();
+  bool pushSuperpage(const DmaSuperpage& superpage);
+  int getTransferQueueAvailable();
+  int getReadyQueueSize();
+  DmaSuperpage popSuperpage();
+  void fillSuperpages();
+  int32_t getDroppedPackets();
+  std::string getDescription();
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  struct linkState {
+    o2::Header::RAWDataHeader rdhTemplate; // RDH with constant fields of this link already set
+    uint64_t packetIndex = 0;              // index of next packet generated by this link (including dropped ones)
+    bool hasPage = false;                  // set when a superpage is being filled by this link
+    DmaSuperpage page;                     // superpage being filled
+  };
+
+  struct completedSuperpage {
+    DmaSuperpage page;           // a filled superpage
+    clock::time_point readyTime; // time when the superpage can be moved to the ready queue
+  };
+
+  void engineLoop();                                   // the DMA engine thread loop
+  bool fillPage(linkState& link, uint64_t maxPackets); // write up to maxPackets in current superpage of link. Returns true when superpage complete.
+
+  char* baseAddress; // base address of the memory block where superpages are
+  size_t baseSize;   // size of the memory block where superpages are
+
+  int cfgNumberOfLinks = 1;       // number of links
+  size_t cfgDmaPageSize = 8192;   // size of each packet
+  int cfgPacketsPerHbf = 4;       // number of packets per HBF, for each link
+  int cfgTFperiod = 256;          // timeframe length, in orbits
+  double cfgLinkRate = 0;         // data rate of each link, in bytes per second. 0 for unlimited.
+  double cfgDmaLatency = 0;       // delay between superpage completion and availability in ready queue, in seconds
+  int cfgTransferQueueSize = 128; // maximum number of superpages in transfer queue
+  int cfgReadyQueueSize = 0;      // maximum number of superpages in ready queue
+  double cfgPacketDropRate = 0;   // fraction of packets randomly dropped
+
+  std::vector<linkState> links; // state of each link, accessed by engine thread only while DMA running
+
+  std::mutex queueMutex;                         // lock to access the queues and state flags below
+  std::condition_variable engineWakeUp;          // to wake up engine thread when superpages are pushed or DMA stopped
+  std::deque<DmaSuperpage> pendingQueue;         // superpages pushed, not used yet by a link
+  std::deque<completedSuperpage> completedQueue; // superpages filled, waiting to be moved to the ready queue
+  std::deque<DmaSuperpage> readyQueue;           // superpages ready, to be popped
+  int transferQueueCount = 0;                    // number of superpages pushed, and not yet in the ready queue
+  bool isRunning = false;                        // set while DMA is running
+  bool isStarted = false;                        // set when the first superpage has been pushed after startDma(). Links start sending data at this time.
+  clock::time_point startTime;                   // time when the links started sending data
+
+  std::unique_ptr<std::thread> engineThread; // the thread filling superpages
+  std::atomic<int32_t> droppedPackets = 0;   // number of packets dropped
+
+  std::mt19937_64 randomEngine;                                 // random generator for packets dropped
+  std::uniform_real_distribution<double> randomUniform{ 0, 1 }; // uniform distribution in [0,1[
+};
+
+DmaChannelSimulator::DmaChannelSimulator(ConfigFile& cfg, std::string cfgEntryPoint, void* vBaseAddress, size_t vBaseSize)
+{
+  baseAddress = (char*)vBaseAddress;
+  baseSize = vBaseSize;
+
+  // configuration parameter: | equipment-rorcsimulator-* | numberOfLinks | int | 1 | Number of links simulated. Each superpage is filled with the packets of a single link. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".numberOfLinks", cfgNumberOfLinks);
+  // configuration parameter: | equipment-rorcsimulator-* | linkId | int | 0 | Id of the first link. Links use consecutive ids from this value. |
+  int cfgLinkId = 0;
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".linkId", cfgLinkId);
+  // configuration parameter: | equipment-rorcsimulator-* | cruId | int | 0 | CRU id set in the RDH. |
+  int cfgCruId = 0;
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".cruId", cfgCruId);
+  // configuration parameter: | equipment-rorcsimulator-* | systemId | int | 19 | System id set in the RDH. |
+  int cfgSystemId = 19;
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".systemId", cfgSystemId);
+  // configuration parameter: | equipment-rorcsimulator-* | dmaPageSize | bytes | 8k | Size of the RDH packets written in the superpages. |
+  std::string cfgStringDmaPageSize = "8k";
+  cfg.getOptionalValue<std::string>(cfgEntryPoint + ".dmaPageSize", cfgStringDmaPageSize);
+  cfgDmaPageSize = (size_t)ReadoutUtils::getNumberOfBytesFromString(cfgStringDmaPageSize.c_str());
+  // configuration parameter: | equipment-rorcsimulator-* | packetsPerHbf | int | 4 | Number of packets in each HBF (i.e. in each orbit), for each link. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".packetsPerHbf", cfgPacketsPerHbf);
+  // configuration parameter: | equipment-rorcsimulator-* | TFperiod | int | 256 | Duration of a timeframe, in number of LHC orbits. Used for the timeframe boundaries of the RDH generated, it should match equipment-* TFperiod. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".TFperiod", cfgTFperiod);
+  // configuration parameter: | equipment-rorcsimulator-* | linkRate | bytes | 0 | Data rate of each link, in bytes per second. When set, packets are dropped if no superpage is available. When zero, links send data as fast as superpages are available. |
+  std::string cfgStringLinkRate = "0";
+  cfg.getOptionalValue<std::string>(cfgEntryPoint + ".linkRate", cfgStringLinkRate);
+  cfgLinkRate = (double)ReadoutUtils::getNumberOfBytesFromString(cfgStringLinkRate.c_str());
+  // configuration parameter: | equipment-rorcsimulator-* | dmaLatency | double | 0 | Delay (in seconds) between the time a superpage is filled and the time it can be moved to the ready queue. |
+  cfg.getOptionalValue<double>(cfgEntryPoint + ".dmaLatency", cfgDmaLatency);
+  // configuration parameter: | equipment-rorcsimulator-* | transferQueueSize | int | 128 | Maximum number of superpages in the transfer queue. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".transferQueueSize", cfgTransferQueueSize);
+  // configuration parameter: | equipment-rorcsimulator-* | readyQueueSize | int | 0 | Maximum number of superpages in the ready queue. If zero, same as transferQueueSize. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".readyQueueSize", cfgReadyQueueSize);
+  // configuration parameter: | equipment-rorcsimulator-* | packetDropRate | double | 0 | Fraction of packets randomly dropped by the links (in addition to those dropped when no superpage is available). |
+  cfg.getOptionalValue<double>(cfgEntryPoint + ".packetDropRate", cfgPacketDropRate);
+  // configuration parameter: | equipment-rorcsimulator-* | randomSeed | int | 0 | Seed of the random generator used for packets dropped. |
+  int cfgRandomSeed = 0;
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".randomSeed", cfgRandomSeed);
+
+  // check parameters
+  if ((baseAddress == nullptr) || (cfgNumberOfLinks < 1) || (cfgLinkId < 0) || (cfgLinkId + cfgNumberOfLinks - 1 > (int)RdhMaxLinkId)) {
+    throw std::string("Invalid link parameters");
+  }
+  if ((cfgDmaPageSize < sizeof(o2::Header::RAWDataHeader)) || (cfgDmaPageSize > 0xFFFF)) {
+    throw std::string("Invalid dmaPageSize");
+  }
+  if ((cfgPacketsPerHbf < 1) || (cfgTFperiod < 1) || (cfgLinkRate < 0) || (cfgDmaLatency < 0) || (cfgTransferQueueSize < 1) || (cfgReadyQueueSize < 0) || (cfgPacketDropRate < 0) || (cfgPacketDropRate > 1)) {
+    throw std::string("Invalid DMA simulation parameters");
+  }
+  if (cfgReadyQueueSize == 0) {
+    cfgReadyQueueSize = cfgTransferQueueSize;
+  }
+
+  // initialize state of each link, with RDH template
+  links.resize(cfgNumberOfLinks);
+  for (int i = 0; i < cfgNumberOfLinks; i++) {
+    o2::Header::RAWDataHeader& rdh = links[i].rdhTemplate;
+    rdh.systemId = cfgSystemId;
+    rdh.cruId = cfgCruId;
+    rdh.dpwId = 0;
+    rdh.feeId = cfgLinkId + i;
+    rdh.linkId = cfgLinkId + i;
+    rdh.offsetNextPacket = cfgDmaPageSize;
+    rdh.memorySize = cfgDmaPageSize;
+    rdh.triggerBC = 0;
+  }
+
+  randomEngine.seed((uint64_t)cfgRandomSeed);
+}
+
+DmaChannelSimulator::~DmaChannelSimulator()
+{
+  if (engineThread != nullptr) {
+    stopDma();
+  }
+}
+
+std::string DmaChannelSimulator::getDescription()
+{
+  char description[256];
+  snprintf(description, sizeof(description), "software DMA channel, %d links @ %.0lf bytes/s, DMA page size %d, %d packets per HBF, latency %.6lf s, queues %d/%d, drop rate %lf", cfgNumberOfLinks, cfgLinkRate, (int)cfgDmaPageSize, cfgPacketsPerHbf, cfgDmaLatency, cfgTransferQueueSize, cfgReadyQueueSize, cfgPacketDropRate);
+  return description;
+}
+
+void DmaChannelSimulator::startDma()
+{
+  if (engineThread != nullptr) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(queueMutex);
+
+  // links restart from scratch
+  for (auto& l : links) {
+    l.packetIndex = 0;
+    l.hasPage = false;
+  }
+
+  // superpages left from a previous run are returned empty
+  for (auto& p : readyQueue) {
+    p.ready = false;
+    p.received = 0;
+  }
+
+  isRunning = true;
+  isStarted = false;
+  engineThread = std::make_unique<std::thread>(&DmaChannelSimulator::engineLoop, this);
+}
+
+void DmaChannelSimulator::stopDma()
+{
+  if (engineThread == nullptr) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    isRunning = false;
+  }
+  engineWakeUp.notify_one();
+  engineThread->join();
+  engineThread = nullptr;
+
+  // return all pending superpages in ready queue: filled ones first, then partially filled, and unused ones
+  std::unique_lock<std::mutex> lock(queueMutex);
+  for (auto& c : completedQueue) {
+    c.page.ready = true;
+    readyQueue.push_back(c.page);
+  }
+  completedQueue.clear();
+  for (auto& l : links) {
+    if (l.hasPage) {
+      l.page.ready = (l.page.received > 0);
+      readyQueue.push_back(l.page);
+      l.hasPage = false;
+    }
+  }
+  for (auto& p : pendingQueue) {
+    readyQueue.push_back(p);
+  }
+  pendingQueue.clear();
+  transferQueueCount = 0;
+}
+
+bool DmaChannelSimulator::pushSuperpage(const DmaSuperpage& superpage)
+{
+  std::unique_lock<std::mutex> lock(queueMutex);
+  if ((!isRunning) || (transferQueueCount >= cfgTransferQueueSize)) {
+    return false;
+  }
+  if ((superpage.offset + superpage.size > baseSize) || (superpage.size < cfgDmaPageSize)) {
+    return false;
+  }
+  pendingQueue.push_back(superpage);
+  pendingQueue.back().received = 0;
+  pendingQueue.back().ready = false;
+  transferQueueCount++;
+  if (!isStarted) {
+    // links start sending data once readout is ready to receive it
+    isStarted = true;
+    startTime = clock::now();
+  }
+  lock.unlock();
+  engineWakeUp.notify_one();
+  return true;
+}
+
+int DmaChannelSimulator::getTransferQueueAvailable()
+{
+  std::unique_lock<std::mutex> lock(queueMutex);
+  return cfgTransferQueueSize - transferQueueCount;
+}
+
+int DmaChannelSimulator::getReadyQueueSize()
+{
+  std::unique_lock<std::mutex> lock(queueMutex);
+  return (int)readyQueue.size();
+}
+
+DmaSuperpage DmaChannelSimulator::popSuperpage()
+{
+  std::unique_lock<std::mutex> lock(queueMutex);
+  if (readyQueue.empty()) {
+    return DmaSuperpage();
+  }
+  DmaSuperpage p = readyQueue.front();
+  readyQueue.pop_front();
+  return p;
+}
+
+void DmaChannelSimulator::fillSuperpages()
+{
+  std::unique_lock<std::mutex> lock(queueMutex);
+  if (completedQueue.empty()) {
+    return;
+  }
+  clock::time_point now = clock::now();
+  while ((!completedQueue.empty()) && (completedQueue.front().readyTime <= now) && ((int)readyQueue.size() < cfgReadyQueueSize)) {
+    readyQueue.push_back(completedQueue.front().page);
+    readyQueue.back().ready = true;
+    completedQueue.pop_front();
+    transferQueueCount--;
+  }
+}
+
+int32_t DmaChannelSimulator::getDroppedPackets() { return droppedPackets; }
+
+bool DmaChannelSimulator::fillPage(linkState& l, uint64_t maxPackets)
+{
+  DmaSuperpage& page = l.page;
+  for (uint64_t i = 0; i < maxPackets; i++) {
+    if (page.received + cfgDmaPageSize > page.size) {
+      break;
+    }
+    uint64_t packetIndex = l.packetIndex;
+    uint32_t orbit = (uint32_t)(packetIndex / cfgPacketsPerHbf);
+    int hbfPage = (int)(packetIndex % cfgPacketsPerHbf);
+
+    // superpages do not span over timeframes
+    if ((hbfPage == 0) && (orbit % cfgTFperiod == 0) && (page.received > 0)) {
+      return true;
+    }
+    l.packetIndex++;
+
+    // random packet loss
+    if ((cfgPacketDropRate > 0) && (randomUniform(randomEngine) < cfgPacketDropRate)) {
+      droppedPackets++;
+      continue;
+    }
+
+    // start from the link template (constant fields), and set the fields changing with each packet
+    o2::Header::RAWDataHeader* rdh = (o2::Header::RAWDataHeader*)&baseAddress[page.offset + page.received];
+    memcpy((void*)rdh, &l.rdhTemplate, sizeof(o2::Header::RAWDataHeader));
+    rdh->packetCounter = (uint8_t)packetIndex;
+    rdh->triggerOrbit = orbit;
+    rdh->heartbeatOrbit = orbit;
+    rdh->pagesCounter = hbfPage;
+    rdh->stopBit = (hbfPage == cfgPacketsPerHbf - 1) ? 1 : 0;
+    page.received += cfgDmaPageSize;
+  }
+  return (page.received + cfgDmaPageSize > page.size);
+}
+
+void DmaChannelSimulator::engineLoop()
+{
+  // time to wait when nothing to do: the link rate is applied on average, packets due in the mean time are generated in a burst
+  const auto idleWait = std::chrono::microseconds(100);
+
+  std::unique_lock<std::mutex> lock(queueMutex);
+  while (isRunning) {
+    if (!isStarted) {
+      engineWakeUp.wait(lock);
+      continue;
+    }
+
+    double elapsed = std::chrono::duration<double>(clock::now() - startTime).count();
+    bool isWaitingPage = false; // set when a link could send data, but no superpage available
+    bool isActive = false;      // set when some superpage completed
+
+    // links are served in turn, one superpage at most each
+    for (auto& l : links) {
+      uint64_t nPackets = UINT64_MAX; // number of packets the link can send now
+      if (cfgLinkRate > 0) {
+        uint64_t packetsDue = (uint64_t)(elapsed * cfgLinkRate / cfgDmaPageSize);
+        if (packetsDue <= l.packetIndex) {
+          continue;
+        }
+        nPackets = packetsDue - l.packetIndex;
+      }
+      if (!l.hasPage) {
+        if (pendingQueue.empty()) {
+          if (cfgLinkRate > 0) {
+            // no space available: the card drops the data
+            l.packetIndex += nPackets;
+            droppedPackets += (int32_t)nPackets;
+          } else {
+            isWaitingPage = true;
+          }
+          continue;
+        }
+        l.page = pendingQueue.front();
+        pendingQueue.pop_front();
+        l.hasPage = true;
+      }
+
+      // write data without lock, the superpage is owned by the link
+      lock.unlock();
+      bool isComplete = fillPage(l, nPackets);
+      lock.lock();
+
+      if (isComplete) {
+        completedQueue.push_back({ l.page, clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(cfgDmaLatency)) });
+        l.hasPage = false;
+        isActive = true;
+      }
+    }
+
+    if ((!isActive) || (isWaitingPage)) {
+      engineWakeUp.wait_for(lock, idleWait);
+    }
+  }
+}
+
+std::unique_ptr<DmaChannel> getDmaChannelSimulator(ConfigFile& cfg, std::string cfgEntryPoint, void* baseAddress, size_t baseSize) { return std::make_unique<DmaChannelSimulator>(cfg, cfgEntryPoint, baseAddress, baseSize); }
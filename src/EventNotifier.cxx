@@ -0,0 +1,105 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#include "EventNotifier.h"
+
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+int EventNotifierWaitEnabled = 0; // default: polling mode
+int EventNotifierSpinMax = 1000;
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word size mismatch");
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+EventNotifier::EventNotifier()
+{
+  sequence = 0;
+  waiters = 0;
+  nNotify = 0;
+  spinLimit = (EventNotifierSpinMax > 0) ? EventNotifierSpinMax : 0;
+}
+
+EventNotifier::~EventNotifier() {}
+
+uint32_t EventNotifier::getSequence() { return sequence.load(std::memory_order_acquire); }
+
+void EventNotifier::notify()
+{
+  nNotify.fetch_add(1, std::memory_order_relaxed);
+  sequence.fetch_add(1, std::memory_order_seq_cst);
+  // syscall only if somebody is blocked
+  if (waiters.load(std::memory_order_seq_cst) > 0) {
+    syscall(SYS_futex, (uint32_t*)&sequence, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+  }
+}
+
+bool EventNotifier::wait(uint32_t seq, int timeoutUs)
+{
+  nWait++;
+
+  // spin first
+  unsigned int maxSpin = (EventNotifierSpinMax > 0) ? EventNotifierSpinMax : 0;
+  for (unsigned int i = 0; i < spinLimit; i++) {
+    if (sequence.load(std::memory_order_acquire) != seq) {
+      nSpin += i;
+      nSpinWakeup++;
+      // spinning was useful, allow more next time
+      spinLimit = (spinLimit * 2 < maxSpin) ? spinLimit * 2 : maxSpin;
+      return true;
+    }
+    cpuRelax();
+  }
+  nSpin += spinLimit;
+  // spinning was useless, reduce it next time
+  spinLimit = spinLimit / 2;
+  if ((spinLimit < 16) && (maxSpin >= 16)) {
+    spinLimit = 16;
+  }
+
+  // then block, until notified or timeout
+  struct timespec ts;
+  ts.tv_sec = timeoutUs / 1000000;
+  ts.tv_nsec = (timeoutUs % 1000000) * 1000;
+  waiters.fetch_add(1, std::memory_order_seq_cst);
+  // returns immediately if sequence already changed
+  syscall(SYS_futex, (uint32_t*)&sequence, FUTEX_WAIT_PRIVATE, seq, &ts, nullptr, 0);
+  waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+  if (sequence.load(std::memory_order_acquire) != seq) {
+    nBlockWakeup++;
+    return true;
+  }
+  nTimeout++;
+  return false;
+}
+
+void EventNotifier::idle(uint32_t seq, int timeoutUs)
+{
+  if (EventNotifierWaitEnabled) {
+    wait(seq, timeoutUs);
+  } else {
+    usleep(timeoutUs);
+  }
+}
+
+std::string EventNotifier::getStats()
+{
+  return "notifications=" + std::to_string(nNotify.load()) + " waits=" + std::to_string(nWait) + " spin wakeups=" + std::to_string(nSpinWakeup) + " blocked wakeups=" + std::to_string(nBlockWakeup) + " timeouts=" + std::to_string(nTimeout) + " spin iterations=" + std::to_string(nSpin);
+}
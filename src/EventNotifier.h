@@ -0,0 +1,62 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#ifndef _EVENTNOTIFIER_H
+#define _EVENTNOTIFIER_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+// global settings for idle threads of the data path
+extern int EventNotifierWaitEnabled; // if set, idle threads wait for notification. Otherwise, they poll (sleep).
+extern int EventNotifierSpinMax;     // maximum number of spin iterations before blocking, when waiting
+
+// This class allows a thread to wait until some other thread notifies new data is available.
+// Typical use, to avoid missing a notification:
+// - consumer: seq=getSequence(), check input FIFOs, if nothing to do: idle(seq, timeout)
+// - producer: push to FIFO(s), then notify() (once per batch is enough)
+// One notifier can be shared by several producers (e.g. one waiter watching several FIFOs).
+// The waiter first spins (adaptive number of iterations), then blocks (futex).
+class EventNotifier
+{
+ public:
+  EventNotifier();
+  ~EventNotifier();
+
+  uint32_t getSequence(); // get current sequence number, to be passed to wait()
+  void notify();          // signal new data to waiting thread(s)
+
+  // wait for a notification posted after seq was read with getSequence(), for at most timeoutUs microseconds
+  // returns true if notified, false on timeout
+  bool wait(uint32_t seq, int timeoutUs);
+
+  // idle for at most timeoutUs, according to global settings:
+  // either wait for a notification posted after seq was read, or sleep (polling mode)
+  void idle(uint32_t seq, int timeoutUs);
+
+  std::string getStats(); // return a string summarizing counters
+
+ private:
+  alignas(64) std::atomic<uint32_t> sequence; // incremented on each notification. Used as futex word.
+  std::atomic<int> waiters;                   // number of threads blocked in futex wait
+
+  alignas(64) unsigned int spinLimit; // current number of spin iterations before blocking (adaptive)
+
+  // counters
+  std::atomic<unsigned long long> nNotify; // number of calls to notify()
+  unsigned long long nWait = 0;            // number of calls to wait()
+  unsigned long long nSpinWakeup = 0;      // number of wakeups while spinning
+  unsigned long long nBlockWakeup = 0;     // number of wakeups after blocking
+  unsigned long long nTimeout = 0;         // number of waits ended on timeout
+  unsigned long long nSpin = 0;            // total number of spin iterations
+};
+
+#endif // #ifndef _EVENTNOTIFIER_H
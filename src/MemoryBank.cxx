@@ -19,11 +19,25 @@
 #include <ReadoutCard/MemoryMappedFile.h>
 #endif
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
 #include <utility>
 #include <vector>
+#ifdef WITH_NUMA
+#include <numa.h>
+#endif
 
 #include "readoutInfoLogger.h"
 
+#if defined(MFD_HUGETLB) && !defined(MFD_HUGE_SHIFT)
+#define MFD_HUGE_SHIFT MAP_HUGE_SHIFT // same hugepage size encoding for memfd_create() and mmap()
+#endif
+
 /// generic base class
 
 MemoryBank::MemoryBank(std::string v_description)
@@ -31,9 +45,13 @@ MemoryBank::MemoryBank(std::string v_description)
   baseAddress = nullptr;
   size = 0;
   description = v_description;
+  pageSize = sysconf(_SC_PAGESIZE);
 }
 
-MemoryBank::MemoryBank(void* v_baseAddress, std::size_t v_size, ReleaseCallback v_callback, std::string v_description) : baseAddress(v_baseAddress), size(v_size), description(v_description), releaseCallback(v_callback) {}
+MemoryBank::MemoryBank(void* v_baseAddress, std::size_t v_size, ReleaseCallback v_callback, std::string v_description) : baseAddress(v_baseAddress), size(v_size), description(v_description), releaseCallback(v_callback)
+{
+  pageSize = sysconf(_SC_PAGESIZE);
+}
 
 MemoryBank::~MemoryBank()
 {
@@ -48,12 +66,135 @@ size_t MemoryBank::getSize() { return size; }
 
 std::string MemoryBank::getDescription() { return description; }
 
+std::size_t MemoryBank::getPageSize() { return pageSize; }
+
 void MemoryBank::clear()
 {
   std::memset(baseAddress, 0, size);
   return;
 }
 
+int MemoryBank::initialize(InitMode mode, int nThreads, int numaNode, bool lock)
+{
+  if ((mode == InitMode::None) && (!lock)) {
+    return 0;
+  }
+  if ((baseAddress == nullptr) || (size == 0)) {
+    return 0;
+  }
+#ifndef WITH_NUMA
+  numaNode = -1; // threads placement not supported by this build
+#endif
+  const char* modeName = (mode == InitMode::Clear) ? "clear" : ((mode == InitMode::Prefault) ? "prefault" : "none");
+
+  // split memory range in chunks (aligned on page boundaries), one per thread
+  std::size_t step = (pageSize > 0) ? pageSize : 4096;
+  std::size_t nPages = (size + step - 1) / step;
+  if (nThreads <= 0) {
+    nThreads = (int)std::thread::hardware_concurrency();
+#ifdef WITH_NUMA
+    if ((numaNode >= 0) && (numa_available() >= 0)) {
+      struct bitmask* cpus = numa_allocate_cpumask();
+      if (cpus != nullptr) {
+        if (numa_node_to_cpus(numaNode, cpus) == 0) {
+          nThreads = (int)numa_bitmask_weight(cpus);
+        }
+        numa_free_cpumask(cpus);
+      }
+    }
+#endif
+  }
+  if (nThreads < 1) {
+    nThreads = 1;
+  }
+  if ((std::size_t)nThreads > nPages) {
+    nThreads = (int)nPages;
+  }
+  std::size_t chunkSize = ((nPages + nThreads - 1) / nThreads) * step;
+
+  theLog.log(LogInfoDevel_(3008), "Memory bank %s : initializing %ld bytes (%s%s) with %d thread(s)%s", description.c_str(), (long)size, modeName, lock ? ", lock" : "", nThreads, (numaNode >= 0) ? (" on NUMA node " + std::to_string(numaNode)).c_str() : "");
+
+  std::atomic<std::size_t> bytesDone(0);
+  std::atomic<int> nErrors(0);
+  std::atomic<int> lockErrno(0);
+  auto worker = [&](std::size_t offset, std::size_t length) {
+#ifdef WITH_NUMA
+    if (numaNode >= 0) {
+      numa_run_on_node(numaNode);
+    }
+#endif
+    char* begin = (char*)baseAddress + offset;
+    bool populated = false;
+#ifdef MADV_POPULATE_WRITE
+    if (mode == InitMode::Prefault) {
+      // let the kernel fault pages in one go, if supported
+      if (madvise(begin, length, MADV_POPULATE_WRITE) == 0) {
+        populated = true;
+        bytesDone += length;
+      }
+    }
+#endif
+    if (!populated && (mode != InitMode::None)) {
+      // process in slices, to report progress
+      const std::size_t sliceSize = std::max(step, (std::size_t)(64 * 1024 * 1024 / step) * step);
+      for (std::size_t i = 0; i < length; i += sliceSize) {
+        std::size_t n = std::min(sliceSize, length - i);
+        if (mode == InitMode::Clear) {
+          std::memset(begin + i, 0, n);
+        } else {
+          // write back first byte of each page, to allocate it without changing content
+          for (std::size_t j = 0; j < n; j += step) {
+            volatile char* p = begin + i + j;
+            *p = *p;
+          }
+        }
+        bytesDone += n;
+      }
+    }
+    if (lock) {
+      if (mlock(begin, length) != 0) {
+        lockErrno = errno;
+        nErrors++;
+      }
+    }
+  };
+
+  auto t0 = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (std::size_t offset = 0; offset < size; offset += chunkSize) {
+    threads.emplace_back(worker, offset, std::min(chunkSize, size - offset));
+  }
+
+  // report progress while threads are running
+  if (mode != InitMode::None) {
+    const double progressInterval = 1.0;
+    double lastReport = 0;
+    for (;;) {
+      std::size_t done = bytesDone;
+      if (done >= size) {
+        break;
+      }
+      double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      if (elapsed - lastReport >= progressInterval) {
+        theLog.log(LogInfoDevel_(3008), "Memory bank %s : %s %.0f%% done", description.c_str(), modeName, done * 100.0 / size);
+        lastReport = elapsed;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  if (nErrors) {
+    theLog.log(LogErrorSupport_(3230), "Memory bank %s : failed to lock memory (%s). Check memlock limits (ulimit -l)", description.c_str(), strerror(lockErrno));
+    return -1;
+  }
+  theLog.log(LogInfoDevel_(3008), "Memory bank %s : initialized in %.3f s (%.2f GB/s)", description.c_str(), elapsed, (elapsed > 0) ? size / elapsed / (1024.0 * 1024.0 * 1024.0) : 0.0);
+  return 0;
+}
+
 /// MemoryBank implementation with malloc()
 
 class MemoryBankMalloc : public MemoryBank
@@ -146,12 +287,181 @@ MemoryBankMemoryMappedFile::MemoryBankMemoryMappedFile(size_t v_size, std::strin
 MemoryBankMemoryMappedFile::~MemoryBankMemoryMappedFile() {}
 #endif
 
+// MemoryBank implementation with mmap(), backed by hugepages
+// hugetlb: anonymous mapping of hugepages (MAP_HUGETLB)
+// memfd: hugepages file descriptor (memfd_create() with MFD_HUGETLB), mapped in memory. Can be shared with other processes.
+// thp: anonymous mapping, aligned and advised for transparent hugepages (madvise(MADV_HUGEPAGE))
+// When hugepages can not be allocated (e.g. not reserved in the system), falls back to thp.
+class MemoryBankHugePages : public MemoryBank
+{
+ public:
+  MemoryBankHugePages(size_t size, std::string type, size_t hugePageSize, std::string description);
+  ~MemoryBankHugePages();
+
+ private:
+  void* mappedAddress = nullptr; // address of mapped block
+  size_t mappedSize = 0;         // size of mapped block (rounded up to page size, possibly with extra space for alignment)
+  int fd = -1;                   // file descriptor, for memfd
+
+  bool mapHugeTlb(size_t hugePageSize, bool useMemFd); // try to map block with given hugepage size. Returns true on success.
+  void mapThp();                                       // map block with transparent hugepages
+};
+
+// get value of a keyword (e.g. Hugepagesize) from /proc/meminfo, in bytes. Returns 0 if not found.
+static size_t getMemInfoBytes(const std::string& keyword)
+{
+  std::ifstream f("/proc/meminfo");
+  std::string key, unit;
+  size_t value;
+  while (f >> key >> value) {
+    std::getline(f, unit);
+    if (key == keyword + ":") {
+      return value * 1024;
+    }
+  }
+  return 0;
+}
+
+// get a short string for a page size, e.g. 4kB, 2MB, 1GB
+static std::string getPageSizeString(size_t pageSize)
+{
+  if ((pageSize >= 1024 * 1024 * 1024) && (pageSize % (1024 * 1024 * 1024) == 0)) {
+    return std::to_string(pageSize / (1024 * 1024 * 1024)) + "GB";
+  } else if ((pageSize >= 1024 * 1024) && (pageSize % (1024 * 1024) == 0)) {
+    return std::to_string(pageSize / (1024 * 1024)) + "MB";
+  } else if ((pageSize >= 1024) && (pageSize % 1024 == 0)) {
+    return std::to_string(pageSize / 1024) + "kB";
+  }
+  return std::to_string(pageSize) + "B";
+}
+
+MemoryBankHugePages::MemoryBankHugePages(size_t v_size, std::string v_type, size_t v_hugePageSize, std::string v_description) : MemoryBank(v_description)
+{
+  if (v_description.length() == 0) {
+    description = "Bank " + v_type;
+  }
+  size = v_size;
+  std::string effectiveType = v_type;
+
+  if ((v_type == "hugetlb") || (v_type == "memfd")) {
+    // default hugepage size of the system
+    if (v_hugePageSize == 0) {
+      v_hugePageSize = getMemInfoBytes("Hugepagesize");
+    }
+    if ((v_hugePageSize == 0) || (v_hugePageSize & (v_hugePageSize - 1))) {
+      theLog.log(LogErrorSupport_(3103), "Memory bank %s : wrong hugepage size %ld", description.c_str(), (long)v_hugePageSize);
+      throw __LINE__;
+    }
+    if (!mapHugeTlb(v_hugePageSize, v_type == "memfd")) {
+      std::string err = strerror(errno);
+      theLog.log(LogWarningSupport_(3230), "Memory bank %s : failed to allocate %ld bytes with %s hugepages (%s). Check that enough hugepages are reserved (/sys/kernel/mm/hugepages/hugepages-%ldkB/nr_hugepages). Falling back to transparent hugepages", description.c_str(), (long)v_size, getPageSizeString(v_hugePageSize).c_str(), err.c_str(), (long)(v_hugePageSize / 1024));
+      mapThp();
+      effectiveType = "thp, fallback from " + v_type;
+    }
+  } else {
+    mapThp();
+  }
+
+  description += " (" + effectiveType + ", page size " + getPageSizeString(pageSize) + ")";
+  theLog.log(LogInfoDevel_(3008), "Memory bank %s : %ld bytes @ %p", description.c_str(), (long)size, baseAddress);
+}
+
+bool MemoryBankHugePages::mapHugeTlb(size_t hugePageSize, bool useMemFd)
+{
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+  int hugePageShift = __builtin_ctzll(hugePageSize);
+  size_t newSize = ((size + hugePageSize - 1) / hugePageSize) * hugePageSize;
+  void* ptr = MAP_FAILED;
+  if (useMemFd) {
+#if defined(MFD_HUGETLB) && defined(MFD_HUGE_SHIFT)
+    fd = memfd_create(("readout-" + description).c_str(), MFD_CLOEXEC | MFD_HUGETLB | (hugePageShift << MFD_HUGE_SHIFT));
+    if (fd < 0) {
+      return false;
+    }
+    if (ftruncate(fd, newSize) == 0) {
+      ptr = mmap(nullptr, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (ptr == MAP_FAILED) {
+      int err = errno;
+      close(fd);
+      fd = -1;
+      errno = err;
+      return false;
+    }
+#else
+    theLog.log(LogWarningSupport_(3101), "Memory bank %s : memfd hugepages not supported by this build", description.c_str());
+    errno = ENOTSUP;
+    return false;
+#endif
+  } else {
+    ptr = mmap(nullptr, newSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (hugePageShift << MAP_HUGE_SHIFT), -1, 0);
+    if (ptr == MAP_FAILED) {
+      return false;
+    }
+  }
+  mappedAddress = ptr;
+  mappedSize = newSize;
+  baseAddress = ptr;
+  pageSize = hugePageSize;
+  return true;
+#else
+  (void)hugePageSize;
+  (void)useMemFd;
+  errno = ENOTSUP;
+  return false;
+#endif
+}
+
+void MemoryBankHugePages::mapThp()
+{
+  // transparent hugepages size, and kernel policy
+  size_t thpSize = 0;
+  std::string thpPolicy;
+  std::ifstream("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size") >> thpSize;
+  std::getline(std::ifstream("/sys/kernel/mm/transparent_hugepage/enabled"), thpPolicy);
+  bool thpEnabled = (thpSize > 0) && (thpPolicy.find("[never]") == std::string::npos);
+  size_t alignment = thpEnabled ? thpSize : pageSize;
+
+  // map with extra space, so that block can be aligned on hugepage boundary
+  mappedSize = ((size + alignment - 1) / alignment) * alignment + alignment;
+  mappedAddress = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mappedAddress == MAP_FAILED) {
+    mappedAddress = nullptr;
+    throw std::bad_alloc();
+  }
+  baseAddress = (void*)((((size_t)mappedAddress + alignment - 1) / alignment) * alignment);
+
+  if (thpEnabled) {
+#ifdef MADV_HUGEPAGE
+    if (madvise(baseAddress, mappedSize - ((char*)baseAddress - (char*)mappedAddress), MADV_HUGEPAGE) == 0) {
+      pageSize = thpSize;
+    } else {
+      theLog.log(LogWarningSupport_(3230), "Memory bank %s : madvise(MADV_HUGEPAGE) failed (%s), using normal pages", description.c_str(), strerror(errno));
+    }
+#endif
+  } else {
+    theLog.log(LogWarningSupport_(3230), "Memory bank %s : transparent hugepages not available, using normal pages", description.c_str());
+  }
+}
+
+MemoryBankHugePages::~MemoryBankHugePages()
+{
+  if (mappedAddress != nullptr) {
+    munmap(mappedAddress, mappedSize);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
 // MemoryBank factory based on type
-std::shared_ptr<MemoryBank> getMemoryBank(size_t size, std::string type, std::string description)
+std::shared_ptr<MemoryBank> getMemoryBank(size_t size, std::string type, std::string description, size_t hugePageSize)
 {
 
   if (type == "malloc") {
     return std::make_shared<MemoryBankMalloc>(size, description);
+  } else if ((type == "hugetlb") || (type == "memfd") || (type == "thp")) {
+    return std::make_shared<MemoryBankHugePages>(size, type, hugePageSize, description);
   } else if (type == "MemoryMappedFile") {
 #ifdef WITH_READOUTCARD
     return std::make_shared<MemoryBankMemoryMappedFile>(size, description);
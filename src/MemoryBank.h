@@ -34,20 +34,34 @@ class MemoryBank
   void* getBaseAddress();       // get the (virtual) base address of this memory bank
   std::size_t getSize();        // get the total size (bytes) of this memory bank
   std::string getDescription(); // get the description of this memory bank;
+  std::size_t getPageSize();    // get the (effective) size of the memory pages backing this memory bank
 
   void clear(); // write zeroes into the whole memory range
 
+  // modes available to initialize the memory range
+  enum class InitMode { Clear,    // write zeroes into the whole memory range
+                        Prefault, // only touch each page, so that it is allocated (content not modified)
+                        None };   // do nothing
+  // initialize the memory range, in parallel.
+  // nThreads: number of threads to be used (0 = one per CPU available)
+  // numaNode: when >=0 (and NUMA supported), threads are executed on this node, so that first-touch allocates memory locally
+  // lock: when set, pages are locked in RAM (mlock)
+  // Progress and total time are reported in log. Returns 0 on success, -1 on error.
+  int initialize(InitMode mode, int nThreads = 1, int numaNode = -1, bool lock = false);
+
  protected:
   void* baseAddress;               // base address (virtual) of buffer
   std::size_t size;                // size of buffer, in bytes
   std::string description;         // description of the memory bank (type/sypport, etc)
+  std::size_t pageSize;            // size of memory pages backing this memory bank (system page size by default)
   ReleaseCallback releaseCallback; // an optional user-callback to be called in destructor, when overloaded constructor has been used
 };
 
 // factory function to create a MemoryBank instance of a given type
 // size: size of the bank, in bytes
-// support: type of support to be used. Available choices: malloc, MemoryMappedFile
-// description: optional description for the memory bank
-std::shared_ptr<MemoryBank> getMemoryBank(size_t size, std::string support, std::string description = "");
+// support: type of support to be used. Available choices: malloc, MemoryMappedFile, hugetlb, memfd, thp
+// description: optional description for the memory bank. For hugetlb, memfd, thp, the type and effective page size are appended.
+// hugePageSize: for hugetlb, memfd: size of hugepages to be used (bytes). If zero, using the system default hugepage size.
+std::shared_ptr<MemoryBank> getMemoryBank(size_t size, std::string support, std::string description = "", size_t hugePageSize = 0);
 
 #endif // #ifndef _MEMORYBANKMANAGER_H
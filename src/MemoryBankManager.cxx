@@ -10,13 +10,16 @@
 
 #include "MemoryBankManager.h"
 
+#include <algorithm>
+#include <iterator>
+
 #include "readoutInfoLogger.h"
 
 MemoryBankManager::MemoryBankManager() {}
 
 MemoryBankManager::~MemoryBankManager() {}
 
-int MemoryBankManager::addBank(std::shared_ptr<MemoryBank> bankPtr, std::string name)
+int MemoryBankManager::addBank(std::shared_ptr<MemoryBank> bankPtr, std::string name, std::string configuration)
 {
 
   // disable concurrent execution of this function
@@ -26,7 +29,13 @@ int MemoryBankManager::addBank(std::shared_ptr<MemoryBank> bankPtr, std::string
     if (name.length() == 0) {
       name = bankPtr->getDescription();
     }
-    banks.push_back({ name, bankPtr, {} });
+    bankDescriptor bd;
+    bd.name = name;
+    bd.bank = bankPtr;
+    bd.freeRanges[0] = bankPtr->getSize(); // all bank available
+    bd.id = ++lastBankId;
+    bd.configuration = configuration;
+    banks.push_back(std::move(bd));
   } catch (...) {
     return -1;
   }
@@ -34,13 +43,42 @@ int MemoryBankManager::addBank(std::shared_ptr<MemoryBank> bankPtr, std::string
   return 0;
 }
 
-std::shared_ptr<MemoryPagesPool> MemoryBankManager::getPagedPool(size_t pageSize, size_t pageNumber, std::string bankName, size_t firstPageOffset, size_t blockAlign)
+bool MemoryBankManager::reuseBank(const std::string& name, const std::string& configuration)
 {
+  std::unique_lock<std::mutex> lock(bankMutex);
+  for (auto it = banks.begin(); it != banks.end(); ++it) {
+    if ((!it->isKept) || (it->name != name)) {
+      continue;
+    }
+    if ((configuration.length() == 0) || (it->configuration != configuration)) {
+      // released now, before the new bank is created, so that both are not allocated at the same time
+      theLog.log(LogInfoDevel_(3008), "Releasing bank %s (configuration changed)", it->name.c_str());
+      banks.erase(it);
+      return false;
+    }
+    // move bank at the end of the list, so that banks stay in the order they are configured
+    it->isKept = false;
+    std::rotate(it, std::next(it), banks.end());
+    return true;
+  }
+  return false;
+}
 
-  void* baseAddress = nullptr; // base address of bank from which the block is taken
-  size_t offset = 0;           // offset of new block (relative to baseAddress)
-  size_t blockSize = 0;        // size of new block (in bytes)
+void MemoryBankManager::releaseUnusedBanks()
+{
+  std::unique_lock<std::mutex> lock(bankMutex);
+  for (auto it = banks.begin(); it != banks.end();) {
+    if (it->isKept) {
+      theLog.log(LogInfoDevel_(3008), "Releasing bank %s (not used anymore)", it->name.c_str());
+      it = banks.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
 
+int MemoryBankManager::allocateRange(size_t blockSizeMax, std::string bankName, size_t blockAlign, void*& baseAddress, size_t& offset, size_t& blockSize, uint64_t& bankId)
+{
   // disable concurrent execution of this block
   // automatic release of lock when going out of scope
   // beginning of locked block
@@ -49,7 +87,7 @@ std::shared_ptr<MemoryPagesPool> MemoryBankManager::getPagedPool(size_t pageSize
 
     if (banks.size() == 0) {
       theLog.log(LogErrorSupport_(3103), "Can not create memory pool: no memory bank defined");
-      return nullptr;
+      return -1;
     }
 
     // look for corresponding named bank
@@ -72,71 +110,214 @@ std::shared_ptr<MemoryPagesPool> MemoryBankManager::getPagedPool(size_t pageSize
     }
     if (!bankFound) {
       theLog.log(LogErrorSupport_(3103), "Can not find specified memory bank '%s'", bankName.c_str());
-      return nullptr;
+      return -1;
     }
 
     // theLog.log(LogDebugTrace_(3008),"Allocating %ld x %ld bytes from memory bank '%s'",pageNumber,pageSize,banks[ix].name.c_str());
 
     // reserve space from big block
     baseAddress = banks[ix].bank->getBaseAddress();
-    offset = 0;
-    blockSize = pageSize * (pageNumber + 1); // this is the maximum space to use... may loose some pages for alignment
-
-    // alloc new block after existing ranges already in use
-    for (auto it = banks[ix].rangesInUse.begin(); it != banks[ix].rangesInUse.end(); ++it) {
-      size_t maxOffset = it->offset + it->size;
-      if (maxOffset > offset) {
-        offset = maxOffset;
-      }
-    }
+    bankId = banks[ix].id;
 
-    // align beginning of block as specified
-    if (blockAlign > 0) {
-      size_t bytesExcess = (((size_t)baseAddress) + offset) % blockAlign;
-      if (bytesExcess) {
-        size_t alignOffset = blockAlign - bytesExcess;
-        offset += alignOffset;    // advance to next aligned address
-        blockSize -= alignOffset; // decrease block size to respect initial limit
+    // look for the smallest free range in which the block fits
+    auto bestFit = banks[ix].freeRanges.end();
+    size_t bestFitAlignOffset = 0;
+    for (auto it = banks[ix].freeRanges.begin(); it != banks[ix].freeRanges.end(); ++it) {
+      // align beginning of block as specified
+      size_t alignOffset = 0;
+      if (blockAlign > 0) {
+        size_t bytesExcess = (((size_t)baseAddress) + it->first) % blockAlign;
+        if (bytesExcess) {
+          alignOffset = blockAlign - bytesExcess;
+        }
+      }
+      if (alignOffset >= blockSizeMax) {
+        continue;
+      }
+      // block size is decreased by alignment to respect initial limit, so it always spans blockSizeMax bytes from beginning of free range
+      if (blockSizeMax > it->second) {
+        continue;
+      }
+      if ((bestFit == banks[ix].freeRanges.end()) || (it->second < bestFit->second)) {
+        bestFit = it;
+        bestFitAlignOffset = alignOffset;
       }
     }
 
     // check not exceeding bank size
-    if (offset + blockSize > banks[ix].bank->getSize()) {
-      theLog.log(LogErrorSupport_(3230), "Not enough space left in memory bank '%s' (need %ld bytes more)", banks[ix].name.c_str(), offset + blockSize - banks[ix].bank->getSize());
+    if (bestFit == banks[ix].freeRanges.end()) {
+      size_t largestFreeRange = 0;
+      for (const auto& r : banks[ix].freeRanges) {
+        largestFreeRange = std::max(largestFreeRange, r.second);
+      }
+      theLog.log(LogErrorSupport_(3230), "Not enough space left in memory bank '%s' (need %ld bytes, largest free range is %ld bytes, %d free ranges)", banks[ix].name.c_str(), (long)blockSizeMax, (long)largestFreeRange, (int)banks[ix].freeRanges.size());
       throw std::bad_alloc();
     }
 
+    // carve new block from free range, keep what's left (before and after it) available
+    size_t freeOffset = bestFit->first;
+    size_t freeSize = bestFit->second;
+    offset = freeOffset + bestFitAlignOffset;
+    blockSize = blockSizeMax - bestFitAlignOffset;
+    banks[ix].freeRanges.erase(bestFit);
+    if (bestFitAlignOffset) {
+      banks[ix].freeRanges[freeOffset] = bestFitAlignOffset;
+    }
+    if (freeOffset + freeSize > offset + blockSize) {
+      banks[ix].freeRanges[offset + blockSize] = freeOffset + freeSize - (offset + blockSize);
+    }
+
     // keep track of this new block
     banks[ix].rangesInUse.push_back({ offset, blockSize });
   }
   // end of locked block
 
+  return 0;
+}
+
+std::shared_ptr<MemoryPagesPool> MemoryBankManager::getPagedPool(size_t pageSize, size_t pageNumber, std::string bankName, size_t firstPageOffset, size_t blockAlign)
+{
+  void* baseAddress = nullptr; // base address of bank from which the block is taken
+  size_t offset = 0;           // offset of new block (relative to baseAddress)
+  size_t blockSize = 0;        // size of new block (in bytes)
+  uint64_t bankId = 0;         // id of bank from which the block is taken
+
+  // this is the maximum space to use... may loose some pages for alignment
+  if (allocateRange(pageSize * (pageNumber + 1), bankName, blockAlign, baseAddress, offset, blockSize, bankId)) {
+    return nullptr;
+  }
+
   // create pool of pages from new block
-  return std::make_shared<MemoryPagesPool>(pageSize, pageNumber, &(((char*)baseAddress)[offset]), blockSize, nullptr, firstPageOffset);
+  // the block is given back to the bank when the pool is destroyed
+  auto releaseBlock = [this, bankId, offset](void*) { releaseRange(bankId, offset); };
+  std::shared_ptr<MemoryPagesPool> pool;
+  try {
+    pool = std::make_shared<MemoryPagesPool>(pageSize, pageNumber, &(((char*)baseAddress)[offset]), blockSize, releaseBlock, firstPageOffset);
+  } catch (...) {
+    releaseRange(bankId, offset);
+    throw;
+  }
+  return pool;
+}
+
+std::shared_ptr<MemoryPagesSlabPool> MemoryBankManager::getSlabPool(std::vector<MemoryPagesSlabPool::SizeClass> sizeClasses, std::string bankName, size_t blockAlign)
+{
+  void* baseAddress = nullptr; // base address of bank from which the block is taken
+  size_t offset = 0;           // offset of new block (relative to baseAddress)
+  size_t blockSize = 0;        // size of new block (in bytes)
+  uint64_t bankId = 0;         // id of bank from which the block is taken
+
+  // reserve extra space for alignment, as for getPagedPool()
+  if (allocateRange(MemoryPagesSlabPool::getSizeNeeded(sizeClasses) + blockAlign, bankName, blockAlign, baseAddress, offset, blockSize, bankId)) {
+    return nullptr;
+  }
+
+  // create pools of pages from new block
+  // the block is given back to the bank when the pool is destroyed
+  auto releaseBlock = [this, bankId, offset](void*) { releaseRange(bankId, offset); };
+  std::shared_ptr<MemoryPagesSlabPool> pool;
+  try {
+    pool = std::make_shared<MemoryPagesSlabPool>(sizeClasses, &(((char*)baseAddress)[offset]), blockSize, releaseBlock);
+  } catch (...) {
+    releaseRange(bankId, offset);
+    throw;
+  }
+  return pool;
+}
+
+void MemoryBankManager::releaseRange(uint64_t bankId, size_t offset)
+{
+  std::unique_lock<std::mutex> lock(bankMutex);
+
+  // find corresponding bank. It may have been removed already.
+  for (auto& b : banks) {
+    if (b.id != bankId) {
+      continue;
+    }
+    for (auto it = b.rangesInUse.begin(); it != b.rangesInUse.end(); ++it) {
+      if (it->offset != offset) {
+        continue;
+      }
+      size_t size = it->size;
+      b.rangesInUse.erase(it);
+
+      // insert in free ranges, and merge with adjacent ones
+      auto next = b.freeRanges.lower_bound(offset);
+      if (next != b.freeRanges.end() && (offset + size == next->first)) {
+        size += next->second;
+        next = b.freeRanges.erase(next);
+      }
+      if (next != b.freeRanges.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+          prev->second += size;
+          return;
+        }
+      }
+      b.freeRanges[offset] = size;
+      return;
+    }
+    return;
+  }
 }
 
 // a global MemoryBankManager instance
 MemoryBankManager theMemoryBankManager;
 
 int MemoryBankManager::getMemoryRegions(std::vector<memoryRange>& ranges)
+{
+  std::vector<bankUsage> usage;
+  return getMemoryRegions(ranges, usage);
+}
+
+int MemoryBankManager::getMemoryRegions(std::vector<memoryRange>& ranges, std::vector<bankUsage>& usage)
 {
   std::unique_lock<std::mutex> lock(bankMutex);
   ranges.clear();
+  usage.clear();
   for (unsigned int ix = 0; ix < banks.size(); ix++) {
     memoryRange r;
     r.offset = (size_t)banks[ix].bank->getBaseAddress();
     r.size = (size_t)banks[ix].bank->getSize();
     ranges.push_back(r);
+
+    bankUsage u;
+    u.name = banks[ix].name;
+    u.size = r.size;
+    u.bytesInUse = 0;
+    for (const auto& rr : banks[ix].rangesInUse) {
+      u.bytesInUse += rr.size;
+    }
+    u.bytesFree = 0;
+    u.largestFreeRange = 0;
+    for (const auto& rr : banks[ix].freeRanges) {
+      u.bytesFree += rr.second;
+      u.largestFreeRange = std::max(u.largestFreeRange, rr.second);
+    }
+    u.numberOfRangesInUse = banks[ix].rangesInUse.size();
+    u.numberOfFreeRanges = banks[ix].freeRanges.size();
+    u.fragmentation = (u.bytesFree > 0) ? 1.0 - u.largestFreeRange / (double)u.bytesFree : 0.0;
+    usage.push_back(u);
   }
   return 0;
 }
 
-void MemoryBankManager::reset()
+void MemoryBankManager::reset(bool keepBanks)
 {
   std::unique_lock<std::mutex> lock(bankMutex);
-  for (auto& it : banks) {
-    int useCount = it.bank.use_count();
-    theLog.log(LogInfoDevel_(3008), "Releasing bank %s%s", it.name.c_str(), (useCount == 1) ? "" : "warning - still in use elsewhere !");
+  for (auto it = banks.begin(); it != banks.end();) {
+    if (it->rangesInUse.size()) {
+      theLog.log(LogInfoDevel_(3008), "Bank %s: %d memory range(s) still in use", it->name.c_str(), (int)it->rangesInUse.size());
+    }
+    if ((keepBanks) && (it->configuration.length())) {
+      // ranges still in use are given back to the bank when released
+      theLog.log(LogInfoDevel_(3008), "Keeping bank %s", it->name.c_str());
+      it->isKept = true;
+      ++it;
+      continue;
+    }
+    int useCount = it->bank.use_count();
+    theLog.log(LogInfoDevel_(3008), "Releasing bank %s%s", it->name.c_str(), (useCount == 1) ? "" : "warning - still in use elsewhere !");
+    it = banks.erase(it);
   }
-  banks.clear();
 }
@@ -21,9 +21,13 @@
 #include <map>
 #include <memory>
 #include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "MemoryBank.h"
 #include "MemoryPagesPool.h"
+#include "MemoryPagesSlabPool.h"
 
 class MemoryBankManager
 {
@@ -32,8 +36,16 @@ class MemoryBankManager
   MemoryBankManager();  // constructor
   ~MemoryBankManager(); // destructor
 
-  int addBank(std::shared_ptr<MemoryBank> bankPtr,
-              std::string name = ""); // add a named memory bank to the manager. By default, takes name from bank description
+  // add a named memory bank to the manager. By default, takes name from bank description
+  // configuration: optional description of the parameters used to create the bank. If set, the bank can be kept on reset() and reused by reuseBank().
+  // A bank kept with the same name is released.
+  int addBank(std::shared_ptr<MemoryBank> bankPtr, std::string name = "", std::string configuration = "");
+
+  // reuse a bank kept on last reset(), if it has given name and configuration. Returns true if the bank can be used, false otherwise (it has to be created again: a kept bank with same name and a different configuration is released immediately).
+  bool reuseBank(const std::string& name, const std::string& configuration);
+
+  // release the banks kept on last reset() and not reused since
+  void releaseUnusedBanks();
 
   // get a pool of pages from the manager, using the banks available
   // parameters:
@@ -42,9 +54,17 @@ class MemoryBankManager
   // - bankName: name of the bank from which to create the pool. If not specified, using the first bank.
   // - firstPageOffset: to control alignment of first page in pool. With zero, start from beginning of big block.
   // - blockAlign: alignment of beginning of big memory block from which pool is created. Pool will start at a multiple of this value.
-  // NB: trivial implementation, once a region from a bank has been used, it can not be reused after the corresponding pool of pages has been release ... don't want to deal with fragmentation etc
+  // The block is taken from the free range of the bank which fits best (smallest one big enough, after alignment).
+  // It is given back to the bank when the pool is destroyed, and merged with adjacent free ranges.
   std::shared_ptr<MemoryPagesPool> getPagedPool(size_t pageSize, size_t pageNumber, std::string bankName = "", size_t firstPageOffset = 0, size_t blockAlign = 0);
 
+  // get a pool of pages of different sizes (see MemoryPagesSlabPool) from the manager, using the banks available.
+  // All pages are taken from a single range of the bank, given back when the pool is destroyed.
+  // parameters:
+  // - sizeClasses: list of page sizes and corresponding number of pages
+  // - bankName, blockAlign: same as for getPagedPool()
+  std::shared_ptr<MemoryPagesSlabPool> getSlabPool(std::vector<MemoryPagesSlabPool::SizeClass> sizeClasses, std::string bankName = "", size_t blockAlign = 0);
+
   // a struct to define a memory range
   struct memoryRange {
     size_t offset; // beginning of memory range (bytes, counted from beginning of block)
@@ -56,17 +76,43 @@ class MemoryBankManager
     std::string name;                     // bank name
     std::shared_ptr<MemoryBank> bank;     // reference to bank instance
     std::vector<memoryRange> rangesInUse; // list of ranges (with reference to bank base address) currently used in the bank
+    std::map<size_t, size_t> freeRanges;  // list of ranges (offset -> size) currently free in the bank, ordered by offset, adjacent ranges merged
+    uint64_t id;                          // unique identifier of this bank registration
+    std::string configuration;            // parameters used to create the bank, if it can be kept on reset
+    bool isKept = false;                  // set when bank kept on reset, until reused
+  };
+
+  // a struct to report usage of a bank
+  struct bankUsage {
+    std::string name;           // bank name
+    size_t size;                // bank size (bytes)
+    size_t bytesInUse;          // total size of ranges in use (bytes)
+    size_t bytesFree;           // total size of free ranges (bytes)
+    size_t largestFreeRange;    // size of largest free range (bytes), i.e. biggest block which can still be allocated
+    size_t numberOfRangesInUse; // number of ranges in use
+    size_t numberOfFreeRanges;  // number of free ranges
+    double fragmentation;       // 1 - largestFreeRange / bytesFree (0 when free space is contiguous)
   };
 
   // get list of memory regions currently registered
   int getMemoryRegions(std::vector<memoryRange>& ranges);
 
+  // same as above, and also get usage report for each region (bank)
+  int getMemoryRegions(std::vector<memoryRange>& ranges, std::vector<bankUsage>& usage);
+
   // reset bank manager in fresh state, in particular: clear all banks
-  void reset();
+  // if keepBanks set, the banks with a configuration (see addBank) are not released, they can be reused on next configure.
+  void reset(bool keepBanks = false);
 
  private:
   std::vector<bankDescriptor> banks; // list of registered memory banks
   std::mutex bankMutex;              // instance mutex to handle concurrent access to public methods
+  uint64_t lastBankId = 0;           // counter used to assign bank ids
+
+  // reserve a range in a bank (see getPagedPool() parameters). blockSizeMax is the maximum space to use, the range is reduced by the alignment.
+  // Returns 0 on success, with base address of bank, offset and size of range, and bank id. Throws bad_alloc if not enough space.
+  int allocateRange(size_t blockSizeMax, std::string bankName, size_t blockAlign, void*& baseAddress, size_t& offset, size_t& blockSize, uint64_t& bankId);
+  void releaseRange(uint64_t bankId, size_t offset); // give back to the bank the range starting at given offset. Called on pool destruction.
 };
 
 // a global MemoryBankManager instance
@@ -10,10 +10,25 @@
 
 #include "MemoryPagesPool.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdio>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
-int MemoryPagesPoolStatsEnabled = 0; // flag to control memory stats
+int MemoryPagesPoolStatsEnabled = 0;   // flag to control memory stats
+int MemoryPagesPoolMagazineSize = 0;   // if non-zero, pools are created in multi-producer/multi-consumer mode, with this number of pages per magazine
+
+// assign a magazine index to each thread, round-robin
+static std::atomic<unsigned int> magazineThreadCounter(0);
+static int getThreadMagazineIndex(int numberOfMagazines)
+{
+  static thread_local unsigned int threadIndex = magazineThreadCounter++;
+  return threadIndex % numberOfMagazines;
+}
 
 MemoryPagesPool::MemoryPagesPool(size_t vPageSize, size_t vNumberOfPages, void* vBaseAddress, size_t vBaseSize, ReleaseCallback vCallback, size_t firstPageOffset)
 {
@@ -44,31 +59,72 @@ MemoryPagesPool::MemoryPagesPool(size_t vPageSize, size_t vNumberOfPages, void*
     numberOfPages = (baseBlockSize - firstPageOffset) / pageSize;
   }
 
-  // create a fifo and store list of pages available
-  pagesAvailable = std::make_unique<AliceO2::Common::Fifo<void*>>(numberOfPages);
+  // precompute constants used for page index / address validation
+  if (numberOfPages > 0) {
+    lastPageOffset = (numberOfPages - 1) * pageSize;
+  }
+  if ((pageSize & (pageSize - 1)) == 0) {
+    pageSizeShift = __builtin_ctzll(pageSize);
+  }
+
+  // select mode
+  if (MemoryPagesPoolMagazineSize > 0) {
+    magazineSize = (size_t)MemoryPagesPoolMagazineSize;
+    if (numberOfPages >= (size_t)UINT32_MAX) {
+      throw __LINE__;
+    }
+    for (int i = 0; i < numberOfMagazines; i++) {
+      magazines.push_back(std::make_unique<PageMagazine>());
+      magazines.back()->pages.reserve(2 * magazineSize);
+    }
+    pageLink = std::make_unique<std::atomic<uint32_t>[]>(numberOfPages);
+    chainLink = std::make_unique<std::atomic<uint32_t>[]>(numberOfPages);
+    for (size_t i = 0; i < numberOfPages; i++) {
+      pageLink[i] = 0;
+      chainLink[i] = 0;
+    }
+    depotHead = 0;
+    numberOfPagesAvailable = 0;
+  } else {
+    // create a fifo to store list of pages available
+    pagesAvailable = std::make_unique<AliceO2::Common::Fifo<void*>>(numberOfPages);
+  }
+
+  // store list of pages available
+  firstPageAddress = &((char*)baseBlockAddress)[firstPageOffset];
+  std::vector<void*> initialPages;
   void* ptr = nullptr;
-  int id = 0;
   for (size_t i = 0; i < numberOfPages; i++) {
     ptr = &((char*)baseBlockAddress)[firstPageOffset + i * pageSize];
-    pagesAvailable->push(ptr);
-    if (i == 0) {
-      firstPageAddress = ptr;
+    if (magazineSize) {
+      initialPages.push_back(ptr);
+    } else {
+      pagesAvailable->push(ptr);
     }
-    if (MemoryPagesPoolStatsEnabled) {
-      DataPageDescriptor d;
-      d.id = id;
-      d.ptr = ptr;
-      d.timeGetPage = 0.0;
-      d.timeGetDataBlock = 0.0;
-      d.timeReleasePage = 0.0;
-      d.nTimeUsed = 0;
-      pagesMap[ptr] = d;
-    }
-    id++;
   }
   lastPageAddress = ptr;
+  pagesContainerSlots = std::make_unique<PageContainerSlot[]>(numberOfPages);
+
+  if (magazineSize) {
+    // fill depot with full chains, remaining pages go to first magazine
+    // reverse order so that pages are used from beginning of block
+    std::reverse(initialPages.begin(), initialPages.end());
+    numberOfPagesAvailable = initialPages.size();
+    while (initialPages.size() >= magazineSize) {
+      depotPushChain(initialPages, magazineSize);
+    }
+    magazines[0]->pages = initialPages;
+  }
 
   if (MemoryPagesPoolStatsEnabled) {
+    // create page descriptors
+    pagesDescriptors = std::make_unique<DataPageDescriptor[]>(numberOfPages);
+    for (size_t i = 0; i < numberOfPages; i++) {
+      pagesDescriptors[i] = { 0, 0, 0, 0 };
+    }
+    numberOfPagesNeverUsed = numberOfPages;
+    ticksPerMicrosecond = getTicksPerMicrosecond();
+
     // enable histograms for t1..t4
     t1.enableHistogram(64, 1, 100000000);
     t2.enableHistogram(64, 1, 100000000);
@@ -79,7 +135,7 @@ MemoryPagesPool::MemoryPagesPool(size_t vPageSize, size_t vNumberOfPages, void*
 
 MemoryPagesPool::~MemoryPagesPool()
 {
-  if (MemoryPagesPoolStatsEnabled) {
+  if (pagesDescriptors != nullptr) {
     printf("memory pool statistics: \n");
     printf("getpage->getdatablock");
     printf(": avg=%.0lf  min=%llu  max=%llu  count=%llu \n", t1.getAverage(), (unsigned long long)t1.getMinimum(), (unsigned long long)t1.getMaximum(), (unsigned long long)t1.getCount());
@@ -122,14 +178,7 @@ MemoryPagesPool::~MemoryPagesPool()
       printf("%.1e   \t%.2lf\t%.2lf\t%.2lf\t%.2lf\n", t, tr1, tr2, tr3, tr4);
     }
 
-    int nNeverUsed = 0;
-    for (auto& p : pagesMap) {
-      // printf("page id %d used %d\n",p.second.id,p.second.nTimeUsed);
-      if (p.second.nTimeUsed <= 10) {
-        nNeverUsed++;
-      }
-    }
-    printf("Pages never used: %d\n", nNeverUsed);
+    printf("Pages never used: %lu\n", (unsigned long)numberOfPagesNeverUsed);
   }
 
   // if defined, use provided callback to release base block
@@ -140,27 +189,36 @@ MemoryPagesPool::~MemoryPagesPool()
 
 void* MemoryPagesPool::getPage()
 {
-  // update statistics
-  poolStats.set((CounterValue)getNumberOfPagesAvailable());
-
-  // get a page from fifo, if available
   void* ptr = nullptr;
-  pagesAvailable->pop(ptr);
+
+  if (magazineSize) {
+    // update statistics, if not busy elsewhere
+    if (statsMutex.try_lock()) {
+      poolStats.set((CounterValue)getNumberOfPagesAvailable());
+      statsMutex.unlock();
+    }
+    // get a page from magazines, if available
+    ptr = getPageMPMC();
+  } else {
+    // update statistics
+    poolStats.set((CounterValue)getNumberOfPagesAvailable());
+    // get a page from fifo, if available
+    pagesAvailable->pop(ptr);
+  }
 
   // stats
-  if (MemoryPagesPoolStatsEnabled) {
-    if (ptr != nullptr) {
-      auto search = pagesMap.find(ptr);
-      if (search != pagesMap.end()) {
-        search->second.timeGetPage = clock.getTime();
-        if (search->second.timeReleasePage > 0) {
-          t3.set((uint64_t)((search->second.timeGetPage - search->second.timeReleasePage) * 1000000));
-        }
-        search->second.timeGetDataBlock = 0;
-        search->second.timeReleasePage = 0;
-        search->second.nTimeUsed++;
-      }
+  if ((pagesDescriptors != nullptr) && (ptr != nullptr)) {
+    DataPageDescriptor& d = pagesDescriptors[getPageIndex(ptr)];
+    d.timeGetPage = getTicks();
+    if (d.timeReleasePage > 0) {
+      setTimeStats(t3, d.timeReleasePage, d.timeGetPage);
     }
+    d.timeGetDataBlock = 0;
+    d.timeReleasePage = 0;
+    if (d.nTimeUsed == 0) {
+      numberOfPagesNeverUsed--;
+    }
+    d.nTimeUsed++;
   }
 
   return ptr;
@@ -174,29 +232,237 @@ void MemoryPagesPool::releasePage(void* address)
   }
 
   // stats
-  if (MemoryPagesPoolStatsEnabled) {
-    auto search = pagesMap.find(address);
-    if (search != pagesMap.end()) {
-      search->second.timeReleasePage = clock.getTime();
-      if (search->second.timeGetDataBlock > 0) {
-        t2.set((uint64_t)((search->second.timeReleasePage - search->second.timeGetDataBlock) * 1000000));
-      }
-      if (search->second.timeGetPage > 0) {
-        t4.set((uint64_t)((search->second.timeReleasePage - search->second.timeGetPage) * 1000000));
-      }
+  if (pagesDescriptors != nullptr) {
+    DataPageDescriptor& d = pagesDescriptors[getPageIndex(address)];
+    d.timeReleasePage = getTicks();
+    if (d.timeGetDataBlock > 0) {
+      setTimeStats(t2, d.timeGetDataBlock, d.timeReleasePage);
+    }
+    if (d.timeGetPage > 0) {
+      setTimeStats(t4, d.timeGetPage, d.timeReleasePage);
     }
   }
 
   // put back page in list of available pages
-  pagesAvailable->push(address);
+  if (magazineSize) {
+    releasePageMPMC(address);
+  } else {
+    pagesAvailable->push(address);
+  }
+}
+
+uint32_t MemoryPagesPool::getPageIndex(void* address)
+{
+  size_t offset = (char*)address - (char*)firstPageAddress;
+  if (pageSizeShift >= 0) {
+    return (uint32_t)(offset >> pageSizeShift);
+  }
+  return (uint32_t)(offset / pageSize);
+}
+
+uint64_t MemoryPagesPool::getTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+double MemoryPagesPool::getTicksPerMicrosecond()
+{
+  // calibrated once, against the system steady clock
+  static double ticksPerMicrosecond = []() {
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t c0 = getTicks();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto t1 = std::chrono::steady_clock::now();
+    uint64_t c1 = getTicks();
+    double us = std::chrono::duration<double, std::micro>(t1 - t0).count();
+    if ((us <= 0) || (c1 <= c0)) {
+      return 1.0;
+    }
+    return (c1 - c0) / us;
+  }();
+  return ticksPerMicrosecond;
+}
+
+void MemoryPagesPool::setTimeStats(CounterStats& t, uint64_t tBegin, uint64_t tEnd)
+{
+  if (tEnd < tBegin) {
+    return;
+  }
+  CounterValue v = (CounterValue)((tEnd - tBegin) / ticksPerMicrosecond);
+  // stats may be updated concurrently by several threads, and read by getStats()
+  std::unique_lock<std::mutex> lock(statsMutex);
+  t.set(v);
+}
+
+void MemoryPagesPool::depotPushChain(std::vector<void*>& pages, size_t count)
+{
+  if ((count == 0) || (count > pages.size())) {
+    return;
+  }
+  // link pages of the chain together, starting from last one
+  uint32_t next = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t ix = getPageIndex(pages.back());
+    pages.pop_back();
+    pageLink[ix].store(next, std::memory_order_relaxed);
+    next = ix + 1;
+  }
+  uint32_t chainHead = next - 1;
+
+  // push chain on top of depot stack
+  uint64_t oldHead = depotHead.load(std::memory_order_relaxed);
+  for (;;) {
+    chainLink[chainHead].store((uint32_t)oldHead, std::memory_order_relaxed);
+    uint64_t newHead = (((oldHead >> 32) + 1) << 32) | (uint64_t)(chainHead + 1);
+    if (depotHead.compare_exchange_weak(oldHead, newHead, std::memory_order_release, std::memory_order_relaxed)) {
+      break;
+    }
+  }
+}
+
+bool MemoryPagesPool::depotPopChain(std::vector<void*>& pages)
+{
+  // take chain from top of depot stack
+  uint64_t oldHead = depotHead.load(std::memory_order_acquire);
+  uint32_t chainHead = 0;
+  for (;;) {
+    uint32_t top = (uint32_t)oldHead;
+    if (top == 0) {
+      return false;
+    }
+    chainHead = top - 1;
+    // the ABA tag protects against a concurrent pop/push of the same chain head
+    uint64_t newHead = (((oldHead >> 32) + 1) << 32) | (uint64_t)chainLink[chainHead].load(std::memory_order_relaxed);
+    if (depotHead.compare_exchange_weak(oldHead, newHead, std::memory_order_acquire, std::memory_order_acquire)) {
+      break;
+    }
+  }
+
+  // unlink pages of the chain
+  for (uint32_t next = chainHead + 1; next != 0;) {
+    uint32_t ix = next - 1;
+    pages.push_back(&((char*)firstPageAddress)[ix * pageSize]);
+    next = pageLink[ix].load(std::memory_order_relaxed);
+  }
+  return true;
+}
+
+void* MemoryPagesPool::getPageMPMC()
+{
+  void* ptr = nullptr;
+  int mIx = getThreadMagazineIndex(numberOfMagazines);
+  PageMagazine& m = *magazines[mIx];
+
+  {
+    std::unique_lock<std::mutex> lock(m.lock);
+    // refill from depot if magazine empty
+    if (m.pages.empty()) {
+      depotPopChain(m.pages);
+    }
+    if (!m.pages.empty()) {
+      ptr = m.pages.back();
+      m.pages.pop_back();
+    }
+  }
+
+  if (ptr == nullptr) {
+    // depot is empty: steal some pages from other magazines
+    std::vector<void*> stolen;
+    for (int i = 1; (i < numberOfMagazines) && (stolen.empty()); i++) {
+      PageMagazine& other = *magazines[(mIx + i) % numberOfMagazines];
+      std::unique_lock<std::mutex> lock(other.lock);
+      size_t n = (other.pages.size() + 1) / 2;
+      for (size_t j = 0; j < n; j++) {
+        stolen.push_back(other.pages.back());
+        other.pages.pop_back();
+      }
+    }
+    if (stolen.empty()) {
+      return nullptr;
+    }
+    ptr = stolen.back();
+    stolen.pop_back();
+    if (!stolen.empty()) {
+      std::unique_lock<std::mutex> lock(m.lock);
+      m.pages.insert(m.pages.end(), stolen.begin(), stolen.end());
+    }
+  }
+
+  numberOfPagesAvailable--;
+  return ptr;
+}
+
+void MemoryPagesPool::releasePageMPMC(void* address)
+{
+  PageMagazine& m = *magazines[getThreadMagazineIndex(numberOfMagazines)];
+  numberOfPagesAvailable++;
+
+  std::unique_lock<std::mutex> lock(m.lock);
+  m.pages.push_back(address);
+  // return a full batch to depot when magazine is full
+  if (m.pages.size() >= 2 * magazineSize) {
+    depotPushChain(m.pages, magazineSize);
+  }
 }
 
 size_t MemoryPagesPool::getPageSize() { return pageSize; }
 size_t MemoryPagesPool::getTotalNumberOfPages() { return numberOfPages; }
-size_t MemoryPagesPool::getNumberOfPagesAvailable() { return pagesAvailable->getNumberOfUsedSlots(); }
+size_t MemoryPagesPool::getNumberOfPagesAvailable()
+{
+  if (magazineSize) {
+    return numberOfPagesAvailable.load(std::memory_order_relaxed);
+  }
+  return pagesAvailable->getNumberOfUsedSlots();
+}
 void* MemoryPagesPool::getBaseBlockAddress() { return baseBlockAddress; }
 size_t MemoryPagesPool::getBaseBlockSize() { return baseBlockSize; }
 
+// allocator used for the DataBlockContainer of a page (and the shared_ptr control block)
+// memory is taken from the page storage slot, and the page is released when it is deallocated
+// i.e. after the last reference to the container is gone (including weak references)
+template <typename T>
+struct MemoryPagesPool::PageContainerAllocator {
+  using value_type = T;
+
+  MemoryPagesPool* pool;
+  void* page;
+
+  PageContainerAllocator(MemoryPagesPool* vPool, void* vPage) : pool(vPool), page(vPage) {}
+  template <typename U>
+  PageContainerAllocator(const PageContainerAllocator<U>& a) : pool(a.pool), page(a.page)
+  {
+  }
+
+  T* allocate(size_t n)
+  {
+    // T is the shared_ptr control block embedding the DataBlockContainer: check at compile time that it fits in slot,
+    // otherwise getNewDataBlockContainer() would fail for every page
+    static_assert(alignof(T) <= alignof(PageContainerSlot), "PageContainerSlot alignment too small");
+    static_assert(sizeof(T) <= sizeof(PageContainerSlot), "PageContainerSlot too small for DataBlockContainer and its shared_ptr control block");
+    if (n * sizeof(T) > sizeof(PageContainerSlot)) {
+      throw std::bad_alloc();
+    }
+    return (T*)pool->pagesContainerSlots[pool->getPageIndex(page)].storage;
+  }
+
+  void deallocate(T*, size_t) { pool->releasePage(page); }
+
+  template <typename U>
+  bool operator==(const PageContainerAllocator<U>& a) const
+  {
+    return page == a.page;
+  }
+  template <typename U>
+  bool operator!=(const PageContainerAllocator<U>& a) const
+  {
+    return page != a.page;
+  }
+};
+
 std::shared_ptr<DataBlockContainer> MemoryPagesPool::getNewDataBlockContainer(void* newPage)
 {
   // get a new page if none provided
@@ -214,32 +480,33 @@ std::shared_ptr<DataBlockContainer> MemoryPagesPool::getNewDataBlockContainer(vo
   }
 
   // stats
-  if (MemoryPagesPoolStatsEnabled) {
-    auto search = pagesMap.find(newPage);
-    if (search != pagesMap.end()) {
-      search->second.timeGetDataBlock = clock.getTime();
-      if (search->second.timeGetPage > 0) {
-        t1.set((uint64_t)((search->second.timeGetDataBlock - search->second.timeGetPage) * 1000000));
-      }
+  if (pagesDescriptors != nullptr) {
+    DataPageDescriptor& d = pagesDescriptors[getPageIndex(newPage)];
+    d.timeGetDataBlock = getTicks();
+    if (d.timeGetPage > 0) {
+      setTimeStats(t1, d.timeGetPage, d.timeGetDataBlock);
     }
   }
 
   // fill header at beginning of page assuming payload is contiguous after header
+  // or in header array, payload then using the full page
   DataBlock* b = (DataBlock*)newPage;
+  if (pagesHeaders != nullptr) {
+    b = &pagesHeaders[getPageIndex(newPage)];
+  }
   b->header = defaultDataBlockHeader;
   b->header.dataSize = getDataBlockMaxSize();
-  b->data = &(((char*)b)[headerReservedSpace]);
-
-  // define a function to put it back in pool after use
-  auto releaseCallback = [this, newPage](void) -> void {
-    this->releasePage(newPage);
-    return;
-  };
-
-  // create a container and associate data page and release callback
-  std::shared_ptr<DataBlockContainer> bc = std::make_shared<DataBlockContainer>(releaseCallback, (DataBlock*)newPage, pageSize);
+  b->data = &(((char*)newPage)[headerReservedSpace]);
+
+  // create a container and associate data page
+  // it is stored in the page slot, and page is put back in pool after use (see PageContainerAllocator)
+  std::shared_ptr<DataBlockContainer> bc = nullptr;
+  try {
+    bc = std::allocate_shared<DataBlockContainer>(PageContainerAllocator<DataBlockContainer>(this, newPage), b, (uint64_t)pageSize);
+  } catch (...) {
+  }
   if (bc == nullptr) {
-    releaseCallback();
+    releasePage(newPage);
     return nullptr;
   }
 
@@ -250,20 +517,89 @@ std::shared_ptr<DataBlockContainer> MemoryPagesPool::getNewDataBlockContainer(vo
 
 bool MemoryPagesPool::isPageValid(void* pagePtr)
 {
-  if (pagePtr < firstPageAddress) {
+  // single unsigned comparison covers both lower and upper bounds
+  size_t offset = (size_t)((char*)pagePtr - (char*)firstPageAddress);
+  if (offset > lastPageOffset) {
     return false;
   }
-  if (pagePtr > lastPageAddress) {
-    return false;
+  if (pageSizeShift >= 0) {
+    return (offset & (pageSize - 1)) == 0;
   }
-  if ((((char*)pagePtr - (char*)firstPageAddress) % pageSize) != 0) {
-    return false;
+  return (offset % pageSize) == 0;
+}
+
+int MemoryPagesPool::enablePageSideBuffer(size_t size)
+{
+  if (size == 0) {
+    return -1;
   }
-  return true;
+  // round up to cache line size, to avoid false sharing between pages
+  size = ((size + 63) / 64) * 64;
+  if (pagesSideBuffer != nullptr) {
+    return (size == pageSideBufferSize) ? 0 : -1;
+  }
+  pagesSideBuffer = std::unique_ptr<char[]>(new (std::nothrow) char[size * numberOfPages]);
+  if (pagesSideBuffer == nullptr) {
+    return -1;
+  }
+  pageSideBufferSize = size;
+  return 0;
+}
+
+void* MemoryPagesPool::getPageSideBuffer(void* page)
+{
+  if ((pagesSideBuffer == nullptr) || (!isPageValid(page))) {
+    return nullptr;
+  }
+  return &pagesSideBuffer[getPageIndex(page) * pageSideBufferSize];
+}
+
+size_t MemoryPagesPool::getPageSideBufferSize() { return pageSideBufferSize; }
+
+int MemoryPagesPool::enableOutOfBandHeaders()
+{
+  if (pagesHeaders != nullptr) {
+    return 0;
+  }
+  // pages should not be in use, their header would be lost
+  if (getNumberOfPagesAvailable() != numberOfPages) {
+    return -1;
+  }
+  pagesHeaders = std::unique_ptr<DataBlock[]>(new (std::nothrow) DataBlock[numberOfPages]);
+  if (pagesHeaders == nullptr) {
+    return -1;
+  }
+  headerReservedSpace = 0;
+  return 0;
+}
+
+bool MemoryPagesPool::isOutOfBandHeadersEnabled() { return (pagesHeaders != nullptr); }
+
+void* MemoryPagesPool::getPageFromDataBlock(DataBlock* b)
+{
+  if (pagesHeaders != nullptr) {
+    return (void*)b->data;
+  }
+  return (void*)b;
 }
 
 size_t MemoryPagesPool::getDataBlockMaxSize() { return pageSize - headerReservedSpace; }
 
-std::string MemoryPagesPool::getStats() {
-  return "number of pages used: " + std::to_string(poolStats.getTotal()) + " average free pages: " + std::to_string((uint64_t)poolStats.getAverage()) + " minimum free pages: " + std::to_string(poolStats.getMinimum());
+std::string MemoryPagesPool::getStats()
+{
+  // only running counters are read here, this may be called at any time
+  std::unique_lock<std::mutex> lock(statsMutex);
+  std::string stats = "number of pages used: " + std::to_string(poolStats.getTotal()) + " average free pages: " + std::to_string((uint64_t)poolStats.getAverage()) + " minimum free pages: " + std::to_string(poolStats.getMinimum());
+  if (pagesDescriptors != nullptr) {
+    // pages lifecycle, live values
+    auto timeStats = [&](const char* description, CounterStats& t) {
+      stats += std::string(" ") + description + " (us): avg=" + std::to_string((uint64_t)t.getAverage()) + " min=" + std::to_string(t.getMinimum()) + " max=" + std::to_string(t.getMaximum());
+    };
+    timeStats("getpage->getdatablock", t1);
+    timeStats("getdatablock->releasepage", t2);
+    timeStats("releasepage->getpage", t3);
+    timeStats("getpage->releasepage", t4);
+    stats += " pages never used: " + std::to_string(numberOfPagesNeverUsed);
+  }
+  return stats;
 }
@@ -13,18 +13,26 @@
 
 #include <Common/Fifo.h>
 #include <Common/Timer.h>
+#include <atomic>
 #include <functional>
-#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "CounterStats.h"
 #include "DataBlockContainer.h"
 
 // This class creates a pool of data pages from a memory block
-// Optimized for 1-1 consumers (1 thread to get the page, 1 thread to release them)
+// By default, optimized for 1-1 consumers (1 thread to get the page, 1 thread to release them)
+// When MemoryPagesPoolMagazineSize is set, the pool is created in multi-producer/multi-consumer mode:
+// each thread works on its own cache (magazine) of free pages, batch-refilled from / batch-returned to a shared lock-free depot.
 // No check is done on validity of address of data pages pushed back in queue Base address should be kept while object is in use
 
+// size of per-thread magazines for pools created from now on (0 = 1-1 mode), as set by readout.memoryPoolMagazineSize
+// components releasing pages from several threads need it to be set
+extern int MemoryPagesPoolMagazineSize;
+
 class MemoryPagesPool
 {
 
@@ -49,6 +57,7 @@ class MemoryPagesPool
 
   // methods to get and release page
   // the two functions can be called concurrently without locking (but a lock is needed if calling the same function concurrently)
+  // in multi-producer/multi-consumer mode, both functions can be called concurrently from any number of threads
   void* getPage();                 // get a new page from the pool (if available, nullptr if none)
   void releasePage(void* address); // insert back page to the pool after use, to make it available again
 
@@ -70,14 +79,49 @@ class MemoryPagesPool
 
   bool isPageValid(void* page); // check to see if a page address is valid
 
-  std::string getStats(); // return a string summarizing memory pool usage statistics
+  // per-page side buffers, to keep metadata associated to a page outside of the page itself (e.g. RDH packet index)
+  // all pages get a side buffer of same size, valid as long as the pool exists. Content is not reset between page uses.
+  int enablePageSideBuffer(size_t size); // allocate side buffers of given size for all pages. Returns 0 on success (or if already enabled with same size).
+  void* getPageSideBuffer(void* page);   // get side buffer associated to page (nullptr if not enabled or invalid page)
+  size_t getPageSideBufferSize();        // get size of each side buffer (zero if not enabled)
+
+  // out-of-band headers: the DataBlock headers are stored in a separate array (indexed by page number), instead of at the beginning of each page.
+  // The payload then starts at the beginning of the page and uses the full page, keeping the page alignment.
+  // Must be called before pages are used. Returns 0 on success (or if already enabled).
+  int enableOutOfBandHeaders();
+  bool isOutOfBandHeadersEnabled();          // returns true if out-of-band headers enabled
+  void* getPageFromDataBlock(DataBlock* b); // get the page associated to a data block returned by getNewDataBlockContainer()
+
+  std::string getStats(); // return a string summarizing memory pool usage statistics (including pages lifecycle, when memory pool stats enabled)
 
  private:
-  std::unique_ptr<AliceO2::Common::Fifo<void*>> pagesAvailable; // a buffer to keep track of individual pages
+  std::unique_ptr<AliceO2::Common::Fifo<void*>> pagesAvailable; // a buffer to keep track of individual pages (1-1 mode)
+
+  // multi-producer/multi-consumer mode
+  // free pages are kept in per-thread magazines. Full magazines are exchanged with a shared depot,
+  // a lock-free stack of chains of magazineSize pages (linked by page index).
+  static constexpr int numberOfMagazines = 16; // number of magazines. Threads are assigned one round-robin.
+  struct alignas(64) PageMagazine {
+    std::mutex lock;          // lock for this magazine, normally not contended (only when stealing pages)
+    std::vector<void*> pages; // free pages in this magazine
+  };
+  size_t magazineSize = 0;                                  // number of pages per batch exchanged with depot. Zero for 1-1 mode.
+  std::vector<std::unique_ptr<PageMagazine>> magazines;     // per-thread caches of free pages
+  std::unique_ptr<std::atomic<uint32_t>[]> pageLink;        // for each page: index+1 of next page in same chain (0 for end of chain)
+  std::unique_ptr<std::atomic<uint32_t>[]> chainLink;       // for each page heading a chain: index+1 of next chain head in depot (0 for end of depot)
+  alignas(64) std::atomic<uint64_t> depotHead;              // top of depot stack: (ABA tag << 32) | (chain head index + 1)
+  alignas(64) std::atomic<size_t> numberOfPagesAvailable;   // number of free pages (in depot and magazines)
+  std::mutex statsMutex;                                     // to protect poolStats in multi-producer/multi-consumer mode, and t1..t4
+
+  void depotPushChain(std::vector<void*>& pages, size_t count); // move last count pages from vector to depot, as a single chain
+  bool depotPopChain(std::vector<void*>& pages);                // append to vector the pages of a chain taken from depot. Returns false if depot empty.
+  void* getPageMPMC();                                          // getPage() in multi-producer/multi-consumer mode
+  void releasePageMPMC(void* address);                          // releasePage() in multi-producer/multi-consumer mode
+  uint32_t getPageIndex(void* address);                         // index of page in pool
 
   size_t numberOfPages;                           // number of pages
   size_t pageSize;                                // size of each page, in bytes
-  size_t headerReservedSpace = sizeof(DataBlock); // number of bytes reserved at top of each page for header
+  size_t headerReservedSpace = sizeof(DataBlock); // number of bytes reserved at top of each page for header (zero with out-of-band headers)
 
   void* baseBlockAddress; // address of block containing all pages
   size_t baseBlockSize;   // size of block containing all pages
@@ -86,20 +130,38 @@ class MemoryPagesPool
 
   ReleaseCallback releaseBaseBlockCallback; // the user function called in destructor, typically to release the baseAddress block.
 
-  AliceO2::Common::Timer clock; // a global clock
-
   // index to keep track of individual pages in pool
-  struct DataPageDescriptor {
-    int id;                  // page id
-    void* ptr;               // pointer to page
-    double timeGetPage;      // time of last getPage()
-    double timeGetDataBlock; // time of last getNewDataBlockContainer()
-    double timeReleasePage;  // time of last releasePage()
-    int nTimeUsed;
+  // descriptors are stored in a flat array, indexed by page number (see getPageIndex())
+  // times are in ticks of a cheap clock (TSC when available), see getTicks()
+  struct alignas(64) DataPageDescriptor {
+    uint64_t timeGetPage;      // time of last getPage()
+    uint64_t timeGetDataBlock; // time of last getNewDataBlockContainer()
+    uint64_t timeReleasePage;  // time of last releasePage()
+    uint64_t nTimeUsed;        // number of times the page was used
   };
+  std::unique_ptr<DataPageDescriptor[]> pagesDescriptors; // reference of all registered pages (when stats enabled)
+  std::atomic<size_t> numberOfPagesNeverUsed = 0;         // number of pages with nTimeUsed == 0 (when stats enabled)
+
+  static uint64_t getTicks();            // get current time, in ticks
+  static double getTicksPerMicrosecond(); // get clock frequency
+  double ticksPerMicrosecond = 1.0;      // clock frequency, cached at construction time
+
+  // per-page storage for the DataBlockContainer of each page and its shared_ptr control block,
+  // so that getNewDataBlockContainer() does not allocate memory. The page is released when its storage is freed.
+  struct alignas(64) PageContainerSlot {
+    char storage[192];
+  };
+  std::unique_ptr<PageContainerSlot[]> pagesContainerSlots;
+  template <typename T>
+  struct PageContainerAllocator; // allocator returning the storage slot of a page
+
+  std::unique_ptr<DataBlock[]> pagesHeaders; // out-of-band headers of all pages, contiguous, indexed by page number (if enabled)
+
+  std::unique_ptr<char[]> pagesSideBuffer; // side buffers of all pages, contiguous, indexed by page number
+  size_t pageSideBufferSize = 0;             // size of each side buffer
 
-  using DataPageMap = std::map<void*, DataPageDescriptor>;
-  DataPageMap pagesMap; // reference of all registered pages
+  size_t lastPageOffset = 0; // offset of last page from first page, for fast page address validation
+  int pageSizeShift = -1;    // log2(pageSize) if pageSize is a power of 2, or -1
 
   // statistics on time for superpage
   // t1: getpage->getdatablock
@@ -107,6 +169,7 @@ class MemoryPagesPool
   // t3: releasepage->getpage
   // t4: getpage->releasepage
   CounterStats t1, t2, t3, t4;
+  void setTimeStats(CounterStats& t, uint64_t tBegin, uint64_t tEnd); // add elapsed time (in microseconds) between 2 ticks to stats
   
   CounterStats poolStats; // keep track of number of free pages in the pool 
 };
@@ -0,0 +1,155 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#include "MemoryPagesSlabPool.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "ReadoutUtils.h"
+
+MemoryPagesSlabPool::MemoryPagesSlabPool(std::vector<SizeClass> sizeClasses, void* vBaseAddress, size_t vBaseSize, ReleaseCallback vCallback)
+{
+  baseBlockAddress = vBaseAddress;
+  baseBlockSize = vBaseSize;
+  releaseBaseBlockCallback = vCallback;
+
+  // check validity of parameters
+  if ((baseBlockAddress == nullptr) || (sizeClasses.size() == 0)) {
+    throw __LINE__;
+  }
+
+  // create pages of each class, by increasing size
+  // (same layout as in getSizeNeeded())
+  sortSizeClasses(sizeClasses);
+  size_t offset = 0;
+  for (const auto& c : sizeClasses) {
+    if ((c.pageSize <= sizeof(DataBlock)) || (c.numberOfPages == 0)) {
+      throw __LINE__;
+    }
+    offset = ((offset + classAlignment - 1) / classAlignment) * classAlignment;
+    size_t classSize = c.pageSize * c.numberOfPages;
+    if (offset + classSize > baseBlockSize) {
+      // block too small
+      throw __LINE__;
+    }
+    auto p = std::make_unique<SizeClassPool>();
+    p->pool = std::make_shared<MemoryPagesPool>(c.pageSize, c.numberOfPages, &(((char*)baseBlockAddress)[offset]), classSize);
+    p->dataBlockMaxSize = p->pool->getDataBlockMaxSize();
+    p->nRequests = 0;
+    p->nFallbacks = 0;
+    p->nFailures = 0;
+    pools.push_back(std::move(p));
+    offset += classSize;
+  }
+}
+
+MemoryPagesSlabPool::~MemoryPagesSlabPool()
+{
+  // release pools before the base block
+  pools.clear();
+
+  // if defined, use provided callback to release base block
+  if ((releaseBaseBlockCallback != nullptr) && (baseBlockAddress != nullptr)) {
+    releaseBaseBlockCallback(baseBlockAddress);
+  }
+}
+
+std::shared_ptr<DataBlockContainer> MemoryPagesSlabPool::getNewDataBlockContainer(size_t dataSize)
+{
+  // find smallest class fitting
+  size_t ix = 0;
+  for (; ix < pools.size(); ix++) {
+    if (pools[ix]->dataBlockMaxSize >= dataSize) {
+      break;
+    }
+  }
+  if (ix == pools.size()) {
+    return nullptr;
+  }
+  pools[ix]->nRequests++;
+
+  // take a page from this class, or from bigger ones if none left
+  for (size_t i = ix; i < pools.size(); i++) {
+    auto bc = pools[i]->pool->getNewDataBlockContainer();
+    if (bc != nullptr) {
+      if (i != ix) {
+        pools[ix]->nFallbacks++;
+      }
+      return bc;
+    }
+  }
+  pools[ix]->nFailures++;
+  return nullptr;
+}
+
+size_t MemoryPagesSlabPool::getDataBlockMaxSize() { return pools.back()->dataBlockMaxSize; }
+
+int MemoryPagesSlabPool::getNumberOfSizeClasses() { return (int)pools.size(); }
+
+std::shared_ptr<MemoryPagesPool> MemoryPagesSlabPool::getPool(int sizeClass)
+{
+  if ((sizeClass < 0) || (sizeClass >= (int)pools.size())) {
+    return nullptr;
+  }
+  return pools[sizeClass]->pool;
+}
+
+size_t MemoryPagesSlabPool::getSizeNeeded(std::vector<SizeClass> sizeClasses)
+{
+  // alignment padding depends on order: compute it for the actual layout
+  sortSizeClasses(sizeClasses);
+  size_t size = 0;
+  for (const auto& c : sizeClasses) {
+    size = ((size + classAlignment - 1) / classAlignment) * classAlignment;
+    size += c.pageSize * c.numberOfPages;
+  }
+  return size;
+}
+
+void MemoryPagesSlabPool::sortSizeClasses(std::vector<SizeClass>& sizeClasses)
+{
+  std::sort(sizeClasses.begin(), sizeClasses.end(), [](const SizeClass& a, const SizeClass& b) { return a.pageSize < b.pageSize; });
+}
+
+std::string MemoryPagesSlabPool::getStats()
+{
+  std::string stats;
+  for (const auto& p : pools) {
+    if (stats.length()) {
+      stats += " ; ";
+    }
+    stats += "class " + std::to_string(p->pool->getPageSize()) + " bytes x " + std::to_string(p->pool->getTotalNumberOfPages()) + " pages: free pages: " + std::to_string(p->pool->getNumberOfPagesAvailable()) + " requests: " + std::to_string(p->nRequests) + " fallbacks: " + std::to_string(p->nFallbacks) + " failures: " + std::to_string(p->nFailures) + " " + p->pool->getStats();
+  }
+  return stats;
+}
+
+int MemoryPagesSlabPool::getSizeClassesFromString(const std::string& s, std::vector<SizeClass>& sizeClasses)
+{
+  sizeClasses.clear();
+  std::vector<std::string> items;
+  getListFromString(s, items);
+  for (const auto& item : items) {
+    size_t ix = item.find(':');
+    if (ix == std::string::npos) {
+      return -1;
+    }
+    long long pageSize = ReadoutUtils::getNumberOfBytesFromString(item.substr(0, ix).c_str());
+    long long numberOfPages = std::atoll(item.substr(ix + 1).c_str());
+    if ((pageSize <= 0) || (numberOfPages <= 0)) {
+      return -1;
+    }
+    sizeClasses.push_back({ (size_t)pageSize, (size_t)numberOfPages });
+  }
+  if (sizeClasses.size() == 0) {
+    return -1;
+  }
+  return 0;
+}
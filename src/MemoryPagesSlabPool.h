@@ -0,0 +1,84 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#ifndef _MEMORYPAGESSLABPOOL_H
+#define _MEMORYPAGESSLABPOOL_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MemoryPagesPool.h"
+
+// This class creates pools of data pages of different sizes (size classes) from a single memory block.
+// Blocks are taken from the smallest class fitting the requested size,
+// or from the next bigger ones when it is exhausted.
+// This avoids using big pages to store small blocks.
+// Each class is a MemoryPagesPool, with the same properties for concurrent access.
+
+class MemoryPagesSlabPool
+{
+
+ public:
+  using ReleaseCallback = MemoryPagesPool::ReleaseCallback;
+
+  // definition of a size class
+  struct SizeClass {
+    size_t pageSize;      // size of each page (in bytes), including header
+    size_t numberOfPages; // number of pages of this size
+  };
+
+  // constructor
+  // parameters:
+  // - list of size classes. Pages of each class are created contiguously, in order of increasing page size.
+  // - base address and size of memory block where to create the pages. Should be big enough for sum of pageSize * numberOfPages (plus alignment of each class on 64 bytes).
+  // - a release callback to be called at destruction time, with baseAddress as argument
+  MemoryPagesSlabPool(std::vector<SizeClass> sizeClasses, void* baseAddress, size_t baseSize, ReleaseCallback callback = nullptr);
+
+  // destructor
+  ~MemoryPagesSlabPool();
+
+  // get an empty data block container, with usable payload size at least dataSize bytes.
+  // Returns nullptr if no page available big enough.
+  // The base header is filled, block->header.dataSize has usable page size (of the class used) and block->data points to it.
+  std::shared_ptr<DataBlockContainer> getNewDataBlockContainer(size_t dataSize);
+
+  size_t getDataBlockMaxSize();                            // returns usable payload size of biggest blocks available
+  int getNumberOfSizeClasses();                            // number of size classes
+  std::shared_ptr<MemoryPagesPool> getPool(int sizeClass); // access pool of pages of given size class
+
+  static size_t getSizeNeeded(std::vector<SizeClass> sizeClasses); // returns size of memory block needed for these size classes
+
+  std::string getStats(); // return a string summarizing usage statistics of each size class
+
+  // parse a list of size classes from a string "pageSize:numberOfPages,...", e.g. "1k:1000,64k:100". Returns 0 on success.
+  static int getSizeClassesFromString(const std::string& s, std::vector<SizeClass>& sizeClasses);
+
+ private:
+  static constexpr size_t classAlignment = 64; // alignment of the pages of each class
+  static void sortSizeClasses(std::vector<SizeClass>& sizeClasses); // sort size classes by increasing page size, i.e. in the order they are laid out in memory
+
+  struct SizeClassPool {
+    std::shared_ptr<MemoryPagesPool> pool; // pool of pages for this class
+    size_t dataBlockMaxSize;               // usable payload in each page of this class
+    std::atomic<uint64_t> nRequests;       // number of blocks requested in this class (smallest fitting)
+    std::atomic<uint64_t> nFallbacks;      // number of blocks requested in this class, but taken from a bigger one
+    std::atomic<uint64_t> nFailures;       // number of blocks requested in this class, not served
+  };
+  std::vector<std::unique_ptr<SizeClassPool>> pools; // one pool per size class, ordered by increasing page size
+
+  void* baseBlockAddress;                   // address of block containing all pages
+  size_t baseBlockSize;                     // size of block containing all pages
+  ReleaseCallback releaseBaseBlockCallback; // the user function called in destructor, typically to release the baseAddress block.
+};
+
+#endif // #ifndef _MEMORYPAGESSLABPOOL_H
@@ -1,3 +1,6 @@
+#ifndef _RATEREGULATOR_H
+#define _RATEREGULATOR_H
+
 #include <chrono>
 #include <math.h>
 
@@ -116,3 +119,5 @@ private:
   }
 
 */
+
+#endif // #ifndef _RATEREGULATOR_H
@@ -9,6 +9,10 @@
 // or submit itself to any jurisdiction.
 
 #include "RdhUtils.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 RdhHandle::RdhHandle(void* data) { rdhPtr = (o2::Header::RAWDataHeader*)data; }
 
 RdhHandle::~RdhHandle() {}
@@ -160,3 +164,143 @@ int RdhBlockHandle::printSummary()
 
   return 0;
 }
+
+int RdhHandle::validateRdh(const void* data, RdhPacketIndexEntry* packets, int numberOfPackets)
+{
+  // same checks as validateRdh(std::string&), without error message
+  // the fields checked are in the first 16 bytes of the RDH: version and headerSize (word0), offsetNextPacket (word2), linkId (word3)
+  int numberOfValidPackets = numberOfPackets;
+  int i = 0;
+#if defined(__SSE2__)
+  // 4 packets at a time: load their first 16 bytes, transpose to get each word of the 4 packets in a vector, and check them in parallel
+  const __m128i mask8 = _mm_set1_epi32(0xFF);
+  const __m128i mask16 = _mm_set1_epi32(0xFFFF);
+  const __m128i rdhSize = _mm_set1_epi32(sizeof(o2::Header::RAWDataHeader));
+  for (; i + 4 <= numberOfPackets; i += 4) {
+    __m128i r0 = _mm_loadu_si128((const __m128i*)((const uint8_t*)data + packets[i].offset));
+    __m128i r1 = _mm_loadu_si128((const __m128i*)((const uint8_t*)data + packets[i + 1].offset));
+    __m128i r2 = _mm_loadu_si128((const __m128i*)((const uint8_t*)data + packets[i + 2].offset));
+    __m128i r3 = _mm_loadu_si128((const __m128i*)((const uint8_t*)data + packets[i + 3].offset));
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+    __m128i word0 = _mm_unpacklo_epi64(t0, t1);
+    __m128i word2 = _mm_unpacklo_epi64(t2, t3);
+    __m128i word3 = _mm_unpackhi_epi64(t2, t3);
+
+    __m128i version = _mm_and_si128(word0, mask8);
+    __m128i headerSize = _mm_and_si128(_mm_srli_epi32(word0, 8), mask8);
+    __m128i offsetNextPacket = _mm_and_si128(word2, mask16);
+    __m128i linkId = _mm_and_si128(word3, mask8);
+    __m128i isValid = _mm_and_si128(_mm_or_si128(_mm_cmpeq_epi32(version, _mm_set1_epi32(5)), _mm_cmpeq_epi32(version, _mm_set1_epi32(6))), _mm_cmpeq_epi32(headerSize, rdhSize));
+    __m128i isInvalid = _mm_or_si128(_mm_cmpgt_epi32(linkId, _mm_set1_epi32(RdhMaxLinkId)), _mm_and_si128(_mm_cmpgt_epi32(offsetNextPacket, _mm_setzero_si128()), _mm_cmplt_epi32(offsetNextPacket, rdhSize)));
+    int invalidMask = (~_mm_movemask_ps(_mm_castsi128_ps(isValid)) | _mm_movemask_ps(_mm_castsi128_ps(isInvalid))) & 0xF;
+    for (int j = 0; j < 4; j++) {
+      packets[i + j].flags |= ((invalidMask >> j) & 1) ? RdhPacketFlagInvalid : 0;
+    }
+  }
+#endif
+  // remaining packets (or all, without SSE2), evaluated in a branch-free loop
+  for (; i < numberOfPackets; i++) {
+    const o2::Header::RAWDataHeader* rdh = (const o2::Header::RAWDataHeader*)((const uint8_t*)data + packets[i].offset);
+    uint8_t version = rdh->version;
+    uint16_t offsetNextPacket = rdh->offsetNextPacket;
+    bool isInvalid = ((version != 5) & (version != 6)) | (rdh->headerSize != sizeof(o2::Header::RAWDataHeader)) | ((uint8_t)rdh->linkId > RdhMaxLinkId) | ((offsetNextPacket > 0) & (offsetNextPacket < sizeof(o2::Header::RAWDataHeader)));
+    packets[i].flags |= isInvalid ? RdhPacketFlagInvalid : 0;
+  }
+  for (int i = 0; i < numberOfPackets; i++) {
+    if (packets[i].flags & RdhPacketFlagInvalid) {
+      numberOfValidPackets = i;
+      break;
+    }
+  }
+  return numberOfValidPackets;
+}
+
+void fillRdhPacketIndexEntry(RdhHandle& h, uint32_t offset, RdhPacketIndexEntry& entry)
+{
+  entry.offset = offset;
+  entry.hbOrbit = h.getHbOrbit();
+  entry.triggerOrbit = h.getTriggerOrbit();
+  entry.offsetNextPacket = h.getOffsetNextPacket();
+  entry.memorySize = h.getMemorySize();
+  entry.pagesCounter = h.getPagesCounter();
+  entry.linkId = h.getLinkId();
+  entry.flags = 0;
+  if (h.getStopBit()) {
+    entry.flags |= RdhPacketFlagStopBit;
+  }
+  if (h.getMemorySize() == h.getHeaderSize()) {
+    entry.flags |= RdhPacketFlagEmpty;
+  }
+}
+
+RdhPacketIndex* buildRdhPacketIndex(DataBlock* b, RdhPacketIndexEntry* packets, int maxPackets)
+{
+  if ((b == nullptr) || (b->data == nullptr) || (packets == nullptr)) {
+    return nullptr;
+  }
+  size_t blockSize = b->header.dataSize;
+  uint8_t* baseAddress = (uint8_t*)(b->data);
+  int numberOfPackets = 0;
+  bool isComplete = true;
+
+  // walk the RDH chain
+  for (size_t pageOffset = 0; pageOffset + sizeof(o2::Header::RAWDataHeader) <= blockSize;) {
+    if (numberOfPackets >= maxPackets) {
+      isComplete = false;
+      break;
+    }
+    RdhHandle h(baseAddress + pageOffset);
+    fillRdhPacketIndexEntry(h, (uint32_t)pageOffset, packets[numberOfPackets]);
+    numberOfPackets++;
+    uint16_t offsetNextPacket = h.getOffsetNextPacket();
+    if (offsetNextPacket == 0) {
+      break;
+    }
+    pageOffset += offsetNextPacket;
+  }
+
+  int numberOfValidPackets = RdhHandle::validateRdh(b->data, packets, numberOfPackets);
+  return setRdhPacketIndex(b, packets, numberOfPackets, numberOfValidPackets, isComplete);
+}
+
+// location of index in block header, aligned (userSpace is not)
+static RdhPacketIndex* getRdhPacketIndexLocation(DataBlock* b)
+{
+  uintptr_t p = (uintptr_t)&(b->header.userSpace[RdhPacketIndexUserSpaceOffset]);
+  p = (p + alignof(RdhPacketIndex) - 1) & ~((uintptr_t)alignof(RdhPacketIndex) - 1);
+  return (RdhPacketIndex*)p;
+}
+
+RdhPacketIndex* setRdhPacketIndex(DataBlock* b, RdhPacketIndexEntry* packets, int numberOfPackets, int numberOfValidPackets, bool isComplete)
+{
+  if (b == nullptr) {
+    return nullptr;
+  }
+  RdhPacketIndex* index = getRdhPacketIndexLocation(b);
+  index->numberOfPackets = numberOfPackets;
+  index->numberOfValidPackets = numberOfValidPackets;
+  index->isComplete = isComplete;
+  index->data = b->data;
+  index->dataSize = b->header.dataSize;
+  index->packets = packets;
+  index->magic = RdhPacketIndexMagic;
+  return index;
+}
+
+RdhPacketIndex* getRdhPacketIndex(DataBlock* b, bool isComplete)
+{
+  if (b == nullptr) {
+    return nullptr;
+  }
+  RdhPacketIndex* index = getRdhPacketIndexLocation(b);
+  if ((index->magic != RdhPacketIndexMagic) || (index->data != b->data) || (index->dataSize != b->header.dataSize)) {
+    return nullptr;
+  }
+  if ((isComplete) && (!index->isComplete)) {
+    return nullptr;
+  }
+  return index;
+}
@@ -15,11 +15,14 @@
 
 #include <string>
 
+#include "DataBlock.h"
 #include "RAWDataHeader.h"
 
 // Some constants
 const unsigned int RdhMaxLinkId = 31; // maximum ID of a linkId in RDH
 
+struct RdhPacketIndexEntry;
+
 // Utility class to access RDH fields and check them
 class RdhHandle
 {
@@ -35,6 +38,11 @@ class RdhHandle
   // Error message sets accordingly
   int validateRdh(std::string& err);
 
+  // check RDH content of a batch of packets, as listed in an index (see RdhPacketIndex)
+  // no error message is built: flag RdhPacketFlagInvalid is set for the packets failing the checks of validateRdh()
+  // returns the number of consecutive valid packets from the beginning of the batch
+  static int validateRdh(const void* data, RdhPacketIndexEntry* packets, int numberOfPackets);
+
   // print RDH content
   // offset is a value to be displayed as address. if -1, memory address is used.
   // singleLine: when set, RDH content printed in single line with top header printed once
@@ -83,4 +91,56 @@ class RdhBlockHandle
   size_t blockSize; // size of memory block
 };
 
+// Index of the RDH packets found in a data page.
+// It is computed once (typically, by the equipment when the page is received) and shared by the following
+// readout components, so that they don't have to walk and parse again the RDH chain of each page.
+// The index entries are stored in a side buffer (see MemoryPagesPool::getPageSideBuffer()),
+// and referenced from the DataBlockHeader.userSpace of the page.
+
+// flags of a packet in index
+const uint8_t RdhPacketFlagStopBit = 0x01; // RDH stop bit set
+const uint8_t RdhPacketFlagEmpty = 0x02;   // packet without payload (memorySize == headerSize)
+const uint8_t RdhPacketFlagInvalid = 0x04; // RDH did not pass validateRdh()
+
+// description of a packet in index
+struct RdhPacketIndexEntry {
+  uint32_t offset;           // offset of packet in page
+  uint32_t hbOrbit;          // RDH heartbeatOrbit
+  uint32_t triggerOrbit;     // RDH triggerOrbit
+  uint16_t offsetNextPacket; // RDH offsetNextPacket
+  uint16_t memorySize;       // RDH memorySize
+  uint16_t pagesCounter;     // RDH pagesCounter
+  uint8_t linkId;            // RDH linkId
+  uint8_t flags;             // combination of RdhPacketFlag* values
+};
+
+// reference to an index, stored in DataBlockHeader.userSpace
+struct RdhPacketIndex {
+  uint32_t magic;                // set to RdhPacketIndexMagic when index defined
+  uint32_t numberOfPackets;      // number of packets in index
+  uint32_t numberOfValidPackets; // number of consecutive valid packets from the beginning of page
+  uint32_t isComplete;           // set when index covers all packets of page, zero if truncated (too many packets)
+  const void* data;              // page payload indexed. Index is valid only if it matches current block data and size.
+  uint64_t dataSize;             // size of payload indexed
+  RdhPacketIndexEntry* packets;  // array of packets
+};
+
+const uint32_t RdhPacketIndexMagic = 0x1D8C1D8C;  // value of RdhPacketIndex.magic
+const uint32_t RdhPacketIndexUserSpaceOffset = 64; // location of RdhPacketIndex in DataBlockHeader.userSpace (beginning is used by other components). Aligned at runtime.
+static_assert(RdhPacketIndexUserSpaceOffset + sizeof(RdhPacketIndex) + alignof(RdhPacketIndex) <= DataBlockHeaderUserSpace, "RdhPacketIndex does not fit in DataBlock.userSpace");
+
+// fill an index entry from given RDH
+void fillRdhPacketIndexEntry(RdhHandle& h, uint32_t offset, RdhPacketIndexEntry& entry);
+
+// walk the RDH chain of the block payload, fill (up to maxPackets) entries, validate them, and store index reference in block header
+// returns the index, or nullptr on error
+RdhPacketIndex* buildRdhPacketIndex(DataBlock* b, RdhPacketIndexEntry* packets, int maxPackets);
+
+// store reference to an index already filled in block header
+RdhPacketIndex* setRdhPacketIndex(DataBlock* b, RdhPacketIndexEntry* packets, int numberOfPackets, int numberOfValidPackets, bool isComplete);
+
+// get index associated to block, if any (nullptr otherwise)
+// when isComplete is set, only an index covering the full page is returned
+RdhPacketIndex* getRdhPacketIndex(DataBlock* b, bool isComplete = true);
+
 #endif
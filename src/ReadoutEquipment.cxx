@@ -10,7 +10,9 @@
 
 #include "ReadoutEquipment.h"
 #include "ReadoutStats.h"
+#include "TimeframeAdmission.h"
 #include "readoutInfoLogger.h"
+#include <chrono>
 #include <inttypes.h>
 
 extern tRunNumber occRunNumber;
@@ -69,6 +71,9 @@ ReadoutEquipment::ReadoutEquipment(ConfigFile& cfg, std::string cfgEntryPoint, b
   // configuration parameter: | equipment-* | disableOutput | int | 0 | If non-zero, data generated by this equipment is discarded immediately and is not pushed to output fifo of readout thread. Used for testing. |
   cfg.getOptionalValue<int>(cfgEntryPoint + ".disableOutput", disableOutput);
 
+  // configuration parameter: | equipment-* | pageTimestampEnabled | int | 0 | If non-zero, each data page is tagged with the time it is pushed to the output fifo of readout thread. Used to measure the latency of the data path (e.g. by o2-readout-bench). |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".pageTimestampEnabled", cfgPageTimestampEnabled);
+
   // memory alignment
   // configuration parameter: | equipment-* | firstPageOffset | bytes | | Offset of the first page, in bytes from the beginning of the memory pool. If not set (recommended), will start at memoryPoolPageSize (one free page is kept before the first usable page for readout internal use). |
   std::string cfgStringFirstPageOffset = "0";
@@ -78,6 +83,9 @@ ReadoutEquipment::ReadoutEquipment(ConfigFile& cfg, std::string cfgEntryPoint, b
   std::string cfgStringBlockAlign = "2M";
   cfg.getOptionalValue<std::string>(cfgEntryPoint + ".blockAlign", cfgStringBlockAlign);
   size_t cfgBlockAlign = (size_t)ReadoutUtils::getNumberOfBytesFromString(cfgStringBlockAlign.c_str());
+  // configuration parameter: | equipment-* | pageHeadersOutOfBand | int | 0 | If set, the headers of data pages are stored in a separate array, instead of at the beginning of each page. The payload then uses the full page and is aligned on page boundaries (e.g. suitable for O_DIRECT). The first page starts at the beginning of the memory pool (unless firstPageOffset is set). |
+  int cfgPageHeadersOutOfBand = 0;
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".pageHeadersOutOfBand", cfgPageHeadersOutOfBand);
 
   // output periodic statistics on console
   // configuration parameter: | equipment-* | consoleStatsUpdateTime | double | 0 | If set, number of seconds between printing statistics on console. |
@@ -122,7 +130,22 @@ ReadoutEquipment::ReadoutEquipment(ConfigFile& cfg, std::string cfgEntryPoint, b
   cfg.getOptionalValue<int>(cfgEntryPoint + ".rdhDumpWarningEnabled", cfgRdhDumpWarningEnabled);
   // configuration parameter: | equipment-* | rdhUseFirstInPageEnabled | int | 0 or 1 | If set, the first RDH in each data page is used to populate readout headers (e.g. linkId). Default is 1 for  equipments generating data with RDH, 0 otherwsise. |
   cfg.getOptionalValue<int>(cfgEntryPoint + ".rdhUseFirstInPageEnabled", cfgRdhUseFirstInPageEnabled);
-  theLog.log(LogInfoDevel_(3002), "RDH settings: rdhCheckEnabled=%d rdhDumpEnabled=%d rdhDumpErrorEnabled=%d rdhDumpWarningEnabled=%d rdhUseFirstInPageEnabled=%d", cfgRdhCheckEnabled, cfgRdhDumpEnabled, cfgRdhDumpErrorEnabled, cfgRdhDumpWarningEnabled, cfgRdhUseFirstInPageEnabled);
+  // configuration parameter: | equipment-* | rdhIndexEnabled | int | 0 | If set, the RDH packets of each data page are indexed once when received (offsets, orbits, link, flags), and the index is shared with the next readout components (RDH check, consumers) so that they don't parse again the RDH chain. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".rdhIndexEnabled", cfgRdhIndexEnabled);
+  // configuration parameter: | equipment-* | rdhIndexMaxPackets | int | 1024 | Maximum number of RDH packets indexed per data page, when rdhIndexEnabled is set. Pages with more packets are not indexed. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".rdhIndexMaxPackets", cfgRdhIndexMaxPackets);
+  // configuration parameter: | equipment-* | rdhSplitTimeframesEnabled | int | 0 | If set, data pages containing RDH packets of several timeframes are split in several blocks, one per timeframe, each tagged with its timeframe id and orbit range. The blocks reference the same page (no copy). Requires rdhUseFirstInPageEnabled. Otherwise, a page is associated to the timeframe of its first RDH. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".rdhSplitTimeframesEnabled", cfgRdhSplitTimeframesEnabled);
+  if (!isRdhEquipment) {
+    cfgRdhIndexEnabled = 0;
+  }
+  if (cfgRdhIndexMaxPackets <= 0) {
+    cfgRdhIndexEnabled = 0;
+  }
+  if ((!cfgRdhUseFirstInPageEnabled) || (cfgDisableTimeframes)) {
+    cfgRdhSplitTimeframesEnabled = 0;
+  }
+  theLog.log(LogInfoDevel_(3002), "RDH settings: rdhCheckEnabled=%d rdhDumpEnabled=%d rdhDumpErrorEnabled=%d rdhDumpWarningEnabled=%d rdhUseFirstInPageEnabled=%d rdhIndexEnabled=%d rdhSplitTimeframesEnabled=%d", cfgRdhCheckEnabled, cfgRdhDumpEnabled, cfgRdhDumpErrorEnabled, cfgRdhDumpWarningEnabled, cfgRdhUseFirstInPageEnabled, cfgRdhIndexEnabled, cfgRdhSplitTimeframesEnabled);
 
   if (!cfgDisableTimeframes) {
     // configuration parameter: | equipment-* | TFperiod | int | 256 | Duration of a timeframe, in number of LHC orbits. |
@@ -154,6 +177,9 @@ ReadoutEquipment::ReadoutEquipment(ConfigFile& cfg, std::string cfgEntryPoint, b
   }
   pageSpaceReserved = sizeof(DataBlock); // reserve some data at beginning of each page for header,
                                          // keep beginning of payload aligned as requested in config
+  if (cfgPageHeadersOutOfBand) {
+    pageSpaceReserved = 0; // headers stored outside of pages
+  }
   size_t firstPageOffset = 0;            // alignment of 1st page of memory pool
   if (pageSpaceReserved) {
     // auto-align
@@ -172,9 +198,25 @@ ReadoutEquipment::ReadoutEquipment(ConfigFile& cfg, std::string cfgEntryPoint, b
     theLog.log(LogErrorSupport_(3230), "Failed to create pool of memory pages");
     throw __LINE__;
   }
+  if (cfgPageHeadersOutOfBand) {
+    if (mp->enableOutOfBandHeaders()) {
+      theLog.log(LogErrorSupport_(3230), "Failed to allocate out-of-band page headers");
+      throw __LINE__;
+    }
+    theLog.log(LogInfoDevel_(3008), "Page headers stored out-of-band, payload uses full pages");
+  }
   // todo: move page align to MemoryPool class
   assert(pageSpaceReserved == mp->getPageSize() - mp->getDataBlockMaxSize());
 
+  // side buffers for RDH packet index
+  if (cfgRdhIndexEnabled) {
+    if (mp->enablePageSideBuffer(cfgRdhIndexMaxPackets * sizeof(RdhPacketIndexEntry))) {
+      theLog.log(LogErrorSupport_(3230), "Failed to allocate RDH packet index for %d packets per page", cfgRdhIndexMaxPackets);
+      throw __LINE__;
+    }
+    theLog.log(LogInfoDevel_(3008), "RDH packet index enabled, up to %d packets per page (%d bytes per page)", cfgRdhIndexMaxPackets, (int)mp->getPageSideBufferSize());
+  }
+
   // create output fifo
   dataOut = std::make_shared<AliceO2::Common::Fifo<DataBlockContainerReference>>(cfgOutputFifoSize);
   if (dataOut == nullptr) {
@@ -212,8 +254,15 @@ void ReadoutEquipment::start()
   clk0.reset();
 
   // reset TF rate clock
-  TFregulator.init(cfgTfRateLimit);
+  // when global admission control is used, TF rate is enforced there (by dropping timeframes)
+  isTimeframeAdmissionEnabled = (gTimeframeAdmission.isEnabled()) && (!cfgDisableTimeframes);
+  isTimeframeDropped = false;
+  TFregulator.init(isTimeframeAdmissionEnabled ? 0 : cfgTfRateLimit);
+  if (isTimeframeAdmissionEnabled) {
+    gTimeframeAdmission.addMemoryPool(mp, &numberOfPagesReserved);
+  }
   throttlePendingBlock = nullptr;
+  splitPendingBlocks = {};
   
   // reset stats timer
   consoleStatsTimer.reset(cfgConsoleStatsUpdateTime * 1000000);
@@ -236,7 +285,11 @@ void ReadoutEquipment::stop()
   ReadoutEquipment::finalCounters();
 
   // cleanup
+  if (isTimeframeAdmissionEnabled) {
+    gTimeframeAdmission.removeMemoryPool(mp);
+  }
   throttlePendingBlock = nullptr;
+  splitPendingBlocks = {};
 
   for (int i = 0; i < (int)EquipmentStatsIndexes::maxIndex; i++) {
     if (equipmentStats[i].getCount()) {
@@ -330,6 +383,10 @@ Thread::CallbackResult ReadoutEquipment::threadCallback(void* arg)
       DataBlockContainerReference nextBlock = nullptr;
       if (ptr->throttlePendingBlock != nullptr) {      
         nextBlock = std::move(ptr->throttlePendingBlock);
+      } else if (!ptr->splitPendingBlocks.empty()) {
+        // next part of a split page, already tagged
+        nextBlock = std::move(ptr->splitPendingBlocks.front());
+        ptr->splitPendingBlocks.pop();
       } else {
 	try {
           nextBlock = ptr->getNextBlock();
@@ -368,11 +425,26 @@ Thread::CallbackResult ReadoutEquipment::threadCallback(void* arg)
 
 	// tag data with run number
 	nextBlock->getData()->header.runNumber = occRunNumber;
+
+	// split page if it contains several timeframes
+	if ((ptr->cfgRdhSplitTimeframesEnabled) && (nextBlock->getData()->header.isRdhFormat)) {
+          ptr->splitRdhTimeframes(nextBlock);
+	}
       }
       
       // check TF id of new block
       uint64_t tfId = nextBlock->getData()->header.timeframeId;
       if (tfId != ptr->lastTimeframe) {
+	// check global admission decision for this TF
+	if (ptr->isTimeframeAdmissionEnabled) {
+          ptr->isTimeframeDropped = !gTimeframeAdmission.isAccepted(tfId);
+	  if ((ptr->isTimeframeDropped) && (tfId > ptr->lastTimeframeDropped)) {
+            // count each TF once, even if links interleaved
+            ptr->statsTimeframesDropped++;
+            ptr->lastTimeframeDropped = tfId;
+	  }
+	}
+
 	// regulate TF rate if needed
 	if (!ptr->TFregulator.next()) {
           ptr->throttlePendingBlock = std::move(nextBlock); // keep block with new TF for later
@@ -380,7 +452,9 @@ Thread::CallbackResult ReadoutEquipment::threadCallback(void* arg)
 	  break;
 	}
 
-	ptr->statsNumberOfTimeframes++;
+	if (!ptr->isTimeframeDropped) {
+          ptr->statsNumberOfTimeframes++;
+	}
 
 	// detect gaps in TF id continuity
 	if (tfId != ptr->lastTimeframe + 1) {
@@ -391,6 +465,13 @@ Thread::CallbackResult ReadoutEquipment::threadCallback(void* arg)
       }
       ptr->lastTimeframe = tfId;
 
+      // discard blocks of dropped TF (page released to pool)
+      if (ptr->isTimeframeDropped) {
+        ptr->statsBlocksDropped++;
+        isActive = true;
+        continue;
+      }
+
       // update rate-limit clock
       if (ptr->readoutRate > 0) {
         ptr->clk.increment();
@@ -410,11 +491,18 @@ Thread::CallbackResult ReadoutEquipment::threadCallback(void* arg)
       }
 
       if (!ptr->disableOutput) {
+        // tag page with time it leaves the equipment
+        if (ptr->cfgPageTimestampEnabled) {
+          nextBlock->setTimestamp(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
         // push new page to output fifo
         ptr->dataOut->push(nextBlock);
       }
     }
     ptr->equipmentStats[EquipmentStatsIndexes::nBlocksOut].increment(nPushedOut);
+    if ((nPushedOut) && (ptr->dataOutNotifier != nullptr)) {
+      ptr->dataOutNotifier->notify();
+    }
 
     // prepare next blocks
     if (ptr->isDataOn) {
@@ -486,8 +574,14 @@ void ReadoutEquipment::initCounters()
   statsRdhCheckOk = 0;
   statsRdhCheckErr = 0;
   statsRdhCheckStreamErr = 0;
+  statsRdhSplitPages = 0;
+  statsRdhSplitBlocks = 0;
+  statsTimeframesDropped = 0;
+  statsBlocksDropped = 0;
+  lastTimeframeDropped = undefinedTimeframeId;
 
   statsNumberOfTimeframes = 0;
+  numberOfPagesReserved = 0;
 
   // reset timeframe clock
   currentTimeframe = undefinedTimeframeId;
@@ -506,6 +600,12 @@ void ReadoutEquipment::finalCounters()
   if (cfgRdhCheckEnabled) {
     theLog.log(LogInfoDevel_(3003), "Equipment %s : %llu timeframes, RDH checks %llu ok, %llu errors, %llu stream inconsistencies", name.c_str(), statsNumberOfTimeframes, statsRdhCheckOk, statsRdhCheckErr, statsRdhCheckStreamErr);
   }
+  if (cfgRdhSplitTimeframesEnabled) {
+    theLog.log(LogInfoDevel_(3003), "Equipment %s : %llu pages split in %llu blocks, on timeframe boundaries", name.c_str(), statsRdhSplitPages, statsRdhSplitBlocks);
+  }
+  if (isTimeframeAdmissionEnabled) {
+    theLog.log(LogInfoDevel_(3003), "Equipment %s : %llu timeframes dropped by admission control (%llu blocks)", name.c_str(), statsTimeframesDropped, statsBlocksDropped);
+  }
 };
 
 uint64_t ReadoutEquipment::getTimeframeFromOrbit(uint32_t hbOrbit)
@@ -589,6 +689,15 @@ int ReadoutEquipment::processRdh(DataBlockContainerReference& block)
     return -1;
   }
 
+  // index RDH packets, unless already done (e.g. by equipment when reading data)
+  RdhPacketIndex* index = getRdhPacketIndex(block->getData(), false);
+  if ((index == nullptr) && (cfgRdhIndexEnabled)) {
+    index = buildRdhPacketIndex(block->getData(), getRdhPacketIndexBuffer(block->getData()), cfgRdhIndexMaxPackets);
+  }
+  if ((index != nullptr) && (!index->isComplete)) {
+    index = nullptr; // partial index can not be used for the checks below
+  }
+
   // retrieve metadata from RDH, if configured to do so
   if ((cfgRdhUseFirstInPageEnabled) || (cfgRdhCheckEnabled)) {
     RdhHandle h(blockData);
@@ -624,7 +733,25 @@ int ReadoutEquipment::processRdh(DataBlockContainerReference& block)
 
       // printf("RDH #%d @ 0x%X : next block @ +%d bytes\n",rdhIndexInPage,(unsigned int)pageOffset,h.getOffsetNextPacket());
 
-      if (h.validateRdh(errorDescription)) {
+      // when page is indexed, RDH fields are taken from index (validated in batch), otherwise from RDH
+      // the index ends where the walk would leave the page: what remains is checked (and reported) as usual
+      const RdhPacketIndexEntry* entry = nullptr;
+      if ((index != nullptr) && (rdhIndexInPage <= (int)index->numberOfPackets)) {
+        entry = &index->packets[rdhIndexInPage - 1];
+      }
+      bool isRdhInvalid;
+      if (entry != nullptr) {
+        isRdhInvalid = (entry->flags & RdhPacketFlagInvalid);
+        if ((isRdhInvalid) && ((cfgRdhDumpEnabled) || (cfgRdhDumpErrorEnabled))) {
+          h.validateRdh(errorDescription); // get error details
+        }
+      } else {
+        isRdhInvalid = (h.validateRdh(errorDescription) != 0);
+      }
+      uint8_t rdhLinkId = (entry != nullptr) ? entry->linkId : h.getLinkId();
+      uint32_t rdhTriggerOrbit = (entry != nullptr) ? entry->triggerOrbit : h.getTriggerOrbit();
+
+      if (isRdhInvalid) {
         if ((cfgRdhDumpEnabled) || (cfgRdhDumpErrorEnabled)) {
           for (int i = 0; i < 16; i++) {
             printf("%08X ", (int)(((uint32_t*)baseAddress)[i]));
@@ -651,21 +778,21 @@ int ReadoutEquipment::processRdh(DataBlockContainerReference& block)
 
       // linkId should be same everywhere in page
       if (pageOffset == 0) {
-        linkId = h.getLinkId(); // keep link of 1st RDH
+        linkId = rdhLinkId; // keep link of 1st RDH
       }
-      if (linkId != h.getLinkId()) {
+      if (linkId != rdhLinkId) {
         if (cfgRdhDumpWarningEnabled) {
-          theLog.log(logRdhErrorsToken, "Equipment %d RDH #%d @ 0x%X : inconsistent link ids: %d != %d", id, rdhIndexInPage, (unsigned int)pageOffset, linkId, h.getLinkId());
+          theLog.log(logRdhErrorsToken, "Equipment %d RDH #%d @ 0x%X : inconsistent link ids: %d != %d", id, rdhIndexInPage, (unsigned int)pageOffset, linkId, rdhLinkId);
         }
         statsRdhCheckStreamErr++;
         break; // stop checking this page
       }
 
-      // check no timeframe overlap in page
-      if (!cfgDisableTimeframes) {
-	if (((blockHeader.timeframeOrbitFirst < blockHeader.timeframeOrbitLast) && ((h.getTriggerOrbit() < blockHeader.timeframeOrbitFirst) || (h.getTriggerOrbit() > blockHeader.timeframeOrbitLast))) || ((blockHeader.timeframeOrbitFirst > blockHeader.timeframeOrbitLast) && ((h.getTriggerOrbit() < blockHeader.timeframeOrbitFirst) && (h.getTriggerOrbit() > blockHeader.timeframeOrbitLast)))) {
+      // check no timeframe overlap in page (unless page is split afterwards)
+      if ((!cfgDisableTimeframes) && (!cfgRdhSplitTimeframesEnabled)) {
+	if (((blockHeader.timeframeOrbitFirst < blockHeader.timeframeOrbitLast) && ((rdhTriggerOrbit < blockHeader.timeframeOrbitFirst) || (rdhTriggerOrbit > blockHeader.timeframeOrbitLast))) || ((blockHeader.timeframeOrbitFirst > blockHeader.timeframeOrbitLast) && ((rdhTriggerOrbit < blockHeader.timeframeOrbitFirst) && (rdhTriggerOrbit > blockHeader.timeframeOrbitLast)))) {
           if (cfgRdhDumpErrorEnabled) {
-            theLog.log(logRdhErrorsToken, "Equipment %d RDH #%d @ 0x%X : TimeFrame ID change in page not allowed : orbit 0x%08X not in range [0x%08X,0x%08X]", id, rdhIndexInPage, (unsigned int)pageOffset, (int)h.getTriggerOrbit(), (int)blockHeader.timeframeOrbitFirst, (int)blockHeader.timeframeOrbitLast);
+            theLog.log(logRdhErrorsToken, "Equipment %d RDH #%d @ 0x%X : TimeFrame ID change in page not allowed : orbit 0x%08X not in range [0x%08X,0x%08X]", id, rdhIndexInPage, (unsigned int)pageOffset, (int)rdhTriggerOrbit, (int)blockHeader.timeframeOrbitFirst, (int)blockHeader.timeframeOrbitLast);
           }
           statsRdhCheckStreamErr++;
           break; // stop checking this page
@@ -693,7 +820,7 @@ int ReadoutEquipment::processRdh(DataBlockContainerReference& block)
 
       // todo: check counter increasing all have same TF id
 
-      uint16_t offsetNextPacket = h.getOffsetNextPacket();
+      uint16_t offsetNextPacket = (entry != nullptr) ? entry->offsetNextPacket : h.getOffsetNextPacket();
       if (offsetNextPacket == 0) {
         break;
       }
@@ -702,3 +829,96 @@ int ReadoutEquipment::processRdh(DataBlockContainerReference& block)
   }
   return 0;
 }
+
+int ReadoutEquipment::splitRdhTimeframes(DataBlockContainerReference& block)
+{
+  DataBlock* b = block->getData();
+  uint8_t* baseAddress = (uint8_t*)(b->data);
+  size_t blockSize = b->header.dataSize;
+  if (baseAddress == nullptr) {
+    return 0;
+  }
+
+  // walk the RDH chain (from index, if available), and find offsets where timeframe changes
+  // the page is associated to the timeframe of the 1st RDH (see tagDatablockFromRdh), this is the 1st range
+  RdhPacketIndex* index = getRdhPacketIndex(b);
+  std::vector<std::pair<size_t, uint64_t>> ranges; // list of (offset, timeframe id), after the 1st range
+  uint64_t currentTfId = b->header.timeframeId;
+  std::string errorDescription;
+  size_t pageOffset = 0;
+  for (unsigned int i = 0; pageOffset + sizeof(o2::Header::RAWDataHeader) <= blockSize; i++) {
+    uint32_t hbOrbit;
+    uint16_t offsetNextPacket;
+    if ((index != nullptr) && (i < index->numberOfPackets)) {
+      const RdhPacketIndexEntry& entry = index->packets[i];
+      if (entry.flags & RdhPacketFlagInvalid) {
+        break;
+      }
+      hbOrbit = entry.hbOrbit;
+      offsetNextPacket = entry.offsetNextPacket;
+    } else {
+      RdhHandle h(baseAddress + pageOffset);
+      if (h.validateRdh(errorDescription)) {
+        break; // stop on first RDH error, remaining data stays with the current timeframe
+      }
+      hbOrbit = h.getHbOrbit();
+      offsetNextPacket = h.getOffsetNextPacket();
+    }
+    uint64_t tfId = getTimeframeFromOrbit(hbOrbit);
+    if (tfId != currentTfId) {
+      ranges.push_back({ pageOffset, tfId });
+      currentTfId = tfId;
+    }
+    if (offsetNextPacket == 0) {
+      break;
+    }
+    pageOffset += offsetNextPacket;
+  }
+  if (ranges.empty()) {
+    return 0;
+  }
+
+  // create a block for each range, referencing the page
+  DataBlockContainerReference page = block;
+  size_t rangeBegin = 0;
+  uint64_t rangeTfId = b->header.timeframeId;
+  int nBlocks = 0;
+  for (unsigned int i = 0; i <= ranges.size(); i++) {
+    size_t rangeEnd = (i < ranges.size()) ? ranges[i].first : blockSize;
+    DataBlockContainerReference newBlock = nullptr;
+    try {
+      newBlock = std::make_shared<DataBlockContainerFromBlock>(page, rangeBegin, rangeEnd - rangeBegin);
+    } catch (...) {
+      static InfoLogger::AutoMuteToken token(LogWarningSupport_(3230));
+      theLog.log(token, "Equipment %s: failed to split page on timeframe boundary", name.c_str());
+      splitPendingBlocks = {};
+      block = page;
+      return 0;
+    }
+    DataBlockHeader& h = newBlock->getData()->header;
+    h.timeframeId = rangeTfId;
+    getTimeframeOrbitRange(rangeTfId, h.timeframeOrbitFirst, h.timeframeOrbitLast);
+    if (nBlocks == 0) {
+      block = newBlock;
+    } else {
+      h.blockId = ++currentBlockId;
+      splitPendingBlocks.push(newBlock);
+    }
+    nBlocks++;
+    if (i < ranges.size()) {
+      rangeBegin = ranges[i].first;
+      rangeTfId = ranges[i].second;
+    }
+  }
+  statsRdhSplitPages++;
+  statsRdhSplitBlocks += nBlocks;
+  return nBlocks;
+}
+
+RdhPacketIndexEntry* ReadoutEquipment::getRdhPacketIndexBuffer(DataBlock* b)
+{
+  if (!cfgRdhIndexEnabled) {
+    return nullptr;
+  }
+  return (RdhPacketIndexEntry*)mp->getPageSideBuffer(mp->getPageFromDataBlock(b));
+}
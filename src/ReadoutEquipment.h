@@ -12,12 +12,15 @@
 #include <Common/Fifo.h>
 #include <Common/Thread.h>
 #include <Common/Timer.h>
+#include <atomic>
 #include <memory>
+#include <queue>
 
 #include "CounterStats.h"
 #include "DataBlock.h"
 #include "DataBlockContainer.h"
 #include "DataSet.h"
+#include "EventNotifier.h"
 #include "MemoryBankManager.h"
 #include "MemoryHandler.h"
 #include "RdhUtils.h"
@@ -47,12 +50,13 @@ class ReadoutEquipment
   virtual void initCounters();
   virtual void finalCounters();
 
-  bool stopOnError = false; // if set, readout will stop when this equipment reports an error (isError flag)
-  int isError = 0;          // flag which might be used to count number of errors occuring in the equipment
+  bool stopOnError = false;     // if set, readout will stop when this equipment reports an error (isError flag)
+  std::atomic<int> isError = 0; // flag which might be used to count number of errors occuring in the equipment (updated from readout thread)
 
   // protected:
   // todo: give direct access to output FIFO?
   std::shared_ptr<AliceO2::Common::Fifo<DataBlockContainerReference>> dataOut;
+  std::shared_ptr<EventNotifier> dataOutNotifier; // if set, notified when new data pushed to dataOut
 
   // get current memory pool usage (available and total)
   int getMemoryUsage(size_t& numberOfPagesAvailable, size_t& numberOfPagesInPool);
@@ -120,12 +124,15 @@ class ReadoutEquipment
   uint16_t id = undefinedEquipmentId; // id of equipment (optional, used to tag data blocks)
 
   std::shared_ptr<MemoryPagesPool> mp; // a memory pool from which to allocate data pages
+  std::atomic<uint64_t> numberOfPagesReserved = 0; // number of pages taken from pool but not holding data yet (e.g. given to device for DMA), to be updated by equipment
   int memoryPoolPageSize = 0;          // size if each page in pool
   int memoryPoolNumberOfPages = 0;     // number of pages in pool
   std::string memoryBankName = "";     // memory bank to be used. by default, this uses the first memory bank available
 
   int disableOutput = 0; // when set true, data are dropped before pushing to output queue
 
+  int cfgPageTimestampEnabled = 0; // when set true, pages are tagged with time they are pushed to output queue
+
   size_t pageSpaceReserved = 0; // amount of space reserved (in bytes) at beginning of each data page, possibly to store header
 
   int debugFirstPages = 0; // print debug info on first number of pages read
@@ -153,16 +160,28 @@ class ReadoutEquipment
   int cfgRdhDumpErrorEnabled = 1;      // flag to enable RDH error log at runtime
   int cfgRdhDumpWarningEnabled = 0;    // flag to enable RDH warning log at runtime
   int cfgRdhUseFirstInPageEnabled = 0; // flag to enable reading of first RDH in page to populate readout headers
+  int cfgRdhIndexEnabled = 0;          // flag to enable indexing of RDH packets in page
+  int cfgRdhIndexMaxPackets = 1024;    // maximum number of RDH packets indexed per page
+  int cfgRdhSplitTimeframesEnabled = 0; // flag to enable splitting of pages containing packets of several timeframes
   //int cfgRdhCheckPacketCounterContiguous = 1; // flag to enable checking if RDH packetCounter value contiguous (done link-by-link)
   double cfgTfRateLimit = 0;           // TF rate limit, to throttle data readout
   int cfgDisableTimeframes = 0;        // When set, all TF features disabled
   RateRegulator TFregulator;           // clock counter for TF rate checks
   DataBlockContainerReference throttlePendingBlock; // in case TF rate limit was reached, a block may be set aside for later (when it belongs to next TF)
+  std::queue<DataBlockContainerReference> splitPendingBlocks; // blocks resulting from a page split, to be pushed out after the first one
+  bool isTimeframeAdmissionEnabled = false; // if set, TF rate is enforced by dropping timeframes rejected by the global admission control, instead of throttling readout
+  bool isTimeframeDropped = false;          // set when current timeframe was rejected by the global admission control
+  uint64_t lastTimeframeDropped = 0;        // id of last timeframe dropped by the global admission control
 
   bool isRdhEquipment = false; // to be set true for RDH equipments
 
   int processRdh(DataBlockContainerReference& nextBlock);
 
+  // split a page containing RDH packets of several timeframes, in blocks of a single timeframe referencing the page (no copy)
+  // block is replaced by the first one, the next ones are appended to splitPendingBlocks
+  // returns the number of blocks created (zero if page not split)
+  int splitRdhTimeframes(DataBlockContainerReference& block);
+
  protected:
   // get timeframe from orbit
   // orbit of TF 1 is set on first call
@@ -171,16 +190,26 @@ class ReadoutEquipment
 
   uint32_t getTimeframePeriodOrbits() { return timeframePeriodOrbits; }
 
+  // get buffer where to store the RDH packet index of given block (a page from the equipment memory pool)
+  // returns nullptr if RDH index disabled. Buffer size is getRdhPacketIndexMaxPackets() entries.
+  RdhPacketIndexEntry* getRdhPacketIndexBuffer(DataBlock* b);
+  int getRdhPacketIndexMaxPackets() { return cfgRdhIndexMaxPackets; }
+
   // compute range of orbits for given timeframe
   void getTimeframeOrbitRange(uint64_t tfId, uint32_t& hbOrbitMin, uint32_t& hbOrbitMax);
 
   unsigned long long statsRdhCheckOk = 0;        // number of RDH structs which have passed check ok
   unsigned long long statsRdhCheckErr = 0;       // number of RDH structs which have not passed check
   unsigned long long statsRdhCheckStreamErr = 0; // number of inconsistencies in RDH stream (e.g. ids/timing compared to previous RDH)
+  unsigned long long statsRdhSplitPages = 0;     // number of pages split because containing several timeframes
+  unsigned long long statsRdhSplitBlocks = 0;    // number of blocks created from split pages
+  unsigned long long statsTimeframesDropped = 0; // number of timeframes dropped by the admission control
+  unsigned long long statsBlocksDropped = 0;     // number of blocks dropped by the admission control
 };
 
 std::unique_ptr<ReadoutEquipment> getReadoutEquipmentDummy(ConfigFile& cfg, std::string cfgEntryPoint);
 std::unique_ptr<ReadoutEquipment> getReadoutEquipmentRORC(ConfigFile& cfg, std::string cfgEntryPoint);
+std::unique_ptr<ReadoutEquipment> getReadoutEquipmentRORCSimulator(ConfigFile& cfg, std::string cfgEntryPoint);
 std::unique_ptr<ReadoutEquipment> getReadoutEquipmentCruEmulator(ConfigFile& cfg, std::string cfgEntryPoint);
 std::unique_ptr<ReadoutEquipment> getReadoutEquipmentPlayer(ConfigFile& cfg, std::string cfgEntryPoint);
 std::unique_ptr<ReadoutEquipment> getReadoutEquipmentZmq(ConfigFile& cfg, std::string cfgEntryPoint);
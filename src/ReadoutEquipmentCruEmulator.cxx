@@ -10,7 +10,12 @@
 
 #include <Common/Fifo.h>
 #include <Common/Timer.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <stdlib.h>
+#include <string.h>
+#include <thread>
 
 #include "RAWDataHeader.h"
 #include "ReadoutEquipment.h"
@@ -53,6 +58,42 @@ class ReadoutEquipmentCruEmulator : public ReadoutEquipment
 
   double cfgEmptyHbRatio = 0.0;   // amount of empty HB frames
   int cfgPayloadSize = 64 * 1024; // maximum payload size, randomized
+  int cfgNumberOfThreads = 0;     // number of threads generating links in parallel (0 = equipment thread only)
+  int cfgRandomSeed = 0;          // seed for the random generators of each link
+
+  // a fast pseudo-random number generator (xoshiro256**), one per link
+  class randomGenerator
+  {
+   public:
+    void seed(uint64_t v)
+    {
+      // state initialized with splitmix64, as recommended
+      for (int i = 0; i < 4; i++) {
+        v += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = v;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        s[i] = z ^ (z >> 31);
+      }
+    }
+    uint64_t next()
+    {
+      uint64_t result = rotl(s[1] * 5, 7) * 9;
+      uint64_t t = s[1] << 17;
+      s[2] ^= s[0];
+      s[3] ^= s[1];
+      s[1] ^= s[2];
+      s[0] ^= s[3];
+      s[2] ^= t;
+      s[3] = rotl(s[3], 45);
+      return result;
+    }
+    double nextDouble() { return (next() >> 11) * 0x1.0p-53; } // uniform in [0,1)
+
+   private:
+    static inline uint64_t rotl(const uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+    uint64_t s[4];
+  };
 
   class linkState
   {
@@ -60,8 +101,33 @@ class ReadoutEquipmentCruEmulator : public ReadoutEquipment
     int HBpagecount = 0;
     int isEmpty = 0;
     int payloadBytesLeft = -1;
+    randomGenerator rng;                  // random generator for this link
+    o2::Header::RAWDataHeader rdhTemplate; // RDH with constant fields of this link already set
+    uint32_t endOrbit = 0;                // LHC orbit reached after last page filled
+    uint32_t endBc = 0;                   // LHC bunch crossing reached after last page filled
   };
-  std::map<int, linkState> perLinkState;
+  std::vector<linkState> perLinkState; // state of each link (indexed from 0 to numberOfLinks-1)
+
+  // RDH fields set for each packet, the others being constant for a link (see rdhTemplate)
+  // mask of their bits, as 64-bit words, to check if constant fields of a RDH in page are already set
+  static constexpr int rdhWords = sizeof(o2::Header::RAWDataHeader) / sizeof(uint64_t);
+  uint64_t rdhChangingFieldsMask[rdhWords];
+  bool isRdhConstantPartOk(const o2::Header::RAWDataHeader* rdh, const o2::Header::RAWDataHeader& rdhTemplate); // returns true if RDH has the constant fields of the template
+
+  void fillLink(int currentLink, uint32_t startOrbit, uint32_t startBc); // fill pending page of given link, starting from given LHC clock
+
+  // pool of threads filling the pages of links in parallel with the equipment thread
+  // thread i (the equipment thread being 0) fills links i, i+numberOfThreads, ...
+  std::vector<std::unique_ptr<std::thread>> workerThreads; // the worker threads
+  std::mutex workerMutex;                                 // lock for the variables below
+  std::condition_variable workerWakeUp;                   // to notify workers that a new set of pages is to be filled
+  std::condition_variable workerCompletion;               // to notify the equipment thread that workers are done
+  uint64_t workerGeneration = 0;                          // counter incremented for each new set of pages
+  int workersPending = 0;                                 // number of workers still filling the current set of pages
+  bool workerShutdown = false;                            // flag to stop workers
+  uint32_t workerStartOrbit = 0;                          // LHC orbit at which current set of pages starts
+  uint32_t workerStartBc = 0;                             // LHC bunch crossing at which current set of pages starts
+  void workerLoop(int threadIndex);                       // code executed by worker threads
 
   uint32_t LHCorbit = 0; // current LHC orbit
   uint32_t LHCbc = 0;    // current LHC bunch crossing
@@ -99,13 +165,45 @@ ReadoutEquipmentCruEmulator::ReadoutEquipmentCruEmulator(ConfigFile& cfg, std::s
   cfg.getOptionalValue<int>(cfgEntryPoint + ".HBperiod", cfgHBperiod);
   cfg.getOptionalValue<double>(cfgEntryPoint + ".EmptyHbRatio", cfgEmptyHbRatio);
   cfg.getOptionalValue<int>(cfgEntryPoint + ".PayloadSize", cfgPayloadSize);
+  // configuration parameter: | equipment-cruemulator-* | numberOfThreads | int | 0 | Number of threads generating the links data in parallel (the equipment thread being one of them). If 0 or 1, all links are generated in the equipment thread. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".numberOfThreads", cfgNumberOfThreads);
+  // configuration parameter: | equipment-cruemulator-* | randomSeed | int | 0 | Seed for the random generators of payload size and empty HB frames. Each link has its own generator, seeded from this value and link index, so that the data sequence is reproducible. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".randomSeed", cfgRandomSeed);
+  if (cfgNumberOfThreads > cfgNumberOfLinks) {
+    cfgNumberOfThreads = cfgNumberOfLinks;
+  }
+  if (cfgNumberOfThreads < 1) {
+    cfgNumberOfThreads = 1;
+  }
 
   // log config summary
-  theLog.log(LogInfoDevel_(3002), "Equipment %s: maxBlocksPerPage=%d cruBlockSize=%d numberOfLinks=%d systemId=%d cruId=%d dpwId=%d feeId=%d linkId=%d HBperiod=%d EmptyHbRatio=%f PayloadSize=%d", name.c_str(), cfgMaxBlocksPerPage, cruBlockSize, cfgNumberOfLinks, cfgSystemId, cfgCruId, cfgDpwId, cfgFeeId, cfgLinkId, cfgHBperiod, cfgEmptyHbRatio, cfgPayloadSize);
+  theLog.log(LogInfoDevel_(3002), "Equipment %s: maxBlocksPerPage=%d cruBlockSize=%d numberOfLinks=%d systemId=%d cruId=%d dpwId=%d feeId=%d linkId=%d HBperiod=%d EmptyHbRatio=%f PayloadSize=%d numberOfThreads=%d randomSeed=%d", name.c_str(), cfgMaxBlocksPerPage, cruBlockSize, cfgNumberOfLinks, cfgSystemId, cfgCruId, cfgDpwId, cfgFeeId, cfgLinkId, cfgHBperiod, cfgEmptyHbRatio, cfgPayloadSize, cfgNumberOfThreads, cfgRandomSeed);
 
   // initialize array of pending blocks (to be filled with data)
   pendingBlocks.resize(cfgNumberOfLinks);
 
+  // initialize state of each link, with RDH template
+  perLinkState.resize(cfgNumberOfLinks);
+  for (int i = 0; i < cfgNumberOfLinks; i++) {
+    o2::Header::RAWDataHeader& rdh = perLinkState[i].rdhTemplate;
+    rdh.systemId = cfgSystemId;
+    rdh.cruId = cfgCruId;
+    rdh.dpwId = cfgDpwId;
+    rdh.feeId = cfgFeeId;
+    rdh.linkId = cfgLinkId + i;
+    rdh.offsetNextPacket = cruBlockSize;
+  }
+  o2::Header::RAWDataHeader mask;
+  memset((void*)&mask, 0, sizeof(mask));
+  // decrement from zero sets all bits of the field
+  mask.triggerOrbit--;
+  mask.triggerBC--;
+  mask.heartbeatOrbit--;
+  mask.pagesCounter--;
+  mask.memorySize--;
+  mask.stopBit--;
+  memcpy(rdhChangingFieldsMask, &mask, sizeof(mask));
+
   // output queue: 1 block per link
   readyBlocks = std::make_unique<AliceO2::Common::Fifo<DataBlockContainerReference>>(cfgNumberOfLinks);
   if (readyBlocks == nullptr) {
@@ -115,9 +213,53 @@ ReadoutEquipmentCruEmulator::ReadoutEquipmentCruEmulator(ConfigFile& cfg, std::s
   // init parameters
   bcStep = (int)(LHCBCRate * ((cruBlockSize - sizeof(o2::Header::RAWDataHeader)) * 1.0 / (cfgGbtLinkThroughput * 1024 * 1024 * 1024 / 8)));
   theLog.log(LogInfoDevel_(3002), "Equipment %s: using block rate = %d BC", name.c_str(), bcStep);
+
+  // start worker threads
+  for (int i = 1; i < cfgNumberOfThreads; i++) {
+    workerThreads.push_back(std::make_unique<std::thread>(&ReadoutEquipmentCruEmulator::workerLoop, this, i));
+  }
+}
+
+ReadoutEquipmentCruEmulator::~ReadoutEquipmentCruEmulator()
+{
+  // stop worker threads
+  {
+    std::unique_lock<std::mutex> lock(workerMutex);
+    workerShutdown = true;
+  }
+  workerWakeUp.notify_all();
+  for (auto& t : workerThreads) {
+    t->join();
+  }
 }
 
-ReadoutEquipmentCruEmulator::~ReadoutEquipmentCruEmulator() {}
+void ReadoutEquipmentCruEmulator::workerLoop(int threadIndex)
+{
+  uint64_t lastGeneration = 0;
+  for (;;) {
+    uint32_t startOrbit, startBc;
+    {
+      std::unique_lock<std::mutex> lock(workerMutex);
+      workerWakeUp.wait(lock, [&] { return workerShutdown || (workerGeneration != lastGeneration); });
+      if (workerShutdown) {
+        return;
+      }
+      lastGeneration = workerGeneration;
+      startOrbit = workerStartOrbit;
+      startBc = workerStartBc;
+    }
+    for (int i = threadIndex; i < cfgNumberOfLinks; i += cfgNumberOfThreads) {
+      fillLink(i, startOrbit, startBc);
+    }
+    {
+      std::unique_lock<std::mutex> lock(workerMutex);
+      workersPending--;
+      if (workersPending == 0) {
+        workerCompletion.notify_one();
+      }
+    }
+  }
+}
 
 Thread::CallbackResult ReadoutEquipmentCruEmulator::prepareBlocks()
 {
@@ -162,137 +304,175 @@ Thread::CallbackResult ReadoutEquipmentCruEmulator::prepareBlocks()
 
   // at this point, we have 1 free page per link... fill it!
 
-  o2::Header::RAWDataHeader defaultRDH; // a default RDH
-
-  unsigned int nowOrbit = LHCorbit;
-  unsigned int nowBc = LHCbc;
+  // the timeframe reference is set on first call, do it before links are filled in parallel
+  getTimeframeFromOrbit(LHCorbit);
+
+  if (workerThreads.size()) {
+    // wake up workers, and fill our share of the links
+    {
+      std::unique_lock<std::mutex> lock(workerMutex);
+      workerStartOrbit = LHCorbit;
+      workerStartBc = LHCbc;
+      workersPending = (int)workerThreads.size();
+      workerGeneration++;
+    }
+    workerWakeUp.notify_all();
+    for (int i = 0; i < cfgNumberOfLinks; i += cfgNumberOfThreads) {
+      fillLink(i, LHCorbit, LHCbc);
+    }
+    std::unique_lock<std::mutex> lock(workerMutex);
+    workerCompletion.wait(lock, [&] { return workersPending == 0; });
+  } else {
+    for (int i = 0; i < cfgNumberOfLinks; i++) {
+      fillLink(i, LHCorbit, LHCbc);
+    }
+  }
 
+  // pages ready, in links order
   for (int currentLink = 0; currentLink < cfgNumberOfLinks; currentLink++) {
+    readyBlocks->push(pendingBlocks[currentLink]);
+    pendingBlocks[currentLink] = nullptr;
+  }
+
+  // LHC clock continues from where last link stopped
+  LHCorbit = perLinkState[cfgNumberOfLinks - 1].endOrbit;
+  LHCbc = perLinkState[cfgNumberOfLinks - 1].endBc;
 
-    // fill the new data page for this link
-    DataBlock* b = pendingBlocks[currentLink]->getData();
-
-    // printf ("data block %p data=%p\n",b,b->data);
-
-    int offset; // number of bytes used in page
-    int nBlocksInPage = 0;
-
-    nowOrbit = LHCorbit;
-    nowBc = LHCbc;
-    uint64_t nowId = getTimeframeFromOrbit(nowOrbit);
-
-    int linkId = cfgLinkId + currentLink;
-    int bytesAvailableInPage = b->header.dataSize; // a bit less than memoryPoolPageSize;
-    // printf("bytes available: %d bytes\n",bytesAvailableInPage);
-
-    linkState& ls = perLinkState[linkId];
-    // printf("link %d: %d\n",linkId,ls.payloadBytesLeft);
-
-    for (offset = 0; offset + cruBlockSize <= bytesAvailableInPage; offset += cruBlockSize) {
-
-      if ((ls.payloadBytesLeft < 0)) {
-        // this is a new HB frame
-
-        unsigned int nextBc = nowBc + bcStep;
-        unsigned int nextOrbit = nowOrbit;
-        if (nextBc >= LHCBunches) {
-          nextOrbit += nextBc / LHCBunches;
-          nextBc = nextBc % LHCBunches;
-          unsigned int nextId = getTimeframeFromOrbit(nextOrbit); // timeframe ID
-          if (nextId != nowId) {
-            if (offset) {
-              // force page change on timeframe boundary
-              // printf("TF boundary : %d != %d\n",nextId,nowId);
-              break;
-            } else {
-              // ok to change TFid when it's the first clock step
-              nowId = nextId;
-            }
+  return Thread::CallbackResult::Ok;
+}
+
+void ReadoutEquipmentCruEmulator::fillLink(int currentLink, uint32_t startOrbit, uint32_t startBc)
+{
+  // fill the new data page for this link
+  DataBlock* b = pendingBlocks[currentLink]->getData();
+
+  // printf ("data block %p data=%p\n",b,b->data);
+
+  int offset; // number of bytes used in page
+  int nBlocksInPage = 0;
+
+  unsigned int nowOrbit = startOrbit;
+  unsigned int nowBc = startBc;
+  uint64_t nowId = getTimeframeFromOrbit(nowOrbit);
+
+  int linkId = cfgLinkId + currentLink;
+  int bytesAvailableInPage = b->header.dataSize; // a bit less than memoryPoolPageSize;
+  // printf("bytes available: %d bytes\n",bytesAvailableInPage);
+
+  linkState& ls = perLinkState[currentLink];
+  // printf("link %d: %d\n",linkId,ls.payloadBytesLeft);
+
+  for (offset = 0; offset + cruBlockSize <= bytesAvailableInPage; offset += cruBlockSize) {
+
+    if ((ls.payloadBytesLeft < 0)) {
+      // this is a new HB frame
+
+      unsigned int nextBc = nowBc + bcStep;
+      unsigned int nextOrbit = nowOrbit;
+      if (nextBc >= LHCBunches) {
+        nextOrbit += nextBc / LHCBunches;
+        nextBc = nextBc % LHCBunches;
+        unsigned int nextId = getTimeframeFromOrbit(nextOrbit); // timeframe ID
+        if (nextId != nowId) {
+          if (offset) {
+            // force page change on timeframe boundary
+            // printf("TF boundary : %d != %d\n",nextId,nowId);
+            break;
+          } else {
+            // ok to change TFid when it's the first clock step
+            nowId = nextId;
           }
         }
-        nowBc = nextBc;
-        nowOrbit = nextOrbit;
-
-        ls.HBpagecount = 0;
-
-        // create empty HB?
-        if (rand() < cfgEmptyHbRatio * RAND_MAX) {
-          ls.isEmpty = 1;
-          ls.payloadBytesLeft = 0;
-        } else {
-          // HB with random payload size
-          ls.isEmpty = 0;
-          ls.payloadBytesLeft = cfgPayloadSize * (rand() * 1.0 / RAND_MAX);
-        }
-
-      } else {
-        // continue with current HB
-        ls.HBpagecount++;
       }
+      nowBc = nextBc;
+      nowOrbit = nextOrbit;
 
-      int nowHb = nowOrbit / cfgHBperiod;
-      // printf("orbit=%d bc=%d HB=%d\n",nowOrbit,nowBc,nowHb);
-
-      // rdh as defined in:
-      // https://docs.google.com/document/d/1KUoLnEw5PndVcj4FKR5cjV-MBN3Bqfx_B0e6wQOIuVE/edit#heading=h.5q65he8hp62c
-
-      o2::Header::RAWDataHeader* rdh = (o2::Header::RAWDataHeader*)&b->data[offset];
-      // printf("rdh=%p block=%p delta=%d\n",rdh,b->data,(int)((char *)rdh-(char *)b->data));
-
-      *rdh = defaultRDH; // reset fields to defaults
-      rdh->triggerOrbit = nowOrbit;
-      rdh->triggerBC = nowBc;
-      rdh->heartbeatOrbit = nowHb;
-      rdh->systemId = cfgSystemId;
-      rdh->cruId = cfgCruId;
-      rdh->dpwId = cfgDpwId;
-      rdh->feeId = cfgFeeId;
-      rdh->linkId = linkId;
-      rdh->offsetNextPacket = cruBlockSize;
-
-      rdh->pagesCounter = ls.HBpagecount;
-      if (ls.payloadBytesLeft > 0) {
-        int bytesNow = ls.payloadBytesLeft;
-        if (bytesNow + (int)sizeof(o2::Header::RAWDataHeader) > cruBlockSize) {
-          bytesNow = cruBlockSize - sizeof(o2::Header::RAWDataHeader);
-        }
-        ls.payloadBytesLeft -= bytesNow;
-        rdh->memorySize = sizeof(o2::Header::RAWDataHeader) + bytesNow;
-        if (ls.payloadBytesLeft <= 0) {
-          ls.payloadBytesLeft = 0;
-          rdh->stopBit = 1;
-          ls.payloadBytesLeft = -1;
-        }
+      ls.HBpagecount = 0;
+
+      // create empty HB?
+      if (ls.rng.nextDouble() < cfgEmptyHbRatio) {
+        ls.isEmpty = 1;
+        ls.payloadBytesLeft = 0;
       } else {
-        rdh->memorySize = sizeof(o2::Header::RAWDataHeader);
-        if (!((ls.isEmpty) && (ls.HBpagecount == 0))) {
-          rdh->stopBit = 1;
-          ls.payloadBytesLeft = -1;
-        }
+        // HB with random payload size
+        ls.isEmpty = 0;
+        ls.payloadBytesLeft = cfgPayloadSize * ls.rng.nextDouble();
       }
 
-      // printf("block %p offset %d / %d, link %d @ %p data=%p\n",b,offset,memPoolElementSize,linkId,rdh,b->data);
-      // dumpRDH(rdh);
-      nBlocksInPage++;
+    } else {
+      // continue with current HB
+      ls.HBpagecount++;
     }
 
-    // size used (bytes) in page is last offset
-    int dSize = offset;
+    int nowHb = nowOrbit / cfgHBperiod;
+    // printf("orbit=%d bc=%d HB=%d\n",nowOrbit,nowBc,nowHb);
 
-    // printf("wrote %d bytes\n",dSize);
+    // rdh as defined in:
+    // https://docs.google.com/document/d/1KUoLnEw5PndVcj4FKR5cjV-MBN3Bqfx_B0e6wQOIuVE/edit#heading=h.5q65he8hp62c
 
-    // no need to fill header defaults, this is done by getNewDataBlockContainer()
-    // only adjust payload size
-    b->header.dataSize = dSize;
-    b->header.linkId = linkId;
+    o2::Header::RAWDataHeader* rdh = (o2::Header::RAWDataHeader*)&b->data[offset];
+    // printf("rdh=%p block=%p delta=%d\n",rdh,b->data,(int)((char *)rdh-(char *)b->data));
 
-    readyBlocks->push(pendingBlocks[currentLink]);
-    pendingBlocks[currentLink] = nullptr;
+    // constant fields copied from the link template, unless already there (page previously used for this link),
+    // then only the fields changing with each packet are set
+    if (!isRdhConstantPartOk(rdh, ls.rdhTemplate)) {
+      memcpy((void*)rdh, &ls.rdhTemplate, sizeof(o2::Header::RAWDataHeader));
+    }
+    rdh->triggerOrbit = nowOrbit;
+    rdh->triggerBC = nowBc;
+    rdh->heartbeatOrbit = nowHb;
+
+    rdh->pagesCounter = ls.HBpagecount;
+    int stopBit = ls.rdhTemplate.stopBit; // default value, if not last packet of HB frame
+    if (ls.payloadBytesLeft > 0) {
+      int bytesNow = ls.payloadBytesLeft;
+      if (bytesNow + (int)sizeof(o2::Header::RAWDataHeader) > cruBlockSize) {
+        bytesNow = cruBlockSize - sizeof(o2::Header::RAWDataHeader);
+      }
+      ls.payloadBytesLeft -= bytesNow;
+      rdh->memorySize = sizeof(o2::Header::RAWDataHeader) + bytesNow;
+      if (ls.payloadBytesLeft <= 0) {
+        ls.payloadBytesLeft = 0;
+        stopBit = 1;
+        ls.payloadBytesLeft = -1;
+      }
+    } else {
+      rdh->memorySize = sizeof(o2::Header::RAWDataHeader);
+      if (!((ls.isEmpty) && (ls.HBpagecount == 0))) {
+        stopBit = 1;
+        ls.payloadBytesLeft = -1;
+      }
+    }
+    rdh->stopBit = stopBit;
+
+    // printf("block %p offset %d / %d, link %d @ %p data=%p\n",b,offset,memPoolElementSize,linkId,rdh,b->data);
+    // dumpRDH(rdh);
+    nBlocksInPage++;
   }
-  LHCorbit = nowOrbit;
-  LHCbc = nowBc;
 
-  return Thread::CallbackResult::Ok;
+  // size used (bytes) in page is last offset
+  int dSize = offset;
+
+  // printf("wrote %d bytes\n",dSize);
+
+  // no need to fill header defaults, this is done by getNewDataBlockContainer()
+  // only adjust payload size
+  b->header.dataSize = dSize;
+  b->header.linkId = linkId;
+
+  ls.endOrbit = nowOrbit;
+  ls.endBc = nowBc;
+}
+
+bool ReadoutEquipmentCruEmulator::isRdhConstantPartOk(const o2::Header::RAWDataHeader* rdh, const o2::Header::RAWDataHeader& rdhTemplate)
+{
+  const uint64_t* w = (const uint64_t*)rdh;
+  const uint64_t* t = (const uint64_t*)&rdhTemplate;
+  uint64_t diff = 0;
+  for (int i = 0; i < rdhWords; i++) {
+    diff |= (w[i] ^ t[i]) & ~rdhChangingFieldsMask[i];
+  }
+  return (diff == 0);
 }
 
 DataBlockContainerReference ReadoutEquipmentCruEmulator::getNextBlock()
@@ -318,10 +498,12 @@ void ReadoutEquipmentCruEmulator::initCounters()
   LHCorbit = 0;
   LHCbc = 0;
 
-  for (auto& ls : perLinkState) {
-    ls.second.HBpagecount = 0;
-    ls.second.isEmpty = 0;
-    ls.second.payloadBytesLeft = -1;
+  for (int i = 0; i < cfgNumberOfLinks; i++) {
+    linkState& ls = perLinkState[i];
+    ls.HBpagecount = 0;
+    ls.isEmpty = 0;
+    ls.payloadBytesLeft = -1;
+    ls.rng.seed((uint64_t)cfgRandomSeed * 0x100000001B3ULL + cfgLinkId + i);
   }
 }
 
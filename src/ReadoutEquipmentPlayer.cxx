@@ -8,9 +8,23 @@
 // granted to it by virtue of its status as an Intergovernmental Organization
 // or submit itself to any jurisdiction.
 
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <glob.h>
+#include <mutex>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "MemoryBankManager.h"
+#include "MemoryPagesPool.h"
 #include "RdhUtils.h"
 #include "ReadoutEquipment.h"
 #include "ReadoutUtils.h"
@@ -26,6 +40,7 @@ class ReadoutEquipmentPlayer : public ReadoutEquipment
 
  private:
   void initCounters();
+  void finalCounters();
 
   Thread::CallbackResult populateFifoOut(); // iterative callback
 
@@ -41,21 +56,137 @@ class ReadoutEquipmentPlayer : public ReadoutEquipment
   size_t bytesPerPage = 0;      // number of bytes per data page
   FILE* fp = nullptr;           // file handle
   bool fpOk = false;            // flag to say if fp can be used
-  unsigned long fileOffset = 0; // current file offset
-  uint64_t loopCount = 0;       // number of file reading loops so far
 
   struct PacketHeader {
     uint64_t timeframeId = undefinedTimeframeId;
     int linkId = undefinedLinkId;
     int equipmentId = undefinedEquipmentId; // used to store CRU id
   };
-  PacketHeader lastPacketHeader; // keep track of last packet header
 
-  uint32_t orbitOffset = 0; // to be applied to orbit after 1st loop
+  // replay status of a data file (autoChunk mode)
+  struct ReplayFile {
+    std::string path;                  // path to data file
+    size_t size = 0;                   // data file size
+    uint8_t* data = nullptr;           // file content (mapping or buffer), if accessed from memory
+    bool isMapped = false;             // set when data is a file mapping
+    std::unique_ptr<uint8_t[]> buffer; // file content, when preloaded
+    unsigned long fileOffset = 0;      // current file offset
+    uint64_t loopCount = 0;            // number of file reading loops so far
+    PacketHeader lastPacketHeader;     // keep track of last packet header
+    uint32_t orbitOffset = 0;          // to be applied to orbit after 1st loop
+    bool isOk = true;                  // cleared when replay completed or aborted
+    std::atomic<bool> isDone;          // set by reader thread when no more pages from this file (multi-file mode)
+    std::atomic<bool> isLoopWaiting;   // set by reader thread when end of file reached, waiting for the other files to complete the loop (multi-file mode)
+    uint64_t loopGeneration = 0;       // value of loopGeneration when end of file reached (multi-file mode)
+    DataBlockContainerReference pageUnused; // page obtained but not filled at end of replay, released on stop (multi-file mode)
+    std::unique_ptr<AliceO2::Common::Fifo<DataBlockContainerReference>> pagesReady; // pages filled by reader thread, not yet output (multi-file mode)
+  };
+  std::vector<std::unique_ptr<ReplayFile>> replayFiles; // files replayed in autoChunk mode
 
   void copyFileDataToPage(void* page); // fill given page with file data according to current settings
+
+  // find page boundary in given buffer, from RDH information, and fill page header (and RDH packet index) accordingly.
+  // If updateOrbit is set, orbitOffset is applied to the RDH in buffer. Otherwise, it is only taken into account for metadata.
+  // Returns the number of bytes to be used for the page. isOk is cleared on error.
+  size_t scanPage(ReplayFile& f, uint8_t* data, size_t nBytes, DataBlock* b, bool updateOrbit, bool& isOk);
+
+  // access file content from memory: file is mapped, or loaded in a buffer if preLoad set. Returns 0 on success, or -1 and error description.
+  int openReplayFile(ReplayFile& f, bool preLoad, std::string& err);
+
+  // memory-mapped replay (autoChunk mode)
+  int fileMap;                                         // if set, file is memory-mapped instead of read with fread()
+  int fileMapZeroCopy;                                 // if set, pages reference the file mapping directly (no copy)
+  int fileMapNonTemporal;                              // if set, data is copied to pages with non-temporal stores
+  size_t fileMapReadAhead = 0;                         // size of data to be prefetched ahead of current replay position (bytes)
+  std::atomic<size_t> fileMapReplayOffset;             // current replay position, as seen by readahead thread
+  std::atomic<bool> fileMapReadAheadShutdown;          // flag to stop readahead thread
+  std::unique_ptr<std::thread> fileMapReadAheadThread; // thread prefetching data ahead of replay position
+  void fileMapReadAheadLoop();                         // code executed by readahead thread
+  bool getNextChunkFromMap(ReplayFile& f, DataBlock* b); // fill next page from file content in memory (autoChunk mode). Returns false when replay stopped.
+  int filePreLoad;                                       // if set, files are loaded in memory on startup (autoChunk mode)
+
+  // parallel replay of several files (autoChunk mode)
+  int fileReaderThreads;                                   // number of threads reading files
+  int fileLookAheadPages;                                  // maximum number of pages prepared in advance for each file
+  int readerIdleSleepTime = 100;                           // sleep time (microseconds) of reader threads when idle
+  std::vector<std::unique_ptr<std::thread>> readerThreads; // threads filling pages from files
+  std::atomic<bool> readerShutdown;                        // flag to stop reader threads
+  std::mutex loopMutex;                                    // to synchronize files at end of loop
+  std::atomic<uint64_t> loopGeneration;                    // incremented each time all files completed a loop
+  int loopFilesWaiting = 0;                                // number of files which completed current loop
+  uint64_t loopTimeframeIdMax = 0;                         // last timeframe id of all files in completed loops
+  uint32_t loopOrbitOffset = 0;                            // orbit offset applied to all files after a loop
+  bool isLoopCompleted(ReplayFile& f);                     // called at end of file: returns true when all files completed the loop (and loopOrbitOffset is set)
+  void readerLoop(int threadIndex, int numberOfThreads);   // code executed by reader threads
+  void startReaders();                                     // start reader threads
+  void stopReaders();                                      // stop reader threads, and release pages not output
+  DataBlockContainerReference getNextBlockFromReaders();   // get next page filled by reader threads, in timeframe order
 };
 
+// build list of files from a comma-separated list of paths, possibly containing wildcards (each pattern expanded in sorted order)
+static int getFilesFromString(const std::string& s, std::vector<std::string>& files)
+{
+  files.clear();
+  std::vector<std::string> items;
+  if (getListFromString(s, items)) {
+    return -1;
+  }
+  for (const auto& item : items) {
+    if (item.length() == 0) {
+      continue;
+    }
+    if (item.find_first_of("*?[") == std::string::npos) {
+      files.push_back(item);
+      continue;
+    }
+    glob_t g;
+    if (glob(item.c_str(), 0, nullptr, &g) == 0) {
+      for (size_t i = 0; i < g.gl_pathc; i++) {
+        files.push_back(g.gl_pathv[i]);
+      }
+    }
+    globfree(&g);
+  }
+  if (files.size() == 0) {
+    return -1;
+  }
+  return 0;
+}
+
+// copy data, using non-temporal stores (bypassing CPU caches) when available
+static void copyNonTemporal(void* dst, const void* src, size_t n)
+{
+#if defined(__SSE2__)
+  char* d = (char*)dst;
+  const char* s = (const char*)src;
+  // copy head until destination 16-byte aligned
+  size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+  if (head > n) {
+    head = n;
+  }
+  memcpy(d, s, head);
+  d += head;
+  s += head;
+  n -= head;
+  for (; n >= 64; n -= 64) {
+    __m128i v0 = _mm_loadu_si128((const __m128i*)s);
+    __m128i v1 = _mm_loadu_si128((const __m128i*)(s + 16));
+    __m128i v2 = _mm_loadu_si128((const __m128i*)(s + 32));
+    __m128i v3 = _mm_loadu_si128((const __m128i*)(s + 48));
+    _mm_stream_si128((__m128i*)d, v0);
+    _mm_stream_si128((__m128i*)(d + 16), v1);
+    _mm_stream_si128((__m128i*)(d + 32), v2);
+    _mm_stream_si128((__m128i*)(d + 48), v3);
+    d += 64;
+    s += 64;
+  }
+  _mm_sfence();
+  memcpy(d, s, n);
+#else
+  memcpy(dst, src, n);
+#endif
+}
+
 void ReadoutEquipmentPlayer::copyFileDataToPage(void* page)
 {
   if (page == nullptr)
@@ -86,8 +217,12 @@ ReadoutEquipmentPlayer::ReadoutEquipmentPlayer(ConfigFile& cfg, std::string cfgE
   };
 
   // get configuration values
-  // configuration parameter: | equipment-player-* | filePath | string | | Path of file containing data to be injected in readout. |
+  // configuration parameter: | equipment-player-* | filePath | string | | Path of file containing data to be injected in readout. Several files can be given (comma-separated list, and/or wildcards), e.g. one file per link as recorded with consumer-fileRecorder-* fileName containing %l: they are then replayed in parallel (autoChunk mode only), and pages are output in timeframe order. |
   filePath = cfg.getValue<std::string>(cfgEntryPoint + ".filePath");
+  std::vector<std::string> filePaths;
+  if (getFilesFromString(filePath, filePaths)) {
+    throw std::string("No file matching " + filePath);
+  }
   // configuration parameter: | equipment-player-* | preLoad | int | 1 | If 1, data pages preloaded with file content on startup. If 0, data is copied at runtime. |
   cfg.getOptionalValue<int>(cfgEntryPoint + ".preLoad", preLoad, 1);
   // configuration parameter: | equipment-player-* | fillPage | int | 1 | If 1, content of data file is copied multiple time in each data page until page is full (or almost full: on the last iteration, there is no partial copy if remaining space is smaller than full file size). If 0, data file is copied exactly once in each data page. |
@@ -96,9 +231,151 @@ ReadoutEquipmentPlayer::ReadoutEquipmentPlayer(ConfigFile& cfg, std::string cfgE
   cfg.getOptionalValue<int>(cfgEntryPoint + ".autoChunk", autoChunk, 0);
   // configuration parameter: | equipment-player-* | autoChunkLoop | int | 0 | When set, the file is replayed in loops. Trigger orbit counter in RDH are modified for iterations after the first one, so that they keep increasing. If value is negative, only that number of loop is executed (-5 -> 5x replay). |
   cfg.getOptionalValue<int>(cfgEntryPoint + ".autoChunkLoop", autoChunkLoop, 0);
+  // configuration parameter: | equipment-player-* | fileMap | int | 0 | Used with autoChunk. If set, the file is memory-mapped instead of being read with fread(): page boundaries are found directly in the mapping, and only the data used in each page is copied (no re-read of the end of the chunk). |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".fileMap", fileMap, 0);
+  // configuration parameter: | equipment-player-* | fileMapZeroCopy | int | 0 | Used with fileMap. If set, data is not copied: pages reference the file mapping directly (page header only is taken from memory pool). Payload is then outside of the memory bank: disabled (data copied) if a consumer needs it there (FairMQChannel with shmem transport, fileRecorder with async directIO). Not compatible with autoChunkLoop (RDH orbits are modified when looping) nor with pageHeadersOutOfBand. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".fileMapZeroCopy", fileMapZeroCopy, 0);
+  // configuration parameter: | equipment-player-* | fileMapNonTemporal | int | 1 | Used with fileMap. If set, data is copied to pages with non-temporal stores, bypassing the CPU caches. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".fileMapNonTemporal", fileMapNonTemporal, 1);
+  // configuration parameter: | equipment-player-* | fileMapReadAhead | bytes | 256M | Used with fileMap. Size of data prefetched from file by a background thread, ahead of the current replay position. 0 disables the readahead thread. |
+  std::string cfgFileMapReadAhead = "256M";
+  cfg.getOptionalValue<std::string>(cfgEntryPoint + ".fileMapReadAhead", cfgFileMapReadAhead);
+  fileMapReadAhead = (size_t)ReadoutUtils::getNumberOfBytesFromString(cfgFileMapReadAhead.c_str());
+  // configuration parameter: | equipment-player-* | filePreLoad | int | 0 | Used with autoChunk. If set, the file content is loaded in memory on startup (in parallel, when several files), and replayed from there. Copy to pages is done as with fileMap. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".filePreLoad", filePreLoad, 0);
+  // configuration parameter: | equipment-player-* | fileReaderThreads | int | 0 | When several files are replayed, number of threads reading them in parallel. More than 1 needs memory pools in multi-producer/multi-consumer mode (readout.memoryPoolMagazineSize). If 0, one per file (up to number of CPU cores) if possible, or 1. Files are opened (and loaded, with filePreLoad) in parallel with one thread per file (up to number of CPU cores). |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".fileReaderThreads", fileReaderThreads, 0);
+  // configuration parameter: | equipment-player-* | fileLookAheadPages | int | 8 | When several files are replayed, maximum number of pages prepared in advance for each file, waiting to be output in timeframe order. Reduced if memory pool is too small. |
+  cfg.getOptionalValue<int>(cfgEntryPoint + ".fileLookAheadPages", fileLookAheadPages, 8);
+  if (filePaths.size() > 1) {
+    if (!autoChunk) {
+      throw std::string("Several files can only be replayed with autoChunk");
+    }
+    if (!filePreLoad) {
+      fileMap = 1;
+    }
+  }
+  if (!autoChunk) {
+    fileMap = 0;
+    filePreLoad = 0;
+  }
+  if (filePreLoad) {
+    fileMap = 0;
+  }
+  if ((!fileMap) && (!filePreLoad)) {
+    fileMapZeroCopy = 0;
+  }
+  if (fileMapZeroCopy && autoChunkLoop) {
+    theLog.log(LogWarningSupport_(3102), "Equipment %s: fileMapZeroCopy not compatible with autoChunkLoop, disabled", name.c_str());
+    fileMapZeroCopy = 0;
+  }
+  if (fileMapZeroCopy) {
+    // payload is outside of the memory bank: data copied to pages if an enabled consumer needs it there
+    for (auto kName : ConfigFileBrowser(&cfg, "consumer-")) {
+      int cfgEnabled = 1;
+      cfg.getOptionalValue<int>(kName + ".enabled", cfgEnabled);
+      if (!cfgEnabled) {
+        continue;
+      }
+      std::string cfgType;
+      cfg.getOptionalValue<std::string>(kName + ".consumerType", cfgType);
+      bool isBankNeeded = false;
+      if (cfgType == "FairMQChannel") {
+        // shared memory transport sends references to pages in memory bank
+        std::string cfgTransport = "shmem";
+        cfg.getOptionalValue<std::string>(kName + ".fmq-transport", cfgTransport);
+        isBankNeeded = (cfgTransport == "shmem");
+      } else if (cfgType == "fileRecorder") {
+        // O_DIRECT writes expect page-aligned data from the memory bank
+        std::string cfgWriteMode = "sync";
+        int cfgDirectIO = 0;
+        cfg.getOptionalValue<std::string>(kName + ".writeMode", cfgWriteMode);
+        cfg.getOptionalValue<int>(kName + ".directIO", cfgDirectIO);
+        isBankNeeded = ((cfgWriteMode == "async") && (cfgDirectIO));
+      }
+      if (isBankNeeded) {
+        theLog.log(LogWarningSupport_(3102), "Equipment %s: fileMapZeroCopy not compatible with consumer %s (data needed in memory bank), disabled", name.c_str(), kName.c_str());
+        fileMapZeroCopy = 0;
+        break;
+      }
+    }
+  }
 
   // log config summary
-  theLog.log(LogInfoDevel_(3002), "Equipment %s: using data source file=%s preLoad=%d fillPage=%d autoChunk=%d autoChunkLoop=%d", name.c_str(), filePath.c_str(), preLoad, fillPage, autoChunk, autoChunkLoop);
+  theLog.log(LogInfoDevel_(3002), "Equipment %s: using data source file=%s (%d file(s)) preLoad=%d fillPage=%d autoChunk=%d autoChunkLoop=%d fileMap=%d fileMapZeroCopy=%d filePreLoad=%d", name.c_str(), filePath.c_str(), (int)filePaths.size(), preLoad, fillPage, autoChunk, autoChunkLoop, fileMap, fileMapZeroCopy, filePreLoad);
+
+  if ((fileMapZeroCopy) && (mp->isOutOfBandHeadersEnabled())) {
+    // page is then identified from data pointer, which has to remain in page
+    theLog.log(LogWarningSupport_(3102), "Equipment %s: fileMapZeroCopy not compatible with pageHeadersOutOfBand, disabled", name.c_str());
+    fileMapZeroCopy = 0;
+  }
+
+  // several files: replayed from memory, with reader threads
+  if (filePaths.size() > 1) {
+    bytesPerPage = mp->getDataBlockMaxSize();
+    int nFiles = (int)filePaths.size();
+    int nOpenThreads = std::min(nFiles, (int)std::max(1u, std::thread::hardware_concurrency()));
+    // pages are obtained from memory pool by reader threads: several of them need a multi-producer pool
+    if (fileReaderThreads <= 0) {
+      fileReaderThreads = (MemoryPagesPoolMagazineSize > 0) ? nOpenThreads : 1;
+    } else if ((fileReaderThreads > 1) && (MemoryPagesPoolMagazineSize <= 0)) {
+      throw std::string("fileReaderThreads > 1 needs readout.memoryPoolMagazineSize set");
+    }
+    fileReaderThreads = std::min(fileReaderThreads, nFiles);
+
+    // pages prepared in advance should not exhaust the pool
+    int maxLookAheadPages = ((int)mp->getTotalNumberOfPages() - 1) / nFiles;
+    if (maxLookAheadPages < 1) {
+      throw std::string("Memory pool too small to replay " + std::to_string(nFiles) + " files");
+    }
+    if (fileLookAheadPages > maxLookAheadPages) {
+      theLog.log(LogWarningSupport_(3102), "Equipment %s: fileLookAheadPages reduced to %d, to fit memory pool", name.c_str(), maxLookAheadPages);
+      fileLookAheadPages = maxLookAheadPages;
+    }
+    if (fileLookAheadPages < 1) {
+      fileLookAheadPages = 1;
+    }
+
+    for (const auto& path : filePaths) {
+      auto f = std::make_unique<ReplayFile>();
+      f->path = path;
+      f->isDone = false;
+      f->isLoopWaiting = false;
+      f->pagesReady = std::make_unique<AliceO2::Common::Fifo<DataBlockContainerReference>>(fileLookAheadPages);
+      replayFiles.push_back(std::move(f));
+    }
+
+    // files are opened (and loaded, if configured) in parallel
+    std::vector<std::string> errors(nFiles);
+    std::vector<std::thread> openThreads;
+    AliceO2::Common::Timer t;
+    t.reset();
+    for (int i = 0; i < nOpenThreads; i++) {
+      openThreads.emplace_back([&, i]() {
+        for (int j = i; j < nFiles; j += nOpenThreads) {
+          openReplayFile(*replayFiles[j], filePreLoad, errors[j]);
+        }
+      });
+    }
+    for (auto& th : openThreads) {
+      th.join();
+    }
+    size_t totalSize = 0;
+    for (int i = 0; i < nFiles; i++) {
+      if (errors[i].length()) {
+        throw std::string(replayFiles[i]->path + ": " + errors[i]);
+      }
+      totalSize += replayFiles[i]->size;
+    }
+    initCounters();
+    if (filePreLoad) {
+      double tl = t.getTime();
+      theLog.log(LogInfoDevel, "Loaded %d files = %lu bytes in %.2lf s (%s) with %d threads", nFiles, (unsigned long)totalSize, tl, ReadoutUtils::NumberOfBytesToString(tl > 0 ? totalSize / tl : 0, "B/s").c_str(), nOpenThreads);
+    }
+    theLog.log(LogInfoDevel, "Will replay %d files = %lu bytes in chunks of maximum %lu bytes, with %d reader threads and %d pages lookahead per file", nFiles, (unsigned long)totalSize, (unsigned long)bytesPerPage, fileReaderThreads, fileLookAheadPages);
+    return;
+  }
+  filePath = filePaths[0];
 
   // open data file
   fp = fopen(filePath.c_str(), "rb");
@@ -120,12 +397,35 @@ ReadoutEquipmentPlayer::ReadoutEquipmentPlayer(ConfigFile& cfg, std::string cfgE
   }
   fileSize = (size_t)fs;
 
+  if (autoChunk) {
+    auto f = std::make_unique<ReplayFile>();
+    f->path = filePath;
+    f->size = fileSize;
+    replayFiles.push_back(std::move(f));
+  }
+
   // reset counters
   initCounters();
 
   if (autoChunk) {
     bytesPerPage = mp->getDataBlockMaxSize();
     theLog.log(LogInfoDevel, "Will load file = %lu bytes in chunks of maximum %lu bytes", (unsigned long)fileSize, (unsigned long)bytesPerPage);
+    if ((fileMap) || (filePreLoad)) {
+      ReplayFile& f = *replayFiles[0];
+      std::string err;
+      if (openReplayFile(f, filePreLoad, err)) {
+        errorHandler(err);
+      }
+      fclose(fp);
+      fp = nullptr;
+      fpOk = false;
+      fileMapReplayOffset = 0;
+      fileMapReadAheadShutdown = false;
+      if ((f.isMapped) && (fileMapReadAhead > 0)) {
+        fileMapReadAheadThread = std::make_unique<std::thread>(&ReadoutEquipmentPlayer::fileMapReadAheadLoop, this);
+      }
+      theLog.log(LogInfoDevel, "File %s @ %p, %s", f.isMapped ? "mapped" : "loaded", f.data, fileMapZeroCopy ? "pages referencing file content" : (fileMapNonTemporal ? "copy with non-temporal stores" : "copy"));
+    }
     return;
   }
 
@@ -178,6 +478,19 @@ ReadoutEquipmentPlayer::ReadoutEquipmentPlayer(ConfigFile& cfg, std::string cfgE
 
 ReadoutEquipmentPlayer::~ReadoutEquipmentPlayer()
 {
+  stopReaders();
+  if (fileMapReadAheadThread != nullptr) {
+    fileMapReadAheadShutdown = true;
+    fileMapReadAheadThread->join();
+    fileMapReadAheadThread = nullptr;
+  }
+  for (auto& f : replayFiles) {
+    if (f->isMapped) {
+      munmap(f->data, f->size);
+      f->data = nullptr;
+      f->isMapped = false;
+    }
+  }
   if (fp != nullptr) {
     fclose(fp);
   }
@@ -185,6 +498,11 @@ ReadoutEquipmentPlayer::~ReadoutEquipmentPlayer()
 
 DataBlockContainerReference ReadoutEquipmentPlayer::getNextBlock()
 {
+  // several files: pages filled by reader threads
+  if (replayFiles.size() > 1) {
+    return getNextBlockFromReaders();
+  }
+
   // query memory pool for a free block
   DataBlockContainerReference nextBlock = nullptr;
   try {
@@ -200,7 +518,12 @@ DataBlockContainerReference ReadoutEquipmentPlayer::getNextBlock()
     // only adjust payload size
     b->header.dataSize = 0;
 
-    if (autoChunk) {
+    if ((autoChunk) && (replayFiles[0]->data != nullptr)) {
+      if (!getNextChunkFromMap(*replayFiles[0], b)) {
+        return nullptr;
+      }
+    } else if (autoChunk) {
+      ReplayFile& f = *replayFiles[0];
       bool isOk = 1;
       // read from file
       if ((fp != nullptr) && (fpOk)) {
@@ -211,19 +534,19 @@ DataBlockContainerReference ReadoutEquipmentPlayer::getNextBlock()
             theLog.log(LogErrorSupport_(3232), "File %s read error, aborting replay", name.c_str());
           }
           if (feof(fp)) {
-            if ((!autoChunkLoop) || ((loopCount + 1 + autoChunkLoop) == 0)) {
-              theLog.log(LogInfoDevel, "File %s replay completed (%lu loops)", name.c_str(), (unsigned long)(loopCount + 1));
+            if ((!autoChunkLoop) || ((f.loopCount + 1 + autoChunkLoop) == 0)) {
+              theLog.log(LogInfoDevel, "File %s replay completed (%lu loops)", name.c_str(), (unsigned long)(f.loopCount + 1));
             } else {
               // replay file
               if (fseek(fp, 0, SEEK_SET)) {
                 theLog.log(LogErrorSupport_(3232), "Failed to rewind file, aborting replay");
               } else {
-                if (loopCount == 0) {
+                if (f.loopCount == 0) {
                   theLog.log(LogInfoDevel, "File %s replay - 1st loop completed", name.c_str());
                 }
-                loopCount++;
-                fileOffset = 0;
-                orbitOffset = lastPacketHeader.timeframeId * getTimeframePeriodOrbits();
+                f.loopCount++;
+                f.fileOffset = 0;
+                f.orbitOffset = f.lastPacketHeader.timeframeId * getTimeframePeriodOrbits();
                 isOk = 1;
               }
             }
@@ -231,76 +554,15 @@ DataBlockContainerReference ReadoutEquipmentPlayer::getNextBlock()
         } else {
           // printf ("read %d bytes\n",nBytes);
           // scan the data to find a page boundary
-          size_t pageOffset = 0;
-          for (; pageOffset < nBytes;) {
-            if (pageOffset + sizeof(o2::Header::RAWDataHeader) > nBytes) {
-              break;
-            }
-            RdhHandle h(((uint8_t*)b->data) + pageOffset);
-            std::string errorDescription;
-            int nErr = h.validateRdh(errorDescription);
-            if (nErr) {
-              theLog.log(LogErrorSupport_(3004), "File %s RDH error, aborting replay @ 0x%lX: %s", name.c_str(), (unsigned long)(fileOffset + pageOffset), errorDescription.c_str());
-              isOk = 0;
-              break;
-            }
-            if (orbitOffset) {
-              // update RDH orbit when applicable
-              h.incrementHbOrbit(orbitOffset);
-            }
-
-            // printf ("RDH @ %lu+ %d\n",fileOffset,pageOffset);
-            PacketHeader currentPacketHeader;
-            currentPacketHeader.linkId = (int)h.getLinkId();
-            currentPacketHeader.equipmentId = (int)(h.getCruId() * 10 + h.getEndPointId());
-
-            int hbOrbit = h.getHbOrbit();
-            currentPacketHeader.timeframeId = getTimeframeFromOrbit(hbOrbit);
-
-            // fill page metadata
-            if (pageOffset == 0) {
-              // printf("link %d TF %d\n", (int)currentPacketHeader.linkId,(int)currentPacketHeader.timeframeId);
-              b->header.linkId = currentPacketHeader.linkId;
-              b->header.equipmentId = currentPacketHeader.equipmentId;
-              b->header.timeframeId = currentPacketHeader.timeframeId;
-            }
-
-            // changing link/cruid or TF -> change page (unless at the beginning of the page)
-            bool changePage = 0;
-            if (pageOffset != 0) {
-              if ((currentPacketHeader.linkId != lastPacketHeader.linkId) || (currentPacketHeader.equipmentId != lastPacketHeader.equipmentId) || (currentPacketHeader.timeframeId != lastPacketHeader.timeframeId)) {
-                // printf("%d : %d -> %d : %d\n",currentPacketHeader.linkId,currentPacketHeader.timeframeId,lastPacketHeader.linkId,lastPacketHeader.timeframeId);
-                changePage = 1;
-              }
-            }
-            lastPacketHeader = currentPacketHeader;
-            if (changePage) {
-              // printf("force new page\n");
-              break;
-            }
-
-            uint16_t offsetNextPacket = h.getOffsetNextPacket();
-            if (offsetNextPacket == 0) {
-              break;
-            }
-            if (pageOffset + offsetNextPacket > nBytes) {
-              break;
-            }
-            pageOffset += offsetNextPacket;
-          }
-
-          if (pageOffset == 0) {
-            theLog.log(LogErrorSupport_(3004), "File %s stopping replay @ 0x%lX, last packet invalid", name.c_str(), (unsigned long)(fileOffset + pageOffset));
-            isOk = 0;
-          }
+          size_t pageOffset = scanPage(f, (uint8_t*)b->data, nBytes, b, true, isOk);
           int delta = nBytes - pageOffset;
           nBytes = pageOffset;
           b->header.dataSize = nBytes;
-          fileOffset += nBytes;
-          // printf ("bytes = %d    delta = %d    new file Offset = %lu\n", nBytes, delta, fileOffset);
+          f.fileOffset += nBytes;
+          // printf ("bytes = %d    delta = %d    new file Offset = %lu\n", nBytes, delta, f.fileOffset);
           if (delta > 0) {
             // rewind if necessary
-            if (fseek(fp, fileOffset, SEEK_SET)) {
+            if (fseek(fp, f.fileOffset, SEEK_SET)) {
               theLog.log(LogErrorSupport_(3232), "Failed to seek in file, aborting replay");
               isOk = 0;
             }
@@ -333,6 +595,239 @@ DataBlockContainerReference ReadoutEquipmentPlayer::getNextBlock()
   return nextBlock;
 }
 
+size_t ReadoutEquipmentPlayer::scanPage(ReplayFile& f, uint8_t* data, size_t nBytes, DataBlock* b, bool updateOrbit, bool& isOk)
+{
+  // RDH packets are indexed on the way, if enabled
+  RdhPacketIndexEntry* indexPackets = getRdhPacketIndexBuffer(b);
+  int indexMaxPackets = getRdhPacketIndexMaxPackets();
+  int indexNumberOfPackets = 0;
+  size_t pageOffset = 0;
+  for (; pageOffset < nBytes;) {
+    if (pageOffset + sizeof(o2::Header::RAWDataHeader) > nBytes) {
+      break;
+    }
+    RdhHandle h(data + pageOffset);
+    std::string errorDescription;
+    int nErr = h.validateRdh(errorDescription);
+    if (nErr) {
+      theLog.log(LogErrorSupport_(3004), "File %s RDH error, aborting replay @ 0x%lX: %s", f.path.c_str(), (unsigned long)(f.fileOffset + pageOffset), errorDescription.c_str());
+      isOk = 0;
+      break;
+    }
+    if ((f.orbitOffset) && (updateOrbit)) {
+      // update RDH orbit when applicable
+      h.incrementHbOrbit(f.orbitOffset);
+    }
+
+    // printf ("RDH @ %lu+ %d\n",f.fileOffset,pageOffset);
+    PacketHeader currentPacketHeader;
+    currentPacketHeader.linkId = (int)h.getLinkId();
+    currentPacketHeader.equipmentId = (int)(h.getCruId() * 10 + h.getEndPointId());
+
+    int hbOrbit = h.getHbOrbit() + (updateOrbit ? 0 : f.orbitOffset);
+    currentPacketHeader.timeframeId = getTimeframeFromOrbit(hbOrbit);
+
+    // fill page metadata
+    if (pageOffset == 0) {
+      // printf("link %d TF %d\n", (int)currentPacketHeader.linkId,(int)currentPacketHeader.timeframeId);
+      b->header.linkId = currentPacketHeader.linkId;
+      b->header.equipmentId = currentPacketHeader.equipmentId;
+      b->header.timeframeId = currentPacketHeader.timeframeId;
+    }
+
+    // changing link/cruid or TF -> change page (unless at the beginning of the page)
+    bool changePage = 0;
+    if (pageOffset != 0) {
+      if ((currentPacketHeader.linkId != f.lastPacketHeader.linkId) || (currentPacketHeader.equipmentId != f.lastPacketHeader.equipmentId) || (currentPacketHeader.timeframeId != f.lastPacketHeader.timeframeId)) {
+        // printf("%d : %d -> %d : %d\n",currentPacketHeader.linkId,currentPacketHeader.timeframeId,f.lastPacketHeader.linkId,f.lastPacketHeader.timeframeId);
+        changePage = 1;
+      }
+    }
+    f.lastPacketHeader = currentPacketHeader;
+    if (changePage) {
+      // printf("force new page\n");
+      break;
+    }
+
+    uint16_t offsetNextPacket = h.getOffsetNextPacket();
+    if (offsetNextPacket == 0) {
+      break;
+    }
+    if (pageOffset + offsetNextPacket > nBytes) {
+      break;
+    }
+    if ((indexPackets != nullptr) && (indexNumberOfPackets < indexMaxPackets)) {
+      fillRdhPacketIndexEntry(h, (uint32_t)pageOffset, indexPackets[indexNumberOfPackets]);
+      indexPackets[indexNumberOfPackets].hbOrbit = hbOrbit;
+    }
+    indexNumberOfPackets++;
+    pageOffset += offsetNextPacket;
+  }
+
+  if (pageOffset == 0) {
+    theLog.log(LogErrorSupport_(3004), "File %s stopping replay @ 0x%lX, last packet invalid", f.path.c_str(), (unsigned long)(f.fileOffset + pageOffset));
+    isOk = 0;
+  }
+  if ((indexPackets != nullptr) && (nBytes > 0)) {
+    // all packets kept in page have been validated
+    bool indexComplete = (indexNumberOfPackets <= indexMaxPackets);
+    int n = indexComplete ? indexNumberOfPackets : indexMaxPackets;
+    setRdhPacketIndex(b, indexPackets, n, n, indexComplete);
+  }
+  return pageOffset;
+}
+
+bool ReadoutEquipmentPlayer::getNextChunkFromMap(ReplayFile& f, DataBlock* b)
+{
+  if (!f.isOk) {
+    return false;
+  }
+
+  // end of file: stop or loop
+  if (f.fileOffset >= f.size) {
+    if ((!autoChunkLoop) || ((f.loopCount + 1 + autoChunkLoop) == 0)) {
+      theLog.log(LogInfoDevel, "File %s replay completed (%lu loops)", f.path.c_str(), (unsigned long)(f.loopCount + 1));
+      f.isOk = false;
+      return false;
+    }
+    if (f.loopCount == 0) {
+      theLog.log(LogInfoDevel, "File %s replay - 1st loop completed", f.path.c_str());
+    }
+    f.loopCount++;
+    f.fileOffset = 0;
+    if (replayFiles.size() > 1) {
+      // same offset for all files, so that their timeframe ids stay aligned (see isLoopCompleted())
+      f.orbitOffset = loopOrbitOffset;
+    } else {
+      f.orbitOffset = f.lastPacketHeader.timeframeId * getTimeframePeriodOrbits();
+    }
+  }
+
+  // find page boundary directly in file content
+  uint8_t* src = f.data + f.fileOffset;
+  size_t nBytes = std::min(bytesPerPage, f.size - f.fileOffset);
+  bool isOk = 1;
+  if (fileMapZeroCopy) {
+    // page payload is the file content itself
+    b->data = (char*)src;
+  }
+  size_t pageOffset = scanPage(f, src, nBytes, b, false, isOk);
+  if (!isOk) {
+    f.isOk = false;
+    return false;
+  }
+
+  // copy data used in page, and update orbits when looping
+  if (!fileMapZeroCopy) {
+    if (fileMapNonTemporal) {
+      copyNonTemporal(b->data, src, pageOffset);
+    } else {
+      memcpy(b->data, src, pageOffset);
+    }
+    if (f.orbitOffset) {
+      for (size_t offset = 0; offset < pageOffset;) {
+        RdhHandle h(((uint8_t*)b->data) + offset);
+        h.incrementHbOrbit(f.orbitOffset);
+        offset += h.getOffsetNextPacket();
+      }
+    }
+  }
+  b->header.dataSize = pageOffset;
+  f.fileOffset += pageOffset;
+  if (replayFiles.size() == 1) {
+    fileMapReplayOffset = f.fileOffset;
+  }
+  return true;
+}
+
+int ReadoutEquipmentPlayer::openReplayFile(ReplayFile& f, bool preLoad, std::string& err)
+{
+  int fd = open(f.path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    err = std::string("open failed: ") + strerror(errno);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    err = std::string("stat failed: ") + strerror(errno);
+    close(fd);
+    return -1;
+  }
+  if (st.st_size == 0) {
+    err = "file is empty";
+    close(fd);
+    return -1;
+  }
+  f.size = (size_t)st.st_size;
+
+  if (preLoad) {
+    // load file in memory
+    f.buffer = std::unique_ptr<uint8_t[]>(new (std::nothrow) uint8_t[f.size]);
+    if (f.buffer == nullptr) {
+      err = "memory allocation failure";
+      close(fd);
+      return -1;
+    }
+    for (size_t offset = 0; offset < f.size;) {
+      ssize_t n = read(fd, &f.buffer[offset], f.size - offset);
+      if (n <= 0) {
+        err = std::string("read failed: ") + strerror(errno);
+        f.buffer = nullptr;
+        close(fd);
+        return -1;
+      }
+      offset += n;
+    }
+    f.data = f.buffer.get();
+  } else {
+    // map file in memory
+    void* ptr = mmap(nullptr, f.size, PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+      err = std::string("mmap failed: ") + strerror(errno);
+      close(fd);
+      return -1;
+    }
+    madvise(ptr, f.size, MADV_SEQUENTIAL);
+    f.data = (uint8_t*)ptr;
+    f.isMapped = true;
+  }
+  close(fd);
+  return 0;
+}
+
+void ReadoutEquipmentPlayer::fileMapReadAheadLoop()
+{
+  const size_t stepSize = 4 * 1024 * 1024; // amount of data prefetched per iteration
+  const size_t systemPageSize = sysconf(_SC_PAGESIZE);
+  size_t prefetchOffset = 0; // file offset up to which data was prefetched
+  size_t lastReplayOffset = 0;
+  while (!fileMapReadAheadShutdown) {
+    size_t replayOffset = fileMapReplayOffset;
+    if (replayOffset < lastReplayOffset) {
+      // file replayed in loop, restart from beginning
+      prefetchOffset = 0;
+    }
+    lastReplayOffset = replayOffset;
+    if (prefetchOffset < replayOffset) {
+      prefetchOffset = (replayOffset / systemPageSize) * systemPageSize;
+    }
+    size_t target = std::min(replayFiles[0]->size, replayOffset + fileMapReadAhead);
+    if (prefetchOffset >= target) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    // ask kernel to read ahead, and fault pages in this thread rather than in the equipment thread
+    size_t n = std::min(stepSize, target - prefetchOffset);
+    uint8_t* base = replayFiles[0]->data;
+    madvise(base + prefetchOffset, n, MADV_WILLNEED);
+    volatile uint8_t sum = 0;
+    for (size_t i = 0; i < n; i += systemPageSize) {
+      sum += base[prefetchOffset + i];
+    }
+    prefetchOffset += n;
+  }
+}
+
 void ReadoutEquipmentPlayer::initCounters()
 {
   fpOk = false;
@@ -343,10 +838,194 @@ void ReadoutEquipmentPlayer::initCounters()
       fpOk = true;
     }
   }
-  fileOffset = 0;
-  lastPacketHeader.timeframeId = undefinedTimeframeId;
-  lastPacketHeader.linkId = undefinedLinkId;
-  lastPacketHeader.equipmentId = undefinedEquipmentId;
+  for (auto& f : replayFiles) {
+    f->fileOffset = 0;
+    f->loopCount = 0;
+    f->orbitOffset = 0;
+    f->lastPacketHeader = PacketHeader();
+    f->isOk = true;
+    f->isLoopWaiting = false;
+  }
+  fileMapReplayOffset = 0;
+  loopGeneration = 0;
+  loopFilesWaiting = 0;
+  loopTimeframeIdMax = 0;
+  loopOrbitOffset = 0;
+}
+
+void ReadoutEquipmentPlayer::finalCounters() { stopReaders(); }
+
+void ReadoutEquipmentPlayer::startReaders()
+{
+  // timeframe ids are counted from first orbit of all files, set it before threads start
+  uint32_t firstOrbit = undefinedOrbit;
+  bool isFirstOrbitDefined = false;
+  for (auto& f : replayFiles) {
+    f->isDone = false;
+    f->pagesReady->clear();
+    if (f->size >= sizeof(o2::Header::RAWDataHeader)) {
+      RdhHandle h(f->data);
+      std::string err;
+      if (h.validateRdh(err) == 0) {
+        uint32_t orbit = h.getHbOrbit();
+        if ((!isFirstOrbitDefined) || ((int32_t)(orbit - firstOrbit) < 0)) {
+          firstOrbit = orbit;
+          isFirstOrbitDefined = true;
+        }
+      }
+    }
+  }
+  if (isFirstOrbitDefined) {
+    getTimeframeFromOrbit(firstOrbit);
+  }
+
+  readerShutdown = false;
+  for (int i = 0; i < fileReaderThreads; i++) {
+    readerThreads.push_back(std::make_unique<std::thread>(&ReadoutEquipmentPlayer::readerLoop, this, i, fileReaderThreads));
+  }
+}
+
+void ReadoutEquipmentPlayer::stopReaders()
+{
+  readerShutdown = true;
+  for (auto& t : readerThreads) {
+    t->join();
+  }
+  readerThreads.clear();
+  // release pages not output
+  for (auto& f : replayFiles) {
+    f->pageUnused = nullptr;
+    if (f->pagesReady != nullptr) {
+      DataBlockContainerReference page;
+      while (f->pagesReady->pop(page) == 0) {
+        page = nullptr;
+      }
+    }
+  }
+}
+
+void ReadoutEquipmentPlayer::readerLoop(int threadIndex, int numberOfThreads)
+{
+  // each thread fills pages for a subset of the files, in turn, up to the lookahead limit
+  for (;;) {
+    if (readerShutdown) {
+      break;
+    }
+    bool isActive = false;  // set when a page was filled in this iteration
+    bool isRunning = false; // set while some files are still being replayed
+    for (int i = threadIndex; i < (int)replayFiles.size(); i += numberOfThreads) {
+      ReplayFile& f = *replayFiles[i];
+      if (f.isDone) {
+        continue;
+      }
+      isRunning = true;
+      if (f.pagesReady->isFull()) {
+        continue;
+      }
+      if ((f.isOk) && (f.fileOffset >= f.size) && (autoChunkLoop) && ((f.loopCount + 1 + autoChunkLoop) != 0)) {
+        if (!isLoopCompleted(f)) {
+          continue;
+        }
+      }
+      DataBlockContainerReference page = nullptr;
+      try {
+        page = mp->getNewDataBlockContainer();
+      } catch (...) {
+      }
+      if (page == nullptr) {
+        break;
+      }
+      DataBlock* b = page->getData();
+      b->header.dataSize = 0;
+      if (getNextChunkFromMap(f, b)) {
+        f.pagesReady->push(page);
+        isActive = true;
+      } else {
+        // not released here: pages are released by the consumers thread, unless pool in multi-producer/multi-consumer mode
+        f.pageUnused = page;
+        f.isDone = true;
+      }
+    }
+    if (!isRunning) {
+      break;
+    }
+    if (!isActive) {
+      std::this_thread::sleep_for(std::chrono::microseconds(readerIdleSleepTime));
+    }
+  }
+}
+
+bool ReadoutEquipmentPlayer::isLoopCompleted(ReplayFile& f)
+{
+  std::unique_lock<std::mutex> lock(loopMutex);
+  if (!f.isLoopWaiting) {
+    f.loopGeneration = loopGeneration;
+    loopFilesWaiting++;
+    if ((f.lastPacketHeader.timeframeId != undefinedTimeframeId) && (f.lastPacketHeader.timeframeId > loopTimeframeIdMax)) {
+      loopTimeframeIdMax = f.lastPacketHeader.timeframeId;
+    }
+    f.isLoopWaiting = true; // set after last page pushed, see getNextBlockFromReaders()
+  }
+  if (f.loopGeneration == loopGeneration) {
+    // loop completed when all files waiting or done
+    int nFilesDone = 0;
+    for (auto& ff : replayFiles) {
+      if ((ff->isDone) && (!ff->isLoopWaiting)) {
+        nFilesDone++;
+      }
+    }
+    if (loopFilesWaiting + nFilesDone < (int)replayFiles.size()) {
+      return false;
+    }
+    loopOrbitOffset = loopTimeframeIdMax * getTimeframePeriodOrbits();
+    loopFilesWaiting = 0;
+    loopGeneration++;
+  }
+  f.isLoopWaiting = false;
+  return true;
+}
+
+DataBlockContainerReference ReadoutEquipmentPlayer::getNextBlockFromReaders()
+{
+  if (readerThreads.size() == 0) {
+    startReaders();
+  }
+
+  // output pages in timeframe order: wait until a page is available from each file being replayed,
+  // and take the one with the lowest timeframe id (in files order for a given timeframe)
+  // files waiting for the others at end of loop are skipped: their next pages are in the next loop
+  ReplayFile* nextFile = nullptr;
+  uint64_t nextTimeframeId = 0;
+  uint64_t generation = loopGeneration;
+  bool isLoopWaitingSkipped = false;
+  for (auto& f : replayFiles) {
+    bool isDone = f->isDone;               // checked before fifo, last page is pushed before flag is set
+    bool isLoopWaiting = f->isLoopWaiting; // same
+    DataBlockContainerReference page;
+    if (f->pagesReady->front(page) != 0) {
+      if (isLoopWaiting) {
+        isLoopWaitingSkipped = true;
+      } else if (!isDone) {
+        return nullptr;
+      }
+      continue;
+    }
+    uint64_t tfId = page->getData()->header.timeframeId;
+    if ((nextFile == nullptr) || (tfId < nextTimeframeId)) {
+      nextFile = f.get();
+      nextTimeframeId = tfId;
+    }
+  }
+  if (nextFile == nullptr) {
+    return nullptr;
+  }
+  if ((isLoopWaitingSkipped) && (loopGeneration != generation)) {
+    // next loop started meanwhile: skipped files may now have pages before the one selected
+    return nullptr;
+  }
+  DataBlockContainerReference nextBlock = nullptr;
+  nextFile->pagesReady->pop(nextBlock);
+  return nextBlock;
 }
 
 std::unique_ptr<ReadoutEquipment> getReadoutEquipmentPlayer(ConfigFile& cfg, std::string cfgEntryPoint) { return std::make_unique<ReadoutEquipmentPlayer>(cfg, cfgEntryPoint); }
@@ -9,26 +9,85 @@
 // or submit itself to any jurisdiction.
 
 #include <Common/Timer.h>
+#ifdef WITH_READOUTCARD
 #include <ReadoutCard/ChannelFactory.h>
 #include <ReadoutCard/DmaChannelInterface.h>
 #include <ReadoutCard/Exception.h>
 #include <ReadoutCard/MemoryMappedFile.h>
 #include <ReadoutCard/Parameters.h>
+#endif
+#include <boost/exception/diagnostic_information.hpp>
 #include <cstring>
 #include <mutex>
 #include <string>
 #include <inttypes.h>
 
+#include "DmaChannel.h"
 #include "RdhUtils.h"
 #include "ReadoutEquipment.h"
 #include "ReadoutUtils.h"
 #include "readoutInfoLogger.h"
 
+#ifdef WITH_READOUTCARD
+// DMA channel of a ReadoutCard device
+class DmaChannelRoc : public DmaChannel
+{
+ public:
+  DmaChannelRoc(AliceO2::roc::Parameters& params) { channel = AliceO2::roc::ChannelFactory().getDmaChannel(params); }
+
+  void startDma() { channel->startDma(); }
+  void stopDma() { channel->stopDma(); }
+  bool pushSuperpage(const DmaSuperpage& superpage)
+  {
+    AliceO2::roc::Superpage rocSuperpage;
+    rocSuperpage.setOffset(superpage.offset);
+    rocSuperpage.setSize(superpage.size);
+    rocSuperpage.setUserData(superpage.userData);
+    return channel->pushSuperpage(rocSuperpage);
+  }
+  int getTransferQueueAvailable() { return channel->getTransferQueueAvailable(); }
+  int getReadyQueueSize() { return channel->getReadyQueueSize(); }
+  DmaSuperpage popSuperpage()
+  {
+    auto rocSuperpage = channel->popSuperpage();
+    DmaSuperpage superpage;
+    superpage.offset = rocSuperpage.getOffset();
+    superpage.size = rocSuperpage.getSize();
+    superpage.userData = rocSuperpage.getUserData();
+    superpage.received = rocSuperpage.getReceived();
+    superpage.ready = rocSuperpage.isReady();
+    return superpage;
+  }
+  void fillSuperpages() { channel->fillSuperpages(); }
+  int32_t getDroppedPackets() { return channel->getDroppedPackets(); }
+
+  std::string getDescription()
+  {
+    // retrieve card information
+    std::string infoPciAddress = channel->getPciAddress().toString();
+    int infoNumaNode = channel->getNumaNode();
+    std::string infoSerialNumber = "unknown";
+    auto v_infoSerialNumber = channel->getSerial();
+    if (v_infoSerialNumber) {
+      infoSerialNumber = std::to_string(v_infoSerialNumber.get());
+    }
+    std::string infoFirmwareVersion = channel->getFirmwareInfo().value_or("unknown");
+    std::string infoCardId = channel->getCardId().value_or("unknown");
+    return "PCI " + infoPciAddress + " @ NUMA node " + std::to_string(infoNumaNode) + ", serial number " + infoSerialNumber + ", firmware version " + infoFirmwareVersion + ", card id " + infoCardId;
+  }
+
+ private:
+  AliceO2::roc::ChannelFactory::DmaChannelSharedPtr channel; // channel to ROC device
+};
+#endif
+
 class ReadoutEquipmentRORC : public ReadoutEquipment
 {
 
  public:
-  ReadoutEquipmentRORC(ConfigFile& cfg, std::string name = "rorcReadout");
+  // constructor parameters:
+  // - isSimulated: if set, a software DMA channel is used instead of a ReadoutCard device
+  ReadoutEquipmentRORC(ConfigFile& cfg, std::string name = "rorcReadout", bool isSimulated = false);
   ~ReadoutEquipmentRORC();
 
  private:
@@ -41,7 +100,7 @@ class ReadoutEquipmentRORC : public ReadoutEquipment
 
   Thread::CallbackResult populateFifoOut(); // the data readout loop function
 
-  AliceO2::roc::ChannelFactory::DmaChannelSharedPtr channel; // channel to ROC device
+  std::unique_ptr<DmaChannel> channel; // channel to ROC device (or its software simulation)
 
   bool isInitialized = false;     // flag set to 1 when class has been successfully initialized
   bool isWaitingFirstLoop = true; // flag set until first readout loop called
@@ -67,10 +126,7 @@ class ReadoutEquipmentRORC : public ReadoutEquipment
 
 // std::mutex readoutEquipmentRORCLock;
 
-struct ReadoutEquipmentRORCException : virtual Exception {
-};
-
-ReadoutEquipmentRORC::ReadoutEquipmentRORC(ConfigFile& cfg, std::string name) : ReadoutEquipment(cfg, name, 1)  // this is RDH-data equipment
+ReadoutEquipmentRORC::ReadoutEquipmentRORC(ConfigFile& cfg, std::string name, bool isSimulated) : ReadoutEquipment(cfg, name, 1)  // this is RDH-data equipment
 {
 
   try {
@@ -78,32 +134,12 @@ ReadoutEquipmentRORC::ReadoutEquipmentRORC(ConfigFile& cfg, std::string name) :
     // get parameters from configuration
     // config keys are the same as the corresponding set functions in AliceO2::roc::Parameters
 
-    // configuration parameter: | equipment-rorc-* | cardId | string | | ID of the board to be used. Typically, a PCI bus device id. c.f. AliceO2::roc::Parameters. |
-    std::string cardId = cfg.getValue<std::string>(name + ".cardId");
-
-    // configuration parameter: | equipment-rorc-* | channelNumber | int | 0 | Channel number of the board to be used. Typically 0 for CRU, or 0-5 for CRORC. c.f. AliceO2::roc::Parameters. |
-    int cfgChannelNumber = 0;
-    cfg.getOptionalValue<int>(name + ".channelNumber", cfgChannelNumber);
-
-    // configuration parameter: | equipment-rorc-* | dataSource | string | Internal | This parameter selects the data source used by ReadoutCard, c.f. AliceO2::roc::Parameters. It can be for CRU one of Fee, Ddg, Internal and for CRORC one of Fee, SIU, DIU, Internal. |
-    std::string cfgDataSource = "Internal";
-    cfg.getOptionalValue<std::string>(name + ".dataSource", cfgDataSource);
-
-    // std::string cfgReadoutMode="CONTINUOUS";
-    // cfg.getOptionalValue<std::string>(name + ".readoutMode", cfgReadoutMode);
-
     // configuration parameter: | equipment-rorc-* | cleanPageBeforeUse | int | 0 | If set, data pages are filled with zero before being given for writing by device. Slow, but usefull to readout incomplete pages (driver currently does not return correctly number of bytes written in page. |
     cfg.getOptionalValue<int>(name + ".cleanPageBeforeUse", cfgCleanPageBeforeUse);
     if (cfgCleanPageBeforeUse) {
       theLog.log(LogInfoDevel_(3002), "Superpages will be cleaned before each DMA - this may be slow!");
     }
 
-    // configuration parameter: | equipment-rorc-* | firmwareCheckEnabled | int | 1 | If set, RORC driver checks compatibility with detected firmware. Use 0 to bypass this check (eg new fw version not yet recognized by ReadoutCard version). |
-    cfg.getOptionalValue<int>(name + ".firmwareCheckEnabled", cfgFirmwareCheckEnabled);
-    if (!cfgFirmwareCheckEnabled) {
-      theLog.log(LogWarningSupport_(3002), "Bypassing RORC firmware compatibility check");
-    }
-
     // configuration parameter: | equipment-rorc-* | debugStatsEnabled | int | 0 | If set, enable extra statistics about internal buffers status. (printed to stdout when stopping) |
     cfg.getOptionalValue<int>(name + ".debugStatsEnabled", cfgDebugStatsEnabled);
 
@@ -115,61 +151,71 @@ ReadoutEquipmentRORC::ReadoutEquipmentRORC(ConfigFile& cfg, std::string name) :
     // std::string cfgHugePageSize="1GB";
     // cfg.getOptionalValue<std::string>(name + ".memoryHugePageSize",cfgHugePageSize);
 
-    // unique identifier based on card ID
-    std::string uid = "readout." + cardId + "." + std::to_string(cfgChannelNumber);
-    // sleep((cfgChannelNumber+1)*2);  // trick to avoid all channels open at once - fail to acquire lock
-
     // define usable superpagesize
     superPageSize = mp->getPageSize() - pageSpaceReserved; // Keep space at beginning for DataBlock object
     superPageSize -= superPageSize % (32 * 1024);          // Must be a multiple of 32Kb for ROC
     theLog.log(LogInfoDevel_(3008), "Using superpage size %ld", superPageSize);
     if (superPageSize == 0) {
-      BOOST_THROW_EXCEPTION(ReadoutEquipmentRORCException() << ErrorInfo::Message("Superpage must be at least 32kB"));
+      throw std::string("Superpage must be at least 32kB");
     }
 
-    // open and configure ROC
-    theLog.log(LogInfoDevel_(3010), "Opening ROC %s:%d", cardId.c_str(), cfgChannelNumber);
-    AliceO2::roc::Parameters params;
-    params.setCardId(AliceO2::roc::Parameters::cardIdFromString(cardId));
-    params.setChannelNumber(cfgChannelNumber);
-    params.setFirmwareCheckEnabled(cfgFirmwareCheckEnabled);
+    // the memory block for DMA
+    void* baseAddress = (void*)mp->getBaseBlockAddress();
+    size_t blockSize = mp->getBaseBlockSize();
 
-    // setDmaPageSize() : seems deprecated, let's not configure it
+    if (isSimulated) {
+      theLog.log(LogInfoDevel_(3010), "Using software DMA channel on block %p:%lu", baseAddress, blockSize);
+      channel = getDmaChannelSimulator(cfg, name, baseAddress, blockSize);
+    } else {
+#ifdef WITH_READOUTCARD
+      // configuration parameter: | equipment-rorc-* | cardId | string | | ID of the board to be used. Typically, a PCI bus device id. c.f. AliceO2::roc::Parameters. |
+      std::string cardId = cfg.getValue<std::string>(name + ".cardId");
 
-    // card data source
-    params.setDataSource(AliceO2::roc::DataSource::fromString(cfgDataSource));
+      // configuration parameter: | equipment-rorc-* | channelNumber | int | 0 | Channel number of the board to be used. Typically 0 for CRU, or 0-5 for CRORC. c.f. AliceO2::roc::Parameters. |
+      int cfgChannelNumber = 0;
+      cfg.getOptionalValue<int>(name + ".channelNumber", cfgChannelNumber);
 
-    // card readout mode : experimental, not needed
-    // params.setReadoutMode(AliceO2::roc::ReadoutMode::fromString(cfgReadoutMode));
+      // configuration parameter: | equipment-rorc-* | dataSource | string | Internal | This parameter selects the data source used by ReadoutCard, c.f. AliceO2::roc::Parameters. It can be for CRU one of Fee, Ddg, Internal and for CRORC one of Fee, SIU, DIU, Internal. |
+      std::string cfgDataSource = "Internal";
+      cfg.getOptionalValue<std::string>(name + ".dataSource", cfgDataSource);
 
-    /*
-    theLog.log(LogDebugTrace, "Loop DMA block %p:%lu", mp->getBaseBlockAddress(), // mp->getBaseBlockSize()); 
-    char *ptr=(char *)mp->getBaseBlockAddress();
-    for (size_t i=0;i<mp->getBaseBlockSize();i++) { 
-      ptr[i]=0;
-    }
-    */
+      // std::string cfgReadoutMode="CONTINUOUS";
+      // cfg.getOptionalValue<std::string>(name + ".readoutMode", cfgReadoutMode);
 
-    // register the memory block for DMA
-    void* baseAddress = (void*)mp->getBaseBlockAddress();
-    size_t blockSize = mp->getBaseBlockSize();
-    theLog.log(LogInfoDevel_(3010), "Register DMA block %p:%lu", baseAddress, blockSize);
-    params.setBufferParameters(AliceO2::roc::buffer_parameters::Memory{ baseAddress, blockSize });
+      // configuration parameter: | equipment-rorc-* | firmwareCheckEnabled | int | 1 | If set, RORC driver checks compatibility with detected firmware. Use 0 to bypass this check (eg new fw version not yet recognized by ReadoutCard version). |
+      cfg.getOptionalValue<int>(name + ".firmwareCheckEnabled", cfgFirmwareCheckEnabled);
+      if (!cfgFirmwareCheckEnabled) {
+        theLog.log(LogWarningSupport_(3002), "Bypassing RORC firmware compatibility check");
+      }
 
-    // open channel with above parameters
-    channel = AliceO2::roc::ChannelFactory().getDmaChannel(params);
+      // open and configure ROC
+      theLog.log(LogInfoDevel_(3010), "Opening ROC %s:%d", cardId.c_str(), cfgChannelNumber);
+      AliceO2::roc::Parameters params;
+      params.setCardId(AliceO2::roc::Parameters::cardIdFromString(cardId));
+      params.setChannelNumber(cfgChannelNumber);
+      params.setFirmwareCheckEnabled(cfgFirmwareCheckEnabled);
 
-    // retrieve card information
-    std::string infoPciAddress = channel->getPciAddress().toString();
-    int infoNumaNode = channel->getNumaNode();
-    std::string infoSerialNumber = "unknown";
-    auto v_infoSerialNumber = channel->getSerial();
-    if (v_infoSerialNumber) {
-      infoSerialNumber = std::to_string(v_infoSerialNumber.get());
+      // setDmaPageSize() : seems deprecated, let's not configure it
+
+      // card data source
+      params.setDataSource(AliceO2::roc::DataSource::fromString(cfgDataSource));
+
+      // card readout mode : experimental, not needed
+      // params.setReadoutMode(AliceO2::roc::ReadoutMode::fromString(cfgReadoutMode));
+
+      // register the memory block for DMA
+      theLog.log(LogInfoDevel_(3010), "Register DMA block %p:%lu", baseAddress, blockSize);
+      params.setBufferParameters(AliceO2::roc::buffer_parameters::Memory{ baseAddress, blockSize });
+
+      // open channel with above parameters
+      channel = std::make_unique<DmaChannelRoc>(params);
+#else
+      throw std::string("ReadoutCard not supported by this build");
+#endif
     }
-    std::string infoFirmwareVersion = channel->getFirmwareInfo().value_or("unknown");
-    std::string infoCardId = channel->getCardId().value_or("unknown");
-    theLog.log(LogInfoDevel_(3010), "Equipment %s : PCI %s @ NUMA node %d, serial number %s, firmware version %s, card id %s", name.c_str(), infoPciAddress.c_str(), infoNumaNode, infoSerialNumber.c_str(), infoFirmwareVersion.c_str(), infoCardId.c_str());
+
+    // retrieve channel information
+    theLog.log(LogInfoDevel_(3010), "Equipment %s : %s", name.c_str(), channel->getDescription().c_str());
 
     // todo: log parameters ?
 
@@ -237,14 +283,15 @@ Thread::CallbackResult ReadoutEquipmentRORC::prepareBlocks()
       if (cfgCleanPageBeforeUse) {
         std::memset(newPage, 0, mp->getPageSize());
       }
-      AliceO2::roc::Superpage superpage;
-      superpage.setOffset((char*)newPage - (char*)mp->getBaseBlockAddress() + pageSpaceReserved);
-      superpage.setSize(superPageSize);
+      DmaSuperpage superpage;
+      superpage.offset = (char*)newPage - (char*)mp->getBaseBlockAddress() + pageSpaceReserved;
+      superpage.size = superPageSize;
       // printf("pushed page %d\n",(int)superPageSize);
-      superpage.setUserData(newPage);
+      superpage.userData = newPage;
       if (channel->pushSuperpage(superpage)) {
         isActive = 1;
         nPushed++;
+        numberOfPagesReserved++;
       } else {
         // push failed (typically, stopDma() has been called in the mean time)
         // release allocated page to memory pool
@@ -306,10 +353,11 @@ DataBlockContainerReference ReadoutEquipmentRORC::getNextBlock()
     if ((channel->getReadyQueueSize() > 0)) {
       // get next page from FIFO
       auto superpage = channel->popSuperpage();
-      void* mpPageAddress = (void*)(superpage.getUserData());
-      if (superpage.isReady()) {
+      numberOfPagesReserved--;
+      void* mpPageAddress = superpage.userData;
+      if (superpage.ready) {
 	std::shared_ptr<DataBlockContainer> d = nullptr;
-	// printf ("received a page with %d bytes - isFilled=%d isREady=%d\n", (int)superpage.getReceived(),(int)superpage.isFilled(),(int)superpage.isReady());
+	// printf ("received a page with %d bytes - isREady=%d\n", (int)superpage.received,(int)superpage.ready);
 	if (!mp->isPageValid(mpPageAddress)) {
           theLog.log(LogWarningSupport_(3008), "Got an invalid page from RORC : %p", mpPageAddress);
 	} else {
@@ -322,7 +370,7 @@ DataBlockContainerReference ReadoutEquipmentRORC::getNextBlock()
 	if (d != nullptr) {
           statsNumberOfPages++;
           nextBlock = d;
-          d->getData()->header.dataSize = superpage.getReceived();
+          d->getData()->header.dataSize = superpage.received;
 
           // printf("\nPage %llu\n",statsNumberOfPages);
 	} else {
@@ -351,6 +399,8 @@ DataBlockContainerReference ReadoutEquipmentRORC::getNextBlock()
 
 std::unique_ptr<ReadoutEquipment> getReadoutEquipmentRORC(ConfigFile& cfg, std::string cfgEntryPoint) { return std::make_unique<ReadoutEquipmentRORC>(cfg, cfgEntryPoint); }
 
+std::unique_ptr<ReadoutEquipment> getReadoutEquipmentRORCSimulator(ConfigFile& cfg, std::string cfgEntryPoint) { return std::make_unique<ReadoutEquipmentRORC>(cfg, cfgEntryPoint, true); }
+
 void ReadoutEquipmentRORC::setDataOn()
 {
   if (isInitialized) {
@@ -42,6 +42,8 @@ void ReadoutStats::reset()
   counters.pagesPendingFairMQreleased = 0;
   counters.pagesPendingFairMQtime = 0;
   counters.timeframeIdFairMQ = 0;
+  counters.bytesFairMQrepacked = 0;
+  counters.timeFairMQrepack = 0;
 }
 
 void ReadoutStats::print()
@@ -29,6 +29,8 @@ struct ReadoutStatsCounters {
   std::atomic<uint64_t> pagesPendingFairMQreleased; // number of pages which have been released by ConsumerFMQ
   std::atomic<uint64_t> pagesPendingFairMQtime;     // latency in FMQ, in microseconds, total for all released pages
   std::atomic<uint32_t> timeframeIdFairMQ;          // last timeframe pushed to ConsumerFMQ
+  std::atomic<uint64_t> bytesFairMQrepacked;        // number of bytes copied by ConsumerFMQ to repack HBF spanning several pages
+  std::atomic<uint64_t> timeFairMQrepack;           // time spent by ConsumerFMQ copying data to repack HBF, in nanoseconds
 };
 
 // need to be able to easily transmit this struct as a whole
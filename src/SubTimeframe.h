@@ -12,6 +12,8 @@
 // subtimeframe made of 1 message with this header
 // followed by 1 message for each heartbeat-frame
 // All data come from the same data source (same linkId - but possibly different FEE ids)
+// When flag hbfContinuation is set, a heartbeat-frame may be split in several consecutive messages
+// (e.g. when it spans several data pages): consecutive messages with the same RDH heartbeat orbit belong to the same heartbeat-frame.
 
 struct SubTimeframe {
   uint8_t version = 2;      // version of this structure
@@ -26,9 +28,10 @@ struct SubTimeframe {
   union {
     uint8_t flags = 0;
     struct {
-      uint8_t lastTFMessage : 1; // bit 0
-      uint8_t isRdhFormat : 1;   // bit 1
-      uint8_t flagsUnused : 6;   // bit 2-7: unused
+      uint8_t lastTFMessage : 1;   // bit 0
+      uint8_t isRdhFormat : 1;     // bit 1
+      uint8_t hbfContinuation : 1; // bit 2: HBF may be split in consecutive messages
+      uint8_t flagsUnused : 5;     // bit 3-7: unused
     };
   };
 };
@@ -0,0 +1,153 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#include "TimeframeAdmission.h"
+#include "DataBlock.h"
+#include "ReadoutStats.h"
+#include <algorithm>
+
+TimeframeAdmission gTimeframeAdmission;
+
+TimeframeAdmission::TimeframeAdmission() {}
+
+TimeframeAdmission::~TimeframeAdmission() {}
+
+void TimeframeAdmission::init(double tfRateLimit, double memoryThreshold, uint64_t fmqPendingMax, unsigned int windowSize)
+{
+  std::unique_lock<std::mutex> l(lock);
+  rateRegulator.init(tfRateLimit);
+  cfgMemoryThreshold = memoryThreshold;
+  cfgFmqPendingMax = fmqPendingMax;
+  // to be called before readout threads are started: decisions are read without lock
+  decisionsSize = (windowSize > 0) ? windowSize : 1;
+  decisions = std::make_unique<std::atomic<uint64_t>[]>(decisionsSize);
+  lateTimeframes = std::make_unique<uint64_t[]>(decisionsSize);
+  enabled = true;
+}
+
+void TimeframeAdmission::disable()
+{
+  std::unique_lock<std::mutex> l(lock);
+  enabled = false;
+  pools.clear();
+}
+
+void TimeframeAdmission::reset()
+{
+  std::unique_lock<std::mutex> l(lock);
+  for (unsigned int i = 0; i < decisionsSize; i++) {
+    decisions[i] = (undefinedTimeframeId << 1);
+    lateTimeframes[i] = undefinedTimeframeId;
+  }
+  rateRegulator.reset();
+  nAccepted = 0;
+  for (int i = 0; i < maxDropReason; i++) {
+    nDropped[i] = 0;
+  }
+}
+
+void TimeframeAdmission::addMemoryPool(std::shared_ptr<MemoryPagesPool> const& pool, const std::atomic<uint64_t>* nPagesReserved)
+{
+  if (pool == nullptr) {
+    return;
+  }
+  std::unique_lock<std::mutex> l(lock);
+  pools.push_back({ pool, nPagesReserved });
+}
+
+void TimeframeAdmission::removeMemoryPool(std::shared_ptr<MemoryPagesPool> const& pool)
+{
+  std::unique_lock<std::mutex> l(lock);
+  pools.erase(std::remove_if(pools.begin(), pools.end(), [&](const MemoryPoolUsage& p) { return p.pool == pool; }), pools.end());
+}
+
+bool TimeframeAdmission::isAccepted(uint64_t tfId)
+{
+  if ((!enabled) || (tfId == undefinedTimeframeId)) {
+    return true;
+  }
+
+  // decision already taken ?
+  std::atomic<uint64_t>& d = decisions[tfId % decisionsSize];
+  uint64_t v = d.load();
+  if ((v >> 1) == tfId) {
+    return (v & 1);
+  }
+
+  std::unique_lock<std::mutex> l(lock);
+  v = d.load();
+  if ((v >> 1) == tfId) {
+    // decision taken in the mean time by another source
+    return (v & 1);
+  }
+  if ((v >> 1) > tfId) {
+    // decision not kept anymore: this source is far behind the others
+    // count it once, even if requested by several sources
+    uint64_t& late = lateTimeframes[tfId % decisionsSize];
+    if (late != tfId) {
+      late = tfId;
+      nDropped[DropReason::Late]++;
+    }
+    return false;
+  }
+
+  // take decision for a new timeframe
+  // rate is checked last, as only accepted timeframes are counted in rate
+  bool isAccepted = true;
+  if (cfgMemoryThreshold > 0) {
+    for (auto const& p : pools) {
+      size_t nPages = p.pool->getTotalNumberOfPages();
+      size_t nPagesUsed = nPages - p.pool->getNumberOfPagesAvailable();
+      if (p.nPagesReserved != nullptr) {
+        // pages waiting to be filled are not in use
+        uint64_t nPagesReserved = p.nPagesReserved->load();
+        nPagesUsed = (nPagesUsed > nPagesReserved) ? nPagesUsed - nPagesReserved : 0;
+      }
+      if ((nPages) && (nPagesUsed >= cfgMemoryThreshold * nPages)) {
+        nDropped[DropReason::Memory]++;
+        isAccepted = false;
+        break;
+      }
+    }
+  }
+  if ((isAccepted) && (cfgFmqPendingMax > 0) && (gReadoutStats.counters.pagesPendingFairMQ.load() >= cfgFmqPendingMax)) {
+    nDropped[DropReason::FairMQ]++;
+    isAccepted = false;
+  }
+  if ((isAccepted) && (!rateRegulator.next())) {
+    nDropped[DropReason::Rate]++;
+    isAccepted = false;
+  }
+  if (isAccepted) {
+    nAccepted++;
+  }
+
+  d = (tfId << 1) | (isAccepted ? 1 : 0);
+  return isAccepted;
+}
+
+bool TimeframeAdmission::isDropped(uint64_t tfId)
+{
+  if ((!enabled) || (tfId == undefinedTimeframeId)) {
+    return false;
+  }
+  uint64_t v = decisions[tfId % decisionsSize].load();
+  return (((v >> 1) == tfId) && (!(v & 1)));
+}
+
+std::string TimeframeAdmission::getStats()
+{
+  std::unique_lock<std::mutex> l(lock);
+  unsigned long long nDroppedTotal = 0;
+  for (int i = 0; i < maxDropReason; i++) {
+    nDroppedTotal += nDropped[i];
+  }
+  return std::to_string(nAccepted) + " accepted, " + std::to_string(nDroppedTotal) + " dropped (rate: " + std::to_string(nDropped[DropReason::Rate]) + ", memory: " + std::to_string(nDropped[DropReason::Memory]) + ", FairMQ: " + std::to_string(nDropped[DropReason::FairMQ]) + ", late: " + std::to_string(nDropped[DropReason::Late]) + ")";
+}
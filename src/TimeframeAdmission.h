@@ -0,0 +1,92 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+#ifndef _TIMEFRAMEADMISSION_H
+#define _TIMEFRAMEADMISSION_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "MemoryPagesPool.h"
+#include "RateRegulator.h"
+
+// Admission control of timeframes, shared by all equipments and the aggregator.
+// The decision to accept or drop a timeframe is taken once, when first requested for this timeframe id (i.e. by the first source reaching it),
+// from global signals: timeframe rate, occupancy of the equipments memory pools, pages pending in FairMQ.
+// All sources then get the same decision, so that a timeframe is either complete or dropped for all of them.
+// Decisions are kept for a window of timeframe ids. A source asking for an older timeframe gets it dropped (late).
+// Decisions already taken are read without lock, a lock is used only to take new ones.
+class TimeframeAdmission
+{
+ public:
+  TimeframeAdmission();
+  ~TimeframeAdmission();
+
+  // reasons why a timeframe is dropped
+  enum DropReason { Rate = 0,
+                    Memory = 1,
+                    FairMQ = 2,
+                    Late = 3,
+                    maxDropReason = 4 };
+
+  // enable admission control with given thresholds. A zero value disables the corresponding check.
+  // tfRateLimit: maximum timeframe rate (Hz)
+  // memoryThreshold: fraction of pages in use in any registered memory pool above which timeframes are dropped (0-1)
+  // fmqPendingMax: number of pages pending in FairMQ above which timeframes are dropped
+  // windowSize: number of timeframe ids for which decisions are kept
+  void init(double tfRateLimit, double memoryThreshold, uint64_t fmqPendingMax, unsigned int windowSize = 4096);
+  void disable();                      // disable admission control: all timeframes accepted
+  bool isEnabled() { return enabled; } // returns true if admission control enabled
+  void reset();                        // reset decisions and counters (e.g. on start of run)
+
+  // register/unregister a memory pool to be checked for occupancy
+  // nPagesReserved: if set, number of pages taken from the pool but not holding data (e.g. given to a device for DMA), not counted as used
+  void addMemoryPool(std::shared_ptr<MemoryPagesPool> const& pool, const std::atomic<uint64_t>* nPagesReserved = nullptr);
+  void removeMemoryPool(std::shared_ptr<MemoryPagesPool> const& pool);
+
+  bool isAccepted(uint64_t tfId); // get decision for given timeframe. It is taken now, if it was not yet.
+  bool isDropped(uint64_t tfId);  // returns true if given timeframe was dropped. Does not take decision.
+
+  std::string getStats(); // return a string summarizing counters
+
+ private:
+  bool enabled = false;
+  double cfgMemoryThreshold = 0;
+  uint64_t cfgFmqPendingMax = 0;
+  RateRegulator rateRegulator; // to check timeframe rate
+
+  // decisions, indexed by timeframe id (modulo size)
+  // each value is the timeframe id, shifted by one bit, with the decision (1 for accepted) in lowest bit
+  std::unique_ptr<std::atomic<uint64_t>[]> decisions;
+  unsigned int decisionsSize = 0;
+
+  std::mutex lock; // lock for all variables below, and to take new decisions
+
+  std::unique_ptr<uint64_t[]> lateTimeframes; // late timeframes already counted, indexed by timeframe id (modulo decisionsSize)
+
+  // pools checked for occupancy
+  struct MemoryPoolUsage {
+    std::shared_ptr<MemoryPagesPool> pool;       // the pool
+    const std::atomic<uint64_t>* nPagesReserved; // number of pages of the pool reserved (may be null)
+  };
+  std::vector<MemoryPoolUsage> pools;
+
+  unsigned long long nAccepted = 0;                 // number of timeframes accepted
+  unsigned long long nDropped[maxDropReason] = {}; // number of timeframes dropped, per reason
+};
+
+// global instance used by readout components
+extern TimeframeAdmission gTimeframeAdmission;
+
+#endif // #ifndef _TIMEFRAMEADMISSION_H
@@ -28,6 +28,7 @@
 #include "DataBlock.h"
 #include "DataBlockContainer.h"
 #include "DataSet.h"
+#include "EventNotifier.h"
 
 #ifdef WITH_ZMQ
 #include "ZmqServer.hxx"
@@ -58,6 +59,7 @@
 #include "ReadoutStats.h"
 #include "ReadoutUtils.h"
 #include "ReadoutVersion.h"
+#include "TimeframeAdmission.h"
 #include "TtyChecker.h"
 
 #ifdef WITH_NUMA
@@ -147,7 +149,13 @@ class Readout
   int cfgDisableAggregatorSlicing;
   double cfgAggregatorSliceTimeout;
   double cfgAggregatorStfTimeout;
+  int cfgAggregatorStfSources;
+  int cfgAggregatorThreads;
+  int cfgAggregatorStfBufferSize;
   double cfgTfRateLimit;
+  int cfgTfAdmissionEnabled;
+  double cfgTfAdmissionMemoryThreshold;
+  int cfgTfAdmissionFmqPendingMax;
   int cfgLogbookEnabled;
   std::string cfgLogbookUrl;
   std::string cfgLogbookApiToken;
@@ -162,6 +170,7 @@ class Readout
   std::vector<std::unique_ptr<ReadoutEquipment>> readoutDevices;
   std::unique_ptr<DataBlockAggregator> agg;
   std::unique_ptr<AliceO2::Common::Fifo<DataSetReference>> agg_output;
+  std::shared_ptr<EventNotifier> agg_outputNotifier; // notified when new data in agg_output
 
   int isRunning = 0;                          // set to 1 when running, 0 when not running (or should stop running)
   AliceO2::Common::Timer startTimer;          // time counter from start()
@@ -178,6 +187,7 @@ class Readout
   std::unique_ptr<bookkeeping::BookkeepingInterface> logbookHandle; // handle to logbook
 #endif
   void publishLogbookStats();          // publish current readout counters to logbook
+  void logMemoryBanksUsage();          // print usage and fragmentation of memory banks
   AliceO2::Common::Timer logbookTimer; // timer to handle readout logbook publish interval
 
   uint64_t maxTimeframeId;
@@ -189,6 +199,16 @@ class Readout
 
 bool testLogbook = false; // flag for logbook test mode
 
+void Readout::logMemoryBanksUsage()
+{
+  std::vector<MemoryBankManager::memoryRange> ranges;
+  std::vector<MemoryBankManager::bankUsage> usage;
+  theMemoryBankManager.getMemoryRegions(ranges, usage);
+  for (const auto& u : usage) {
+    theLog.log(LogInfoDevel_(3008), "Bank %s: size %s, used %s (%d ranges), free %s (%d ranges, largest %s), fragmentation %.1f%%", u.name.c_str(), NumberOfBytesToString(u.size, "Bytes").c_str(), NumberOfBytesToString(u.bytesInUse, "Bytes").c_str(), (int)u.numberOfRangesInUse, NumberOfBytesToString(u.bytesFree, "Bytes").c_str(), (int)u.numberOfFreeRanges, NumberOfBytesToString(u.largestFreeRange, "Bytes").c_str(), u.fragmentation * 100.0);
+  }
+}
+
 void Readout::publishLogbookStats()
 {
 #ifdef WITH_LOGBOOK
@@ -452,20 +472,38 @@ int Readout::configure(const boost::property_tree::ptree& properties)
   // configuration parameter: | readout | flushEquipmentTimeout | double | 1 | Time in seconds to wait for data once the equipments are stopped. 0 means stop immediately. |
   cfgFlushEquipmentTimeout = 1;
   cfg.getOptionalValue<double>("readout.flushEquipmentTimeout", cfgFlushEquipmentTimeout);
-  // configuration parameter: | readout | memoryPoolStatsEnabled | int | 0 | Global debugging flag to enable statistics on memory pool usage (printed to stdout when pool released). |
+  // configuration parameter: | readout | memoryPoolStatsEnabled | int | 0 | Global flag to enable statistics on memory pool usage (pages lifecycle timing). Reported with the memory pool statistics at runtime, and printed to stdout when pool released. |
   int cfgMemoryPoolStatsEnabled = 0;
   cfg.getOptionalValue<int>("readout.memoryPoolStatsEnabled", cfgMemoryPoolStatsEnabled);
   extern int MemoryPagesPoolStatsEnabled;
   MemoryPagesPoolStatsEnabled = cfgMemoryPoolStatsEnabled;
+  // configuration parameter: | readout | memoryPoolMagazineSize | int | 0 | If non-zero, memory pools are created in multi-producer/multi-consumer mode: each thread keeps a cache of free pages, refilled from / returned to a shared lock-free depot by batches of this number of pages. This allows pages to be obtained and released concurrently by any number of threads. If zero, pools are optimized for 1 thread getting pages and 1 thread releasing them. |
+  int cfgMemoryPoolMagazineSize = 0;
+  cfg.getOptionalValue<int>("readout.memoryPoolMagazineSize", cfgMemoryPoolMagazineSize);
+  extern int MemoryPagesPoolMagazineSize;
+  MemoryPagesPoolMagazineSize = cfgMemoryPoolMagazineSize;
+  // configuration parameter: | readout | idleWaitEnabled | int | 0 | If set, the idle threads of the data path (aggregator, main loop, consumer dispatch threads, consumer-processor threads) wait to be notified of new data (spin, then block), instead of polling at regular intervals with a sleep. This reduces latency and CPU usage. Statistics on wakeups are printed on stop. |
+  cfg.getOptionalValue<int>("readout.idleWaitEnabled", EventNotifierWaitEnabled);
+  // configuration parameter: | readout | idleSpinMax | int | 1000 | When idleWaitEnabled is set, maximum number of spin iterations before blocking, when waiting for new data. The actual value is adapted at runtime. |
+  cfg.getOptionalValue<int>("readout.idleSpinMax", EventNotifierSpinMax);
   // configuration parameter: | readout | disableAggregatorSlicing | int | 0 | When set, the aggregator slicing is disabled, data pages are passed through without grouping/slicing. |
   cfgDisableAggregatorSlicing = 0;
   cfg.getOptionalValue<int>("readout.disableAggregatorSlicing", cfgDisableAggregatorSlicing);
   // configuration parameter: | readout | aggregatorSliceTimeout | double | 0 | When set, slices (groups) of pages are flushed if not updated after given timeout (otherwise closed only on beginning of next TF, or on stop). |
   cfgAggregatorSliceTimeout = 0;
   cfg.getOptionalValue<double>("readout.aggregatorSliceTimeout", cfgAggregatorSliceTimeout);
-  // configuration parameter: | readout | aggregatorStfTimeout | double | 0 | When set, subtimeframes are buffered until timeout (otherwise, sent immediately and independently for each data source). |
+  // configuration parameter: | readout | aggregatorStfTimeout | double | 0 | When set, subtimeframes are buffered until all sources have closed their slice for this timeframe (i.e. started sending the next one), or until timeout if some are missing (otherwise, sent immediately and independently for each data source). |
   cfgAggregatorStfTimeout = 0;
   cfg.getOptionalValue<double>("readout.aggregatorStfTimeout", cfgAggregatorStfTimeout);
+  // configuration parameter: | readout | aggregatorStfSources | int | 0 | Number of sources (equipment + link) expected in each subtimeframe, when aggregatorStfTimeout is set. If zero, the sources are learned from data: the first subtimeframe is released on timeout, and the sources seen until then are expected in the next ones. |
+  cfgAggregatorStfSources = 0;
+  cfg.getOptionalValue<int>("readout.aggregatorStfSources", cfgAggregatorStfSources);
+  // configuration parameter: | readout | aggregatorStfBufferSize | int | 1024 | Maximum number of subtimeframes buffered, when aggregatorStfTimeout is set. When data is received for a timeframe too far ahead of the oldest one pending, the oldest ones are dropped. |
+  cfgAggregatorStfBufferSize = 1024;
+  cfg.getOptionalValue<int>("readout.aggregatorStfBufferSize", cfgAggregatorStfBufferSize);
+  // configuration parameter: | readout | aggregatorThreads | int | 0 | Number of threads used by the aggregator to group the data pages in slices. The equipments are shared between them, and the slices are merged (and subtimeframes built, in order) by the main aggregator thread. If zero, everything is done in the main aggregator thread. |
+  cfgAggregatorThreads = 0;
+  cfg.getOptionalValue<int>("readout.aggregatorThreads", cfgAggregatorThreads);
   // configuration parameter: | readout | tfRateLimit | double | 0 | When set, the output is limited to a given timeframe rate. |
   cfgTfRateLimit = 0;
   cfg.getOptionalValue<double>("readout.tfRateLimit", cfgTfRateLimit);
@@ -483,6 +521,28 @@ int Readout::configure(const boost::property_tree::ptree& properties)
     theLog.log(LogInfoDevel, "Timeframe rate limit = % .2lf Hz", cfgTfRateLimit);
   }
 
+  // configuration parameter: | readout | tfAdmissionEnabled | int | 0 | When set, a global admission control decides once for each timeframe if it is accepted or dropped, and all equipments apply the same decision (pages of dropped timeframes are released immediately). The decision is based on tfRateLimit, tfAdmissionMemoryThreshold and tfAdmissionFmqPendingMax. tfRateLimit is then enforced by dropping timeframes instead of throttling readout. |
+  cfgTfAdmissionEnabled = 0;
+  cfg.getOptionalValue<int>("readout.tfAdmissionEnabled", cfgTfAdmissionEnabled);
+  // configuration parameter: | readout | tfAdmissionMemoryThreshold | double | 0.9 | Used with tfAdmissionEnabled. New timeframes are dropped when the fraction of pages in use in any equipment memory pool is above this value (0-1). If zero, memory is not checked. |
+  cfgTfAdmissionMemoryThreshold = 0.9;
+  cfg.getOptionalValue<double>("readout.tfAdmissionMemoryThreshold", cfgTfAdmissionMemoryThreshold);
+  // configuration parameter: | readout | tfAdmissionFmqPendingMax | int | 0 | Used with tfAdmissionEnabled. New timeframes are dropped when the number of pages pending in FairMQ is above this value. If zero, FairMQ is not checked. |
+  cfgTfAdmissionFmqPendingMax = 0;
+  cfg.getOptionalValue<int>("readout.tfAdmissionFmqPendingMax", cfgTfAdmissionFmqPendingMax);
+  if ((cfgTfAdmissionEnabled) && (!cfgDisableTimeframes)) {
+    if (cfgTfAdmissionMemoryThreshold > 1) {
+      cfgTfAdmissionMemoryThreshold = 1;
+    }
+    if (cfgTfAdmissionFmqPendingMax < 0) {
+      cfgTfAdmissionFmqPendingMax = 0;
+    }
+    gTimeframeAdmission.init(cfgTfRateLimit, cfgTfAdmissionMemoryThreshold, cfgTfAdmissionFmqPendingMax);
+    theLog.log(LogInfoDevel, "Timeframe admission control enabled: rate limit = %.2lf Hz, memory threshold = %.2lf, FairMQ pending pages max = %d", cfgTfRateLimit, cfgTfAdmissionMemoryThreshold, cfgTfAdmissionFmqPendingMax);
+  } else {
+    gTimeframeAdmission.disable();
+  }
+
 
   // configuration parameter: | readout | logbookEnabled | int | 0 | When set, the logbook is enabled and populated with readout stats at runtime. |
   cfgLogbookEnabled = 0;
@@ -546,7 +606,7 @@ int Readout::configure(const boost::property_tree::ptree& properties)
     }
 
     // bank type
-    // configuration parameter: | bank-* | type | string| | Support used to allocate memory. Possible values: malloc, MemoryMappedFile. |
+    // configuration parameter: | bank-* | type | string| | Support used to allocate memory. Possible values: malloc, MemoryMappedFile, hugetlb, memfd, thp. MemoryMappedFile (hugepages in /var/lib/hugetlbfs) needs ReadoutCard. hugetlb (anonymous mapping) and memfd (hugepages file descriptor) allocate hugepages reserved in the system, and fall back to thp when not available. thp uses transparent hugepages. |
     std::string cfgType = "";
     try {
       cfgType = cfg.getValue<std::string>(kName + ".type");
@@ -563,6 +623,49 @@ int Readout::configure(const boost::property_tree::ptree& properties)
     int cfgNumaNode = -1;
     cfg.getOptionalValue<int>(kName + ".numaNode", cfgNumaNode);
 
+    // hugepage size
+    // configuration parameter: | bank-* | hugePageSize | bytes | | For types hugetlb and memfd, size of hugepages to be used (e.g. 2M or 1G). If not set, the system default hugepage size is used. |
+    std::string cfgHugePageSize = "";
+    cfg.getOptionalValue<std::string>(kName + ".hugePageSize", cfgHugePageSize);
+    long long hugePageSize = 0;
+    if (cfgHugePageSize.length()) {
+      hugePageSize = ReadoutUtils::getNumberOfBytesFromString(cfgHugePageSize.c_str());
+      if (hugePageSize <= 0) {
+        theLog.log(LogErrorSupport_(3100), "Skipping memory bank %s:  wrong hugepage size %s", kName.c_str(), cfgHugePageSize.c_str());
+        continue;
+      }
+    }
+
+    // memory initialization
+    // configuration parameter: | bank-* | initMode | string | clear | How the memory range is initialized after allocation. Possible values: clear (write zeroes), prefault (touch each page so that it is allocated, without writing zeroes), none (memory allocated on first use). |
+    std::string cfgInitMode = "clear";
+    cfg.getOptionalValue<std::string>(kName + ".initMode", cfgInitMode);
+    MemoryBank::InitMode initMode;
+    if (cfgInitMode == "clear") {
+      initMode = MemoryBank::InitMode::Clear;
+    } else if (cfgInitMode == "prefault") {
+      initMode = MemoryBank::InitMode::Prefault;
+    } else if (cfgInitMode == "none") {
+      initMode = MemoryBank::InitMode::None;
+    } else {
+      theLog.log(LogErrorSupport_(3100), "Skipping memory bank %s:  wrong initMode %s", kName.c_str(), cfgInitMode.c_str());
+      continue;
+    }
+    // configuration parameter: | bank-* | initThreads | int | 1 | Number of threads used to initialize the memory range (see initMode). They run on the bank numaNode, if defined. 0 means one thread per CPU available (on the bank numaNode, if defined). |
+    int cfgInitThreads = 1;
+    cfg.getOptionalValue<int>(kName + ".initThreads", cfgInitThreads);
+    // configuration parameter: | bank-* | lockMemory | int | 0 | If set, memory pages are locked in RAM (mlock), so that they can not be swapped out. Requires appropriate memlock limits. |
+    int cfgLockMemory = 0;
+    cfg.getOptionalValue<int>(kName + ".lockMemory", cfgLockMemory);
+
+    // reuse bank kept from previous configuration, if parameters unchanged
+    // (in this case, the bank is not initialized again: it is not cleared, even with initMode=clear)
+    std::string bankConfiguration = "type=" + cfgType + " size=" + std::to_string(mSize) + " numaNode=" + std::to_string(cfgNumaNode) + " hugePageSize=" + std::to_string(hugePageSize) + " initMode=" + cfgInitMode + " lockMemory=" + std::to_string(cfgLockMemory);
+    if (theMemoryBankManager.reuseBank(kName, bankConfiguration)) {
+      theLog.log(LogInfoDevel, "Reusing memory bank %s: configuration unchanged", kName.c_str());
+      continue;
+    }
+
     // instanciate new memory pool
     if (cfgNumaNode >= 0) {
 #ifdef WITH_NUMA
@@ -582,20 +685,26 @@ int Readout::configure(const boost::property_tree::ptree& properties)
     theLog.log(LogInfoDevel, "Creating memory bank %s: type %s size %lld", kName.c_str(), cfgType.c_str(), mSize);
     std::shared_ptr<MemoryBank> b = nullptr;
     try {
-      b = getMemoryBank(mSize, cfgType, kName);
+      b = getMemoryBank(mSize, cfgType, kName, hugePageSize);
     } catch (...) {
     }
     if (b == nullptr) {
       theLog.log(LogErrorSupport_(3230), "Failed to create memory bank %s", kName.c_str());
       continue;
     }
-    // cleanup the memory range
-    b->clear();
+    // initialize the memory range
+    if (b->initialize(initMode, cfgInitThreads, cfgNumaNode, cfgLockMemory) != 0) {
+      theLog.log(LogErrorSupport_(3230), "Failed to initialize memory bank %s", kName.c_str());
+      continue;
+    }
     // add bank to list centrally managed
-    theMemoryBankManager.addBank(b, kName);
-    theLog.log(LogInfoDevel, "Bank %s added", kName.c_str());
+    theMemoryBankManager.addBank(b, kName, bankConfiguration);
+    theLog.log(LogInfoDevel, "Bank %s added: %s", kName.c_str(), b->getDescription().c_str());
   }
 
+  // release banks of previous configuration not used anymore
+  theMemoryBankManager.releaseUnusedBanks();
+
   // releasing memory bind policy
   if (numaNodeChanged) {
 #ifdef WITH_NUMA
@@ -752,7 +861,7 @@ int Readout::configure(const boost::property_tree::ptree& properties)
       continue;
     }
 
-    // configuration parameter: | equipment-* | equipmentType | string |  | The type of equipment to be instanciated. One of: dummy, rorc, cruEmulator |
+    // configuration parameter: | equipment-* | equipmentType | string |  | The type of equipment to be instanciated. One of: dummy, rorc, rorcSimulator, cruEmulator, player, zmq. rorcSimulator runs the rorc equipment readout loop with a software DMA channel instead of a ReadoutCard device. |
     std::string cfgEquipmentType = "";
     cfgEquipmentType = cfg.getValue<std::string>(kName + ".equipmentType");
     theLog.log(LogInfoDevel, "Configuring equipment %s: %s", kName.c_str(), cfgEquipmentType.c_str());
@@ -767,6 +876,8 @@ int Readout::configure(const boost::property_tree::ptree& properties)
 #else
         theLog.log(LogWarningSupport_(3101), "Skipping %s: %s - not supported by this build", kName.c_str(), cfgEquipmentType.c_str());
 #endif
+      } else if (!cfgEquipmentType.compare("rorcSimulator")) {
+        newDevice = getReadoutEquipmentRORCSimulator(cfg, kName);
       } else if (!cfgEquipmentType.compare("cruEmulator")) {
         newDevice = getReadoutEquipmentCruEmulator(cfg, kName);
       } else if (!cfgEquipmentType.compare("player")) {
@@ -810,14 +921,22 @@ int Readout::configure(const boost::property_tree::ptree& properties)
   agg_output = std::make_unique<AliceO2::Common::Fifo<DataSetReference>>(10000);
   int nEquipmentsAggregated = 0;
   agg = std::make_unique<DataBlockAggregator>(agg_output.get(), "Aggregator");
+  agg_outputNotifier = std::make_shared<EventNotifier>();
+  agg->outputNotifier = agg_outputNotifier;
+  if (cfgAggregatorThreads > 0) {
+    agg->cfgSlicerThreads = cfgAggregatorThreads;
+  }
 
   for (auto&& readoutDevice : readoutDevices) {
     // theLog.log(LogInfoDevel, "Adding equipment: %s",readoutDevice->getName().c_str());
     agg->addInput(readoutDevice->dataOut);
+    readoutDevice->dataOutNotifier = agg->getInputNotifier(nEquipmentsAggregated);
     nEquipmentsAggregated++;
   }
   theLog.log(LogInfoDevel, "Aggregator: %d equipments", nEquipmentsAggregated);
 
+  logMemoryBanksUsage();
+
   theLog.log(LogInfoSupport_(3005), "Readout completed CONFIGURE");
   return 0;
 }
@@ -848,16 +967,24 @@ int Readout::start()
     if (cfgAggregatorStfTimeout > 0) {
       theLog.log(LogInfoDevel, "Aggregator subtimeframe timeout = %.2lf seconds", cfgAggregatorStfTimeout);
       agg->cfgStfTimeout = cfgAggregatorStfTimeout;
+      agg->cfgStfSources = cfgAggregatorStfSources;
+      if (cfgAggregatorStfBufferSize > 0) {
+        agg->cfgStfBufferSize = cfgAggregatorStfBufferSize;
+      }
       agg->enableStfBuilding = 1;
     }
   }
 
+  gTimeframeAdmission.reset();
   agg->start();
 
   // notify consumers of imminent data flow start
   for (auto& c : dataConsumers) {
     c->start();
   }
+  for (auto& c : dataConsumers) {
+    c->startDispatch();
+  }
 
   theLog.log(LogInfoDevel, "Starting readout equipments");
   for (auto&& readoutDevice : readoutDevices) {
@@ -903,6 +1030,7 @@ void Readout::loopRunning()
     }
 
     DataSetReference bc = nullptr;
+    uint32_t notifierSequence = agg_outputNotifier->getSequence();
     // check first element from incoming fifo
     if (agg_output->front(bc) == 0) {
 
@@ -912,7 +1040,8 @@ void Readout::loopRunning()
           if (bc->at(0)->getData() != nullptr) {
             uint64_t newTimeframeId = bc->at(0)->getData()->header.timeframeId;
             // are we complying with maximum TF rate ?
-            if (cfgTfRateLimit > 0) {
+            // (with admission control, rate is enforced by dropping timeframes upstream)
+            if ((cfgTfRateLimit > 0) && (!gTimeframeAdmission.isEnabled())) {
               if (newTimeframeId > floor(startTimer.getTime() * cfgTfRateLimit) + 1) {
                 usleep(1000);
                 continue;
@@ -933,7 +1062,7 @@ void Readout::loopRunning()
         for (auto& c : dataConsumers) {
           // push only to "prime" consumers, not to those getting data directly forwarded from another consumer
           if (c->isForwardConsumer == false) {
-            if (c->pushData(bc) < 0) {
+            if (c->dispatchData(bc) < 0) {
               c->isError++;
             }
           }
@@ -953,9 +1082,12 @@ void Readout::loopRunning()
     } else {
       // we are idle...
       // todo: set configurable idling time
-      usleep(1000);
+      agg_outputNotifier->idle(notifierSequence, 1000);
     }
   }
+  if (EventNotifierWaitEnabled) {
+    theLog.log(LogInfoDevel_(3003), "Main loop wakeups: %s", agg_outputNotifier->getStats().c_str());
+  }
 
 #ifdef CALLGRIND
   CALLGRIND_STOP_INSTRUMENTATION;
@@ -1030,6 +1162,11 @@ int Readout::stop()
   }
   runningThread = nullptr;
 
+  // flush data queued for consumers
+  for (auto& c : dataConsumers) {
+    c->stopDispatch();
+  }
+
   for (auto&& readoutDevice : readoutDevices) {
     readoutDevice->stop();
   }
@@ -1038,6 +1175,10 @@ int Readout::stop()
   theLog.log(LogInfoDevel, "Stopping aggregator");
   agg->stop();
 
+  if (gTimeframeAdmission.isEnabled()) {
+    theLog.log(LogInfoDevel_(3003), "Timeframe admission control: %s", gTimeframeAdmission.getStats().c_str());
+  }
+
   theLog.log(LogInfoDevel, "Stopping consumers");
   // notify consumers of imminent data flow stop
   for (auto& c : dataConsumers) {
@@ -1070,6 +1211,10 @@ int Readout::reset()
   theLog.log(LogInfoSupport_(3005), "Readout executing RESET");
 
   // close consumers before closing readout equipments (owner of data blocks)
+  // dispatch threads stopped first, they use the consumers
+  for (auto& c : dataConsumers) {
+    c->stopDispatch();
+  }
   theLog.log(LogInfoDevel, "Releasing primary consumers");
   for (unsigned int i = 0; i < dataConsumers.size(); i++) {
     if (!dataConsumers[i]->isForwardConsumer) {
@@ -1109,8 +1254,10 @@ int Readout::reset()
   readoutDevices.clear();
 
   // reset memory manager
+  // banks are kept, to be reused on next configure if unchanged
+  logMemoryBanksUsage();
   theLog.log(LogInfoDevel, "Releasing memory bank manager");
-  theMemoryBankManager.reset();
+  theMemoryBankManager.reset(true);
 
   // closing latency file
   if (latencyFd >= 0) {
@@ -1555,6 +1702,9 @@ int main(int argc, char* argv[])
     }
   }
 
+  // release memory banks kept after last reset
+  theMemoryBankManager.reset();
+
   theLog.log(LogInfoSupport_(3001), "Readout process exiting");
   return 0;
 }
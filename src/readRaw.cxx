@@ -10,6 +10,7 @@
 
 #include <lz4.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
 
 #include "DataBlock.h"
@@ -172,20 +173,52 @@ int main(int argc, const char* argv[])
 
     if (dataBlockHeaderEnabled) {
       DataBlockHeader hb;
-      if (fread(&hb, sizeof(hb), 1, fp) != 1) {
+      // read version and size first, to support files recorded with previous header versions
+      const size_t hbBaseSize = sizeof(hb.headerVersion) + sizeof(hb.headerSize);
+      if (fread(&hb, hbBaseSize, 1, fp) != 1) {
         break;
       }
-      fileOffset += sizeof(hb);
-
-      if (hb.headerVersion != defaultDataBlockHeader.headerVersion) {
-        ERR_LOOP;
-      }
-      if (hb.headerSize != sizeof(hb)) {
-        ERR_LOOP;
+      if (hb.headerVersion == DataBlockVersionV2) {
+        DataBlockHeaderV2 hb2;
+        if (hb.headerSize != sizeof(hb2)) {
+          ERR_LOOP;
+        }
+        memcpy(&hb2, &hb, hbBaseSize);
+        if (fread(&((char*)&hb2)[hbBaseSize], sizeof(hb2) - hbBaseSize, 1, fp) != 1) {
+          break;
+        }
+        // convert to current version
+        hb = defaultDataBlockHeader;
+        hb.dataSize = hb2.dataSize;
+        hb.equipmentId = hb2.equipmentId;
+        hb.linkId = hb2.linkId;
+        hb.systemId = hb2.systemId;
+        hb.timeframeId = hb2.timeframeId;
+        hb.feeId = hb2.feeId;
+        hb.flagEndOfTimeframe = hb2.flagEndOfTimeframe;
+        hb.isRdhFormat = hb2.isRdhFormat;
+        hb.timeframeOrbitFirst = hb2.timeframeOrbitFirst;
+        hb.timeframeOrbitLast = hb2.timeframeOrbitLast;
+        hb.blockId = hb2.blockId;
+        hb.pipelineId = hb2.pipelineId;
+        hb.runNumber = hb2.runNumber;
+        hb.headerVersion = hb2.headerVersion;
+        hb.headerSize = hb2.headerSize;
+      } else {
+        if (hb.headerVersion != defaultDataBlockHeader.headerVersion) {
+          ERR_LOOP;
+        }
+        if (hb.headerSize != sizeof(hb)) {
+          ERR_LOOP;
+        }
+        if (fread(&((char*)&hb)[hbBaseSize], sizeof(hb) - hbBaseSize, 1, fp) != 1) {
+          break;
+        }
       }
+      fileOffset += hb.headerSize;
 
       if (dumpDataBlockHeader) {
-        printf("Block header %lu @ %lu\n", pageCount + 1, fileOffset - sizeof(hb));
+        printf("Block header %lu @ %lu\n", pageCount + 1, fileOffset - hb.headerSize);
         printf("\theaderVersion= 0x%08X\n", hb.headerVersion);
         printf("\theaderSize = %u\n", hb.headerSize);
         printf("\tdataSize = %u\n", hb.dataSize);
@@ -0,0 +1,725 @@
+// Copyright CERN and copyright holders of ALICE O2. This software is
+// distributed under the terms of the GNU General Public License v3 (GPL
+// Version 3), copied verbatim in the file "COPYING".
+//
+// See http://alice-o2.web.cern.ch/license for full licensing information.
+//
+// In applying this license CERN does not waive the privileges and immunities
+// granted to it by virtue of its status as an Intergovernmental Organization
+// or submit itself to any jurisdiction.
+
+// benchmark of the readout data path, end-to-end within a single process:
+// equipments (dummy or cruEmulator) -> aggregator (with or without STF building) -> null consumers
+// A sweep is done over the lists of parameters given, and results are printed in CSV format, one line per configuration.
+
+#include <Common/Configuration.h>
+#include <Common/Fifo.h>
+#include <Common/Timer.h>
+#include <algorithm>
+#include <atomic>
+#include <boost/property_tree/ptree.hpp>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Consumer.h"
+#include "CounterStats.h"
+#include "DataBlockAggregator.h"
+#include "MemoryBank.h"
+#include "MemoryBankManager.h"
+#include "MemoryPagesPool.h"
+#include "ReadoutEquipment.h"
+#include "ReadoutUtils.h"
+#include "TimeframeAdmission.h"
+
+// logs in console mode
+#include "TtyChecker.h"
+TtyChecker theTtyChecker;
+
+#include <InfoLogger/InfoLogger.hxx>
+AliceO2::InfoLogger::InfoLogger theLog;
+
+tRunNumber occRunNumber = 0; // run number, used by equipments to tag data
+
+#define ERRLOG(args...) fprintf(stderr, args)
+
+// count of memory allocations (operator new), when enabled with option countAllocations
+static std::atomic<bool> allocationsCountEnabled = false;
+static std::atomic<uint64_t> allocationsCount = 0;
+
+void* operator new(size_t size)
+{
+  if (allocationsCountEnabled.load(std::memory_order_relaxed)) {
+    allocationsCount.fetch_add(1, std::memory_order_relaxed);
+  }
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// get current time in nanoseconds, same clock as used by equipments for page timestamps
+static uint64_t getTimeNanosec()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// a consumer discarding data, keeping statistics on throughput and latency of the pages received
+class ConsumerNull : public Consumer
+{
+ public:
+  ConsumerNull(ConfigFile& cfg, std::string cfgEntryPoint, size_t maxLatencySamples) : Consumer(cfg, cfgEntryPoint)
+  {
+    latencySamples.reserve(maxLatencySamples);
+  }
+  ~ConsumerNull() {}
+
+  int pushData(DataBlockContainerReference& b)
+  {
+    if (!isMeasuring) {
+      return 0;
+    }
+    nPages++;
+    nBytes += b->getData()->header.dataSize;
+    uint64_t t0 = b->getTimestamp();
+    if ((t0 != 0) && (latencySamples.size() < latencySamples.capacity())) {
+      latencySamples.push_back(getTimeNanosec() - t0);
+    }
+    return 0;
+  }
+
+  std::atomic<bool> isMeasuring = false; // statistics are collected only when set
+  unsigned long long nPages = 0;        // number of pages received
+  unsigned long long nBytes = 0;        // number of bytes received
+  std::vector<uint64_t> latencySamples; // time (nanoseconds) from equipment output to consumer, for each page received (up to maxLatencySamples)
+};
+
+// parameters of a benchmark sequence
+struct BenchParameters {
+  std::string equipmentType; // dummy, cruEmulator or rorcSimulator
+  size_t pageSize;           // memory pool page size
+  int numberOfLinks;         // number of links per equipment (cruEmulator, rorcSimulator)
+  int numberOfEquipments;    // number of equipments
+  int numberOfConsumers;     // number of consumers
+  int stfBuilding;           // if set, aggregator STF building is enabled
+};
+
+// global settings, same for all sequences
+struct BenchSettings {
+  double duration = 5;                  // measurement time, in seconds
+  double warmup = 1;                    // time before measurement starts, in seconds
+  double flushTimeout = 1;              // time given to flush data after equipments are stopped, in seconds
+  size_t memoryPerEquipment = 256 << 20; // size of memory pool of each equipment, in bytes
+  std::string bankType = "malloc";      // type of memory bank
+  int dispatchQueueSize = 0;            // consumers dispatch queue size (zero: direct push from main loop)
+  double stfTimeout = 0.01;             // aggregator STF timeout, in seconds, when STF building enabled
+  double sliceTimeout = 0.001;          // aggregator slice timeout, in seconds
+  size_t maxLatencySamples = 1000000;   // maximum number of latency samples kept per consumer
+  int tfPeriod = 32;                    // timeframe length, in LHC orbits
+  int generatorThreads = 0;             // number of threads generating links data in each equipment (cruEmulator only)
+  double rate = -1;                     // equipments data rate, in pages per second (-1: unlimited)
+  std::string linkRate = "0";           // data rate of each link, in bytes per second (rorcSimulator only)
+  double dmaLatency = 0;                // DMA latency, in seconds (rorcSimulator only)
+  int aggregatorThreads = 0;            // number of aggregator slicer threads (zero: slicing in aggregator thread)
+  double tfAdmissionMemoryThreshold = 0; // memory threshold of timeframe admission control (zero: admission control disabled)
+  int countAllocations = 0;             // if set, memory allocations are counted during measurement
+  int headerBench = 0;                  // if set, run the page headers access benchmark instead of the data path
+};
+
+// run one benchmark sequence, and print results as a CSV line
+int runBench(const BenchParameters& p, const BenchSettings& s, FILE* fpOut)
+{
+  size_t pagesPerEquipment = s.memoryPerEquipment / p.pageSize;
+  if (pagesPerEquipment < 2) {
+    ERRLOG("memoryPerEquipment too small for page size %lu\n", (unsigned long)p.pageSize);
+    return -1;
+  }
+
+  // create memory bank: enough for all pools, including one spare page each for alignment
+  theMemoryBankManager.reset();
+  size_t bankSize = p.numberOfEquipments * (pagesPerEquipment + 2) * p.pageSize;
+  try {
+    std::shared_ptr<MemoryBank> bank = getMemoryBank(bankSize, s.bankType, "bench");
+    if (bank == nullptr) {
+      throw __LINE__;
+    }
+    bank->clear(); // make sure memory is mapped before measurement
+    theMemoryBankManager.addBank(bank, "bench");
+  } catch (...) {
+    ERRLOG("Failed to create memory bank of %lu bytes\n", (unsigned long)bankSize);
+    return -1;
+  }
+
+  // create configuration
+  boost::property_tree::ptree cfgTree;
+  cfgTree.put("readout.rate", s.rate);
+  for (int i = 0; i < p.numberOfEquipments; i++) {
+    std::string e = "equipment-bench-" + std::to_string(i);
+    cfgTree.put(e + ".equipmentType", p.equipmentType);
+    cfgTree.put(e + ".id", i + 1);
+    cfgTree.put(e + ".memoryBankName", "bench");
+    cfgTree.put(e + ".memoryPoolPageSize", std::to_string(p.pageSize));
+    cfgTree.put(e + ".memoryPoolNumberOfPages", pagesPerEquipment);
+    cfgTree.put(e + ".pageTimestampEnabled", 1);
+    cfgTree.put(e + ".TFperiod", s.tfPeriod);
+    cfgTree.put(e + ".numberOfThreads", s.generatorThreads);
+    cfgTree.put(e + ".numberOfLinks", p.numberOfLinks);
+    cfgTree.put(e + ".linkRate", s.linkRate);
+    cfgTree.put(e + ".dmaLatency", s.dmaLatency);
+    cfgTree.put(e + ".eventMinSize", std::to_string(p.pageSize - sizeof(DataBlock)));
+    cfgTree.put(e + ".eventMaxSize", std::to_string(p.pageSize - sizeof(DataBlock)));
+  }
+  for (int i = 0; i < p.numberOfConsumers; i++) {
+    std::string c = "consumer-bench-" + std::to_string(i);
+    cfgTree.put(c + ".dispatchQueueSize", s.dispatchQueueSize);
+  }
+  ConfigFile cfg;
+  cfg.load(cfgTree);
+
+  // timeframe admission control, shared by equipments
+  if (s.tfAdmissionMemoryThreshold > 0) {
+    gTimeframeAdmission.init(0, s.tfAdmissionMemoryThreshold, 0);
+  } else {
+    gTimeframeAdmission.disable();
+  }
+  gTimeframeAdmission.reset();
+
+  // create equipments
+  std::vector<std::unique_ptr<ReadoutEquipment>> equipments;
+  for (int i = 0; i < p.numberOfEquipments; i++) {
+    std::string e = "equipment-bench-" + std::to_string(i);
+    try {
+      if (p.equipmentType == "dummy") {
+        equipments.push_back(getReadoutEquipmentDummy(cfg, e));
+      } else if (p.equipmentType == "cruEmulator") {
+        equipments.push_back(getReadoutEquipmentCruEmulator(cfg, e));
+      } else if (p.equipmentType == "rorcSimulator") {
+        equipments.push_back(getReadoutEquipmentRORCSimulator(cfg, e));
+      } else {
+        ERRLOG("Unknown equipment type %s\n", p.equipmentType.c_str());
+        return -1;
+      }
+    } catch (...) {
+      ERRLOG("Failed to create equipment %s\n", e.c_str());
+      return -1;
+    }
+  }
+
+  // create aggregator
+  auto aggOutput = std::make_unique<AliceO2::Common::Fifo<DataSetReference>>(10000);
+  auto agg = std::make_unique<DataBlockAggregator>(aggOutput.get(), "Aggregator");
+  auto aggOutputNotifier = std::make_shared<EventNotifier>();
+  agg->outputNotifier = aggOutputNotifier;
+  agg->cfgSlicerThreads = s.aggregatorThreads;
+  for (unsigned int i = 0; i < equipments.size(); i++) {
+    agg->addInput(equipments[i]->dataOut);
+    equipments[i]->dataOutNotifier = agg->getInputNotifier(i);
+  }
+  agg->cfgSliceTimeout = s.sliceTimeout;
+  if (p.stfBuilding) {
+    agg->cfgStfTimeout = s.stfTimeout;
+    agg->enableStfBuilding = 1;
+  }
+
+  // create consumers
+  std::vector<std::unique_ptr<ConsumerNull>> consumers;
+  for (int i = 0; i < p.numberOfConsumers; i++) {
+    try {
+      consumers.push_back(std::make_unique<ConsumerNull>(cfg, "consumer-bench-" + std::to_string(i), s.maxLatencySamples));
+    } catch (...) {
+      ERRLOG("Failed to create consumer %d\n", i);
+      return -1;
+    }
+  }
+
+  // start, same sequence as readout
+  agg->start();
+  for (auto& c : consumers) {
+    c->start();
+  }
+  for (auto& c : consumers) {
+    c->startDispatch();
+  }
+  for (auto& e : equipments) {
+    e->start();
+  }
+  for (auto& e : equipments) {
+    e->setDataOn();
+  }
+
+  // main loop: push aggregator output to consumers, and sample queues occupancy
+  CounterStats eqFifoOccupancy;  // pages in equipments output fifos (sum of all equipments)
+  CounterStats aggFifoOccupancy; // data sets in aggregator output fifo
+  CounterStats pagesInFlight;    // pages used in equipments memory pools (sum of all equipments)
+  AliceO2::Common::Timer runTimer;
+  AliceO2::Common::Timer sampleTimer;
+  runTimer.reset();
+  sampleTimer.reset(1000); // sample queues every millisecond
+  bool isMeasuring = false;
+  bool isStopping = false;
+  bool isFlushing = false;
+  double tMeasureBegin = 0;
+  double tMeasureEnd = 0;
+  uint64_t allocationsBegin = 0;
+  uint64_t allocationsEnd = 0;
+  allocationsCountEnabled = s.countAllocations;
+  for (;;) {
+    double now = runTimer.getTime();
+    if ((!isMeasuring) && (!isStopping) && (now >= s.warmup)) {
+      isMeasuring = true;
+      tMeasureBegin = now;
+      allocationsBegin = allocationsCount;
+      for (auto& c : consumers) {
+        c->isMeasuring = true;
+      }
+    }
+    if ((isMeasuring) && (now >= s.warmup + s.duration)) {
+      isMeasuring = false;
+      tMeasureEnd = now;
+      allocationsEnd = allocationsCount;
+      for (auto& c : consumers) {
+        c->isMeasuring = false;
+      }
+      // stop data producers, and continue to empty fifos
+      for (auto& e : equipments) {
+        e->setDataOff();
+      }
+      isStopping = true;
+    }
+    if ((isStopping) && (!isFlushing) && (now >= tMeasureEnd + s.flushTimeout / 2)) {
+      agg->doFlush = true;
+      isFlushing = true;
+    }
+    if ((isStopping) && (now >= tMeasureEnd + s.flushTimeout)) {
+      break;
+    }
+
+    if ((isMeasuring) && (sampleTimer.isTimeout())) {
+      CounterValue nEqFifo = 0;
+      CounterValue nInFlight = 0;
+      for (auto& e : equipments) {
+        nEqFifo += e->dataOut->getNumberOfUsedSlots();
+        size_t nPagesFree = 0, nPagesTotal = 0;
+        if (e->getMemoryUsage(nPagesFree, nPagesTotal) == 0) {
+          nInFlight += nPagesTotal - nPagesFree;
+        }
+      }
+      eqFifoOccupancy.set(nEqFifo);
+      aggFifoOccupancy.set(aggOutput->getNumberOfUsedSlots());
+      pagesInFlight.set(nInFlight);
+      sampleTimer.increment();
+    }
+
+    DataSetReference bc = nullptr;
+    uint32_t notifierSequence = aggOutputNotifier->getSequence();
+    if (aggOutput->front(bc) == 0) {
+      if (bc != nullptr) {
+        for (auto& c : consumers) {
+          if (c->dispatchData(bc) < 0) {
+            c->isError++;
+          }
+        }
+      }
+      aggOutput->pop(bc);
+    } else {
+      aggOutputNotifier->idle(notifierSequence, 1000);
+    }
+  }
+
+  // stop, same sequence as readout
+  for (auto& c : consumers) {
+    c->stopDispatch();
+  }
+  for (auto& e : equipments) {
+    e->stop();
+  }
+  agg->stop();
+  for (auto& c : consumers) {
+    c->stop();
+  }
+  if (gTimeframeAdmission.isEnabled()) {
+    ERRLOG("Timeframe admission control: %s\n", gTimeframeAdmission.getStats().c_str());
+  }
+
+  // compute results
+  double t = tMeasureEnd - tMeasureBegin;
+  unsigned long long nPages = consumers.size() ? consumers[0]->nPages : 0;
+  unsigned long long nBytes = consumers.size() ? consumers[0]->nBytes : 0;
+  std::vector<uint64_t> latency;
+  for (auto& c : consumers) {
+    latency.insert(latency.end(), c->latencySamples.begin(), c->latencySamples.end());
+  }
+  std::sort(latency.begin(), latency.end());
+  auto percentile = [&](double q) {
+    if (latency.size() == 0) {
+      return 0.0;
+    }
+    size_t ix = (size_t)(q * (latency.size() - 1));
+    return latency[ix] / 1000.0;
+  };
+
+  // number of memory allocations per page received, in whole process (-1 if not counted)
+  double allocationsPerPage = -1;
+  if (s.countAllocations) {
+    allocationsCountEnabled = false;
+    allocationsPerPage = nPages ? (allocationsEnd - allocationsBegin) * 1.0 / nPages : 0;
+  }
+
+  fprintf(fpOut, "%s,%lu,%d,%d,%d,%d,%.3lf,%llu,%llu,%.1lf,%.3lf,%.1lf,%llu,%.1lf,%llu,%.1lf,%llu,%lu,%.1lf,%.1lf,%.1lf,%.1lf,%.1lf,%.3lf\n",
+          p.equipmentType.c_str(), (unsigned long)p.pageSize, p.numberOfLinks, p.numberOfEquipments, p.numberOfConsumers, p.stfBuilding,
+          t, nPages, nBytes, nPages / t, nBytes / (t * 1000000000.0),
+          eqFifoOccupancy.getAverage(), (unsigned long long)eqFifoOccupancy.getMaximum(),
+          aggFifoOccupancy.getAverage(), (unsigned long long)aggFifoOccupancy.getMaximum(),
+          pagesInFlight.getAverage(), (unsigned long long)pagesInFlight.getMaximum(),
+          (unsigned long)latency.size(), percentile(0.50), percentile(0.90), percentile(0.99), percentile(0.999), percentile(1.0),
+          allocationsPerPage);
+  fflush(fpOut);
+
+  // release resources before next sequence
+  consumers.clear();
+  agg = nullptr;
+  aggOutput = nullptr;
+  equipments.clear();
+  theMemoryBankManager.reset();
+  return 0;
+}
+
+// number of cache lines spanned by the given fields (offset, size) of a header located at a cache line boundary
+static int getCacheLines(std::initializer_list<std::pair<size_t, size_t>> fields)
+{
+  std::vector<size_t> lines;
+  for (auto const& f : fields) {
+    for (size_t l = f.first / 64; l <= (f.first + f.second - 1) / 64; l++) {
+      if (std::find(lines.begin(), lines.end(), l) == lines.end()) {
+        lines.push_back(l);
+      }
+    }
+  }
+  return (int)lines.size();
+}
+
+// page headers access benchmark, for a given header layout (DataBlockHeader or DataBlockHeaderV2).
+// Headers are at the beginning of pages, and accessed in random order, as done for each page on the data path:
+// - tag: fields set by the equipment (ids, size, timeframe, flags)
+// - slice: fields read by the aggregator slicer and STF building (ids, timeframe), end of timeframe flag set on the last block of a slice, size read by consumer
+// Results are printed as a CSV line, with time per page for each step.
+template <typename T>
+int runHeaderBenchLayout(const char* headerName, uint32_t headerVersion, const BenchParameters& p, const BenchSettings& s, FILE* fpOut)
+{
+  size_t bankSize = p.numberOfEquipments * s.memoryPerEquipment;
+  size_t nPages = bankSize / p.pageSize;
+  if ((nPages < 2) || (p.pageSize < sizeof(T)) || (p.numberOfLinks < 1) || (p.numberOfEquipments < 1)) {
+    ERRLOG("Wrong header bench parameters\n");
+    return -1;
+  }
+  std::shared_ptr<MemoryBank> bank = nullptr;
+  try {
+    bank = getMemoryBank(bankSize, s.bankType, "bench");
+  } catch (...) {
+  }
+  if (bank == nullptr) {
+    ERRLOG("Failed to create memory bank of %lu bytes\n", (unsigned long)bankSize);
+    return -1;
+  }
+  bank->clear();
+  char* base = (char*)bank->getBaseAddress();
+
+  // pages are distributed round-robin on equipments and links, timeframes made of a few pages per link
+  const int nSources = p.numberOfEquipments * p.numberOfLinks;
+  const int pagesPerLinkPerTimeframe = 4;
+  std::vector<uint32_t> pageOrder(nPages);
+  std::iota(pageOrder.begin(), pageOrder.end(), 0);
+  std::shuffle(pageOrder.begin(), pageOrder.end(), std::mt19937(1234));
+  std::vector<uint64_t> currentTf(nSources, undefinedTimeframeId);
+  std::vector<T*> lastHeader(nSources, nullptr);
+
+  unsigned long long nSlices = 0;
+  uint64_t checksum = 0;
+  auto tag = [&](uint32_t ix) {
+    T* h = (T*)&base[ix * p.pageSize];
+    h->headerVersion = headerVersion;
+    h->headerSize = sizeof(T);
+    h->dataSize = p.pageSize - sizeof(T);
+    h->equipmentId = (ix % nSources) / p.numberOfLinks;
+    h->linkId = ix % p.numberOfLinks;
+    h->systemId = 0;
+    h->feeId = ix % p.numberOfLinks;
+    h->timeframeId = ix / (nSources * pagesPerLinkPerTimeframe) + 1;
+    h->timeframeOrbitFirst = h->timeframeId * s.tfPeriod;
+    h->timeframeOrbitLast = h->timeframeOrbitFirst + s.tfPeriod - 1;
+    h->flagEndOfTimeframe = 0;
+    h->isRdhFormat = 1;
+    h->blockId = ix;
+  };
+  auto slice = [&](uint32_t ix) {
+    T* h = (T*)&base[ix * p.pageSize];
+    unsigned int sourceIx = h->equipmentId * p.numberOfLinks + h->linkId;
+    if (sourceIx >= (unsigned int)nSources) {
+      return;
+    }
+    if (currentTf[sourceIx] != h->timeframeId) {
+      if (lastHeader[sourceIx] != nullptr) {
+        lastHeader[sourceIx]->flagEndOfTimeframe = 1;
+      }
+      currentTf[sourceIx] = h->timeframeId;
+      nSlices++;
+    }
+    lastHeader[sourceIx] = h;
+    checksum += h->dataSize;
+  };
+
+  // one pass to warm up, then as many passes as possible during measurement time
+  for (auto ix : pageOrder) {
+    tag(ix);
+  }
+  double tTag = 0;
+  double tSlice = 0;
+  unsigned long long nPagesDone = 0;
+  AliceO2::Common::Timer runTimer;
+  runTimer.reset();
+  while (runTimer.getTime() < s.duration) {
+    double t0 = runTimer.getTime();
+    for (auto ix : pageOrder) {
+      tag(ix);
+    }
+    double t1 = runTimer.getTime();
+    for (auto ix : pageOrder) {
+      slice(ix);
+    }
+    double t2 = runTimer.getTime();
+    tTag += t1 - t0;
+    tSlice += t2 - t1;
+    nPagesDone += nPages;
+  }
+  if (checksum == 0) {
+    ERRLOG("Header bench: no data\n");
+  }
+
+  int linesTag = getCacheLines({ { offsetof(T, headerVersion), 4 }, { offsetof(T, headerSize), 4 }, { offsetof(T, dataSize), 4 }, { offsetof(T, equipmentId), 2 }, { offsetof(T, linkId), 1 }, { offsetof(T, systemId), 1 }, { offsetof(T, feeId), 2 }, { offsetof(T, timeframeId), 8 }, { offsetof(T, timeframeOrbitFirst), 4 }, { offsetof(T, timeframeOrbitLast), 4 }, { offsetof(T, flagEndOfTimeframe), 1 }, { offsetof(T, isRdhFormat), 1 }, { offsetof(T, blockId), 8 } });
+  int linesSlice = getCacheLines({ { offsetof(T, dataSize), 4 }, { offsetof(T, equipmentId), 2 }, { offsetof(T, linkId), 1 }, { offsetof(T, timeframeId), 8 }, { offsetof(T, flagEndOfTimeframe), 1 } });
+  fprintf(fpOut, "%s,%lu,%lu,%d,%d,%lu,%d,%d,%llu,%.2lf,%.2lf,%llu\n",
+          headerName, (unsigned long)sizeof(T), (unsigned long)p.pageSize, p.numberOfLinks, p.numberOfEquipments, (unsigned long)nPages,
+          linesTag, linesSlice, nPagesDone, nPagesDone ? tTag * 1000000000.0 / nPagesDone : 0, nPagesDone ? tSlice * 1000000000.0 / nPagesDone : 0, nSlices);
+  fflush(fpOut);
+  return 0;
+}
+
+// page headers access benchmark, for current and previous header layouts
+int runHeaderBench(const BenchParameters& p, const BenchSettings& s, FILE* fpOut)
+{
+  int err = 0;
+  err |= runHeaderBenchLayout<DataBlockHeader>("v3", DataBlockVersion, p, s, fpOut);
+  err |= runHeaderBenchLayout<DataBlockHeaderV2>("v2", DataBlockVersionV2, p, s, fpOut);
+  return err;
+}
+
+int main(int argc, const char* argv[])
+{
+  // lists of parameters to be scanned
+  std::vector<std::string> equipmentTypes = { "dummy" };
+  std::vector<size_t> pageSizes = { 1024 * 1024 };
+  std::vector<int> numberOfLinks = { 1 };
+  std::vector<int> numberOfEquipments = { 1 };
+  std::vector<int> numberOfConsumers = { 1 };
+  std::vector<int> stfBuilding = { 0 };
+
+  BenchSettings settings;
+  std::string outputFile;
+
+  // parse input arguments
+  // format is a list of key=value pairs. Values in lists are coma-separated.
+
+  if ((argc == 2) && ((std::string(argv[1]) == "-h") || (std::string(argv[1]) == "--help"))) {
+    ERRLOG(
+      "Usage: %s [options]\n"
+      "List of options (lists are coma-separated, all combinations are run):\n"
+      "    equipmentType=(list of dummy|cruEmulator|rorcSimulator) : type of equipments. rorcSimulator is the rorc equipment with a software DMA channel. Default: dummy\n"
+      "    pageSize=(list of bytes) : memory pool page size. Default: 1M\n"
+      "    links=(list of int) : number of links per equipment (cruEmulator, rorcSimulator). Default: 1\n"
+      "    equipments=(list of int) : number of equipments. Default: 1\n"
+      "    consumers=(list of int) : number of null consumers. Default: 1\n"
+      "    stf=(list of 0|1) : aggregator STF building disabled/enabled. Default: 0\n"
+      "    duration=(double) : measurement time for each configuration, in seconds. Default: 5\n"
+      "    warmup=(double) : time before measurement starts, in seconds. Default: 1\n"
+      "    memoryPerEquipment=(bytes) : size of memory pool of each equipment. Default: 256M\n"
+      "    bankType=(string) : type of memory bank (malloc, hugetlb, memfd, thp). Default: malloc\n"
+      "    dispatchQueueSize=(int) : if set, consumers are fed from a dedicated thread, with a queue of this size. Needs memoryPoolMagazineSize. Default: 0\n"
+      "    memoryPoolMagazineSize=(int) : if set, memory pools are created in multi-producer/multi-consumer mode, with per-thread magazines of this number of pages. Default: 0\n"
+      "    stfTimeout=(double) : aggregator STF timeout, in seconds. Default: 0.01\n"
+      "    sliceTimeout=(double) : aggregator slice timeout, in seconds. Needed when the memory pools are filled before the end of a timeframe (e.g. dummy equipments at unlimited rate). Default: 0.001\n"
+      "    maxLatencySamples=(int) : maximum number of latency samples per consumer. Default: 1000000\n"
+      "    tfPeriod=(int) : timeframe length, in LHC orbits. Default: 32\n"
+      "    generatorThreads=(int) : number of threads generating the links data in each equipment (cruEmulator only). Default: 0\n"
+      "    rate=(double) : data rate of each equipment, in pages per second. Default: -1 (unlimited)\n"
+      "    linkRate=(bytes) : data rate of each link, in bytes per second (rorcSimulator only). Packets are dropped when no superpage is available. Default: 0 (unlimited)\n"
+      "    dmaLatency=(double) : delay before a filled superpage is available, in seconds (rorcSimulator only). Default: 0\n"
+      "    aggregatorThreads=(int) : number of threads used by the aggregator for slicing, equipments being shared between them. Default: 0 (slicing in aggregator thread)\n"
+      "    tfAdmissionMemoryThreshold=(double) : if set, timeframes are dropped by the equipments when a memory pool is used above this fraction (0-1). Default: 0 (disabled)\n"
+      "    countAllocations=0|1 : if set, memory allocations (operator new) of the whole process are counted during measurement, and reported per page received. Default: 0\n"
+      "    headerBench=0|1 : if set, instead of the data path, benchmark the accesses done for each page to its header by equipment (tag) and aggregator (slice), for the current (v3) and previous (v2) header layouts. Uses pageSize, links, equipments, memoryPerEquipment, bankType, tfPeriod, duration. Results are times per page, in nanoseconds. Default: 0\n"
+      "    idleWaitEnabled=0|1 : idle threads wait for notification instead of polling. Default: 0\n"
+      "    output=(string) : path to file where to write results. Default: stdout\n"
+      "Results are given in CSV format, one line per configuration. Latencies are in microseconds, from equipment output to consumer.\n"
+      "NB: the cruEmulator equipment generates data at most at the LHC rate.\n",
+      argv[0]);
+    return 0;
+  }
+
+  for (int i = 1; i < argc; i++) {
+    const char* option = argv[i];
+    std::string key(option);
+    size_t separatorPosition = key.find('=');
+    if (separatorPosition == std::string::npos) {
+      ERRLOG("Failed to parse option '%s'\n", option);
+      return -1;
+    }
+    key.resize(separatorPosition);
+    std::string value = &(option[separatorPosition + 1]);
+
+    try {
+      if (key == "equipmentType") {
+        equipmentTypes.clear();
+        if (getListFromString(value, equipmentTypes) < 0) {
+          throw __LINE__;
+        }
+      } else if (key == "pageSize") {
+        std::vector<std::string> l;
+        if (getListFromString(value, l) < 0) {
+          throw __LINE__;
+        }
+        pageSizes.clear();
+        for (auto& v : l) {
+          pageSizes.push_back((size_t)ReadoutUtils::getNumberOfBytesFromString(v.c_str()));
+        }
+      } else if ((key == "links") || (key == "equipments") || (key == "consumers") || (key == "stf")) {
+        std::vector<int> l;
+        if (getIntegerListFromString(value, l) < 0) {
+          throw __LINE__;
+        }
+        if (key == "links") {
+          numberOfLinks = l;
+        } else if (key == "equipments") {
+          numberOfEquipments = l;
+        } else if (key == "consumers") {
+          numberOfConsumers = l;
+        } else {
+          stfBuilding = l;
+        }
+      } else if (key == "duration") {
+        settings.duration = std::stod(value);
+      } else if (key == "warmup") {
+        settings.warmup = std::stod(value);
+      } else if (key == "memoryPerEquipment") {
+        settings.memoryPerEquipment = (size_t)ReadoutUtils::getNumberOfBytesFromString(value.c_str());
+      } else if (key == "bankType") {
+        settings.bankType = value;
+      } else if (key == "dispatchQueueSize") {
+        settings.dispatchQueueSize = std::stoi(value);
+      } else if (key == "stfTimeout") {
+        settings.stfTimeout = std::stod(value);
+      } else if (key == "sliceTimeout") {
+        settings.sliceTimeout = std::stod(value);
+      } else if (key == "maxLatencySamples") {
+        settings.maxLatencySamples = std::stoul(value);
+      } else if (key == "tfPeriod") {
+        settings.tfPeriod = std::stoi(value);
+      } else if (key == "generatorThreads") {
+        settings.generatorThreads = std::stoi(value);
+      } else if (key == "rate") {
+        settings.rate = std::stod(value);
+      } else if (key == "linkRate") {
+        settings.linkRate = value;
+      } else if (key == "dmaLatency") {
+        settings.dmaLatency = std::stod(value);
+      } else if (key == "aggregatorThreads") {
+        settings.aggregatorThreads = std::stoi(value);
+      } else if (key == "tfAdmissionMemoryThreshold") {
+        settings.tfAdmissionMemoryThreshold = std::stod(value);
+      } else if (key == "countAllocations") {
+        settings.countAllocations = std::stoi(value);
+      } else if (key == "headerBench") {
+        settings.headerBench = std::stoi(value);
+      } else if (key == "memoryPoolMagazineSize") {
+        MemoryPagesPoolMagazineSize = std::stoi(value);
+      } else if (key == "idleWaitEnabled") {
+        EventNotifierWaitEnabled = std::stoi(value);
+      } else if (key == "output") {
+        outputFile = value;
+      } else {
+        ERRLOG("unknown option %s\n", key.c_str());
+        return -1;
+      }
+    } catch (...) {
+      ERRLOG("wrong value for option %s\n", key.c_str());
+      return -1;
+    }
+  }
+
+  FILE* fpOut = stdout;
+  if (outputFile != "") {
+    fpOut = fopen(outputFile.c_str(), "w");
+    if (fpOut == NULL) {
+      ERRLOG("Failed to open %s\n", outputFile.c_str());
+      return -1;
+    }
+  }
+
+  if (settings.headerBench) {
+    fprintf(fpOut, "header,headerSize,pageSize,links,equipments,pages,cacheLinesTag,cacheLinesSlice,pagesDone,tagNsPerPage,sliceNsPerPage,slices\n");
+    fflush(fpOut);
+    int nErrors = 0;
+    for (auto pageSize : pageSizes) {
+      for (auto links : numberOfLinks) {
+        for (auto equipments : numberOfEquipments) {
+          BenchParameters p = { "", pageSize, links, equipments, 0, 0 };
+          if (runHeaderBench(p, settings, fpOut)) {
+            nErrors++;
+          }
+        }
+      }
+    }
+    if (fpOut != stdout) {
+      fclose(fpOut);
+    }
+    return nErrors ? -1 : 0;
+  }
+
+  fprintf(fpOut, "equipmentType,pageSize,links,equipments,consumers,stf,time,pages,bytes,pagesPerSecond,GBPerSecond,eqFifoAvg,eqFifoMax,aggFifoAvg,aggFifoMax,pagesInFlightAvg,pagesInFlightMax,latencySamples,latencyP50,latencyP90,latencyP99,latencyP999,latencyMax,allocationsPerPage\n");
+  fflush(fpOut);
+
+  int nErrors = 0;
+  for (auto& equipmentType : equipmentTypes) {
+    for (auto pageSize : pageSizes) {
+      for (auto links : numberOfLinks) {
+        for (auto equipments : numberOfEquipments) {
+          for (auto consumers : numberOfConsumers) {
+            for (auto stf : stfBuilding) {
+              BenchParameters p = { equipmentType, pageSize, links, equipments, consumers, stf };
+              if (runBench(p, settings, fpOut)) {
+                nErrors++;
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  if (fpOut != stdout) {
+    fclose(fpOut);
+  }
+  return nErrors ? -1 : 0;
+}